@@ -0,0 +1,667 @@
+/** Merkle Tree benchmarks
+ *
+ * Times the hot paths of the library and prints the results as JSON, one
+ * object per benchmark, with latency percentiles and throughput.
+ *
+ * Usage: merkle-bench [--max-leaves N] [--samples N] [--output FILE]
+ */
+
+#include <merkle-tree/blocked-tree.hpp>
+#include <merkle-tree/merkle-tree.hpp>
+#include <merkle-tree/persistent-tree.hpp>
+#include <merkle-tree/pruned-tree.hpp>
+#include <merkle-tree/search-tree.hpp>
+#include "blake2b-compress.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <time.h>
+}
+
+namespace {
+
+/** Target duration of one sample, in nanoseconds */
+const double SAMPLE_NS = 1e6;
+
+/** Target duration of the batches of operations whose latency is recorded,
+ * in nanoseconds; operations which take longer are timed one by one */
+const double LATENCY_BATCH_NS = 1e3;
+
+/** Maximum time spent on one benchmark, in nanoseconds */
+const double BENCHMARK_NS = 2e9;
+
+/** Minimum number of samples per benchmark */
+const size_t MIN_SAMPLES = 3;
+
+/** Largest number of leaves accepted by `--max-leaves` */
+const size_t MAX_LEAVES = 100000000;
+
+/** Number of leaves of the tree used by the proof benchmarks, at most */
+const size_t PROOF_TREE_LEAVES = 1 << 20;
+
+double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/** Something to time; each call to `run()` is one operation */
+class Operation
+{
+public :
+    virtual ~Operation() { }
+
+    /** Run operation number `i` */
+    virtual void run(size_t i) = 0;
+};
+
+/** Collects the results of all the benchmarks, and formats them as JSON */
+class Report
+{
+public :
+    Report(size_t samples) : samples_(samples) { }
+
+    /** Time an operation
+     *
+     * Operations are grouped in samples of about `SAMPLE_NS`, from which the
+     * throughput is computed. Within a sample, operations are timed one by
+     * one, or in batches of about `LATENCY_BATCH_NS` if they are too short
+     * for the clock; the latency of an operation is the duration of its
+     * batch divided by the number of operations in the batch, so that the
+     * percentiles keep the outliers of each batch.
+     *
+     * \param name  [in] Name of the benchmark
+     * \param param [in] Parameter of the benchmark (size, number of leaves)
+     * \param bytes [in] Bytes processed by one operation, or 0
+     * \param op    [in] Operation to time
+     */
+    void time(const std::string& name, uint64_t param, uint64_t bytes,
+            Operation& op)
+    {
+        // Estimate the duration of one operation, which also warms up caches
+        size_t counter = 0;
+        op.run(counter++);
+        double start = now();
+        double elapsed;
+        do {
+            op.run(counter++);
+            elapsed = now() - start;
+        } while (elapsed < 10 * LATENCY_BATCH_NS);
+        const double estimate = std::max(elapsed / (counter - 1), 1.0);
+        const size_t perBatch = std::max<size_t>(1,
+                LATENCY_BATCH_NS / estimate);
+        const size_t batches = std::max<size_t>(1,
+                SAMPLE_NS / (estimate * perBatch));
+        const size_t perSample = batches * perBatch;
+        const size_t samples = std::max(MIN_SAMPLES, std::min(samples_,
+                    size_t(BENCHMARK_NS / (estimate * perSample))));
+
+        std::vector<double> latencies;
+        latencies.reserve(samples * batches);
+        double total = 0;
+        for (size_t s = 0; s < samples; ++s) {
+            const double sampleStart = now();
+            start = sampleStart;
+            for (size_t b = 0; b < batches; ++b) {
+                for (size_t i = 0; i < perBatch; ++i) {
+                    op.run(counter++);
+                }
+                const double end = now();
+                latencies.push_back((end - start) / perBatch);
+                start = end;
+            }
+            total += start - sampleStart;
+        }
+        std::sort(latencies.begin(), latencies.end());
+
+        const double ops = double(samples) * perSample;
+        std::ostringstream oss;
+        oss << "    {\"name\": \"" << name << "\", \"param\": " << param
+            << ", \"samples\": " << samples
+            << ", \"ops_per_sample\": " << perSample
+            << ", \"ops_per_latency\": " << perBatch
+            << ", \"latency_ns\": {\"min\": " << latencies.front()
+            << ", \"p50\": " << percentile(latencies, 0.50)
+            << ", \"p90\": " << percentile(latencies, 0.90)
+            << ", \"p99\": " << percentile(latencies, 0.99)
+            << ", \"max\": " << latencies.back()
+            << ", \"mean\": " << total / ops << "}"
+            << ", \"ops_per_s\": " << ops * 1e9 / total;
+        if (bytes > 0) {
+            oss << ", \"bytes_per_s\": " << ops * bytes * 1e9 / total;
+        }
+        oss << "}";
+        results_.push_back(oss.str());
+        std::cerr << name << " " << param << ": "
+            << percentile(latencies, 0.50) << " ns" << std::endl;
+    }
+
+    void write(std::ostream& os) const
+    {
+        os << "{\n  \"blake2b_impl\": \""
+            << blake2b_impl_name(blake2b_current_impl()) << "\",\n"
+            << "  \"threads\": "
+            << MerkleTreeThreadPool::getDefault().getConcurrency() << ",\n"
+            << "  \"benchmarks\": [\n";
+        for (size_t i = 0; i < results_.size(); ++i) {
+            os << results_[i] << ((i + 1 < results_.size()) ? ",\n" : "\n");
+        }
+        os << "  ]\n}\n";
+    }
+
+private :
+    size_t                   samples_; /**< Maximum samples per benchmark */
+    std::vector<std::string> results_; /**< One JSON object per benchmark */
+
+    static double percentile(const std::vector<double>& sorted, double q)
+    {
+        const size_t i = std::min(sorted.size() - 1,
+                size_t(q * sorted.size()));
+        return sorted[i];
+    }
+};
+
+/** Add leaves to `leaves` until it has `count` of them */
+void growLeaves(MerkleTree::Digests& leaves, size_t count)
+{
+    leaves.reserve(count);
+    for (size_t i = leaves.size(); i < count; ++i) {
+        leaves.push_back(MerkleTree::Digest::fromBuffer(
+                    MerkleTree::hash(&i, sizeof(i))));
+    }
+}
+
+MerkleTree::Digests makeLeaves(size_t count)
+{
+    MerkleTree::Digests leaves;
+    growLeaves(leaves, count);
+    return leaves;
+}
+
+class HashOp : public Operation
+{
+public :
+    HashOp(size_t size) : data_(size, 0x5a) { }
+
+    virtual void run(size_t i)
+    {
+        data_[0] = i;
+        sink_ = MerkleTree::hash(data_)[0];
+    }
+
+private :
+    MerkleTree::Buffer data_;
+    uint8_t            sink_;
+};
+
+class CombinedHashOp : public Operation
+{
+public :
+    CombinedHashOp(const MerkleTree::Digests& leaves) : leaves_(leaves) { }
+
+    virtual void run(size_t i)
+    {
+        const size_t n = leaves_.size();
+        sink_ = MerkleTree::combinedHash(leaves_[i % n].toBuffer(),
+                leaves_[(i + 1) % n].toBuffer(), false)[0];
+    }
+
+private :
+    const MerkleTree::Digests& leaves_;
+    uint8_t                    sink_;
+};
+
+class CombinedDigestOp : public Operation
+{
+public :
+    CombinedDigestOp(const MerkleTree::Digests& leaves) : leaves_(leaves) { }
+
+    virtual void run(size_t i)
+    {
+        const size_t n = leaves_.size();
+        sink_ = MerkleTree::combinedHash(leaves_[i % n], leaves_[(i + 1) % n],
+                true).bytes[0];
+    }
+
+private :
+    const MerkleTree::Digests& leaves_;
+    uint8_t                    sink_;
+};
+
+class ConstructOp : public Operation
+{
+public :
+    ConstructOp(const MerkleTree::Digests& leaves, bool preserveOrder)
+        : leaves_(leaves), preserveOrder_(preserveOrder)
+    {
+    }
+
+    virtual void run(size_t)
+    {
+        sink_ = MerkleTree(leaves_, preserveOrder_).getRootDigest().bytes[0];
+    }
+
+private :
+    const MerkleTree::Digests& leaves_;
+    bool                       preserveOrder_;
+    uint8_t                    sink_;
+};
+
+/** Operations on proofs of random leaves of a tree */
+class ProofOp : public Operation
+{
+public :
+    enum Kind
+    {
+        GET_PROOF,
+        GET_PROOF_ORDERED,
+        GET_PROOF_HEX,
+        CHECK_PROOF,
+        CHECK_PROOF_ORDERED,
+        GET_PROOF_FIXED,
+        CHECK_PROOF_FIXED
+    };
+
+    ProofOp(const MerkleTree& tree, const MerkleTree::Elements& elements,
+            Kind kind)
+        : tree_(tree), elements_(elements), kind_(kind), sink_(0)
+    {
+        if ((kind_ == CHECK_PROOF) || (kind_ == CHECK_PROOF_ORDERED)) {
+            for (size_t i = 0; i < elements_.size(); ++i) {
+                proofs_.push_back((kind_ == CHECK_PROOF)
+                        ? tree_.getProof(elements_[i])
+                        : tree_.getProofOrdered(elements_[i], index(i) + 1));
+            }
+        }
+        if (kind_ == CHECK_PROOF_FIXED) {
+            for (size_t i = 0; i < elements_.size(); ++i) {
+                MerkleTree::Digest proof[MerkleTree::MAX_PROOF_LENGTH];
+                const size_t length = tree_.getProof(
+                        MerkleTree::Digest::fromBuffer(elements_[i]), proof,
+                        MerkleTree::MAX_PROOF_LENGTH);
+                fixedProofs_.push_back(MerkleTree::Digests(proof,
+                            proof + length));
+            }
+        }
+    }
+
+    virtual void run(size_t i)
+    {
+        i %= elements_.size();
+        const MerkleTree::Buffer& element = elements_[i];
+        switch (kind_) {
+        case GET_PROOF :
+            sink_ += tree_.getProof(element).size();
+            break;
+        case GET_PROOF_ORDERED :
+            sink_ += tree_.getProofOrdered(element, index(i) + 1).size();
+            break;
+        case GET_PROOF_HEX :
+            sink_ += tree_.getProofHex(element).size();
+            break;
+        case CHECK_PROOF :
+            sink_ += MerkleTree::checkProof(proofs_[i], tree_.getRoot(),
+                    element);
+            break;
+        case CHECK_PROOF_ORDERED :
+            sink_ += MerkleTree::checkProofOrdered(proofs_[i],
+                    tree_.getRoot(), element, index(i) + 1);
+            break;
+        case GET_PROOF_FIXED :
+            {
+                MerkleTree::Digest proof[MerkleTree::MAX_PROOF_LENGTH];
+                sink_ += tree_.getProof(tree_.getLayer(0)[index(i)], proof,
+                        MerkleTree::MAX_PROOF_LENGTH);
+            }
+            break;
+        case CHECK_PROOF_FIXED :
+            sink_ += MerkleTree::checkProof(&fixedProofs_[i][0],
+                    fixedProofs_[i].size(), tree_.getRootDigest(),
+                    tree_.getLayer(0)[index(i)]);
+            break;
+        }
+    }
+
+private :
+    const MerkleTree&                 tree_;
+    const MerkleTree::Elements&       elements_;
+    Kind                              kind_;
+    std::vector<MerkleTree::Elements> proofs_;
+    std::vector<MerkleTree::Digests>  fixedProofs_;
+    size_t                            sink_;
+
+    /** Index in the tree of `elements_[i]`, \see runProofs() */
+    size_t index(size_t i) const
+    {
+        return (i * 7919) % tree_.getLeafCount();
+    }
+};
+
+void runProofs(Report& report, const MerkleTree::Digests& leaves)
+{
+    for (int preserveOrder = 1; preserveOrder >= 0; --preserveOrder) {
+        MerkleTree tree(leaves, preserveOrder);
+        MerkleTree::Elements elements;
+        for (size_t i = 0; i < 1024; ++i) {
+            const size_t index = (i * 7919) % tree.getLeafCount();
+            elements.push_back(tree.getLayer(0)[index].toBuffer());
+        }
+        const std::string mode = preserveOrder ? "ordered" : "unordered";
+
+        ProofOp getProof(tree, elements, ProofOp::GET_PROOF);
+        report.time("get_proof_by_element/" + mode, leaves.size(), 0,
+                getProof);
+        ProofOp getProofHex(tree, elements, ProofOp::GET_PROOF_HEX);
+        report.time("get_proof_hex/" + mode, leaves.size(), 0, getProofHex);
+        if (preserveOrder) {
+            ProofOp getProofOrdered(tree, elements,
+                    ProofOp::GET_PROOF_ORDERED);
+            report.time("get_proof_by_index", leaves.size(), 0,
+                    getProofOrdered);
+            ProofOp checkProofOrdered(tree, elements,
+                    ProofOp::CHECK_PROOF_ORDERED);
+            report.time("check_proof_ordered", leaves.size(), 0,
+                    checkProofOrdered);
+        } else {
+            ProofOp checkProof(tree, elements, ProofOp::CHECK_PROOF);
+            report.time("check_proof", leaves.size(), 0, checkProof);
+            ProofOp getProofFixed(tree, elements, ProofOp::GET_PROOF_FIXED);
+            report.time("get_proof_fixed", leaves.size(), 0, getProofFixed);
+            ProofOp checkProofFixed(tree, elements,
+                    ProofOp::CHECK_PROOF_FIXED);
+            report.time("check_proof_fixed", leaves.size(), 0,
+                    checkProofFixed);
+        }
+    }
+}
+
+/** Get the proof of a leaf far from the previous one, so that on large
+ * trees the hashes of the lower layers are not in the caches */
+class ColdProofOp : public Operation
+{
+public :
+    ColdProofOp(const MerkleTree& tree, const BlockedMerkleTree* blocked)
+        : tree_(tree), blocked_(blocked), sink_(0)
+    {
+    }
+
+    virtual void run(size_t i)
+    {
+        const size_t index = (i * 2654435761u) % tree_.getLeafCount();
+        MerkleTree::Digest proof[MerkleTree::MAX_PROOF_LENGTH];
+        if (blocked_ != NULL) {
+            sink_ += blocked_->getProof(index + 1, proof,
+                    MerkleTree::MAX_PROOF_LENGTH);
+        } else {
+            sink_ += tree_.getProofOrdered(tree_.getLayer(0)[index],
+                    index + 1, proof, MerkleTree::MAX_PROOF_LENGTH);
+        }
+    }
+
+private :
+    const MerkleTree&        tree_;
+    const BlockedMerkleTree* blocked_;
+    size_t                   sink_;
+};
+
+/** Time proofs of random leaves, with the layers one after the other and
+ * with blocked layers */
+void runColdProofs(Report& report, const MerkleTree::Digests& leaves)
+{
+    MerkleTree tree(leaves, true);
+    ColdProofOp layers(tree, NULL);
+    report.time("get_proof_cold/layers", leaves.size(), 0, layers);
+    BlockedMerkleTree blocked(tree);
+    ColdProofOp blocks(tree, &blocked);
+    report.time("get_proof_cold/blocked", leaves.size(), 0, blocks);
+}
+
+/** Replace a batch of scattered leaves, all at once or one at a time */
+class UpdateOp : public Operation
+{
+public :
+    UpdateOp(MerkleTree& tree, size_t count, bool batched)
+        : tree_(tree), batched_(batched)
+    {
+        for (size_t i = 0; i < count; ++i) {
+            const size_t index = (i * 7919) % tree_.getLeafCount();
+            updates_.push_back(std::make_pair(index + 1,
+                        MerkleTree::Digest::fromBuffer(
+                            MerkleTree::hash(&i, sizeof(i)))));
+        }
+    }
+
+    virtual void run(size_t)
+    {
+        if (batched_) {
+            tree_.updateLeaves(updates_);
+            return;
+        }
+        for (size_t i = 0; i < updates_.size(); ++i) {
+            tree_.updateLeaf(updates_[i].first, updates_[i].second);
+        }
+    }
+
+private :
+    MerkleTree&             tree_;
+    bool                    batched_;
+    MerkleTree::LeafUpdates updates_;
+};
+
+/** Time batches of leaf updates against the number of leaves updated */
+void runUpdates(Report& report, const MerkleTree::Digests& leaves)
+{
+    MerkleTree tree(leaves, true);
+    for (size_t count = 1000; count <= std::min<size_t>(leaves.size(), 100000);
+            count *= 10) {
+        UpdateOp batched(tree, count, true);
+        report.time("update_leaves", count, 0, batched);
+        UpdateOp single(tree, count, false);
+        report.time("update_leaf_loop", count, 0, single);
+    }
+}
+
+/** Get the proof of a leaf of a pruned tree; leaves are picked far apart,
+ * so their subtrees are rebuilt unless the cache is large enough */
+class PrunedProofOp : public Operation
+{
+public :
+    explicit PrunedProofOp(const PrunedMerkleTree& tree)
+        : tree_(tree), sink_(0)
+    {
+    }
+
+    virtual void run(size_t i)
+    {
+        MerkleTree::Digest proof[MerkleTree::MAX_PROOF_LENGTH];
+        sink_ += tree_.getProof((i * 7919) % tree_.getLeafCount() + 1, proof,
+                MerkleTree::MAX_PROOF_LENGTH);
+    }
+
+private :
+    const PrunedMerkleTree& tree_;
+    size_t                  sink_;
+};
+
+/** Time proofs of pruned trees, against the height of the subtrees rebuilt */
+void runPrunedProofs(Report& report, const MerkleTree::Digests& leaves)
+{
+    MerkleTree tree(leaves, true);
+    for (size_t height = 2; height < tree.getLayerCount(); height += 2) {
+        for (size_t cached = 0; cached <= 1; ++cached) {
+            PrunedMerkleTree pruned(leaves, true,
+                    tree.getLayerCount() - height,
+                    cached ? PrunedMerkleTree::DEFAULT_CACHED_SUBTREES : 0);
+            PrunedProofOp op(pruned);
+            report.time(cached ? "get_pruned_proof/cached"
+                    : "get_pruned_proof/uncached", height, 0, op);
+        }
+    }
+}
+
+/** Create a version of a persistent tree, and release the one before it */
+class VersionOp : public Operation
+{
+public :
+    VersionOp(PersistentMerkleTree& tree, size_t count)
+        : tree_(tree)
+    {
+        for (size_t i = 0; i < count; ++i) {
+            const size_t index = (i * 7919) % tree_.getLeafCount();
+            updates_.push_back(std::make_pair(index + 1,
+                        MerkleTree::Digest::fromBuffer(
+                            MerkleTree::hash(&i, sizeof(i)))));
+        }
+    }
+
+    virtual void run(size_t)
+    {
+        tree_.updateLeaves(updates_);
+        tree_.releaseVersion(tree_.getLatestVersion() - 1);
+    }
+
+private :
+    PersistentMerkleTree&   tree_;
+    MerkleTree::LeafUpdates updates_;
+};
+
+/** Time new versions of a persistent tree against the number of leaves
+ * updated */
+void runVersions(Report& report, const MerkleTree::Digests& leaves)
+{
+    PersistentMerkleTree tree(leaves);
+    for (size_t count = 1; count <= std::min<size_t>(leaves.size(), 100000);
+            count *= 100) {
+        VersionOp op(tree, count);
+        report.time("persistent_version", count, 0, op);
+    }
+}
+
+/** Remove a key from a search tree and add it back, which changes and then
+ * restores the tree */
+class SearchTreeOp : public Operation
+{
+public :
+    SearchTreeOp(MerkleSearchTree& tree, const MerkleTree::Digests& keys)
+        : tree_(tree), keys_(keys)
+    {
+    }
+
+    virtual void run(size_t i)
+    {
+        const MerkleTree::Digest& key = keys_[(i * 7919) % keys_.size()];
+        tree_.erase(key);
+        tree_.insert(key);
+    }
+
+private :
+    MerkleSearchTree&          tree_;
+    const MerkleTree::Digests& keys_;
+};
+
+/** Time updates of search trees against their number of keys */
+void runSearchTree(Report& report, const MerkleTree::Digests& leaves)
+{
+    for (size_t count = 1000; count <= leaves.size(); count *= 10) {
+        const MerkleTree::Digests keys(leaves.begin(),
+                leaves.begin() + count);
+        MerkleSearchTree tree(keys);
+        SearchTreeOp op(tree, keys);
+        report.time("search_tree/erase_insert", count, 0, op);
+    }
+}
+
+void usage(const char* name)
+{
+    std::cerr << "Usage: " << name
+        << " [--max-leaves N] [--samples N] [--output FILE]\n"
+        << "  --max-leaves N  Largest tree to build (default: 1000000,"
+        << " up to " << MAX_LEAVES << ")\n"
+        << "  --samples N     Maximum samples per benchmark (default: 50)\n"
+        << "  --output FILE   Write the JSON results to FILE instead of"
+        << " stdout\n";
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    size_t maxLeaves = 1000000;
+    size_t samples = 50;
+    const char* output = NULL;
+    for (int i = 1; i < argc; ++i) {
+        if ((std::strcmp(argv[i], "--max-leaves") == 0) && (i + 1 < argc)) {
+            maxLeaves = std::strtoul(argv[++i], NULL, 10);
+        } else if ((std::strcmp(argv[i], "--samples") == 0) && (i + 1 < argc)) {
+            samples = std::strtoul(argv[++i], NULL, 10);
+        } else if ((std::strcmp(argv[i], "--output") == 0) && (i + 1 < argc)) {
+            output = argv[++i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if ((maxLeaves == 0) || (maxLeaves > MAX_LEAVES) || (samples == 0)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    Report report(samples);
+
+    const size_t sizes[] = { 16, 32, 64, 256, 1024, 4096, 65536, 1 << 20 };
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+        HashOp op(sizes[i]);
+        report.time("hash", sizes[i], sizes[i], op);
+    }
+
+    const MerkleTree::Digests pairs = makeLeaves(1024);
+    CombinedHashOp combinedHash(pairs);
+    report.time("combined_hash", 2 * MERKLE_TREE_ELEMENT_SIZE_B,
+            2 * MERKLE_TREE_ELEMENT_SIZE_B, combinedHash);
+    CombinedDigestOp combinedDigest(pairs);
+    report.time("combined_hash_digest", 2 * MERKLE_TREE_ELEMENT_SIZE_B,
+            2 * MERKLE_TREE_ELEMENT_SIZE_B, combinedDigest);
+
+    // The leaves are grown from one size to the next, rather than copied
+    MerkleTree::Digests leaves;
+    for (size_t count = 1; count <= maxLeaves; count *= 10) {
+        growLeaves(leaves, count);
+        for (int preserveOrder = 1; preserveOrder >= 0; --preserveOrder) {
+            ConstructOp op(leaves, preserveOrder);
+            report.time(preserveOrder ? "construct/ordered"
+                    : "construct/unordered", count,
+                    count * MERKLE_TREE_ELEMENT_SIZE_B, op);
+        }
+    }
+
+    growLeaves(leaves, maxLeaves);
+    const MerkleTree::Digests proofLeaves(leaves.begin(),
+            leaves.begin() + std::min(maxLeaves, PROOF_TREE_LEAVES));
+    runProofs(report, proofLeaves);
+    runColdProofs(report, proofLeaves);
+    runUpdates(report, proofLeaves);
+    runPrunedProofs(report, proofLeaves);
+    runVersions(report, proofLeaves);
+    runSearchTree(report, proofLeaves);
+
+    if (output != NULL) {
+        std::ofstream file(output);
+        report.write(file);
+        if (!file) {
+            std::cerr << "Failed to write " << output << std::endl;
+            return 1;
+        }
+    } else {
+        report.write(std::cout);
+    }
+    return 0;
+}
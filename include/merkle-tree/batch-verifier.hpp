@@ -0,0 +1,81 @@
+#ifndef MERKLE_TREE_BATCH_VERIFIER_HPP_
+#define MERKLE_TREE_BATCH_VERIFIER_HPP_
+
+#include "merkle-tree/merkle-tree.hpp"
+
+/** Check many proofs at once
+ *
+ * Proofs are queued with `add()` and all checked by `verify()`. The result
+ * for each proof is the same as `MerkleTree::checkProof()` or
+ * `MerkleTree::checkProofOrdered()` would return, but the work is organised
+ * differently: step `i` of every proof is done at the same time, so all
+ * these hashes go through the multi-buffer hashing engine in one batch, and
+ * identical hashes at a given step (e.g. the upper nodes shared by proofs
+ * against the same root) are computed only once.
+ *
+ * Queued proofs are copied into flat arrays, so there is no allocation per
+ * hash while verifying.
+ */
+class MerkleBatchVerifier
+{
+public :
+    /** Constructor
+     *
+     * \param preserveOrder [in] Whether the proofs are for Merkle Trees with
+     *                           preserved order
+     */
+    explicit MerkleBatchVerifier(bool preserveOrder);
+
+    /** Queue a proof
+     *
+     * A proof with hashes that are not of the right size can't be valid: it
+     * is queued anyway, and will fail to verify.
+     *
+     * \param proof   [in] Proof to check
+     * \param root    [in] Root hash of the Merkle Tree
+     * \param element [in] Element for which the proof is checked
+     * \param index   [in] Index of `element`, starting at 1; this is only
+     *                     used with preserved order
+     *
+     * \return The position of the result of this proof in the bitmap
+     *         returned by `verify()`
+     */
+    size_t add(const MerkleTree::Elements& proof, const MerkleTree::Buffer& root,
+            const MerkleTree::Buffer& element, size_t index = 0);
+
+    /** Check all the queued proofs
+     *
+     * The proofs stay queued, \see clear().
+     *
+     * \return One bit per queued proof, in the order they were added: `true`
+     *         if the proof is valid, `false` if not
+     */
+    std::vector<bool> verify() const;
+
+    /** Get the number of queued proofs */
+    size_t size() const
+    {
+        return entries_.size();
+    }
+
+    /** Remove all the queued proofs */
+    void clear();
+
+private :
+    /** A queued proof */
+    struct Entry
+    {
+        size_t first;  /**< Index of the first proof hash in `hashes_` */
+        size_t length; /**< Number of proof hashes */
+        size_t index;  /**< Index of the element, starting at 0 */
+        bool   valid;  /**< `false` if the proof can't be valid */
+    };
+
+    bool                preserveOrder_; /**< Whether order is preserved */
+    std::vector<Entry>  entries_;       /**< Queued proofs */
+    MerkleTree::Digests elements_;      /**< Element of each proof */
+    MerkleTree::Digests roots_;         /**< Root of each proof */
+    MerkleTree::Digests hashes_;        /**< Hashes of all the proofs */
+};
+
+#endif // MERKLE_TREE_BATCH_VERIFIER_HPP_
@@ -0,0 +1,147 @@
+#ifndef MERKLE_TREE_BLOCKED_TREE_HPP_
+#define MERKLE_TREE_BLOCKED_TREE_HPP_
+
+#include "merkle-tree/merkle-tree.hpp"
+
+class MappedMerkleTree;
+
+/** Read-only copy of a Merkle Tree laid out for fast proofs by index
+ *
+ * A `MerkleTree` stores its layers one after the other, so a proof reads one
+ * hash in each layer, far from each other: on large trees, each of them is
+ * a cache miss and a TLB miss. This stores the hashes below the root in
+ * blocks of 4 KiB instead. A block holds the subtree of height
+ * `BLOCK_LAYERS` above a node, in the same order as a binary heap: the two
+ * children of the node first, then their four children, and so on. All
+ * the hashes a proof needs in these `BLOCK_LAYERS` layers are in the same
+ * block, so a proof touches one page per `BLOCK_LAYERS` layers rather than
+ * one per layer. The addresses of all the hashes are computed first, and
+ * prefetched before any is read.
+ *
+ * A cache line only holds two pairs of hashes, so a proof still reads
+ * about one cache line per layer, except at the top of each block.
+ *
+ * Proofs are the same as those of the source tree. This holds as many
+ * hashes as the source tree, plus two unused slots per block.
+ *
+ * All the member functions are const and can be called concurrently.
+ */
+class BlockedMerkleTree
+{
+public :
+    /** Number of layers of a block */
+    static const size_t BLOCK_LAYERS = 7;
+
+    /** Constructor, copying a tree
+     *
+     * \param tree [in] Tree to copy; it is not used afterwards
+     */
+    explicit BlockedMerkleTree(const MerkleTree& tree);
+
+    /** Constructor, copying a mapped tree, \see above */
+    explicit BlockedMerkleTree(const MappedMerkleTree& tree);
+
+    /** Destructor */
+    ~BlockedMerkleTree();
+
+    /** Get the root hash of the Merkle Tree */
+    MerkleTree::Buffer getRoot() const
+    {
+        return root_.toBuffer();
+    }
+
+    /** Get the root hash of the Merkle Tree, as a digest */
+    const MerkleTree::Digest& getRootDigest() const
+    {
+        return root_;
+    }
+
+    /** Get the number of leaves */
+    size_t getLeafCount() const
+    {
+        return leafCount_;
+    }
+
+    /** Get the number of layers, including the leaves and the root */
+    size_t getLayerCount() const
+    {
+        return layerCount_;
+    }
+
+    /** Get the leaf at a given index
+     *
+     * **IMPORTANT NOTE**: `index` starts at 1, not at 0.
+     *
+     * \throw `std::runtime_error` if `index` is out of range
+     */
+    const MerkleTree::Digest& getLeaf(size_t index) const;
+
+    /** Get the memory held by the hashes, in bytes */
+    size_t getMemoryUsage() const
+    {
+        return size_ * sizeof(MerkleTree::Digest);
+    }
+
+    /** Get proof for the leaf at a given index, without allocating memory
+     *
+     * This is the same proof as `MerkleTree::getProofOrdered()`, or as
+     * `MerkleTree::getProof()` for the leaf at that index in a tree without
+     * preserved order.
+     *
+     * \param index    [in]  Index of the leaf, starting at 1
+     * \param proof    [out] Buffer to write the proof to, from lowest to
+     *                       root
+     * \param capacity [in]  Number of digests `proof` can hold;
+     *                       `MerkleTree::MAX_PROOF_LENGTH` is always enough
+     *
+     * \return The number of hashes written to `proof`
+     *
+     * \throw `std::runtime_error` if `index` is out of range, or if `proof`
+     *        is too small
+     */
+    size_t getProof(size_t index, MerkleTree::Digest* proof,
+            size_t capacity) const;
+
+private :
+    /** Hashes below the root, band after band; a band is `BLOCK_LAYERS`
+     * layers, or fewer for the top one, and holds one block per node above
+     * it */
+    MerkleTree::Digest* nodes_;
+
+    /** Number of hashes in `nodes_` */
+    size_t size_;
+
+    /** Index in `nodes_` of the first block of each band */
+    std::vector<uint64_t> bandOffsets_;
+
+    MerkleTree::Digest root_; /**< Root hash */
+    size_t leafCount_;        /**< Number of leaves */
+    size_t layerCount_;       /**< Number of layers */
+
+    /** Copy a tree
+     *
+     * \param tree [in] `MerkleTree` or `MappedMerkleTree` to copy
+     */
+    template <class Tree>
+    void build(const Tree& tree);
+
+    /** Get the address of a hash below the root
+     *
+     * \param layer    [in] Layer of the hash
+     * \param position [in] Position of the hash in its layer
+     */
+    const MerkleTree::Digest* getNode(size_t layer, size_t position) const;
+
+    /** Get the address of a hash below the root, \see above */
+    MerkleTree::Digest* getNode(size_t layer, size_t position)
+    {
+        const BlockedMerkleTree* self = this;
+        return const_cast<MerkleTree::Digest*>(self->getNode(layer, position));
+    }
+
+    // Not copyable
+    BlockedMerkleTree(const BlockedMerkleTree&);
+    BlockedMerkleTree& operator=(const BlockedMerkleTree&);
+};
+
+#endif // MERKLE_TREE_BLOCKED_TREE_HPP_
@@ -0,0 +1,92 @@
+#ifndef MERKLE_TREE_EXECUTOR_HPP_
+#define MERKLE_TREE_EXECUTOR_HPP_
+
+#include <cstddef>
+
+/** Something that runs independent work items, possibly in parallel
+ *
+ * The Merkle Tree uses an executor to spread the work of building large
+ * trees over several threads. Implement this interface to have it run on
+ * your own threads, or use the built-in `MerkleTreeThreadPool`.
+ */
+class MerkleTreeExecutor
+{
+public :
+    /** A piece of work made of independent items */
+    class Task
+    {
+    public :
+        virtual ~Task() { }
+
+        /** Process one item
+         *
+         * This may be called concurrently for different items, and must not
+         * throw.
+         *
+         * \param index [in] Item to process
+         */
+        virtual void run(size_t index) = 0;
+    };
+
+    virtual ~MerkleTreeExecutor() { }
+
+    /** Run all the items of a task
+     *
+     * This calls `task.run(i)` exactly once for every `i` in `[0, count)`,
+     * in any order and on any thread, and returns when all of them are
+     * done.
+     *
+     * \param count [in] Number of items
+     * \param task  [in] Task to run
+     */
+    virtual void parallelFor(size_t count, Task& task) = 0;
+
+    /** Get the number of items that can run at the same time */
+    virtual size_t getConcurrency() const = 0;
+};
+
+/** Built-in work-stealing thread pool
+ *
+ * Each call to `parallelFor()` splits the items evenly between the pool
+ * threads and the calling thread; a thread that runs out of items steals
+ * half of the remaining items of the busiest thread. Calls to
+ * `parallelFor()` from several threads are serialized, and a call made
+ * from inside a task runs in the calling thread.
+ */
+class MerkleTreeThreadPool : public MerkleTreeExecutor
+{
+public :
+    /** Constructor
+     *
+     * \param concurrency [in] Total number of threads to use, including the
+     *                         one calling `parallelFor()`; 0 means one per
+     *                         online CPU
+     *
+     * \throw `std::runtime_error` if a thread can't be created
+     */
+    explicit MerkleTreeThreadPool(size_t concurrency = 0);
+
+    /** Destructor; stops and joins the pool threads */
+    virtual ~MerkleTreeThreadPool();
+
+    virtual void parallelFor(size_t count, Task& task);
+
+    virtual size_t getConcurrency() const;
+
+    /** Get the process-wide pool, with one thread per online CPU
+     *
+     * This is the pool used by the Merkle Tree when no executor is given.
+     * It is created on first use, and never destroyed.
+     */
+    static MerkleTreeThreadPool& getDefault();
+
+private :
+    class Impl;
+    Impl* impl_;
+
+    // Not copyable
+    MerkleTreeThreadPool(const MerkleTreeThreadPool&);
+    MerkleTreeThreadPool& operator=(const MerkleTreeThreadPool&);
+};
+
+#endif // MERKLE_TREE_EXECUTOR_HPP_
@@ -0,0 +1,138 @@
+#ifndef MERKLE_TREE_FILE_BUILDER_HPP_
+#define MERKLE_TREE_FILE_BUILDER_HPP_
+
+#include "merkle-tree/merkle-tree.hpp"
+
+/** Build a Merkle Tree file for more leaves than fit in memory
+ *
+ * Leaves are streamed in with `add()`, and the tree is written to a file
+ * that can be served with `MappedMerkleTree`. Whatever the number of
+ * leaves, the memory used stays around the given budget: leaves are
+ * written to disk as they come, and each layer is then computed from the
+ * one below it in sequential chunks.
+ *
+ * In unordered mode, the leaves are sorted and deduplicated with an external
+ * merge sort: sorted runs are written to a temporary file next to the
+ * output file, and then merged into the leaves layer.
+ *
+ * In ordered mode, the file has no leaf hash table, since it would not fit
+ * in memory either: `MappedMerkleTree::getProofOrdered()` is O(log n) as
+ * usual, but `MappedMerkleTree::getProof()` has to scan the leaves.
+ */
+class MerkleTreeFileBuilder
+{
+public :
+    /** Constructor
+     *
+     * \param path          [in] Path of the file to write; it is built as
+     *                           `path` + ".tmp", and only replaces an
+     *                           existing file when `finish()` succeeds
+     * \param preserveOrder [in] Whether to preserve the leaves order
+     * \param memoryBudget  [in] Approximate memory to use, in bytes
+     *
+     * \throw `std::runtime_error` if the file can't be created
+     */
+    MerkleTreeFileBuilder(const std::string& path, bool preserveOrder,
+            size_t memoryBudget = 64 << 20);
+
+    /** Destructor
+     *
+     * If `finish()` has not been called successfully, the partial file is
+     * removed, and any file which was at the output path is left as is.
+     */
+    ~MerkleTreeFileBuilder();
+
+    /** Add a leaf
+     *
+     * \param element [in] Leaf to add; empty elements are ignored, like
+     *                     `MerkleTree` does
+     *
+     * \throw `std::runtime_error` if `element` is not of the right size,
+     *        \see MERKLE_TREE_ELEMENT_SIZE_B, or if writing fails
+     */
+    void add(const MerkleTree::Buffer& element);
+
+    /** Add several leaves
+     *
+     * \param leaves [in] Leaves to add, in order
+     * \param count  [in] Number of leaves
+     *
+     * \throw `std::runtime_error` if writing fails
+     */
+    void add(const MerkleTree::Digest* leaves, size_t count);
+
+    /** Add all the leaves stored in a file
+     *
+     * The file is read from its current offset until end of file, and must
+     * contain raw leaves, one after the other.
+     *
+     * \param fd [in] File descriptor to read from
+     *
+     * \throw `std::runtime_error` if reading or writing fails, or if the
+     *        size of the data is not a multiple of the leaf size
+     */
+    void addFile(int fd);
+
+    /** Get the number of leaves added so far, duplicates included */
+    uint64_t getLeafCount() const
+    {
+        return leafCount_;
+    }
+
+    /** Build the layers and complete the file
+     *
+     * \return The root hash of the Merkle Tree
+     *
+     * \throw `std::runtime_error` if no leaf has been added, or if reading
+     *        or writing fails
+     */
+    MerkleTree::Buffer finish();
+
+private :
+    /** A sorted run of leaves in the temporary file */
+    struct Run
+    {
+        uint64_t position; /**< Position in the temporary file, in bytes */
+        uint64_t count;    /**< Number of leaves */
+    };
+
+    std::string         path_;          /**< Output file */
+    int                 fd_;            /**< Output file descriptor */
+    bool                preserveOrder_; /**< Whether to preserve the order */
+    size_t              memoryBudget_;  /**< Approximate memory to use */
+    uint64_t            leafCount_;     /**< Leaves added so far */
+    uint64_t            written_;       /**< Leaves written to disk so far */
+    bool                finished_;      /**< Whether the file is complete */
+    MerkleTree::Digests buffer_;        /**< Leaves not yet written */
+    std::string         runsPath_;      /**< Temporary file of sorted runs */
+    int                 runsFd_;        /**< Temporary file descriptor */
+    std::vector<Run>    runs_;          /**< Sorted runs written so far */
+
+    /** Write the buffered leaves to disk */
+    void flush();
+
+    /** Merge all the sorted runs into the leaves layer
+     *
+     * \return The number of distinct leaves
+     */
+    uint64_t mergeRuns();
+
+    /** Read the next leaves of a sorted run
+     *
+     * \param fd         [in]  Temporary file descriptor
+     * \param run        [in]  Run to read from; must have leaves left
+     * \param consumed   [in]  Number of leaves of the run already read
+     * \param bufferSize [in]  Maximum number of leaves to read
+     * \param input      [out] Leaves read
+     *
+     * \return The number of leaves of the run read so far
+     */
+    static uint64_t readRun(int fd, const Run& run, uint64_t consumed,
+            size_t bufferSize, MerkleTree::Digests& input);
+
+    // Not copyable
+    MerkleTreeFileBuilder(const MerkleTreeFileBuilder&);
+    MerkleTreeFileBuilder& operator=(const MerkleTreeFileBuilder&);
+};
+
+#endif // MERKLE_TREE_FILE_BUILDER_HPP_
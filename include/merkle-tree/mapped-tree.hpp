@@ -0,0 +1,130 @@
+#ifndef MERKLE_TREE_MAPPED_TREE_HPP_
+#define MERKLE_TREE_MAPPED_TREE_HPP_
+
+#include "merkle-tree/merkle-tree.hpp"
+
+/** Read-only Merkle Tree served from a file mapped in memory
+ *
+ * The file is written by `MerkleTree::save()`. Opening it only maps it in
+ * memory and checks its header: the hashes are used in place, and pages are
+ * loaded by the OS as proofs need them, so opening takes the same time
+ * whatever the size of the tree.
+ *
+ * All the member functions are const and can be called concurrently.
+ */
+class MappedMerkleTree
+{
+public :
+    /** Constructor
+     *
+     * \param path [in] Path of the file to open
+     *
+     * \throw `std::runtime_error` if the file can't be opened, if it is not
+     *        a Merkle Tree file, or if its version is not supported
+     */
+    explicit MappedMerkleTree(const std::string& path);
+
+    /** Destructor; unmaps the file */
+    ~MappedMerkleTree();
+
+    /** Whether the Merkle Tree has been built with preserved order */
+    bool isOrderPreserved() const
+    {
+        return preserveOrder_;
+    }
+
+    /** Get the root hash of the Merkle Tree */
+    MerkleTree::Buffer getRoot() const
+    {
+        return getRootDigest().toBuffer();
+    }
+
+    /** Get the root hash of the Merkle Tree, as a digest */
+    const MerkleTree::Digest& getRootDigest() const
+    {
+        return nodes_[layerOffsets_[layerCount_ - 1]];
+    }
+
+    /** Get the number of leaves */
+    size_t getLeafCount() const
+    {
+        return getLayerSize(0);
+    }
+
+    /** Get the number of layers, including the leaves and the root */
+    size_t getLayerCount() const
+    {
+        return layerCount_;
+    }
+
+    /** Get the number of hashes in a layer, \see MerkleTree::getLayerSize() */
+    size_t getLayerSize(size_t layer) const
+    {
+        return layerOffsets_[layer + 1] - layerOffsets_[layer];
+    }
+
+    /** Get the hashes of a layer, \see MerkleTree::getLayer() */
+    const MerkleTree::Digest* getLayer(size_t layer) const
+    {
+        return nodes_ + layerOffsets_[layer];
+    }
+
+    /** Get proof for a given Merkle Tree element
+     *
+     * \see MerkleTree::getProof()
+     */
+    MerkleTree::Elements getProof(const MerkleTree::Buffer& element) const;
+
+    /** Get proof in string form for a given Merkle Tree element
+     *
+     * \see MerkleTree::getProofHex()
+     */
+    std::string getProofHex(const MerkleTree::Buffer& element) const;
+
+    /** Get proof for a given element of a Merkle Tree with preserved order
+     *
+     * \see MerkleTree::getProofOrdered()
+     */
+    MerkleTree::Elements getProofOrdered(const MerkleTree::Buffer& element,
+            size_t index) const;
+
+    /** Get proof in string form for a given element of a Merkle Tree with preserved order
+     *
+     * \see MerkleTree::getProofOrderedHex()
+     */
+    std::string getProofOrderedHex(const MerkleTree::Buffer& element,
+            size_t index) const;
+
+    /** Get proof for a given Merkle Tree element, without allocating memory
+     *
+     * \see MerkleTree::getProof(const Digest&, Digest*, size_t)
+     */
+    size_t getProof(const MerkleTree::Digest& element,
+            MerkleTree::Digest* proof, size_t capacity) const;
+
+    /** Get proof for a given element of a Merkle Tree with preserved order, without allocating memory
+     *
+     * \see MerkleTree::getProofOrdered(const Digest&, size_t, Digest*, size_t)
+     */
+    size_t getProofOrdered(const MerkleTree::Digest& element, size_t index,
+            MerkleTree::Digest* proof, size_t capacity) const;
+
+private :
+    void*                     map_;           /**< Mapped file */
+    size_t                    mapSize_;       /**< Size of the mapping */
+    bool                      preserveOrder_; /**< Order of the leaves */
+    const MerkleTree::Digest* nodes_;         /**< All the hashes */
+    const uint64_t*           layerOffsets_;  /**< \see TreeView */
+    size_t                    layerCount_;    /**< Number of layers */
+    const uint64_t*           leafSlots_;     /**< \see TreeView */
+    size_t                    slotCount_;     /**< Size of `leafSlots_` */
+
+    /** Get a read-only view of the layers, to serve proofs */
+    BasicTreeView<MerkleTree> getView() const;
+
+    // Not copyable
+    MappedMerkleTree(const MappedMerkleTree&);
+    MappedMerkleTree& operator=(const MappedMerkleTree&);
+};
+
+#endif // MERKLE_TREE_MAPPED_TREE_HPP_
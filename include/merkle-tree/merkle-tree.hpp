@@ -3,28 +3,74 @@
 
 extern "C" {
 #include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
 }
 
 #include <vector>
 #include <deque>
+#include <utility>
 #include <string>
 #include <stdexcept>
+#include <cstring>
+#include "merkle-tree/executor.hpp"
 
-/** Size of a hash, in bytes
+/** Size of a hash of a `MerkleTree`, in bytes
  *
  * We are using Blake2b with an output of 128 bits, which is 16 bytes.
  */
 #define MERKLE_TREE_ELEMENT_SIZE_B 16
 
-class MerkleTree
+/** Alignment of a `BasicMerkleTree::Digest`, in bytes
+ *
+ * Digests whose size is not a multiple of this are not aligned, so they stay
+ * packed in arrays.
+ */
+#define MERKLE_TREE_DIGEST_ALIGN_B 16
+
+#if defined(__GNUC__)
+#define MERKLE_TREE_ALIGNED(n) __attribute__((aligned(n)))
+#else
+#define MERKLE_TREE_ALIGNED(n)
+#endif
+
+template <class Tree> struct BasicTreeView;
+
+/** BLAKE2b hash policy
+ *
+ * Hashes are BLAKE2b with an output of the digest size of the tree, from 16
+ * to 64 bytes; pairs of digests are hashed with the multi-buffer engine.
+ */
+struct MerkleTreeBlake2b;
+
+/** Merkle Tree with a given hash function and digest size
+ *
+ * `HashPolicy` is the hash function, and `DigestBytes` the size of all the
+ * hashes in the tree, in bytes. Both are fixed at compile time: digests are
+ * fixed-size arrays, and each configuration gets its own code, with the
+ * digest size known to the hashing path all the way down.
+ *
+ * Hash policies are defined by the library, which is built with these
+ * configurations:
+ *  - `MerkleTree`: BLAKE2b, 16-byte digests
+ *  - `MerkleTree256`: BLAKE2b, 32-byte digests
+ *
+ * Digests must be at least 16 bytes.
+ */
+template <class HashPolicy, size_t DigestBytes>
+class BasicMerkleTree
 {
 public :
+    /** Hash function of this Merkle Tree */
+    typedef HashPolicy Hash;
+
+    /** Size of a hash, in bytes */
+    static const size_t DIGEST_SIZE_B = DigestBytes;
+
     /** Buffer type
      *
      * This represents a single hash in the Merkle Tree and must have a
-     * length of `MERKLE_TREE_ELEMENT_SIZE_B`.
-     *
-     * \see MERKLE_TREE_ELEMENT_SIZE_B
+     * length of `DIGEST_SIZE_B`.
      */
     typedef std::vector<uint8_t> Buffer;
 
@@ -35,6 +81,123 @@ public :
      */
     typedef std::deque<Buffer> Elements;
 
+    /** Fixed-size hash
+     *
+     * This holds the same bytes as a `Buffer` of `DIGEST_SIZE_B` bytes, but
+     * it is a trivially copyable value type: it lives inline in arrays, so a
+     * layer of the Merkle Tree is a single contiguous block of memory.
+     * Digests compare like the equivalent `Buffer`s.
+     */
+    struct Digest
+    {
+        uint8_t bytes[DigestBytes]; /**< Raw hash */
+
+        /** Build a digest from a buffer
+         *
+         * \throw `std::runtime_error` if `buffer` is not of the right size,
+         *        \see DIGEST_SIZE_B.
+         */
+        static Digest fromBuffer(const Buffer& buffer)
+        {
+            if (buffer.size() != DigestBytes) {
+                throw std::runtime_error("Wrong digest size");
+            }
+            Digest digest;
+            std::memcpy(digest.bytes, &buffer[0], sizeof(digest.bytes));
+            return digest;
+        }
+
+        /** Convert this digest into a buffer */
+        Buffer toBuffer() const
+        {
+            return Buffer(bytes, bytes + sizeof(bytes));
+        }
+
+        bool operator==(const Digest& other) const
+        {
+            return std::memcmp(bytes, other.bytes, sizeof(bytes)) == 0;
+        }
+
+        bool operator!=(const Digest& other) const
+        {
+            return !(*this == other);
+        }
+
+        bool operator<(const Digest& other) const
+        {
+            return std::memcmp(bytes, other.bytes, sizeof(bytes)) < 0;
+        }
+
+        bool operator>(const Digest& other) const
+        {
+            return other < *this;
+        }
+    } MERKLE_TREE_ALIGNED((DigestBytes % MERKLE_TREE_DIGEST_ALIGN_B)
+            ? 1 : MERKLE_TREE_DIGEST_ALIGN_B);
+
+    /** Contiguous list of digests */
+    typedef std::vector<Digest> Digests;
+
+    /** Maximum number of hashes in a proof
+     *
+     * A Merkle Tree has at most 2^64 leaves, so a proof has at most one hash
+     * per layer below the root. A buffer of this many digests can hold any
+     * proof, \see getProof(const Digest&, Digest*, size_t).
+     */
+    static const size_t MAX_PROOF_LENGTH = 64;
+
+    /** List of leaf replacements, as pairs of leaf index and new leaf
+     *
+     * **IMPORTANT NOTE**: indices start at 1, like for `updateLeaf()`.
+     */
+    typedef std::vector<std::pair<size_t, Digest> > LeafUpdates;
+
+    /** Proof for several elements of the same Merkle Tree
+     *
+     * This replaces one proof per element: sibling hashes shared by the
+     * paths of several elements are included only once, and hashes that can
+     * be computed from the proven elements themselves are not included at
+     * all.
+     */
+    struct MultiProof
+    {
+        /** Index of each proven element, in the order they were given
+         *
+         * **IMPORTANT NOTE**: indices start at 1, like for
+         *                     `getProofOrdered()`.
+         */
+        std::vector<size_t> indices;
+
+        /** Sibling hashes, in the order the verifier uses them */
+        Digests hashes;
+    };
+
+    /** Proof that an element is not in a Merkle Tree with sorted leaves
+     *
+     * This holds the proofs of the two leaves adjacent to where the element
+     * would be: the greatest leaf lower than the element, and the next one.
+     * At the ends of the tree, there is only one of them.
+     *
+     * The Merkle Tree must have been built with `preserveOrder` set to
+     * `true` from elements in strictly increasing order, \see
+     * getAbsenceProof().
+     */
+    struct AbsenceProof
+    {
+        /** Index of the lower leaf, or 0 if the element is lower than all
+         * the leaves; the upper leaf, if any, is the next one
+         *
+         * **IMPORTANT NOTE**: indices start at 1, like for
+         *                     `getProofOrdered()`.
+         */
+        size_t lowerIndex;
+
+        Buffer   lower;      /**< Lower leaf, empty if none */
+        Elements lowerProof; /**< Proof of `lower` */
+        Buffer   upper;      /**< Upper leaf, empty if none */
+        Elements upperProof; /**< Proof of `upper` */
+    };
+
     /** Constructor
      *
      * If `preserveOrder` is set to `true`, the `elements` will be used in
@@ -48,13 +211,67 @@ public :
      *
      * \throw `std::runtime_error` if `elements` is empty
      *
+     * Large trees are built in parallel on the default thread pool, \see
+     * MerkleTreeThreadPool::getDefault().
+     *
      * \throw `std::runtime_error` if `elements` contains an element which is
-     *        not of the right size, \see MERKLE_TREE_ELEMENT_SIZE_B.
+     *        not of the right size, \see DIGEST_SIZE_B.
      */
-    MerkleTree(const Elements& elements, bool preserveOrder = false);
+    BasicMerkleTree(const Elements& elements, bool preserveOrder = false);
+
+    /** Constructor using the given executor
+     *
+     * This is the same as the constructor above, except that the work of
+     * building large trees is spread over `executor` rather than over the
+     * default thread pool. Trees below a size threshold are built serially
+     * in the calling thread, whatever the executor.
+     *
+     * \param elements      [in] Elements to add to the Merkle Tree
+     *                           There must be at least one element
+     * \param preserveOrder [in] Whether to preserve the elements order
+     * \param executor      [in] Executor to build the tree on
+     *
+     * \throw `std::runtime_error` if `elements` is empty
+     *
+     * \throw `std::runtime_error` if `elements` contains an element which is
+     *        not of the right size, \see DIGEST_SIZE_B.
+     */
+    BasicMerkleTree(const Elements& elements, bool preserveOrder,
+            MerkleTreeExecutor& executor);
+
+    /** Constructor from digests
+     *
+     * This is the same as the constructor above, but without the cost of
+     * converting each element from a `Buffer`.
+     *
+     * \param leaves        [in] Leaves of the Merkle Tree
+     *                           There must be at least one leaf
+     * \param preserveOrder [in] Whether to preserve the leaves order
+     *
+     * \throw `std::runtime_error` if `leaves` is empty
+     */
+    BasicMerkleTree(const Digests& leaves, bool preserveOrder = false);
+
+    /** Constructor from digests using the given executor
+     *
+     * \param leaves        [in] Leaves of the Merkle Tree
+     *                           There must be at least one leaf
+     * \param preserveOrder [in] Whether to preserve the leaves order
+     * \param executor      [in] Executor to build the tree on
+     *
+     * \throw `std::runtime_error` if `leaves` is empty
+     */
+    BasicMerkleTree(const Digests& leaves, bool preserveOrder,
+            MerkleTreeExecutor& executor);
+
+    /** Copy constructor */
+    BasicMerkleTree(const BasicMerkleTree& other);
+
+    /** Assignment operator */
+    BasicMerkleTree& operator=(const BasicMerkleTree& other);
 
     /** Destructor */
-    virtual ~MerkleTree();
+    virtual ~BasicMerkleTree();
 
     /** Compute a hash
      *
@@ -64,6 +281,61 @@ public :
      */
     static Buffer hash(const Buffer& data);
 
+    /** Compute the hash of a memory region
+     *
+     * The data is hashed in place, whole blocks at a time; this is the
+     * function to use for data that is already in memory, for example in a
+     * mapped file.
+     *
+     * \param data [in] Data to hash
+     * \param size [in] Size of `data`, in bytes
+     *
+     * \return The computed hash of `data`
+     */
+    static Buffer hash(const void* data, size_t size);
+
+    /** Compute the hash of a scatter/gather list
+     *
+     * The result is the same as hashing the concatenation of all the
+     * buffers, but no copy is made.
+     *
+     * \param iov    [in] Buffers to hash, in order
+     * \param iovcnt [in] Number of entries in `iov`
+     *
+     * \return The computed hash of the concatenated buffers
+     */
+    static Buffer hashIov(const struct iovec* iov, size_t iovcnt);
+
+    /** Compute the hash of the content of a file
+     *
+     * Regular files are mapped in memory and hashed in place; anything else
+     * (pipes, sockets, etc.) is read until end of file. The file offset of
+     * `fd` is not used and, for regular files, not modified.
+     *
+     * \param fd [in] File descriptor to read from
+     *
+     * \return The computed hash of the file content
+     *
+     * \throw `std::runtime_error` if the file can't be read
+     */
+    static Buffer hashFile(int fd);
+
+    /** Compute the hash of a region of a file
+     *
+     * The region is mapped in memory and hashed in place if possible, and
+     * read with `pread()` otherwise.
+     *
+     * \param fd     [in] File descriptor to read from
+     * \param offset [in] Offset of the region in the file, in bytes
+     * \param size   [in] Size of the region, in bytes
+     *
+     * \return The computed hash of the region
+     *
+     * \throw `std::runtime_error` if the region can't be read, or if it
+     *        extends past the end of the file
+     */
+    static Buffer hashFile(int fd, off_t offset, size_t size);
+
     /** Combine two hashes into one
      *
      * \param first         [in] First hash (i.e. the one on the left)
@@ -75,17 +347,143 @@ public :
     static Buffer combinedHash(const Buffer& first, const Buffer& second,
             bool preserveOrder);
 
+    /** Combine two digests into one
+     *
+     * This is the same as the function above, for digests.
+     *
+     * \param first         [in] First hash (i.e. the one on the left)
+     * \param second        [in] Second hash (i.e. the one on the right)
+     * \param preserveOrder [in] Whether to preserve the order
+     *
+     * \return The hash of the combined two hashes
+     */
+    static Digest combinedHash(const Digest& first, const Digest& second,
+            bool preserveOrder);
+
     /** Get the root hash of the Merkle Tree */
     Buffer getRoot() const
     {
-        return layers_.back()[0];
+        return getRootDigest().toBuffer();
     }
 
+    /** Get the root hash of the Merkle Tree, as a digest */
+    const Digest& getRootDigest() const
+    {
+        return nodes_.back();
+    }
+
+    /** Get the number of leaves
+     *
+     * In unordered mode, this is the number of leaves after duplicates have
+     * been removed.
+     */
+    size_t getLeafCount() const
+    {
+        return getLayerSize(0);
+    }
+
+    /** Get the number of layers, including the leaves and the root */
+    size_t getLayerCount() const
+    {
+        return layerOffsets_.size() - 1;
+    }
+
+    /** Get the number of hashes in a layer
+     *
+     * \param layer [in] Layer number; 0 is the leaves, `getLayerCount() - 1`
+     *                   is the root
+     */
+    size_t getLayerSize(size_t layer) const
+    {
+        return layerOffsets_[layer + 1] - layerOffsets_[layer];
+    }
+
+    /** Get the hashes of a layer
+     *
+     * \param layer [in] Layer number; 0 is the leaves, `getLayerCount() - 1`
+     *                   is the root
+     *
+     * \return Pointer to the `getLayerSize(layer)` contiguous hashes of the
+     *         layer
+     */
+    const Digest* getLayer(size_t layer) const
+    {
+        return &nodes_[layerOffsets_[layer]];
+    }
+
+    /** Get the memory held by the layers and the leaf index, in bytes
+     *
+     * This is what `MerkleTreeStats::layerBytes` accounts for this tree.
+     */
+    size_t getMemoryUsage() const;
+
+    /** Replace an element of a Merkle Tree with preserved order
+     *
+     * Only the hashes on the path from the element to the root are
+     * recomputed, so this takes O(log n) time. Proofs obtained before the
+     * update are no longer valid against the new root.
+     *
+     * This must not be called concurrently with any other member function.
+     *
+     * \param index   [in] Index of the element to replace
+     * \param element [in] New element
+     *
+     * **IMPORTANT NOTE**: `index` starts at 1, not at 0; so the first element
+     *                     has an index of 1, the second element an index of
+     *                     2, etc.
+     *
+     * \throw `std::runtime_error` if the Merkle Tree has been built with
+     *        `preserveOrder` set to `false`
+     *
+     * \throw `std::runtime_error` if `index` is out of range
+     *
+     * \throw `std::runtime_error` if `element` is not of the right size,
+     *        \see DIGEST_SIZE_B.
+     */
+    void updateLeaf(size_t index, const Buffer& element);
+
+    /** Replace an element of a Merkle Tree with preserved order
+     *
+     * This is the same as the function above, for digests.
+     */
+    void updateLeaf(size_t index, const Digest& element);
+
+    /** Replace several elements of a Merkle Tree with preserved order
+     *
+     * This gives the same tree as calling `updateLeaf()` for each update in
+     * turn, but each node above the leaves is rehashed at most once: the
+     * nodes to rehash are found layer by layer, from the leaves up, and the
+     * pairs of each layer are hashed in batches. Layers with many nodes to
+     * rehash are split over the default thread pool.
+     *
+     * If an index is given several times, the last update wins. Nothing is
+     * modified if an exception is thrown.
+     *
+     * This must not be called concurrently with any other member function.
+     *
+     * \param updates [in] Leaves to replace, in any order
+     *
+     * \throw `std::runtime_error` if the Merkle Tree has been built with
+     *        `preserveOrder` set to `false`
+     *
+     * \throw `std::runtime_error` if any index is out of range
+     */
+    void updateLeaves(const LeafUpdates& updates);
+
+    /** Replace several elements of a Merkle Tree with preserved order, using
+     * the given executor
+     *
+     * This is the same as the function above, except that large layers are
+     * split over `executor` rather than over the default thread pool.
+     */
+    void updateLeaves(const LeafUpdates& updates,
+            MerkleTreeExecutor& executor);
+
     /** Compute a root hash given a set of hashes
      *
-     * This function builds a temporary Merkle Tree and extracts its root
-     * hash. The temporary Merkle Tree will be built using the passed
-     * arguments.
+     * This function computes the root hash of the Merkle Tree that would be
+     * built using the passed arguments, without keeping its layers in
+     * memory: the leaves are reduced in place, one layer at a time.
      *
      * \param elements      [in] Set of hashes used to build the Merkle Tree
      * \param preserveOrder [in] Whether to preserve the order of `elements`
@@ -96,7 +494,7 @@ public :
      * \throw `std::runtime_error` if `elements` is empty
      *
      * \throw `std::runtime_error` if `elements` contains an element which is
-     *        not of the right size, \see MERKLE_TREE_ELEMENT_SIZE_B.
+     *        not of the right size, \see DIGEST_SIZE_B.
      */
     static Buffer merkleRoot(const Elements& elements,
             bool preserveOrder = false);
@@ -199,49 +597,321 @@ public :
     static bool checkProofOrdered(const Elements& proof, const Buffer& root,
             const Buffer& element, size_t index);
 
+    /** Get proof for a given Merkle Tree element, without allocating memory
+     *
+     * This is the same as `getProof()`, except that the proof is written in
+     * a buffer provided by the caller, and that no memory is allocated from
+     * the heap (unless an exception is thrown).
+     *
+     * \param element  [in]  Element to get the proof for
+     * \param proof    [out] Buffer to write the proof to, from lowest to
+     *                       root
+     * \param capacity [in]  Number of digests `proof` can hold;
+     *                       `MAX_PROOF_LENGTH` is always enough
+     *
+     * \return The number of hashes written to `proof`
+     *
+     * \throw `std::runtime_error` if `element` is not in the base layer of
+     *        the Merkle Tree, or if `proof` is too small
+     */
+    size_t getProof(const Digest& element, Digest* proof,
+            size_t capacity) const;
+
+    /** Get proof for a given element of a Merkle Tree with preserved order, without allocating memory
+     *
+     * This is the same as `getProofOrdered()`, except that the proof is
+     * written in a buffer provided by the caller, \see getProof(const
+     * Digest&, Digest*, size_t).
+     *
+     * **IMPORTANT NOTE**: `index` starts at 1, not at 0.
+     *
+     * \return The number of hashes written to `proof`
+     *
+     * \throw `std::runtime_error` if `index` does not point to `element`,
+     *        or if `proof` is too small
+     */
+    size_t getProofOrdered(const Digest& element, size_t index,
+            Digest* proof, size_t capacity) const;
+
+    /** Check the given proof for the given element, without allocating memory
+     *
+     * This is the same as `checkProof()`, for digests. The intermediate
+     * hashes stay on the stack.
+     *
+     * \param proof   [in] Proof to check
+     * \param length  [in] Number of hashes in `proof`
+     * \param root    [in] Root hash of the Merkle Tree
+     * \param element [in] Element for which the proof is checked
+     *
+     * \return `true` if `proof` is valid, `false` if not
+     */
+    static bool checkProof(const Digest* proof, size_t length,
+            const Digest& root, const Digest& element);
+
+    /** Check the given proof for the given element in a Merkle Tree with order preserved, without allocating memory
+     *
+     * This is the same as `checkProofOrdered()`, for digests.
+     *
+     * **IMPORTANT NOTE**: `index` starts at 1, not at 0.
+     *
+     * \return `true` if `proof` is valid, `false` if not
+     */
+    static bool checkProofOrdered(const Digest* proof, size_t length,
+            const Digest& root, const Digest& element, size_t index);
+
+    /** Get a proof for several elements given their indices
+     *
+     * The proof works for Merkle Trees with or without preserved order. In
+     * unordered mode, indices refer to the sorted and deduplicated leaves.
+     *
+     * \param indices [in] Indices of the elements to prove, in any order;
+     *                     duplicates are allowed
+     *
+     * **IMPORTANT NOTE**: `indices` start at 1, not at 0; so the first
+     *                     element has an index of 1, the second element an
+     *                     index of 2, etc.
+     *
+     * \return A proof for all the elements at once
+     *
+     * \throw `std::runtime_error` if `indices` is empty, or if any index is
+     *        out of range
+     */
+    MultiProof getMultiProof(const std::vector<size_t>& indices) const;
+
+    /** Get a proof for several elements
+     *
+     * This is the same as the function above, except that the elements are
+     * looked up in the Merkle Tree like `getProof()` does.
+     *
+     * \param elements [in] Elements to prove
+     *
+     * \return A proof for all the elements at once
+     *
+     * \throw `std::runtime_error` if `elements` is empty, or if any element
+     *        is not in the base layer of the Merkle Tree
+     */
+    MultiProof getMultiProof(const Elements& elements) const;
+
+    /** Get a proof that an element is not in the Merkle Tree
+     *
+     * This is only possible when the Merkle Tree has been built with
+     * `preserveOrder` set to `true`, from elements sorted in strictly
+     * increasing order, e.g. with `std::sort()` and `std::unique()`: hashes
+     * are then combined in the order of the leaves, so the root records the
+     * position of each leaf and proofs can show that two leaves are next to
+     * each other. The neighbours of `element` are found by binary search.
+     *
+     * NB: A Merkle Tree built with `preserveOrder` set to `false` sorts its
+     * leaves too, but combines hashes in sorted order, which loses their
+     * positions.
+     *
+     * \param element [in] Element to prove absent
+     *
+     * \return The proofs of the leaves around `element`
+     *
+     * \throw `std::runtime_error` if the Merkle Tree has been built with
+     *        `preserveOrder` set to `false`, or if its leaves around
+     *        `element` are not sorted
+     *
+     * \throw `std::runtime_error` if `element` is not of the right size,
+     *        \see DIGEST_SIZE_B, or if it is in the Merkle Tree
+     */
+    AbsenceProof getAbsenceProof(const Buffer& element) const;
+
+    /** Check a proof that an element is not in a Merkle Tree with sorted
+     * leaves
+     *
+     * This checks that the leaves of the proof are in the Merkle Tree at
+     * consecutive positions (or at the first or last position, when there
+     * is only one of them), and that they bracket `element`.
+     *
+     * **IMPORTANT NOTE**: `leafCount` must come from the same trusted
+     *                     source as `root`: the positions of the leaves
+     *                     are only bound to the root for a given number of
+     *                     leaves.
+     *
+     * \param proof     [in] Proof to check
+     * \param root      [in] Root hash of the Merkle Tree
+     * \param leafCount [in] Number of leaves of the Merkle Tree
+     * \param element   [in] Element which is supposed to be absent
+     *
+     * \return `true` if `proof` is valid, `false` if not
+     */
+    static bool checkAbsenceProof(const AbsenceProof& proof,
+            const Buffer& root, size_t leafCount, const Buffer& element);
+
+    /** Check a proof for several elements
+     *
+     * The root is rebuilt only once, and each layer is hashed in a single
+     * batch.
+     *
+     * **IMPORTANT NOTE**: `leafCount` must come from the same trusted
+     *                     source as `root`: given a smaller number of
+     *                     leaves, an inner node of the Merkle Tree could
+     *                     pass for a leaf.
+     *
+     * \param proof         [in] Proof to check
+     * \param root          [in] Root hash of the Merkle Tree
+     * \param leafCount     [in] Number of leaves of the Merkle Tree
+     * \param elements      [in] Elements for which the proof is checked, in
+     *                           the same order as `proof.indices`
+     * \param preserveOrder [in] Whether the Merkle Tree has been built with
+     *                           preserved order
+     *
+     * \return `true` if `proof` is valid, `false` if not
+     */
+    static bool checkMultiProof(const MultiProof& proof, const Buffer& root,
+            size_t leafCount, const Elements& elements, bool preserveOrder);
+
+    /** Save the Merkle Tree to a file
+     *
+     * The file holds all the layers, ready to be served from memory by
+     * `MappedMerkleTree` without any decoding. An existing file is replaced
+     * atomically: the tree is written to `path` + ".tmp", synced to disk,
+     * then renamed over `path`, so processes which have mapped the previous
+     * file keep serving it, and a crash never leaves a partial file.
+     *
+     * \param path [in] Path of the file to write
+     *
+     * \throw `std::runtime_error` if the file can't be written
+     */
+    void save(const std::string& path) const;
+
 private :
-    /** Layers data structure
+    friend class MappedMerkleTree;
+
+    bool    preserveOrder_; /**< Whether to preserve the initial order */
+
+    /** The various layers of the Merkle Tree
+     *
+     * All the layers are stored one after the other in a single array. The
+     * first layer is the leaves, the 2nd layer is the combination of the
+     * hashes of the first layer, etc. until the last layer which is the
+     * top-level hash, aka the root. The last layer has a length of one.
+     */
+    Digests nodes_;
+
+    /** Index in `nodes_` of the first hash of each layer
      *
-     * This data structure represents the various layers of the Merkle Tree.
-     * The first layer is the initial list of hashes, the 2nd layer is the
-     * combination of the hashes of the first layer, etc. until the last layer
-     * which is the top-level hash, aka the root. The last layer has a length
-     * of one.
+     * This has one more entry than there are layers: the last entry is the
+     * total number of hashes, so the size of layer `i` is always
+     * `layerOffsets_[i + 1] - layerOffsets_[i]`.
      */
-    typedef std::deque<Elements> Layers;
+    std::vector<uint64_t> layerOffsets_;
 
-    bool     preserveOrder_; /**< Whether to preserve the initial order */
-    Elements elements_;      /**< Leaves of the Merkle Tree */
-    Layers   layers_;        /**< The various layers of the Merkle Tree */
+    /** Hash table from leaf to leaf index, for trees with preserved order
+     *
+     * This uses open addressing with linear probing: each slot holds a leaf
+     * index plus one, or 0 if the slot is empty. The number of slots is a
+     * power of two, at least twice the number of leaves. Every leaf has its
+     * own slot, duplicates included, so a leaf can be replaced without
+     * rebuilding the table. This is empty in unordered mode, where the leaves
+     * are sorted and are found by binary search.
+     */
+    std::vector<uint64_t> leafSlots_;
 
-    /** Build the Merkle Tree layers */
-    void getLayers();
+    /** Task building independent subtrees in parallel */
+    class SubtreesTask;
 
-    /** Build the next Merkle Tree layer */
-    void getNextLayer();
+    /** Task rehashing the nodes of a layer in parallel */
+    class NodesTask;
 
-    /** Get proof given the index of the element
+    /** Remove duplicates and sort the leaves as necessary, then build the
+     * Merkle Tree layers
      *
-     * \param index [in] Index of the element to get the proof for
+     * \param leaves   [in,out] Leaves of the Merkle Tree; this is consumed
+     * \param executor [in]     Executor to use, or NULL for the default pool
+     */
+    void build(Digests& leaves, MerkleTreeExecutor* executor);
+
+    /** Build the Merkle Tree layers above the leaves
      *
-     * \return The list of hashes that make up the proof
+     * Above a size threshold, the leaves are split into blocks, the subtrees
+     * above each block are built in parallel, and the few top layers are
+     * then finished serially.
+     *
+     * \param executor [in] Executor to use, or NULL for the default pool
      */
-    Elements getProof(size_t index) const;
+    void getLayers(MerkleTreeExecutor* executor);
+
+    /** Build the given Merkle Tree layer from the layer below it
+     *
+     * \param layer [in] Layer to build; must be at least 1
+     */
+    void getNextLayer(size_t layer);
+
+    /** Build part of the given Merkle Tree layer from the layer below it
+     *
+     * \param layer [in] Layer to build; must be at least 1
+     * \param first [in] Index of the first hash to build
+     * \param last  [in] Index after the last hash to build
+     */
+    void getNextLayer(size_t layer, size_t first, size_t last);
+
+    /** Rebuild the given hashes of a Merkle Tree layer from the layer below
+     * it
+     *
+     * This is only for trees with preserved order, whose leaves can be
+     * updated: pairs are hashed in the order of the layer.
+     *
+     * \param layer [in] Layer to build; must be at least 1
+     * \param nodes [in] Indices of the hashes to build, with no duplicates
+     * \param count [in] Number of entries in `nodes`
+     */
+    void rehashNodes(size_t layer, const size_t* nodes, size_t count);
+
+    /** Replace leaves and rehash the nodes above them
+     *
+     * \param updates  [in,out] Leaves to replace; this is consumed
+     * \param executor [in]     Executor to use, or NULL for the default pool
+     */
+    void applyUpdates(LeafUpdates& updates, MerkleTreeExecutor* executor);
+
+    /** Build `leafSlots_` from the leaves */
+    void indexLeaves();
+
+    /** Add a leaf to `leafSlots_`
+     *
+     * \param index [in] Index of the leaf
+     */
+    void indexLeaf(size_t index);
+
+    /** Remove a leaf from `leafSlots_`
+     *
+     * \param index [in] Index of the leaf, which must not have been modified
+     *                   since it was added
+     */
+    void unindexLeaf(size_t index);
+
+    /** Get a read-only view of the layers, to serve proofs */
+    BasicTreeView<BasicMerkleTree> getView() const;
+
+    /** Find the index of a leaf
+     *
+     * \param leaf  [in]  Leaf to search for
+     * \param index [out] Index of the first leaf equal to `leaf`
+     *
+     * \return `true` if found, `false` if `leaf` is not a leaf of the tree
+     */
+    bool findLeaf(const Digest& leaf, size_t& index) const;
 
-    /** Get the peer of an element
+    /** Get proof given the index of the element
      *
-     * \param layer [in]  Layer to search
-     * \param index [in]  Index of element in layer
-     * \param pair  [out] Peer element
+     * \param index [in] Index of the element to get the proof for
      *
-     * \return `true` if OK, `false` if no peer element (this can happen if
-     *         the `layer` has an odd number of elements, and you are asking
-     *         for the last one, which obviously has no peer)
+     * \return The list of hashes that make up the proof
      */
-    static bool getPair(const Elements& layer, size_t index, Buffer& pair);
+    Elements getProof(size_t index) const;
 
     /** Converts a list of hashes into a hexadecimal string */
     static std::string elementsToHex(const Elements& elements);
 };
 
+/** Merkle Tree of 16-byte BLAKE2b hashes, \see MERKLE_TREE_ELEMENT_SIZE_B */
+typedef BasicMerkleTree<MerkleTreeBlake2b, MERKLE_TREE_ELEMENT_SIZE_B>
+    MerkleTree;
+
+/** Merkle Tree of 32-byte BLAKE2b hashes */
+typedef BasicMerkleTree<MerkleTreeBlake2b, 32> MerkleTree256;
+
 #endif // MERKLE_TREE_HPP_
@@ -0,0 +1,255 @@
+#ifndef MERKLE_TREE_PERSISTENT_TREE_HPP_
+#define MERKLE_TREE_PERSISTENT_TREE_HPP_
+
+#include "merkle-tree/merkle-tree.hpp"
+#include <map>
+
+/** Merkle Tree with preserved order which keeps its past versions
+ *
+ * Every update creates a new version of the tree and leaves the previous
+ * ones untouched, so roots and proofs can still be served "as of" any
+ * retained version. A new version only allocates the nodes on the paths of
+ * the updated leaves, and shares all the other nodes with the version it
+ * derives from: it takes O(k log n) memory for `k` updated leaves, instead
+ * of O(n) for a copy of the tree.
+ *
+ * Each version has the same root and proofs as a `MerkleTree` built with
+ * preserved order from its leaves. All the versions have the same number of
+ * leaves.
+ *
+ * Nodes are reference counted: releasing a version frees the nodes no other
+ * retained version uses.
+ *
+ * Versions can be read concurrently. This must not be modified concurrently
+ * with any other member function.
+ */
+class PersistentMerkleTree
+{
+public :
+    /** Version number; the first version is 0, and each update creates the
+     * version after the latest one */
+    typedef uint64_t Version;
+
+    /** Constructor, creating version 0
+     *
+     * \param elements [in] Elements to add to the Merkle Tree, in order, as
+     *                      for `MerkleTree`; there must be at least one
+     *
+     * \throw `std::runtime_error` if `elements` is empty, or if it contains
+     *        an element which is not of the right size
+     */
+    explicit PersistentMerkleTree(const MerkleTree::Elements& elements);
+
+    /** Constructor from digests, \see above
+     *
+     * \throw `std::runtime_error` if `leaves` is empty
+     */
+    explicit PersistentMerkleTree(const MerkleTree::Digests& leaves);
+
+    /** Get the number of leaves */
+    size_t getLeafCount() const
+    {
+        return leafCount_;
+    }
+
+    /** Get the number of layers, including the leaves and the root */
+    size_t getLayerCount() const
+    {
+        return layerCount_;
+    }
+
+    /** Get the latest version, which the next update derives from */
+    Version getLatestVersion() const
+    {
+        return latest_;
+    }
+
+    /** Get the retained versions, in increasing order */
+    std::vector<Version> getVersions() const;
+
+    /** Check whether a version is retained */
+    bool hasVersion(Version version) const
+    {
+        return roots_.find(version) != roots_.end();
+    }
+
+    /** Get the root hash of a version
+     *
+     * \throw `std::runtime_error` if `version` is not retained
+     */
+    MerkleTree::Buffer getRoot(Version version) const
+    {
+        return getRootDigest(version).toBuffer();
+    }
+
+    /** Get the root hash of a version, as a digest, \see above */
+    const MerkleTree::Digest& getRootDigest(Version version) const;
+
+    /** Get a leaf of a version
+     *
+     * **IMPORTANT NOTE**: `index` starts at 1, not at 0.
+     *
+     * \throw `std::runtime_error` if `version` is not retained, or if
+     *        `index` is out of range
+     */
+    const MerkleTree::Digest& getLeaf(Version version, size_t index) const;
+
+    /** Replace a leaf, creating a new version from the latest one
+     *
+     * **IMPORTANT NOTE**: `index` starts at 1, not at 0.
+     *
+     * \return The new version
+     *
+     * \throw `std::runtime_error` if `index` is out of range
+     */
+    Version updateLeaf(size_t index, const MerkleTree::Digest& element);
+
+    /** Replace several leaves, creating a single new version from the
+     * latest one
+     *
+     * As for `MerkleTree::updateLeaves()`, the last update of a leaf wins,
+     * and nodes above several updated leaves are only created once.
+     *
+     * \return The new version
+     *
+     * \throw `std::runtime_error` if an index is out of range, in which case
+     *        no version is created
+     */
+    Version updateLeaves(const MerkleTree::LeafUpdates& updates);
+
+    /** Release a version, freeing the nodes which only it uses
+     *
+     * \throw `std::runtime_error` if `version` is not retained, or if it is
+     *        the latest one
+     */
+    void releaseVersion(Version version);
+
+    /** Get proof for a given element of a version
+     *
+     * This is the same proof as `MerkleTree::getProofOrdered()` on the
+     * `MerkleTree` of the leaves of the version.
+     *
+     * **IMPORTANT NOTE**: `index` starts at 1, not at 0.
+     *
+     * \throw `std::runtime_error` if `version` is not retained, or if
+     *        `index` does not point to `element` in that version
+     */
+    MerkleTree::Elements getProofOrdered(Version version,
+            const MerkleTree::Buffer& element, size_t index) const;
+
+    /** Get proof for the leaf at a given index of a version, without
+     * allocating memory
+     *
+     * \param version  [in]  Version of the tree
+     * \param index    [in]  Index of the leaf, starting at 1
+     * \param proof    [out] Buffer to write the proof to, from lowest to
+     *                       root
+     * \param capacity [in]  Number of digests `proof` can hold;
+     *                       `MerkleTree::MAX_PROOF_LENGTH` is always enough
+     *
+     * \return The number of hashes written to `proof`
+     *
+     * \throw `std::runtime_error` if `version` is not retained, if `index`
+     *        is out of range, or if `proof` is too small
+     */
+    size_t getProof(Version version, size_t index, MerkleTree::Digest* proof,
+            size_t capacity) const;
+
+    /** Get the number of nodes used by the retained versions, leaves
+     * included */
+    size_t getNodeCount() const
+    {
+        return nodes_.size() - freeNodes_.size();
+    }
+
+    /** Get the memory held by the nodes, including free ones, in bytes */
+    size_t getMemoryUsage() const;
+
+private :
+    /** Node of the tree
+     *
+     * Leaves have no children, other nodes have two. The last node of a
+     * layer with an odd number of nodes is carried up as is, like in a
+     * `MerkleTree`: the node above it is the same node.
+     */
+    struct Node
+    {
+        MerkleTree::Digest hash;
+        uint32_t           children[2];
+        uint32_t           references;  /**< Parents and versions */
+    };
+
+    /** Nodes of all the versions, including free ones */
+    std::vector<Node> nodes_;
+
+    /** Indices of the free entries of `nodes_` */
+    std::vector<uint32_t> freeNodes_;
+
+    /** Root node of each retained version */
+    std::map<Version, uint32_t> roots_;
+
+    Version latest_;    /**< Latest version */
+    size_t leafCount_;  /**< Number of leaves */
+    size_t layerCount_; /**< Number of layers */
+
+    /** Index of no node */
+    static const uint32_t NONE = 0xffffffff;
+
+    /** Build version 0 from its leaves */
+    void build(const MerkleTree::Digests& leaves);
+
+    /** Get the root node of a version
+     *
+     * \throw `std::runtime_error` if `version` is not retained
+     */
+    uint32_t getRootNode(Version version) const;
+
+    /** Check that `count` more nodes can be allocated
+     *
+     * \throw `std::runtime_error` if there would be too many nodes
+     */
+    void checkCapacity(size_t count) const;
+
+    /** Allocate a node, with no references */
+    uint32_t newNode(const MerkleTree::Digest& hash, uint32_t left,
+            uint32_t right);
+
+    /** Go down from a root to a leaf
+     *
+     * \param root     [in]  Root node of a version
+     * \param index    [in]  Index of the leaf, starting at 0
+     * \param siblings [out] If not NULL, the hashes paired with the path of
+     *                       the leaf, from the root down; this must hold
+     *                       `MerkleTree::MAX_PROOF_LENGTH` hashes
+     * \param count    [out] Number of hashes written to `siblings`
+     *
+     * \return The node of the leaf
+     */
+    uint32_t findLeaf(uint32_t root, size_t index,
+            MerkleTree::Digest* siblings, size_t& count) const;
+
+    /** Remove a reference to a node, and free it and its descendants which
+     * are no longer referenced */
+    void release(uint32_t node);
+
+    /** Copy the path of leaves to update
+     *
+     * \param node     [in] Node to copy
+     * \param layer    [in] Layer of the node
+     * \param position [in] Position of the node in its layer
+     * \param begin    [in] First update under the node, sorted by index
+     *                      without duplicates
+     * \param end      [in] End of the updates under the node
+     *
+     * \return The updated copy of `node`
+     */
+    uint32_t update(uint32_t node, size_t layer, size_t position,
+            const std::pair<size_t, MerkleTree::Digest>* begin,
+            const std::pair<size_t, MerkleTree::Digest>* end);
+
+    // Not copyable
+    PersistentMerkleTree(const PersistentMerkleTree&);
+    PersistentMerkleTree& operator=(const PersistentMerkleTree&);
+};
+
+#endif // MERKLE_TREE_PERSISTENT_TREE_HPP_
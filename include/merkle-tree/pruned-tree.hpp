@@ -0,0 +1,253 @@
+#ifndef MERKLE_TREE_PRUNED_TREE_HPP_
+#define MERKLE_TREE_PRUNED_TREE_HPP_
+
+#include "merkle-tree/merkle-tree.hpp"
+
+/** Merkle Tree which keeps only its leaves and its top layers in memory
+ *
+ * A `MerkleTree` keeps all its layers, which roughly doubles the memory
+ * needed by the leaves alone. This one keeps the leaves and the `keptLayers`
+ * layers below and including the root; the layers in between are dropped
+ * once built. The root and the proofs are the same as those of the
+ * `MerkleTree` built from the same leaves.
+ *
+ * The lowest kept layer above the leaves is layer `getSubtreeHeight()`,
+ * whose nodes are the roots of the subtrees above blocks of
+ * `2^getSubtreeHeight()` leaves. To serve a proof, the subtree of the block
+ * of the leaf is rebuilt from its leaves, which takes one hash per leaf of
+ * the block. The last subtrees rebuilt are kept in a small cache, so proofs
+ * of nearby leaves don't rebuild them again.
+ *
+ * With `h` the subtree height, the hashes kept above the leaves take about
+ * `2^-h` times as much memory as the leaves, and a proof costs up to `2^h`
+ * hashes; `keptLayers` trades one for the other.
+ *
+ * Proofs can be generated concurrently, the cache being protected by a
+ * lock. This must not be modified concurrently with any other member
+ * function.
+ */
+class PrunedMerkleTree
+{
+public :
+    /** Default number of subtrees kept in the cache */
+    static const size_t DEFAULT_CACHED_SUBTREES = 16;
+
+    /** Constructor
+     *
+     * \param elements       [in] Elements to add to the Merkle Tree, as for
+     *                            `MerkleTree`; there must be at least one
+     * \param preserveOrder  [in] Whether to preserve the elements order, as
+     *                            for `MerkleTree`
+     * \param keptLayers     [in] Number of layers to keep above the leaves,
+     *                            including the root; all of them are kept
+     *                            if there are fewer
+     * \param cachedSubtrees [in] Number of rebuilt subtrees to cache; 0
+     *                            disables the cache
+     *
+     * \throw `std::runtime_error` if `elements` is empty, if it contains an
+     *        element which is not of the right size, or if `keptLayers` is
+     *        zero
+     */
+    PrunedMerkleTree(const MerkleTree::Elements& elements, bool preserveOrder,
+            size_t keptLayers,
+            size_t cachedSubtrees = DEFAULT_CACHED_SUBTREES);
+
+    /** Constructor from digests, \see above
+     *
+     * \throw `std::runtime_error` if `leaves` is empty, or if `keptLayers`
+     *        is zero
+     */
+    PrunedMerkleTree(const MerkleTree::Digests& leaves, bool preserveOrder,
+            size_t keptLayers,
+            size_t cachedSubtrees = DEFAULT_CACHED_SUBTREES);
+
+    /** Destructor */
+    ~PrunedMerkleTree();
+
+    /** Get the root hash of the Merkle Tree */
+    MerkleTree::Buffer getRoot() const
+    {
+        return getRootDigest().toBuffer();
+    }
+
+    /** Get the root hash of the Merkle Tree, as a digest */
+    const MerkleTree::Digest& getRootDigest() const
+    {
+        return top_.back();
+    }
+
+    /** Get the number of leaves
+     *
+     * In unordered mode, this is the number of leaves after duplicates have
+     * been removed.
+     */
+    size_t getLeafCount() const
+    {
+        return leaves_.size();
+    }
+
+    /** Get the number of layers of the full tree, including the leaves and
+     * the root */
+    size_t getLayerCount() const
+    {
+        return subtreeHeight_ + topOffsets_.size() - 1;
+    }
+
+    /** Get the number of the lowest layer kept above the leaves
+     *
+     * Proofs rebuild subtrees of this height. This is 1 if all the layers
+     * are kept, and 0 for a tree with a single leaf.
+     */
+    size_t getSubtreeHeight() const
+    {
+        return subtreeHeight_;
+    }
+
+    /** Get the leaves */
+    const MerkleTree::Digests& getLeaves() const
+    {
+        return leaves_;
+    }
+
+    /** Get the memory held by the leaves and the kept layers, in bytes
+     *
+     * This is what `MerkleTreeStats::layerBytes` accounts for this tree. The
+     * cache holds up to `cachedSubtrees` subtrees on top of that, each of
+     * them about as large as its block of leaves.
+     */
+    size_t getMemoryUsage() const;
+
+    /** Replace an element of a Merkle Tree with preserved order
+     *
+     * The subtree of the block of the leaf is rebuilt, unless it is in the
+     * cache, and then the path from its root to the root of the tree.
+     *
+     * **IMPORTANT NOTE**: `index` starts at 1, not at 0.
+     *
+     * \throw `std::runtime_error` if the Merkle Tree has been built with
+     *        `preserveOrder` set to `false`, or if `index` is out of range
+     */
+    void updateLeaf(size_t index, const MerkleTree::Digest& element);
+
+    /** Get proof for a given Merkle Tree element
+     *
+     * This is the same proof as `MerkleTree::getProof()`. Leaves are found
+     * by binary search in unordered mode, and by a linear scan otherwise:
+     * use `getProofOrdered()` for trees with preserved order.
+     *
+     * \throw `std::runtime_error` if `element` is not a leaf
+     */
+    MerkleTree::Elements getProof(const MerkleTree::Buffer& element) const;
+
+    /** Get proof for a given element of a Merkle Tree with preserved order
+     *
+     * This is the same proof as `MerkleTree::getProofOrdered()`.
+     *
+     * **IMPORTANT NOTE**: `index` starts at 1, not at 0.
+     *
+     * \throw `std::runtime_error` if `index` does not point to `element`
+     */
+    MerkleTree::Elements getProofOrdered(const MerkleTree::Buffer& element,
+            size_t index) const;
+
+    /** Get proof for the leaf at a given index, without allocating memory
+     * unless the subtree of the leaf has to be rebuilt
+     *
+     * \param index    [in]  Index of the leaf, starting at 1
+     * \param proof    [out] Buffer to write the proof to, from lowest to
+     *                       root
+     * \param capacity [in]  Number of digests `proof` can hold;
+     *                       `MerkleTree::MAX_PROOF_LENGTH` is always enough
+     *
+     * \return The number of hashes written to `proof`
+     *
+     * \throw `std::runtime_error` if `index` is out of range, or if `proof`
+     *        is too small
+     */
+    size_t getProof(size_t index, MerkleTree::Digest* proof,
+            size_t capacity) const;
+
+private :
+    /** Cache of rebuilt subtrees */
+    class Cache;
+
+    /** Task building the roots of groups of blocks in parallel */
+    class BlockRootsTask;
+
+    bool preserveOrder_; /**< Whether to preserve the initial order */
+
+    /** Leaves, sorted and without duplicates in unordered mode */
+    MerkleTree::Digests leaves_;
+
+    /** Number of the lowest kept layer above the leaves */
+    size_t subtreeHeight_;
+
+    /** Kept layers, from layer `subtreeHeight_` up to the root, one after
+     * the other */
+    MerkleTree::Digests top_;
+
+    /** Index in `top_` of the first hash of each kept layer, plus the total
+     * number of hashes */
+    std::vector<uint64_t> topOffsets_;
+
+    /** Cache of rebuilt subtrees, or NULL if disabled */
+    Cache* cache_;
+
+    /** Build the kept layers from the leaves */
+    void build(size_t keptLayers, size_t cachedSubtrees);
+
+    /** Get the size of a kept layer
+     *
+     * \param layer [in] Layer number in the full tree
+     */
+    size_t getTopSize(size_t layer) const
+    {
+        layer -= subtreeHeight_;
+        return topOffsets_[layer + 1] - topOffsets_[layer];
+    }
+
+    /** Get the hashes of a kept layer
+     *
+     * \param layer [in] Layer number in the full tree
+     */
+    MerkleTree::Digest* getTop(size_t layer)
+    {
+        return &top_[topOffsets_[layer - subtreeHeight_]];
+    }
+
+    /** Get the hashes of a kept layer, \see above */
+    const MerkleTree::Digest* getTop(size_t layer) const
+    {
+        return &top_[topOffsets_[layer - subtreeHeight_]];
+    }
+
+    /** Get the number of leaves of a block */
+    size_t getBlockSize(size_t block) const;
+
+    /** Get the number of hashes of the subtree above a block, leaves
+     * excluded */
+    size_t getSubtreeSize(size_t block) const;
+
+    /** Build the subtree above a block of leaves
+     *
+     * \param block [in]  Block number
+     * \param nodes [out] Layers 1 to `subtreeHeight_` of the subtree, one
+     *                    after the other; this must hold
+     *                    `getSubtreeSize(block)` hashes
+     */
+    void buildSubtree(size_t block, MerkleTree::Digest* nodes) const;
+
+    /** Rebuild the subtree above a block of leaves, to serve a proof or an
+     * update, and cache it
+     *
+     * \param block [in]  Block number
+     * \param nodes [out] The subtree, \see buildSubtree()
+     */
+    void rebuildSubtree(size_t block, MerkleTree::Digests& nodes) const;
+
+    // Not copyable
+    PrunedMerkleTree(const PrunedMerkleTree&);
+    PrunedMerkleTree& operator=(const PrunedMerkleTree&);
+};
+
+#endif // MERKLE_TREE_PRUNED_TREE_HPP_
@@ -0,0 +1,116 @@
+#ifndef MERKLE_TREE_ROOT_BUILDER_HPP_
+#define MERKLE_TREE_ROOT_BUILDER_HPP_
+
+#include "merkle-tree/merkle-tree.hpp"
+
+/** Streaming computation of a Merkle Tree root hash
+ *
+ * Leaves are added one at a time or in batches, and the root is the same as
+ * the one `MerkleTree::merkleRoot()` would return for all the leaves added
+ * so far. Only the roots of the complete subtrees built so far are kept
+ * (one per bit set in the number of leaves), so the memory used is O(log n)
+ * whatever the number of leaves.
+ *
+ * In unordered mode, `MerkleTree` sorts the leaves and removes duplicates,
+ * which can't be done on a stream. The leaves must then be added in
+ * increasing order; a leaf equal to the previous one is ignored, like a
+ * duplicate would be.
+ */
+class MerkleRootBuilder
+{
+public :
+    /** Constructor
+     *
+     * \param preserveOrder [in] Whether the root is computed like for a
+     *                           `MerkleTree` with preserved order
+     */
+    explicit MerkleRootBuilder(bool preserveOrder);
+
+    /** Add a leaf
+     *
+     * \param element [in] Leaf to add; empty elements are ignored, like
+     *                     `MerkleTree` does
+     *
+     * \throw `std::runtime_error` if `element` is not of the right size,
+     *        \see MERKLE_TREE_ELEMENT_SIZE_B.
+     *
+     * \throw `std::runtime_error` in unordered mode, if `element` is lower
+     *        than the previous leaf
+     */
+    void add(const MerkleTree::Buffer& element);
+
+    /** Add a leaf
+     *
+     * \param leaf [in] Leaf to add
+     *
+     * \throw `std::runtime_error` in unordered mode, if `leaf` is lower than
+     *        the previous leaf
+     */
+    void add(const MerkleTree::Digest& leaf);
+
+    /** Add several leaves
+     *
+     * This is faster than adding the leaves one by one: whole blocks of
+     * leaves are reduced with the multi-buffer hashing engine.
+     *
+     * \param leaves [in] Leaves to add, in order
+     * \param count  [in] Number of leaves
+     *
+     * \throw `std::runtime_error` in unordered mode, if the leaves are not
+     *        in increasing order; the leaves before the offending one have
+     *        been added
+     */
+    void add(const MerkleTree::Digest* leaves, size_t count);
+
+    /** Get the number of leaves added so far
+     *
+     * In unordered mode, duplicates are not counted.
+     */
+    uint64_t getLeafCount() const
+    {
+        return leafCount_;
+    }
+
+    /** Get the root hash of the leaves added so far
+     *
+     * \throw `std::runtime_error` if no leaf has been added
+     */
+    MerkleTree::Buffer getRoot() const
+    {
+        return getRootDigest().toBuffer();
+    }
+
+    /** Get the root hash of the leaves added so far, as a digest
+     *
+     * \throw `std::runtime_error` if no leaf has been added
+     */
+    MerkleTree::Digest getRootDigest() const;
+
+    /** Forget all the leaves added so far */
+    void reset();
+
+private :
+    bool     preserveOrder_; /**< Whether to preserve the leaves order */
+    uint64_t leafCount_;     /**< Number of leaves added so far */
+
+    /** Roots of the complete subtrees, biggest (i.e. leftmost) first
+     *
+     * There is one per bit set in `leafCount_`: the subtree for bit `i` has
+     * `2^i` leaves.
+     */
+    MerkleTree::Digests peaks_;
+
+    /** Last leaf added, to check the order in unordered mode */
+    MerkleTree::Digest last_;
+
+    /** Add leaves without checking their order */
+    void addRun(const MerkleTree::Digest* leaves, size_t count);
+
+    /** Add the root of a complete subtree of `2^height` leaves
+     *
+     * `leafCount_` must be a multiple of `2^height`.
+     */
+    void addPeak(const MerkleTree::Digest& peak, size_t height);
+};
+
+#endif // MERKLE_TREE_ROOT_BUILDER_HPP_
@@ -0,0 +1,199 @@
+#ifndef MERKLE_TREE_SEARCH_TREE_HPP_
+#define MERKLE_TREE_SEARCH_TREE_HPP_
+
+#include "merkle-tree/merkle-tree.hpp"
+
+/** Authenticated sorted set of 16-byte keys, with O(log n) updates
+ *
+ * In a `MerkleTree` with sorted leaves, inserting or removing an element
+ * moves all the leaves after it, and the whole tree has to be rebuilt. This
+ * is instead a binary search tree where every node holds a key, and is
+ * hashed with the hashes of its two subtrees: the hash of a node is the
+ * 16-byte BLAKE2b hash of the hash of its left subtree, its key and the
+ * hash of its right subtree, 48 bytes in all; an empty subtree hashes to
+ * all zeros. Inserting or removing a key only rehashes the nodes on its
+ * path, i.e. O(log n) nodes.
+ *
+ * The tree is a treap: each key has a priority, derived from the hash of
+ * the key, and a node has a greater priority than its children. The shape
+ * of the tree, and so its root hash, only depends on the set of keys, not
+ * on the order in which they have been inserted and removed; its expected
+ * depth is about `2 ln n`.
+ *
+ * A proof holds the nodes on the path followed when searching for a key,
+ * from the root down, each one with the hash of its subtree the search does
+ * not go into. The verifier follows the same path by comparing the key with
+ * the keys of these nodes, so the proof either ends at the node of the key,
+ * proving it is present, or at an empty subtree, proving it is absent.
+ *
+ * This must not be modified concurrently with any other member function.
+ */
+class MerkleSearchTree
+{
+public :
+    /** Key of the set, typically the hash of the actual data */
+    typedef MerkleTree::Digest Key;
+
+    /** List of keys */
+    typedef MerkleTree::Digests Keys;
+
+    /** Proof that a key is in the set, or that it is not */
+    struct Proof
+    {
+        /** Node on the search path of the key */
+        struct Step
+        {
+            Key                key;     /**< Key of the node */
+            MerkleTree::Digest sibling; /**< Hash of the other subtree */
+        };
+
+        /** Nodes on the search path of the key, from the root down, not
+         * including the node of the key itself */
+        std::vector<Step> steps;
+
+        /** If the key is present, hashes of the left and right subtrees of
+         * its node; otherwise, unused */
+        MerkleTree::Digest children[2];
+    };
+
+    /** Constructor; the set is initially empty */
+    MerkleSearchTree();
+
+    /** Constructor from keys
+     *
+     * This takes O(n log n) time to sort the keys, and then builds the tree
+     * in O(n) time. Duplicates are removed.
+     *
+     * \param keys [in] Keys of the set, in any order
+     */
+    explicit MerkleSearchTree(const Keys& keys);
+
+    /** Get the root hash of the tree */
+    MerkleTree::Buffer getRoot() const
+    {
+        return getRootDigest().toBuffer();
+    }
+
+    /** Get the root hash of the tree, as a digest; it is all zeros for an
+     * empty set */
+    const MerkleTree::Digest& getRootDigest() const;
+
+    /** Get the number of keys */
+    size_t getKeyCount() const
+    {
+        return keyCount_;
+    }
+
+    /** Get the depth of the tree, i.e. the number of nodes on its longest
+     * path; this takes O(n) time */
+    size_t getDepth() const;
+
+    /** Check whether a key is in the set */
+    bool contains(const Key& key) const;
+
+    /** Add a key
+     *
+     * \return `true` if added, `false` if it was already there
+     */
+    bool insert(const Key& key);
+
+    /** Remove a key
+     *
+     * \return `true` if removed, `false` if it was not there
+     */
+    bool erase(const Key& key);
+
+    /** Get the keys, in increasing order */
+    Keys getKeys() const;
+
+    /** Get a proof for a key
+     *
+     * This is a membership proof if `key` is present, to be checked with
+     * `checkProof()`, or a non-membership proof otherwise, to be checked
+     * with `checkExclusionProof()`.
+     */
+    Proof getProof(const Key& key) const;
+
+    /** Check that a key is in the set
+     *
+     * \param proof [in] Proof to check
+     * \param root  [in] Root hash of the tree
+     * \param key   [in] Key which is supposed to be present
+     *
+     * \return `true` if `proof` is valid, `false` if not
+     */
+    static bool checkProof(const Proof& proof, const MerkleTree::Digest& root,
+            const Key& key);
+
+    /** Check that a key is not in the set
+     *
+     * \param proof [in] Proof to check
+     * \param root  [in] Root hash of the tree
+     * \param key   [in] Key which is supposed to be absent
+     *
+     * \return `true` if `proof` is valid, `false` if not
+     */
+    static bool checkExclusionProof(const Proof& proof,
+            const MerkleTree::Digest& root, const Key& key);
+
+private :
+    /** Node of the tree */
+    struct Node
+    {
+        Key                key;
+        MerkleTree::Digest hash;        /**< Hash of the subtree */
+        uint64_t           priority;    /**< Derived from the key */
+        uint32_t           children[2]; /**< Left and right children */
+    };
+
+    /** Nodes of the tree, including free ones */
+    std::vector<Node> nodes_;
+
+    /** Indices of the free entries of `nodes_` */
+    std::vector<uint32_t> freeNodes_;
+
+    /** Index of the root node, or `NONE` if the set is empty */
+    uint32_t root_;
+
+    /** Number of keys */
+    size_t keyCount_;
+
+    /** Index of no node */
+    static const uint32_t NONE = 0xffffffff;
+
+    /** Allocate a node for a key, without children */
+    uint32_t newNode(const Key& key);
+
+    /** Whether `a` must be above `b` in the tree */
+    bool isAbove(uint32_t a, uint32_t b) const;
+
+    /** Get the hash of a subtree, all zeros if `node` is `NONE` */
+    const MerkleTree::Digest& getHash(uint32_t node) const;
+
+    /** Recompute the hash of a node from its children */
+    void rehash(uint32_t node);
+
+    /** Make a node the child of another one, or the root
+     *
+     * \param parent [in] Parent node, or `NONE` to make `child` the root
+     * \param side   [in] 0 for the left child, 1 for the right one
+     * \param child  [in] New child
+     */
+    void setChild(uint32_t parent, size_t side, uint32_t child);
+
+    /** Rehash the nodes of a path, from the bottom up */
+    void rehashPath(const std::vector<uint32_t>& path);
+
+    /** Split a subtree into the keys lower than `key`, and the others */
+    void split(uint32_t node, const Key& key, uint32_t& lower,
+            uint32_t& upper);
+
+    /** Join two subtrees, all the keys of `lower` being lower than those of
+     * `upper`
+     *
+     * \return The root of the joined subtree
+     */
+    uint32_t join(uint32_t lower, uint32_t upper);
+};
+
+#endif // MERKLE_TREE_SEARCH_TREE_HPP_
@@ -0,0 +1,272 @@
+#ifndef MERKLE_TREE_SPARSE_TREE_HPP_
+#define MERKLE_TREE_SPARSE_TREE_HPP_
+
+#include "merkle-tree/merkle-tree.hpp"
+#include <utility>
+
+/** Sparse Merkle Tree over all the 16-byte keys
+ *
+ * This is a Merkle Tree with a leaf for each of the 2^128 possible keys,
+ * the leaf of a key being the digest of its value. Leaves of absent keys
+ * are all zeros, so the hash of an empty subtree only depends on its depth;
+ * these default hashes are computed once for every depth. Nodes are hashed
+ * with `MerkleTree::combinedHash()`, in preserved order, so the path from
+ * the root to a leaf is given by the bits of its key, most significant bit
+ * first: a bit set to 1 goes right.
+ *
+ * Only the non-empty part of the tree is stored, as a binary trie of the
+ * keys present: a leaf per key, and a branch wherever two keys part ways.
+ * The hashes of the single-child chains between them are folded into the
+ * branches, so memory is O(n) and serving a proof for a present key takes
+ * no hashing at all.
+ *
+ * Updates are applied in batches, and each node touched by a batch is
+ * rehashed only once.
+ *
+ * This must not be modified concurrently with any other member function.
+ */
+class SparseMerkleTree
+{
+public :
+    /** Number of bits in a key, and depth of the leaves */
+    static const size_t DEPTH = 8 * MERKLE_TREE_ELEMENT_SIZE_B;
+
+    /** Key of a leaf */
+    typedef MerkleTree::Digest Key;
+
+    /** Value of a leaf, typically the hash of the actual data */
+    typedef MerkleTree::Digest Value;
+
+    /** List of keys */
+    typedef MerkleTree::Digests Keys;
+
+    /** List of keys and their values */
+    typedef std::vector<std::pair<Key, Value> > Entries;
+
+    /** Proof that a key has a given value, or is absent
+     *
+     * A proof holds the sibling of each node on the path from the leaf up to
+     * the root, except for the siblings which are empty subtrees: the
+     * verifier knows their default hash, so the proof only says which ones
+     * they are.
+     */
+    struct Proof
+    {
+        /** Which siblings are in `siblings`
+         *
+         * Bit `d - 1` (i.e. bit `(d - 1) % 64` of `bitmap[(d - 1) / 64]`)
+         * is set if the sibling at depth `d` is in `siblings`, and clear if
+         * it is an empty subtree.
+         */
+        uint64_t bitmap[2];
+
+        /** Siblings which are not empty subtrees, from the leaf up */
+        MerkleTree::Digests siblings;
+    };
+
+    /** Constructor; the tree is initially empty */
+    SparseMerkleTree();
+
+    /** Get the value of an empty leaf, i.e. all zeros */
+    static const Value& getEmptyValue();
+
+    /** Get the hash of an empty subtree
+     *
+     * \param depth [in] Depth of the root of the subtree; 0 is the root of
+     *                   the tree, `DEPTH` a leaf
+     *
+     * \throw `std::runtime_error` if `depth` is greater than `DEPTH`
+     */
+    static const MerkleTree::Digest& getDefaultHash(size_t depth);
+
+    /** Get the root hash of the Sparse Merkle Tree */
+    MerkleTree::Buffer getRoot() const
+    {
+        return rootHash_.toBuffer();
+    }
+
+    /** Get the root hash of the Sparse Merkle Tree, as a digest */
+    const MerkleTree::Digest& getRootDigest() const
+    {
+        return rootHash_;
+    }
+
+    /** Get the number of keys present */
+    size_t getLeafCount() const
+    {
+        return leafCount_;
+    }
+
+    /** Get the value of a key
+     *
+     * \param key   [in]  Key to look up
+     * \param value [out] Value of `key`, if present
+     *
+     * \return `true` if `key` is present, `false` if not
+     */
+    bool find(const Key& key, Value& value) const;
+
+    /** Set the value of a key
+     *
+     * \throw `std::runtime_error` if `value` is the empty value, which
+     *        would make the key indistinguishable from an absent one; use
+     *        `erase()` instead
+     */
+    void insert(const Key& key, const Value& value);
+
+    /** Set the values of several keys at once
+     *
+     * If a key is given several times, the last value is used. Nothing is
+     * modified if an exception is thrown.
+     *
+     * \throw `std::runtime_error` if any value is the empty value
+     */
+    void insert(const Entries& entries);
+
+    /** Remove a key; nothing happens if it is absent */
+    void erase(const Key& key);
+
+    /** Remove several keys at once; absent keys are ignored */
+    void erase(const Keys& keys);
+
+    /** Get a proof for a key
+     *
+     * This is an inclusion proof if `key` is present, to be checked against
+     * its value, or an exclusion proof otherwise, to be checked against the
+     * empty value.
+     */
+    Proof getProof(const Key& key) const;
+
+    /** Check a proof
+     *
+     * \param proof [in] Proof to check
+     * \param root  [in] Root hash of the Sparse Merkle Tree
+     * \param key   [in] Key for which the proof is checked
+     * \param value [in] Value of `key`; the empty value to check that `key`
+     *                   is absent
+     *
+     * \return `true` if `proof` is valid, `false` if not
+     */
+    static bool checkProof(const Proof& proof, const MerkleTree::Digest& root,
+            const Key& key, const Value& value);
+
+    /** Check that a key is absent
+     *
+     * This is `checkProof()` with the empty value.
+     */
+    static bool checkExclusionProof(const Proof& proof,
+            const MerkleTree::Digest& root, const Key& key)
+    {
+        return checkProof(proof, root, key, getEmptyValue());
+    }
+
+private :
+    /** Node of the trie of present keys */
+    struct Node
+    {
+        /** Key of the leaf; for a branch, key of any leaf below it, of which
+         * only the first `depth` bits matter */
+        Key key;
+
+        /** `DEPTH` for a leaf; for a branch, its depth in the tree: its two
+         * children differ on bit `depth` of their keys */
+        size_t depth;
+
+        /** Left and right children of a branch */
+        size_t children[2];
+
+        /** For a leaf, `hashes[0]` is its value; for a branch, the hashes
+         * of its left and right subtrees, at depth `depth + 1` */
+        MerkleTree::Digest hashes[2];
+    };
+
+    /** Update of a key */
+    struct Change
+    {
+        Key   key;
+        Value value;  /**< New value, or the empty value to remove `key` */
+
+        bool operator<(const Change& other) const
+        {
+            return key < other.key;
+        }
+    };
+
+    /** Nodes of the trie, including free ones */
+    std::vector<Node> nodes_;
+
+    /** Indices of the free entries of `nodes_` */
+    std::vector<size_t> freeNodes_;
+
+    /** Index of the root node of the trie, or `NONE` if the tree is empty */
+    size_t root_;
+
+    /** Number of keys present */
+    size_t leafCount_;
+
+    /** Root hash of the tree */
+    MerkleTree::Digest rootHash_;
+
+    /** Index of no node */
+    static const size_t NONE = static_cast<size_t>(-1);
+
+    /** Apply changes given in the order they have been made; `changes` is
+     * sorted by key in the process */
+    void apply(std::vector<Change>& changes);
+
+    /** Apply changes to a subtree
+     *
+     * \param node  [in] Root node of the subtree, or `NONE` if empty; the
+     *                   keys of `changes` must be in the subtree just above
+     *                   `node`, i.e. share with it the bits above its parent
+     * \param first [in] First change, sorted by key without duplicates
+     * \param last  [in] Change after the last one
+     *
+     * \return The new root node of the subtree, or `NONE` if now empty
+     */
+    size_t apply(size_t node, const Change* first, const Change* last);
+
+    /** Apply changes to an empty subtree, or to a subtree with a single leaf
+     *
+     * \param first [in] First change, sorted by key without duplicates
+     * \param last  [in] Change after the last one
+     * \param leaf  [in] The leaf of the subtree, or `NONE` if empty
+     *
+     * \return The new root node of the subtree, or `NONE` if now empty
+     */
+    size_t merge(const Change* first, const Change* last, size_t leaf);
+
+    /** Build the trie of the given leaves
+     *
+     * \param first [in] First leaf, sorted by key without duplicates; there
+     *                   must be at least one, and none is the empty value
+     * \param last  [in] Leaf after the last one
+     *
+     * \return The root node of the new trie
+     */
+    size_t build(const Change* first, const Change* last);
+
+    /** Allocate a node */
+    size_t newNode();
+
+    /** Free a node */
+    void freeNode(size_t node);
+
+    /** Create a branch above two subtrees
+     *
+     * \param depth [in] Depth of the branch
+     * \param left  [in] Left subtree, whose keys have bit `depth` clear
+     * \param right [in] Right subtree, whose keys have bit `depth` set
+     */
+    size_t newBranch(size_t depth, size_t left, size_t right);
+
+    /** Get the hash of a subtree at a depth above its root node
+     *
+     * \param node  [in] Root node of the subtree
+     * \param depth [in] Depth at which the hash is wanted, at most the depth
+     *                   of `node`
+     */
+    MerkleTree::Digest getHash(size_t node, size_t depth) const;
+};
+
+#endif // MERKLE_TREE_SPARSE_TREE_HPP_
@@ -0,0 +1,95 @@
+#ifndef MERKLE_TREE_STATS_HPP_
+#define MERKLE_TREE_STATS_HPP_
+
+extern "C" {
+#include <stdint.h>
+}
+
+#include <cstddef>
+
+/** Number of layers timed separately by `MerkleTreeStats::layerNanoseconds`
+ *
+ * This is the deepest a tree can be, as proofs can't be longer than
+ * `MerkleTree::MAX_PROOF_LENGTH` hashes.
+ */
+#define MERKLE_TREE_STATS_LAYERS 64
+
+/** Counters of the work done by the Merkle Tree library
+ *
+ * Each thread updates its own counters, without any synchronization, so
+ * keeping them costs a few instructions per event. They can be sampled at
+ * any time, for the calling thread with `getThread()` or summed over all
+ * threads with `getTotal()`; the difference between two samples is the
+ * work done in between. Counters never decrease, except `layerBytes`.
+ *
+ * Statistics are collected only if the library has been built with the
+ * `MERKLE_TREE_STATS` cmake option (the default); otherwise, the code
+ * updating them is compiled out, and all the counters stay at zero.
+ */
+struct MerkleTreeStats
+{
+    /** Whether the library has been built with statistics */
+    static const bool ENABLED;
+
+    /** Number of calls to the compression function of the hash */
+    uint64_t compressions;
+
+    /** Number of bytes hashed, including the digests combined in pairs */
+    uint64_t bytesHashed;
+
+    /** Time spent building each layer of a tree, in nanoseconds
+     *
+     * Entry `i` is for layer `i`, the leaves being layer 0, so entry 0
+     * stays at zero. When the bottom layers of a large tree are built in
+     * parallel as independent subtrees, the time taken by all of them is
+     * accounted to the highest of these layers.
+     */
+    uint64_t layerNanoseconds[MERKLE_TREE_STATS_LAYERS];
+
+    /** Number of proofs generated, a proof for several elements counting
+     * as one */
+    uint64_t proofsGenerated;
+
+    /** Number of proofs checked, whether they are valid or not */
+    uint64_t proofsVerified;
+
+    /** Number of elements looked up in the leaves of a tree */
+    uint64_t leafLookups;
+
+    /** Number of elements looked up and not found in the leaves of a tree */
+    uint64_t leafLookupMisses;
+
+    /** Number of subtrees rebuilt by `PrunedMerkleTree` to serve proofs or
+     * updates, cache hits excluded */
+    uint64_t subtreesRebuilt;
+
+    /** Memory held by the layers and leaf index of in-memory trees, in bytes
+     *
+     * This is updated by the thread that builds or destroys a tree, so the
+     * value for a single thread may be negative; the total over all threads
+     * is the memory held by the trees in existence.
+     */
+    int64_t layerBytes;
+
+    /** Constructor; sets all the counters to zero */
+    MerkleTreeStats();
+
+    /** Add the counters of `other` to these ones */
+    MerkleTreeStats& operator+=(const MerkleTreeStats& other);
+
+    /** Subtract the counters of `other` from these ones */
+    MerkleTreeStats& operator-=(const MerkleTreeStats& other);
+
+    /** Get the counters of the calling thread */
+    static MerkleTreeStats getThread();
+
+    /** Get the sum of the counters of all the threads
+     *
+     * This includes the threads that have exited. The counters of threads
+     * still running are read while they may be updated, so they may miss
+     * the latest events.
+     */
+    static MerkleTreeStats getTotal();
+};
+
+#endif // MERKLE_TREE_STATS_HPP_
@@ -0,0 +1,166 @@
+#ifndef MERKLE_TREE_TREE_DIFF_HPP_
+#define MERKLE_TREE_TREE_DIFF_HPP_
+
+#include "merkle-tree/merkle-tree.hpp"
+#include "merkle-tree/mapped-tree.hpp"
+
+/** Search of the leaves that differ between two Merkle Trees
+ *
+ * The two trees must have the same shape, i.e. the same number of leaves.
+ * They are walked from the root down, one layer at a time, looking only
+ * at the children of the nodes that differ; finding `k` differing leaves
+ * among `n` thus takes O(k log n) time.
+ *
+ * The other tree may be in another process. The search is then a dialog:
+ * this side sends `getRequest()` to the other side, which answers it with
+ * `answer()`, and the response is given back with `addResponse()`, until
+ * `isDone()`. Requests and responses only hold the hashes needed, and can
+ * be serialized to be sent over the network.
+ *
+ * This works with `MerkleTree` and `MappedMerkleTree`, in any combination;
+ * the tree given to the constructor must outlive this object.
+ */
+class MerkleTreeDiff
+{
+public :
+    /** Range of consecutive leaves */
+    struct LeafRange
+    {
+        /** Index of the first leaf
+         *
+         * **IMPORTANT NOTE**: indices start at 1, like for
+         *                     `MerkleTree::getProofOrdered()`.
+         */
+        size_t first;
+
+        size_t count; /**< Number of leaves */
+    };
+
+    /** List of leaf ranges */
+    typedef std::vector<LeafRange> LeafRanges;
+
+    /** Range of consecutive nodes of a layer */
+    struct NodeRange
+    {
+        uint32_t layer; /**< Layer number; 0 is the leaves */
+        uint64_t first; /**< Index of the first node in its layer, from 0 */
+        uint64_t count; /**< Number of nodes */
+    };
+
+    /** Request for the hashes of some nodes */
+    struct Request
+    {
+        std::vector<NodeRange> ranges; /**< Nodes to get */
+
+        /** Serialize this request, in a format which does not depend on
+         * the host */
+        MerkleTree::Buffer serialize() const;
+
+        /** Parse a serialized request
+         *
+         * \throw `std::runtime_error` if `data` is not a valid request
+         */
+        static Request parse(const MerkleTree::Buffer& data);
+    };
+
+    /** Response to a `Request` */
+    struct Response
+    {
+        /** Number of leaves of the tree */
+        uint64_t leafCount;
+
+        /** Hashes of the nodes requested, in the order requested */
+        MerkleTree::Digests hashes;
+
+        /** Serialize this response, in a format which does not depend on
+         * the host */
+        MerkleTree::Buffer serialize() const;
+
+        /** Parse a serialized response
+         *
+         * \throw `std::runtime_error` if `data` is not a valid response
+         */
+        static Response parse(const MerkleTree::Buffer& data);
+    };
+
+    /** Constructor
+     *
+     * \param local [in] Tree on this side
+     */
+    explicit MerkleTreeDiff(const MerkleTree& local);
+
+    /** Constructor
+     *
+     * \param local [in] Tree on this side
+     */
+    explicit MerkleTreeDiff(const MappedMerkleTree& local);
+
+    /** Get the request to send to the other side
+     *
+     * The first one asks for the root. This must not be called once
+     * `isDone()`.
+     */
+    const Request& getRequest() const
+    {
+        return request_;
+    }
+
+    /** Process the response of the other side to `getRequest()`
+     *
+     * \throw `std::runtime_error` if the other tree has a different shape,
+     *        if `response` does not match the request, or if `isDone()`
+     */
+    void addResponse(const Response& response);
+
+    /** Whether the search is finished */
+    bool isDone() const
+    {
+        return done_;
+    }
+
+    /** Get the differing leaves, in increasing order
+     *
+     * This is only complete once `isDone()`.
+     */
+    const LeafRanges& getDifferences() const
+    {
+        return differences_;
+    }
+
+    /** Answer a request from the other side
+     *
+     * \param tree    [in] Tree on this side
+     * \param request [in] Request received
+     *
+     * \throw `std::runtime_error` if `request` asks for nodes which are not
+     *        in `tree`
+     */
+    static Response answer(const MerkleTree& tree, const Request& request);
+
+    /** Answer a request from the other side, \see answer() */
+    static Response answer(const MappedMerkleTree& tree,
+            const Request& request);
+
+    /** Find the leaves that differ between two trees in this process
+     *
+     * \throw `std::runtime_error` if the trees have different shapes
+     */
+    static LeafRanges compare(const MerkleTree& a, const MerkleTree& b);
+
+private :
+    /** Hashes of each layer of the local tree */
+    std::vector<const MerkleTree::Digest*> layers_;
+
+    /** Size of each layer of the local tree */
+    std::vector<size_t> layerSizes_;
+
+    Request    request_;     /**< Next request to send */
+    LeafRanges differences_; /**< Differing leaves found so far */
+    bool       done_;        /**< Whether the search is finished */
+
+    /** Remember the layers of the local tree, and ask for the root */
+    template <class Tree>
+    void start(const Tree& local);
+};
+
+#endif // MERKLE_TREE_TREE_DIFF_HPP_
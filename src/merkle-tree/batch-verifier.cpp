@@ -0,0 +1,153 @@
+#include "merkle-tree/batch-verifier.hpp"
+#include <algorithm>
+#include "hash-policy.hpp"
+#include "proof-path.hpp"
+
+namespace {
+
+/** Slot of a pair of digests in a hash table of `mask + 1` slots */
+inline size_t slotOf(const uint8_t* left, const uint8_t* right, size_t mask)
+{
+    uint64_t a;
+    uint64_t b;
+    std::memcpy(&a, left, sizeof(a));
+    std::memcpy(&b, right, sizeof(b));
+    uint64_t h = (a ^ (b * 0xff51afd7ed558ccdULL)) * 0x9e3779b97f4a7c15ULL;
+    h ^= h >> 32;
+    return static_cast<size_t>(h) & mask;
+}
+
+} // namespace
+
+MerkleBatchVerifier::MerkleBatchVerifier(bool preserveOrder)
+    : preserveOrder_(preserveOrder)
+{
+}
+
+size_t MerkleBatchVerifier::add(const MerkleTree::Elements& proof,
+        const MerkleTree::Buffer& root, const MerkleTree::Buffer& element,
+        size_t index)
+{
+    Entry entry;
+    entry.first = hashes_.size();
+    entry.length = 0;
+    entry.index = index - 1;
+    entry.valid = (root.size() == MERKLE_TREE_ELEMENT_SIZE_B)
+        && (element.size() == MERKLE_TREE_ELEMENT_SIZE_B)
+        && (!preserveOrder_ || (index > 0));
+    for (   MerkleTree::Elements::const_iterator it = proof.begin();
+            entry.valid && (it != proof.end());
+            ++it) {
+        entry.valid = (it->size() == MERKLE_TREE_ELEMENT_SIZE_B);
+    }
+
+    MerkleTree::Digest zero;
+    std::memset(zero.bytes, 0, sizeof(zero.bytes));
+    if (entry.valid) {
+        for (   MerkleTree::Elements::const_iterator it = proof.begin();
+                it != proof.end();
+                ++it) {
+            hashes_.push_back(MerkleTree::Digest::fromBuffer(*it));
+        }
+        entry.length = proof.size();
+        elements_.push_back(MerkleTree::Digest::fromBuffer(element));
+        roots_.push_back(MerkleTree::Digest::fromBuffer(root));
+    } else {
+        elements_.push_back(zero);
+        roots_.push_back(zero);
+    }
+    entries_.push_back(entry);
+    return entries_.size() - 1;
+}
+
+std::vector<bool> MerkleBatchVerifier::verify() const
+{
+    const size_t count = entries_.size();
+    MerkleTree::Digests current(elements_);
+    std::vector<size_t> indices(count);
+    size_t steps = 0;
+    for (size_t i = 0; i < count; ++i) {
+        indices[i] = entries_[i].index;
+        steps = std::max(steps, entries_[i].length);
+    }
+
+    // Step `s` of all the proofs that have that many steps
+    std::vector<size_t> active;
+    std::vector<const uint8_t*> left;
+    std::vector<const uint8_t*> right;
+    std::vector<size_t> messages; // message hashed for each active proof
+    std::vector<size_t> slots;    // message plus one, or 0 if empty
+    MerkleTree::Digests outputs;
+    for (size_t s = 0; s < steps; ++s) {
+        active.clear();
+        for (size_t i = 0; i < count; ++i) {
+            if (entries_[i].length > s) {
+                active.push_back(i);
+            }
+        }
+        size_t size = 1;
+        while (size < 2 * active.size()) {
+            size <<= 1;
+        }
+        slots.assign(size, 0);
+        const size_t mask = size - 1;
+
+        // Collect the messages to hash, each one only once
+        left.clear();
+        right.clear();
+        messages.clear();
+        for (size_t k = 0; k < active.size(); ++k) {
+            const Entry& entry = entries_[active[k]];
+            const uint8_t* a = current[active[k]].bytes;
+            const uint8_t* b = hashes_[entry.first + s].bytes;
+            if (preserveOrder_) {
+                if (orderedProofStep(indices[active[k]], entry.length - s)) {
+                    std::swap(a, b);
+                }
+            } else if (std::memcmp(a, b, MERKLE_TREE_ELEMENT_SIZE_B) <= 0) {
+                std::swap(a, b);
+            }
+
+            size_t slot = slotOf(a, b, mask);
+            for ( ; slots[slot] != 0; slot = (slot + 1) & mask) {
+                const size_t m = slots[slot] - 1;
+                if (    (std::memcmp(left[m], a, MERKLE_TREE_ELEMENT_SIZE_B) == 0)
+                     && (std::memcmp(right[m], b, MERKLE_TREE_ELEMENT_SIZE_B) == 0)) {
+                    break; // already there
+                }
+            }
+            if (slots[slot] == 0) {
+                left.push_back(a);
+                right.push_back(b);
+                slots[slot] = left.size();
+            }
+            messages.push_back(slots[slot] - 1);
+        }
+
+        // NB: `left` and `right` may point into `current`, so hash into a
+        // separate buffer first
+        outputs.resize(left.size());
+        if (!left.empty()) {
+            MerkleTree::Hash::hashPairs(outputs[0].bytes, &left[0], &right[0],
+                    MERKLE_TREE_ELEMENT_SIZE_B, left.size());
+        }
+        for (size_t k = 0; k < active.size(); ++k) {
+            current[active[k]] = outputs[messages[k]];
+        }
+    }
+
+    MERKLE_TREE_STATS_ADD(proofsVerified, count);
+    std::vector<bool> results(count);
+    for (size_t i = 0; i < count; ++i) {
+        results[i] = entries_[i].valid && (current[i] == roots_[i]);
+    }
+    return results;
+}
+
+void MerkleBatchVerifier::clear()
+{
+    entries_.clear();
+    elements_.clear();
+    roots_.clear();
+    hashes_.clear();
+}
@@ -0,0 +1,94 @@
+/*
+   BLAKE2b compression function - shared body of the AVX2 and AVX-512
+   implementations
+
+   Each row of the 4x4 state matrix is held in one 256-bit register. The
+   including file must define `BLAKE2B_AVX_COMPRESS` (the name of the
+   function to define) and the `ROTR32`, `ROTR24`, `ROTR16` and `ROTR63`
+   rotation macros, which is where AVX2 and AVX-512 differ.
+*/
+#ifndef BLAKE2B_AVX_H
+#define BLAKE2B_AVX_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include <immintrin.h>
+
+#include "blake2.h"
+#include "blake2-impl.h"
+#include "blake2b-compress.h"
+
+#define LOADU(p)     _mm256_loadu_si256( (const __m256i *)(p) )
+#define STOREU(p, r) _mm256_storeu_si256( (__m256i *)(p), r )
+
+#define MSG4(r, i, j, k, l)                                              \
+  _mm256_set_epi64x( (long long)m[blake2b_sigma[r][l]],                 \
+                     (long long)m[blake2b_sigma[r][k]],                 \
+                     (long long)m[blake2b_sigma[r][j]],                 \
+                     (long long)m[blake2b_sigma[r][i]] )
+
+#define G1(b)                                                            \
+  do {                                                                   \
+    a = _mm256_add_epi64( _mm256_add_epi64( a, b ), bb );                \
+    d = ROTR32( _mm256_xor_si256( d, a ) );                              \
+    c = _mm256_add_epi64( c, d );                                        \
+    bb = ROTR24( _mm256_xor_si256( bb, c ) );                            \
+  } while(0)
+
+#define G2(b)                                                            \
+  do {                                                                   \
+    a = _mm256_add_epi64( _mm256_add_epi64( a, b ), bb );                \
+    d = ROTR16( _mm256_xor_si256( d, a ) );                              \
+    c = _mm256_add_epi64( c, d );                                        \
+    bb = ROTR63( _mm256_xor_si256( bb, c ) );                            \
+  } while(0)
+
+#define DIAGONALIZE()                                                    \
+  do {                                                                   \
+    bb = _mm256_permute4x64_epi64( bb, _MM_SHUFFLE(0, 3, 2, 1) );        \
+    c = _mm256_permute4x64_epi64( c, _MM_SHUFFLE(1, 0, 3, 2) );          \
+    d = _mm256_permute4x64_epi64( d, _MM_SHUFFLE(2, 1, 0, 3) );          \
+  } while(0)
+
+#define UNDIAGONALIZE()                                                  \
+  do {                                                                   \
+    bb = _mm256_permute4x64_epi64( bb, _MM_SHUFFLE(2, 1, 0, 3) );        \
+    c = _mm256_permute4x64_epi64( c, _MM_SHUFFLE(1, 0, 3, 2) );          \
+    d = _mm256_permute4x64_epi64( d, _MM_SHUFFLE(0, 3, 2, 1) );          \
+  } while(0)
+
+#define ROUND(r)                                                         \
+  do {                                                                   \
+    G1( MSG4(r,  0,  2,  4,  6) );                                       \
+    G2( MSG4(r,  1,  3,  5,  7) );                                       \
+    DIAGONALIZE();                                                       \
+    G1( MSG4(r,  8, 10, 12, 14) );                                       \
+    G2( MSG4(r,  9, 11, 13, 15) );                                       \
+    UNDIAGONALIZE();                                                     \
+  } while(0)
+
+void BLAKE2B_AVX_COMPRESS( blake2b_state *S, const uint8_t block[BLAKE2B_BLOCKBYTES] )
+{
+  __m256i a, bb, c, d;
+  uint64_t m[16];
+
+  memcpy( m, block, sizeof( m ) ); /* x86 is little endian */
+
+  a  = LOADU( &S->h[0] );
+  bb = LOADU( &S->h[4] );
+  c  = LOADU( &blake2b_IV[0] );
+  d  = _mm256_xor_si256( LOADU( &blake2b_IV[4] ),
+      _mm256_set_epi64x( (long long)S->f[1], (long long)S->f[0],
+                         (long long)S->t[1], (long long)S->t[0] ) );
+
+  ROUND( 0 );
+  ROUND( 1 );
+  ROUND( 2 );
+  ROUND( 3 );
+
+  STOREU( &S->h[0], _mm256_xor_si256( LOADU( &S->h[0] ), _mm256_xor_si256( a, c ) ) );
+  STOREU( &S->h[4], _mm256_xor_si256( LOADU( &S->h[4] ), _mm256_xor_si256( bb, d ) ) );
+}
+
+#endif
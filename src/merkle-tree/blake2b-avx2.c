@@ -0,0 +1,22 @@
+/*
+   BLAKE2b compression function - AVX2 implementation
+
+   This file must be compiled with `-mavx2`; it is only called after the
+   dispatcher has checked that the host CPU supports AVX2.
+*/
+
+#include <immintrin.h>
+
+#define BLAKE2B_AVX_COMPRESS blake2b_compress_avx2
+
+#define ROTR32(x) _mm256_shuffle_epi32( (x), _MM_SHUFFLE(2, 3, 0, 1) )
+#define ROTR24(x) _mm256_shuffle_epi8( (x), _mm256_setr_epi8( \
+      3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10,   \
+      3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10 ) )
+#define ROTR16(x) _mm256_shuffle_epi8( (x), _mm256_setr_epi8( \
+      2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9,   \
+      2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9 ) )
+#define ROTR63(x) _mm256_xor_si256( _mm256_srli_epi64( (x), 63 ), \
+      _mm256_add_epi64( (x), (x) ) )
+
+#include "blake2b-avx.h"
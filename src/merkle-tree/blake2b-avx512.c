@@ -0,0 +1,21 @@
+/*
+   BLAKE2b compression function - AVX-512 implementation
+
+   Same as the AVX2 implementation, but uses the AVX-512VL rotate
+   instruction instead of shuffles and shifts.
+
+   This file must be compiled with `-mavx512f -mavx512vl`; it is only called
+   after the dispatcher has checked that the host CPU supports AVX-512F and
+   AVX-512VL.
+*/
+
+#include <immintrin.h>
+
+#define BLAKE2B_AVX_COMPRESS blake2b_compress_avx512
+
+#define ROTR32(x) _mm256_ror_epi64( (x), 32 )
+#define ROTR24(x) _mm256_ror_epi64( (x), 24 )
+#define ROTR16(x) _mm256_ror_epi64( (x), 16 )
+#define ROTR63(x) _mm256_ror_epi64( (x), 63 )
+
+#include "blake2b-avx.h"
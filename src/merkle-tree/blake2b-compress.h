@@ -0,0 +1,111 @@
+/*
+   BLAKE2b compression function implementations and runtime dispatch
+
+   The reference compression function lives in `blake2b-ref.c`; SIMD
+   versions live in `blake2b-sse41.c`, `blake2b-avx2.c` and
+   `blake2b-avx512.c`. They are only compiled in when the build system
+   defines `BLAKE2B_HAVE_SSE41`, `BLAKE2B_HAVE_AVX2` and
+   `BLAKE2B_HAVE_AVX512` respectively. The fastest one supported by the
+   host CPU is picked the first time a block is compressed.
+
+   This is a reduced-round BLAKE2b: every implementation spells out the
+   same 4 rounds (the standard has 12), so that the message schedule is
+   known at compile time. All implementations must produce bit-identical
+   results; the reference one is the oracle.
+*/
+#ifndef BLAKE2B_COMPRESS_H
+#define BLAKE2B_COMPRESS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "blake2.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+  static const uint64_t blake2b_IV[8] =
+  {
+    0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL,
+    0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+    0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL,
+    0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL
+  };
+
+  static const uint8_t blake2b_sigma[12][16] =
+  {
+    {  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 } ,
+    { 14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3 } ,
+    { 11,  8, 12,  0,  5,  2, 15, 13, 10, 14,  3,  6,  7,  1,  9,  4 } ,
+    {  7,  9,  3,  1, 13, 12, 11, 14,  2,  6,  5, 10,  4,  0, 15,  8 } ,
+    {  9,  0,  5,  7,  2,  4, 10, 15, 14,  1, 11, 12,  6,  8,  3, 13 } ,
+    {  2, 12,  6, 10,  0, 11,  8,  3,  4, 13,  7,  5, 15, 14,  1,  9 } ,
+    { 12,  5,  1, 15, 14, 13,  4, 10,  0,  7,  6,  3,  9,  2,  8, 11 } ,
+    { 13, 11,  7, 14, 12,  1,  3,  9,  5,  0, 15,  4,  8,  6,  2, 10 } ,
+    {  6, 15, 14,  9, 11,  3,  0,  8, 12,  2, 13,  7,  1,  4, 10,  5 } ,
+    { 10,  2,  8,  4,  7,  6,  1,  5, 15, 11,  9, 14,  3, 12, 13 , 0 } ,
+    {  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 } ,
+    { 14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3 }
+  };
+
+  /* Available implementations, from slowest to fastest */
+  typedef enum blake2b_impl__
+  {
+    BLAKE2B_IMPL_REF = 0,
+    BLAKE2B_IMPL_SSE41,
+    BLAKE2B_IMPL_AVX2,
+    BLAKE2B_IMPL_AVX512,
+    BLAKE2B_IMPL_COUNT
+  } blake2b_impl;
+
+  /* Compress one block into `S->h`, using the counter and flags from `S` */
+  typedef void ( *blake2b_compress_fn )( blake2b_state *S, const uint8_t block[BLAKE2B_BLOCKBYTES] );
+
+  void blake2b_compress_ref( blake2b_state *S, const uint8_t block[BLAKE2B_BLOCKBYTES] );
+#if defined(BLAKE2B_HAVE_SSE41)
+  void blake2b_compress_sse41( blake2b_state *S, const uint8_t block[BLAKE2B_BLOCKBYTES] );
+#endif
+#if defined(BLAKE2B_HAVE_AVX2)
+  void blake2b_compress_avx2( blake2b_state *S, const uint8_t block[BLAKE2B_BLOCKBYTES] );
+#endif
+#if defined(BLAKE2B_HAVE_AVX512)
+  void blake2b_compress_avx512( blake2b_state *S, const uint8_t block[BLAKE2B_BLOCKBYTES] );
+#endif
+
+  /* Compression function currently in use
+   *
+   * The first call selects the fastest implementation supported by the
+   * host CPU, unless one has been forced with `blake2b_select_impl()`.
+   */
+  blake2b_compress_fn blake2b_compress_get( void );
+
+  /* Implementation currently in use */
+  blake2b_impl blake2b_current_impl( void );
+
+  /* Get a given implementation
+   *
+   * Returns NULL if `impl` has not been compiled in, or if the host CPU
+   * does not support it.
+   */
+  blake2b_compress_fn blake2b_compress_impl( blake2b_impl impl );
+
+  /* Fastest implementation supported by the host CPU */
+  blake2b_impl blake2b_best_impl( void );
+
+  /* Force the implementation used by `blake2b_compress_get()`
+   *
+   * This also selects the matching multi-buffer kernel, if any (see
+   * `blake2b-multi.h`). This is meant for tests and benchmarks. Returns 0
+   * on success, -1 if `impl` is not available.
+   */
+  int blake2b_select_impl( blake2b_impl impl );
+
+  /* Human-readable name of an implementation */
+  const char *blake2b_impl_name( blake2b_impl impl );
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
@@ -0,0 +1,129 @@
+/*
+   BLAKE2b compression function - runtime dispatch
+
+   Picks the fastest compression function supported by the host CPU, using
+   CPUID (through the compiler's `__builtin_cpu_supports()`). The choice is
+   made once, on first use, and can be overridden for tests and benchmarks.
+*/
+
+#include <stddef.h>
+
+#include "blake2.h"
+#include "blake2b-compress.h"
+
+#if defined(__GNUC__)
+#define BLAKE2B_LOAD(p)     __atomic_load_n( (p), __ATOMIC_ACQUIRE )
+#define BLAKE2B_STORE(p, v) __atomic_store_n( (p), (v), __ATOMIC_RELEASE )
+#else
+#define BLAKE2B_LOAD(p)     (*(p))
+#define BLAKE2B_STORE(p, v) (*(p) = (v))
+#endif
+
+static blake2b_compress_fn blake2b_current = NULL;
+static int blake2b_current_id = BLAKE2B_IMPL_REF;
+
+static int blake2b_cpu_supports( blake2b_impl impl )
+{
+#if defined(BLAKE2B_HAVE_SSE41) || defined(BLAKE2B_HAVE_AVX2) || defined(BLAKE2B_HAVE_AVX512)
+  __builtin_cpu_init();
+#endif
+  switch( impl )
+  {
+    case BLAKE2B_IMPL_REF:
+      return 1;
+#if defined(BLAKE2B_HAVE_SSE41)
+    case BLAKE2B_IMPL_SSE41:
+      return __builtin_cpu_supports( "sse4.1" );
+#endif
+#if defined(BLAKE2B_HAVE_AVX2)
+    case BLAKE2B_IMPL_AVX2:
+      return __builtin_cpu_supports( "avx2" );
+#endif
+#if defined(BLAKE2B_HAVE_AVX512)
+    case BLAKE2B_IMPL_AVX512:
+      return __builtin_cpu_supports( "avx512f" ) && __builtin_cpu_supports( "avx512vl" );
+#endif
+    default:
+      return 0;
+  }
+}
+
+blake2b_compress_fn blake2b_compress_impl( blake2b_impl impl )
+{
+  if( !blake2b_cpu_supports( impl ) ) return NULL;
+
+  switch( impl )
+  {
+    case BLAKE2B_IMPL_REF:
+      return blake2b_compress_ref;
+#if defined(BLAKE2B_HAVE_SSE41)
+    case BLAKE2B_IMPL_SSE41:
+      return blake2b_compress_sse41;
+#endif
+#if defined(BLAKE2B_HAVE_AVX2)
+    case BLAKE2B_IMPL_AVX2:
+      return blake2b_compress_avx2;
+#endif
+#if defined(BLAKE2B_HAVE_AVX512)
+    case BLAKE2B_IMPL_AVX512:
+      return blake2b_compress_avx512;
+#endif
+    default:
+      return NULL;
+  }
+}
+
+blake2b_impl blake2b_best_impl( void )
+{
+  int impl;
+  for( impl = BLAKE2B_IMPL_COUNT - 1; impl > BLAKE2B_IMPL_REF; --impl )
+  {
+    if( blake2b_cpu_supports( (blake2b_impl)impl ) ) return (blake2b_impl)impl;
+  }
+  return BLAKE2B_IMPL_REF;
+}
+
+static void blake2b_set_current( blake2b_impl impl, blake2b_compress_fn fn )
+{
+  BLAKE2B_STORE( &blake2b_current_id, (int)impl );
+  BLAKE2B_STORE( &blake2b_current, fn );
+}
+
+blake2b_compress_fn blake2b_compress_get( void )
+{
+  blake2b_compress_fn fn = BLAKE2B_LOAD( &blake2b_current );
+  if( fn == NULL )
+  {
+    /* NB: Concurrent first calls all store the same values */
+    blake2b_impl impl = blake2b_best_impl();
+    fn = blake2b_compress_impl( impl );
+    blake2b_set_current( impl, fn );
+  }
+  return fn;
+}
+
+blake2b_impl blake2b_current_impl( void )
+{
+  if( BLAKE2B_LOAD( &blake2b_current ) == NULL ) blake2b_compress_get();
+  return (blake2b_impl)BLAKE2B_LOAD( &blake2b_current_id );
+}
+
+int blake2b_select_impl( blake2b_impl impl )
+{
+  blake2b_compress_fn fn = blake2b_compress_impl( impl );
+  if( fn == NULL ) return -1;
+  blake2b_set_current( impl, fn );
+  return 0;
+}
+
+const char *blake2b_impl_name( blake2b_impl impl )
+{
+  switch( impl )
+  {
+    case BLAKE2B_IMPL_REF:    return "ref";
+    case BLAKE2B_IMPL_SSE41:  return "sse4.1";
+    case BLAKE2B_IMPL_AVX2:   return "avx2";
+    case BLAKE2B_IMPL_AVX512: return "avx512";
+    default:                  return "unknown";
+  }
+}
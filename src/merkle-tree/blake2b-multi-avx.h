@@ -0,0 +1,123 @@
+/*
+   Multi-buffer BLAKE2b - shared body of the AVX2 and AVX-512 kernels
+
+   Lane `k` of `v[i]` holds word `i` of the state of message `k`, so each
+   instruction advances all the messages at once and no diagonalization is
+   needed. The including file must define `BLAKE2B_MULTI_FN` (the name of
+   the function to define), `BLAKE2B_LANES`, the `vec` vector type and the
+   `VLOADU`, `VSTOREU`, `VSET1`, `VZERO`, `VADD`, `VXOR`, `VROTR32`,
+   `VROTR24`, `VROTR16` and `VROTR63` operations.
+*/
+#ifndef BLAKE2B_MULTI_AVX_H
+#define BLAKE2B_MULTI_AVX_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include <immintrin.h>
+
+#include "blake2.h"
+#include "blake2-impl.h"
+#include "blake2b-compress.h"
+#include "blake2b-multi.h"
+
+#define G(r, i, a, b, c, d)                                 \
+  do {                                                      \
+    a = VADD( VADD( a, b ), m[blake2b_sigma[r][2*i+0]] );   \
+    d = VROTR32( VXOR( d, a ) );                            \
+    c = VADD( c, d );                                       \
+    b = VROTR24( VXOR( b, c ) );                            \
+    a = VADD( VADD( a, b ), m[blake2b_sigma[r][2*i+1]] );   \
+    d = VROTR16( VXOR( d, a ) );                            \
+    c = VADD( c, d );                                       \
+    b = VROTR63( VXOR( b, c ) );                            \
+  } while(0)
+
+#define ROUND(r)                        \
+  do {                                  \
+    G(r, 0, v[ 0], v[ 4], v[ 8], v[12]); \
+    G(r, 1, v[ 1], v[ 5], v[ 9], v[13]); \
+    G(r, 2, v[ 2], v[ 6], v[10], v[14]); \
+    G(r, 3, v[ 3], v[ 7], v[11], v[15]); \
+    G(r, 4, v[ 0], v[ 5], v[10], v[15]); \
+    G(r, 5, v[ 1], v[ 6], v[11], v[12]); \
+    G(r, 6, v[ 2], v[ 7], v[ 8], v[13]); \
+    G(r, 7, v[ 3], v[ 4], v[ 9], v[14]); \
+  } while(0)
+
+/* Always inlined so the common (16, 16) case is specialized, in which case
+ * the compiler drops all the additions of all-zero message words */
+static BLAKE2_INLINE __attribute__((always_inline))
+void blake2b_multi_lanes( uint8_t *out, size_t outlen,
+                          const uint8_t *const *left, const uint8_t *const *right,
+                          size_t halflen )
+{
+  const size_t halfwords = halflen / 8;
+  uint64_t words[16][BLAKE2B_LANES];
+  uint64_t h[8];
+  vec m[16];
+  vec v[16];
+  size_t i, k;
+
+  /* Transpose the messages so each vector holds the same word of each */
+  for( i = 0; i < halfwords; ++i )
+  {
+    for( k = 0; k < BLAKE2B_LANES; ++k )
+    {
+      words[i][k] = load64( left[k] + 8 * i );
+      words[halfwords + i][k] = load64( right[k] + 8 * i );
+    }
+  }
+  for( i = 0; i < 16; ++i )
+  {
+    m[i] = ( i < 2 * halfwords ) ? VLOADU( words[i] ) : VZERO();
+  }
+
+  /* Unkeyed parameter block: digest length, fanout = 1, depth = 1 */
+  for( i = 0; i < 8; ++i ) h[i] = blake2b_IV[i];
+  h[0] ^= 0x01010000ULL ^ (uint64_t)outlen;
+
+  for( i = 0; i < 8; ++i ) v[i] = VSET1( h[i] );
+  v[ 8] = VSET1( blake2b_IV[0] );
+  v[ 9] = VSET1( blake2b_IV[1] );
+  v[10] = VSET1( blake2b_IV[2] );
+  v[11] = VSET1( blake2b_IV[3] );
+  v[12] = VSET1( blake2b_IV[4] ^ (uint64_t)( 2 * halflen ) ); /* counter */
+  v[13] = VSET1( blake2b_IV[5] );
+  v[14] = VSET1( ~blake2b_IV[6] ); /* last block */
+  v[15] = VSET1( blake2b_IV[7] );
+
+  ROUND( 0 );
+  ROUND( 1 );
+  ROUND( 2 );
+  ROUND( 3 );
+
+  for( i = 0; 8 * i < outlen; ++i )
+  {
+    uint64_t lanes[BLAKE2B_LANES];
+    const size_t len = ( outlen - 8 * i < 8 ) ? outlen - 8 * i : 8;
+    VSTOREU( lanes, VXOR( VSET1( h[i] ), VXOR( v[i], v[i + 8] ) ) );
+    for( k = 0; k < BLAKE2B_LANES; ++k )
+    {
+      uint8_t bytes[8];
+      store64( bytes, lanes[k] );
+      memcpy( out + k * outlen + 8 * i, bytes, len );
+    }
+  }
+}
+
+void BLAKE2B_MULTI_FN( uint8_t *out, size_t outlen,
+                       const uint8_t *const *left, const uint8_t *const *right,
+                       size_t halflen )
+{
+  if( outlen == 16 && halflen == 16 )
+  {
+    blake2b_multi_lanes( out, 16, left, right, 16 );
+  }
+  else
+  {
+    blake2b_multi_lanes( out, outlen, left, right, halflen );
+  }
+}
+
+#endif
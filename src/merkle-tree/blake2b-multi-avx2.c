@@ -0,0 +1,32 @@
+/*
+   Multi-buffer BLAKE2b - AVX2 kernel, 4 messages at a time
+
+   This file must be compiled with `-mavx2`; it is only called after the
+   dispatcher has checked that the host CPU supports AVX2.
+*/
+
+#include <immintrin.h>
+
+#define BLAKE2B_MULTI_FN blake2b_pairs_x4_avx2
+#define BLAKE2B_LANES    4
+
+typedef __m256i vec;
+
+#define VLOADU(p)     _mm256_loadu_si256( (const __m256i *)(p) )
+#define VSTOREU(p, x) _mm256_storeu_si256( (__m256i *)(p), (x) )
+#define VSET1(x)      _mm256_set1_epi64x( (long long)(x) )
+#define VZERO()       _mm256_setzero_si256()
+#define VADD(a, b)    _mm256_add_epi64( (a), (b) )
+#define VXOR(a, b)    _mm256_xor_si256( (a), (b) )
+
+#define VROTR32(x) _mm256_shuffle_epi32( (x), _MM_SHUFFLE(2, 3, 0, 1) )
+#define VROTR24(x) _mm256_shuffle_epi8( (x), _mm256_setr_epi8( \
+      3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10,    \
+      3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10 ) )
+#define VROTR16(x) _mm256_shuffle_epi8( (x), _mm256_setr_epi8( \
+      2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9,    \
+      2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9 ) )
+#define VROTR63(x) _mm256_xor_si256( _mm256_srli_epi64( (x), 63 ), \
+      _mm256_add_epi64( (x), (x) ) )
+
+#include "blake2b-multi-avx.h"
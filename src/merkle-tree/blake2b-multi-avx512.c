@@ -0,0 +1,27 @@
+/*
+   Multi-buffer BLAKE2b - AVX-512 kernel, 8 messages at a time
+
+   This file must be compiled with `-mavx512f`; it is only called after the
+   dispatcher has checked that the host CPU supports AVX-512F.
+*/
+
+#include <immintrin.h>
+
+#define BLAKE2B_MULTI_FN blake2b_pairs_x8_avx512
+#define BLAKE2B_LANES    8
+
+typedef __m512i vec;
+
+#define VLOADU(p)     _mm512_loadu_si512( (const void *)(p) )
+#define VSTOREU(p, x) _mm512_storeu_si512( (void *)(p), (x) )
+#define VSET1(x)      _mm512_set1_epi64( (long long)(x) )
+#define VZERO()       _mm512_setzero_si512()
+#define VADD(a, b)    _mm512_add_epi64( (a), (b) )
+#define VXOR(a, b)    _mm512_xor_si512( (a), (b) )
+
+#define VROTR32(x) _mm512_ror_epi64( (x), 32 )
+#define VROTR24(x) _mm512_ror_epi64( (x), 24 )
+#define VROTR16(x) _mm512_ror_epi64( (x), 16 )
+#define VROTR63(x) _mm512_ror_epi64( (x), 63 )
+
+#include "blake2b-multi-avx.h"
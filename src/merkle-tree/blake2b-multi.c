@@ -0,0 +1,86 @@
+/*
+   Multi-buffer BLAKE2b for short messages - dispatch and scalar fallback
+*/
+
+#include <stdint.h>
+#include <string.h>
+
+#include "blake2.h"
+#include "blake2-impl.h"
+#include "blake2b-compress.h"
+#include "blake2b-multi.h"
+
+typedef void ( *blake2b_pairs_fn )( uint8_t *out, size_t outlen,
+                                    const uint8_t *const *left, const uint8_t *const *right,
+                                    size_t halflen );
+
+/* Hash a single message with the single-buffer compression function */
+static void blake2b_pair_one( blake2b_compress_fn compress, uint8_t *out, size_t outlen,
+                              const uint8_t *left, const uint8_t *right, size_t halflen )
+{
+  blake2b_state S[1];
+  uint8_t block[BLAKE2B_BLOCKBYTES];
+  uint8_t buffer[BLAKE2B_OUTBYTES];
+  size_t i;
+
+  memset( S, 0, sizeof( S ) );
+  for( i = 0; i < 8; ++i ) S->h[i] = blake2b_IV[i];
+  S->h[0] ^= 0x01010000ULL ^ (uint64_t)outlen;
+  S->t[0] = 2 * halflen;
+  S->f[0] = (uint64_t)-1;
+
+  memcpy( block, left, halflen );
+  memcpy( block + halflen, right, halflen );
+  memset( block + 2 * halflen, 0, BLAKE2B_BLOCKBYTES - 2 * halflen );
+  compress( S, block );
+
+  for( i = 0; i < 8; ++i ) store64( buffer + 8 * i, S->h[i] );
+  memcpy( out, buffer, outlen );
+}
+
+int blake2b_pairs( uint8_t *out, size_t outlen,
+                   const uint8_t *const *left, const uint8_t *const *right,
+                   size_t halflen, size_t n )
+{
+  blake2b_compress_fn compress = blake2b_compress_get();
+  blake2b_pairs_fn kernel = NULL;
+  size_t lanes = 1;
+  size_t i = 0;
+
+  if( !outlen || outlen > BLAKE2B_OUTBYTES ) return -1;
+  if( 2 * halflen > BLAKE2B_BLOCKBYTES ) return -1;
+
+  if( halflen % 8 == 0 )
+  {
+    switch( blake2b_current_impl() )
+    {
+#if defined(BLAKE2B_HAVE_AVX512)
+      case BLAKE2B_IMPL_AVX512:
+        kernel = blake2b_pairs_x8_avx512;
+        lanes = 8;
+        break;
+#endif
+#if defined(BLAKE2B_HAVE_AVX2)
+      case BLAKE2B_IMPL_AVX2:
+        kernel = blake2b_pairs_x4_avx2;
+        lanes = 4;
+        break;
+#endif
+      default:
+        break;
+    }
+  }
+
+  if( kernel != NULL )
+  {
+    for( ; i + lanes <= n; i += lanes )
+    {
+      kernel( out + i * outlen, outlen, left + i, right + i, halflen );
+    }
+  }
+  for( ; i < n; ++i )
+  {
+    blake2b_pair_one( compress, out + i * outlen, outlen, left[i], right[i], halflen );
+  }
+  return 0;
+}
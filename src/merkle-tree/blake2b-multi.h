@@ -0,0 +1,50 @@
+/*
+   Multi-buffer BLAKE2b for short messages
+
+   Merkle Tree nodes are computed by hashing two digests one after the
+   other, which always fits in a single block. Hashing many such messages
+   at once lets us run 4 (AVX2) or 8 (AVX-512) independent compressions
+   side by side, one per SIMD lane.
+*/
+#ifndef BLAKE2B_MULTI_H
+#define BLAKE2B_MULTI_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+  /* Hash `n` two-part messages
+   *
+   * Message `i` is the `halflen` bytes at `left[i]` followed by the
+   * `halflen` bytes at `right[i]`; its `outlen`-byte digest is written at
+   * `out + i * outlen`. The digests are the same as what `blake2b()` would
+   * produce (unkeyed).
+   *
+   * Returns 0 on success, -1 if `outlen` is 0 or greater than
+   * `BLAKE2B_OUTBYTES`, or if `2 * halflen` is greater than
+   * `BLAKE2B_BLOCKBYTES`.
+   */
+  int blake2b_pairs( uint8_t *out, size_t outlen,
+                     const uint8_t *const *left, const uint8_t *const *right,
+                     size_t halflen, size_t n );
+
+  /* Multi-buffer kernels; `halflen` must be a multiple of 8 */
+#if defined(BLAKE2B_HAVE_AVX2)
+  void blake2b_pairs_x4_avx2( uint8_t *out, size_t outlen,
+                              const uint8_t *const *left, const uint8_t *const *right,
+                              size_t halflen );
+#endif
+#if defined(BLAKE2B_HAVE_AVX512)
+  void blake2b_pairs_x8_avx512( uint8_t *out, size_t outlen,
+                                const uint8_t *const *left, const uint8_t *const *right,
+                                size_t halflen );
+#endif
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
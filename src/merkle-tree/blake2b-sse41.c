@@ -0,0 +1,123 @@
+/*
+   BLAKE2b compression function - SSE4.1 implementation
+
+   Based on the BLAKE2 SSE reference code by Samuel Neves. Each row of the
+   4x4 state matrix is held in two 128-bit registers (low and high halves).
+
+   This file must be compiled with `-msse4.1`; it is only called after the
+   dispatcher has checked that the host CPU supports SSE4.1.
+*/
+
+#include <stdint.h>
+#include <string.h>
+
+#include <smmintrin.h>
+
+#include "blake2.h"
+#include "blake2-impl.h"
+#include "blake2b-compress.h"
+
+#define LOADU(p)     _mm_loadu_si128( (const __m128i *)(p) )
+#define STOREU(p, r) _mm_storeu_si128( (__m128i *)(p), r )
+
+#define ROTR32(x)    _mm_shuffle_epi32( (x), _MM_SHUFFLE(2, 3, 0, 1) )
+#define ROTR24(x)    _mm_shuffle_epi8( (x), r24 )
+#define ROTR16(x)    _mm_shuffle_epi8( (x), r16 )
+#define ROTR63(x)    _mm_xor_si128( _mm_srli_epi64( (x), 63 ), _mm_add_epi64( (x), (x) ) )
+
+#define MSG2(r, i, j) \
+  _mm_set_epi64x( (long long)m[blake2b_sigma[r][j]], (long long)m[blake2b_sigma[r][i]] )
+
+#define G1(b0, b1)                                                   \
+  do {                                                               \
+    row1l = _mm_add_epi64( _mm_add_epi64( row1l, b0 ), row2l );      \
+    row1h = _mm_add_epi64( _mm_add_epi64( row1h, b1 ), row2h );      \
+    row4l = ROTR32( _mm_xor_si128( row4l, row1l ) );                 \
+    row4h = ROTR32( _mm_xor_si128( row4h, row1h ) );                 \
+    row3l = _mm_add_epi64( row3l, row4l );                           \
+    row3h = _mm_add_epi64( row3h, row4h );                           \
+    row2l = ROTR24( _mm_xor_si128( row2l, row3l ) );                 \
+    row2h = ROTR24( _mm_xor_si128( row2h, row3h ) );                 \
+  } while(0)
+
+#define G2(b0, b1)                                                   \
+  do {                                                               \
+    row1l = _mm_add_epi64( _mm_add_epi64( row1l, b0 ), row2l );      \
+    row1h = _mm_add_epi64( _mm_add_epi64( row1h, b1 ), row2h );      \
+    row4l = ROTR16( _mm_xor_si128( row4l, row1l ) );                 \
+    row4h = ROTR16( _mm_xor_si128( row4h, row1h ) );                 \
+    row3l = _mm_add_epi64( row3l, row4l );                           \
+    row3h = _mm_add_epi64( row3h, row4h );                           \
+    row2l = ROTR63( _mm_xor_si128( row2l, row3l ) );                 \
+    row2h = ROTR63( _mm_xor_si128( row2h, row3h ) );                 \
+  } while(0)
+
+#define DIAGONALIZE()                                                \
+  do {                                                               \
+    t0 = _mm_alignr_epi8( row2h, row2l, 8 );                         \
+    t1 = _mm_alignr_epi8( row2l, row2h, 8 );                         \
+    row2l = t0;                                                      \
+    row2h = t1;                                                      \
+    t0 = row3l;                                                      \
+    row3l = row3h;                                                   \
+    row3h = t0;                                                      \
+    t0 = _mm_alignr_epi8( row4h, row4l, 8 );                         \
+    t1 = _mm_alignr_epi8( row4l, row4h, 8 );                         \
+    row4l = t1;                                                      \
+    row4h = t0;                                                      \
+  } while(0)
+
+#define UNDIAGONALIZE()                                              \
+  do {                                                               \
+    t0 = _mm_alignr_epi8( row2l, row2h, 8 );                         \
+    t1 = _mm_alignr_epi8( row2h, row2l, 8 );                         \
+    row2l = t0;                                                      \
+    row2h = t1;                                                      \
+    t0 = row3l;                                                      \
+    row3l = row3h;                                                   \
+    row3h = t0;                                                      \
+    t0 = _mm_alignr_epi8( row4l, row4h, 8 );                         \
+    t1 = _mm_alignr_epi8( row4h, row4l, 8 );                         \
+    row4l = t1;                                                      \
+    row4h = t0;                                                      \
+  } while(0)
+
+#define ROUND(r)                                                     \
+  do {                                                               \
+    G1( MSG2(r,  0,  2), MSG2(r,  4,  6) );                          \
+    G2( MSG2(r,  1,  3), MSG2(r,  5,  7) );                          \
+    DIAGONALIZE();                                                   \
+    G1( MSG2(r,  8, 10), MSG2(r, 12, 14) );                          \
+    G2( MSG2(r,  9, 11), MSG2(r, 13, 15) );                          \
+    UNDIAGONALIZE();                                                 \
+  } while(0)
+
+void blake2b_compress_sse41( blake2b_state *S, const uint8_t block[BLAKE2B_BLOCKBYTES] )
+{
+  const __m128i r16 = _mm_setr_epi8( 2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9 );
+  const __m128i r24 = _mm_setr_epi8( 3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10 );
+  __m128i row1l, row1h, row2l, row2h, row3l, row3h, row4l, row4h;
+  __m128i t0, t1;
+  uint64_t m[16];
+
+  memcpy( m, block, sizeof( m ) ); /* x86 is little endian */
+
+  row1l = LOADU( &S->h[0] );
+  row1h = LOADU( &S->h[2] );
+  row2l = LOADU( &S->h[4] );
+  row2h = LOADU( &S->h[6] );
+  row3l = LOADU( &blake2b_IV[0] );
+  row3h = LOADU( &blake2b_IV[2] );
+  row4l = _mm_xor_si128( LOADU( &blake2b_IV[4] ), LOADU( &S->t[0] ) );
+  row4h = _mm_xor_si128( LOADU( &blake2b_IV[6] ), LOADU( &S->f[0] ) );
+
+  ROUND( 0 );
+  ROUND( 1 );
+  ROUND( 2 );
+  ROUND( 3 );
+
+  STOREU( &S->h[0], _mm_xor_si128( LOADU( &S->h[0] ), _mm_xor_si128( row1l, row3l ) ) );
+  STOREU( &S->h[2], _mm_xor_si128( LOADU( &S->h[2] ), _mm_xor_si128( row1h, row3h ) ) );
+  STOREU( &S->h[4], _mm_xor_si128( LOADU( &S->h[4] ), _mm_xor_si128( row2l, row4l ) ) );
+  STOREU( &S->h[6], _mm_xor_si128( LOADU( &S->h[6] ), _mm_xor_si128( row2h, row4h ) ) );
+}
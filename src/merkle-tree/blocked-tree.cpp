@@ -0,0 +1,142 @@
+#include "merkle-tree/blocked-tree.hpp"
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include "merkle-tree/mapped-tree.hpp"
+#include "prefetch.hpp"
+#include "stats-counters.hpp"
+
+extern "C" {
+#include <stdlib.h>
+}
+
+namespace {
+
+typedef MerkleTree::Digest Digest;
+
+/** Alignment of the hashes, so that full blocks are pages */
+const size_t PAGE_SIZE_B = 4096;
+
+/** Get the size of a layer of a tree of `count` leaves
+ *
+ * \param count [in] Number of leaves; must be at least 1
+ * \param layer [in] Layer number; 0 is the leaves
+ */
+inline size_t layerSize(size_t count, size_t layer)
+{
+    return ((count - 1) >> layer) + 1;
+}
+
+} // namespace
+
+const size_t BlockedMerkleTree::BLOCK_LAYERS;
+
+BlockedMerkleTree::BlockedMerkleTree(const MerkleTree& tree)
+    : nodes_(NULL), size_(0), leafCount_(0), layerCount_(0)
+{
+    build(tree);
+}
+
+BlockedMerkleTree::BlockedMerkleTree(const MappedMerkleTree& tree)
+    : nodes_(NULL), size_(0), leafCount_(0), layerCount_(0)
+{
+    build(tree);
+}
+
+BlockedMerkleTree::~BlockedMerkleTree()
+{
+    MERKLE_TREE_STATS_ADD(layerBytes, -static_cast<int64_t>(getMemoryUsage()));
+    free(nodes_);
+}
+
+const MerkleTree::Digest& BlockedMerkleTree::getLeaf(size_t index) const
+{
+    if (index == 0) {
+        throw std::runtime_error("Index is zero");
+    }
+    if (index > leafCount_) {
+        throw std::runtime_error("Index out of range");
+    }
+    return (layerCount_ == 1) ? root_ : *getNode(0, index - 1);
+}
+
+size_t BlockedMerkleTree::getProof(size_t index, MerkleTree::Digest* proof,
+        size_t capacity) const
+{
+    if (index == 0) {
+        throw std::runtime_error("Index is zero");
+    }
+    index--;
+    if (index >= leafCount_) {
+        throw std::runtime_error("Index out of range");
+    }
+    MERKLE_TREE_STATS_ADD(proofsGenerated, 1);
+
+    // Find and prefetch all the hashes before reading any of them
+    const Digest* hashes[MerkleTree::MAX_PROOF_LENGTH];
+    size_t length = 0;
+    for (size_t layer = 0; layer + 1 < layerCount_; ++layer) {
+        // The last hash of a layer with an odd number of hashes has no peer
+        const size_t pair = (index >> layer) ^ 1;
+        if (pair < layerSize(leafCount_, layer)) {
+            if (length == capacity) {
+                throw std::runtime_error("Proof buffer too small");
+            }
+            hashes[length] = getNode(layer, pair);
+            MERKLE_TREE_PREFETCH(hashes[length]);
+            ++length;
+        }
+    }
+    for (size_t i = 0; i < length; ++i) {
+        proof[i] = *hashes[i];
+    }
+    return length;
+}
+
+template <class Tree>
+void BlockedMerkleTree::build(const Tree& tree)
+{
+    leafCount_ = tree.getLeafCount();
+    layerCount_ = tree.getLayerCount();
+    root_ = tree.getRootDigest();
+
+    // Full bands come first, so their blocks stay aligned on pages
+    for (size_t first = 0; first + 1 < layerCount_; first += BLOCK_LAYERS) {
+        const size_t height = std::min(BLOCK_LAYERS, layerCount_ - 1 - first);
+        bandOffsets_.push_back(size_);
+        size_ += layerSize(leafCount_, first + height) << (height + 1);
+    }
+    if (size_ > 0) {
+        void* memory;
+        if (posix_memalign(&memory, PAGE_SIZE_B, size_ * sizeof(Digest)) != 0) {
+            throw std::bad_alloc();
+        }
+        nodes_ = static_cast<Digest*>(memory);
+        std::memset(nodes_, 0, size_ * sizeof(Digest)); // unused slots
+    }
+
+    for (size_t layer = 0; layer + 1 < layerCount_; ++layer) {
+        const Digest* hashes = tree.getLayer(layer);
+        const size_t size = tree.getLayerSize(layer);
+        for (size_t position = 0; position < size; ++position) {
+            *getNode(layer, position) = hashes[position];
+        }
+    }
+    MERKLE_TREE_STATS_ADD(layerBytes, getMemoryUsage());
+}
+
+const MerkleTree::Digest* BlockedMerkleTree::getNode(size_t layer,
+        size_t position) const
+{
+    // The node is `depth` layers below the node its block hangs from, and
+    // is at index `2^depth + offset` in the block, like in a binary heap
+    const size_t band = layer / BLOCK_LAYERS;
+    const size_t first = band * BLOCK_LAYERS;
+    const size_t height = std::min(BLOCK_LAYERS, layerCount_ - 1 - first);
+    const size_t depth = first + height - layer;
+    const size_t block = position >> depth;
+    const size_t offset = position & ((size_t(1) << depth) - 1);
+    return nodes_ + bandOffsets_[band] + (block << (height + 1))
+        + (size_t(1) << depth) + offset;
+}
@@ -0,0 +1,144 @@
+#include "digest-sort.hpp"
+#include <algorithm>
+
+namespace {
+
+/** Number of buckets of the radix pass; one per value of the two leading
+ * bytes of a digest */
+const size_t BUCKET_COUNT = 1 << 16;
+
+/** Below this number of digests, sort them directly */
+const size_t MIN_RADIX_SIZE = 4096;
+
+/** Below this number of digests, don't bother starting threads */
+const size_t MIN_PARALLEL_SIZE = 1 << 20;
+
+/** Number of buckets sorted by each work item */
+const size_t BUCKETS_PER_CHUNK = 256;
+
+/** Load 8 bytes as a big-endian integer, so integers compare like bytes */
+inline uint64_t loadBigEndian64(const uint8_t* p)
+{
+    uint64_t value = 0;
+    for (size_t i = 0; i < 8; ++i) {
+        value = (value << 8) | p[i];
+    }
+    return value;
+}
+
+/** Same ordering as `BasicMerkleTree::Digest::operator<()`, but compares 8
+ * bytes at a time */
+struct DigestLess
+{
+    template <class Digest>
+    bool operator()(const Digest& a, const Digest& b) const
+    {
+        size_t i = 0;
+        for ( ; i + 8 <= sizeof(a.bytes); i += 8) {
+            const uint64_t x = loadBigEndian64(a.bytes + i);
+            const uint64_t y = loadBigEndian64(b.bytes + i);
+            if (x != y) {
+                return x < y;
+            }
+        }
+        return std::memcmp(a.bytes + i, b.bytes + i, sizeof(a.bytes) - i) < 0;
+    }
+};
+
+template <class Digest>
+inline size_t bucketOf(const Digest& digest)
+{
+    return (size_t(digest.bytes[0]) << 8) | digest.bytes[1];
+}
+
+template <class Digest>
+bool isSorted(const std::vector<Digest>& digests)
+{
+    DigestLess less;
+    for (size_t i = 1; i < digests.size(); ++i) {
+        if (less(digests[i], digests[i - 1])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/** Sort chunks of buckets */
+template <class Digest>
+class SortBuckets : public MerkleTreeExecutor::Task
+{
+public :
+    SortBuckets(Digest* digests, const std::vector<size_t>& offsets)
+        : digests_(digests), offsets_(offsets)
+    {
+    }
+
+    virtual void run(size_t index)
+    {
+        const size_t first = index * BUCKETS_PER_CHUNK;
+        const size_t last = std::min(first + BUCKETS_PER_CHUNK, BUCKET_COUNT);
+        for (size_t bucket = first; bucket < last; ++bucket) {
+            std::sort(digests_ + offsets_[bucket],
+                    digests_ + offsets_[bucket + 1], DigestLess());
+        }
+    }
+
+private :
+    Digest*                    digests_;
+    const std::vector<size_t>& offsets_;
+};
+
+template <class Digest>
+void radixSort(std::vector<Digest>& digests, MerkleTreeExecutor* executor)
+{
+    // Radix pass on the two leading bytes
+    std::vector<size_t> offsets(BUCKET_COUNT + 1, 0);
+    for (size_t i = 0; i < digests.size(); ++i) {
+        ++offsets[bucketOf(digests[i]) + 1];
+    }
+    for (size_t bucket = 0; bucket < BUCKET_COUNT; ++bucket) {
+        offsets[bucket + 1] += offsets[bucket];
+    }
+    std::vector<Digest> sorted(digests.size());
+    {
+        std::vector<size_t> next(offsets.begin(), offsets.end() - 1);
+        for (size_t i = 0; i < digests.size(); ++i) {
+            sorted[next[bucketOf(digests[i])]++] = digests[i];
+        }
+    }
+    digests.swap(sorted);
+
+    // Sort each bucket
+    SortBuckets<Digest> task(&digests[0], offsets);
+    const size_t chunks = (BUCKET_COUNT + BUCKETS_PER_CHUNK - 1)
+        / BUCKETS_PER_CHUNK;
+    if (digests.size() >= MIN_PARALLEL_SIZE) {
+        if (executor == NULL) {
+            executor = &MerkleTreeThreadPool::getDefault();
+        }
+        executor->parallelFor(chunks, task);
+    } else {
+        for (size_t i = 0; i < chunks; ++i) {
+            task.run(i);
+        }
+    }
+}
+
+} // namespace
+
+template <class Digest>
+void sortUniqueDigests(std::vector<Digest>& digests,
+        MerkleTreeExecutor* executor)
+{
+    if (!isSorted(digests)) {
+        if (digests.size() < MIN_RADIX_SIZE) {
+            std::sort(digests.begin(), digests.end(), DigestLess());
+        } else {
+            radixSort(digests, executor);
+        }
+    }
+    digests.erase(std::unique(digests.begin(), digests.end()), digests.end());
+}
+
+template void sortUniqueDigests(MerkleTree::Digests&, MerkleTreeExecutor*);
+template void sortUniqueDigests(MerkleTree256::Digests&, MerkleTreeExecutor*);
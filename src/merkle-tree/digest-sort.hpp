@@ -0,0 +1,27 @@
+#ifndef MERKLE_TREE_DIGEST_SORT_HPP_
+#define MERKLE_TREE_DIGEST_SORT_HPP_
+
+#include "merkle-tree/merkle-tree.hpp"
+#include "merkle-tree/executor.hpp"
+
+/** Sort a list of digests and remove duplicates
+ *
+ * This is the build stage of unordered Merkle Trees. The result is the same
+ * as `std::sort()` followed by `std::unique()`, but faster: an input that is
+ * already sorted is only checked, small inputs are sorted directly, and
+ * large inputs are first split into 65536 buckets on their two leading
+ * bytes (one radix pass), and each bucket is then sorted on its own. Buckets
+ * are sorted in parallel on `executor` when the input is large enough.
+ *
+ * This is instantiated for the digests of each configuration of
+ * `BasicMerkleTree` built into the library.
+ *
+ * \param digests  [in,out] Digests to sort
+ * \param executor [in]     Executor to run the bucket sorts on, or NULL for
+ *                          the default thread pool
+ */
+template <class Digest>
+void sortUniqueDigests(std::vector<Digest>& digests,
+        MerkleTreeExecutor* executor);
+
+#endif // MERKLE_TREE_DIGEST_SORT_HPP_
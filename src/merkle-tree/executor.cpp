@@ -0,0 +1,295 @@
+#include "merkle-tree/executor.hpp"
+#include <vector>
+#include <stdexcept>
+
+extern "C" {
+#include <pthread.h>
+#include <unistd.h>
+}
+
+namespace {
+
+/** Items not yet started by a thread of the pool
+ *
+ * The owner takes items from the front; thieves take the back half.
+ */
+struct Slice
+{
+    size_t          begin;
+    size_t          end;
+    pthread_mutex_t mutex;
+};
+
+pthread_once_t defaultPoolOnce = PTHREAD_ONCE_INIT;
+MerkleTreeThreadPool* defaultPool = NULL;
+
+void createDefaultPool()
+{
+    defaultPool = new MerkleTreeThreadPool;
+}
+
+} // namespace
+
+class MerkleTreeThreadPool::Impl
+{
+public :
+    Impl(size_t concurrency)
+        : slices_(concurrency), task_(NULL), generation_(0), pending_(0),
+          stopping_(false)
+    {
+        pthread_mutex_init(&jobMutex_, NULL);
+        pthread_mutex_init(&mutex_, NULL);
+        pthread_cond_init(&wake_, NULL);
+        pthread_cond_init(&done_, NULL);
+        pthread_key_create(&workerKey_, NULL);
+        for (size_t i = 0; i < slices_.size(); ++i) {
+            slices_[i].begin = 0;
+            slices_[i].end = 0;
+            pthread_mutex_init(&slices_[i].mutex, NULL);
+        }
+
+        // Slice 0 belongs to the thread calling `parallelFor()`
+        for (size_t i = 1; i < concurrency; ++i) {
+            Worker* worker = new Worker;
+            worker->impl = this;
+            worker->slice = i;
+            pthread_t thread;
+            if (pthread_create(&thread, NULL, workerMain, worker) != 0) {
+                delete worker;
+                stop();
+                destroy();
+                throw std::runtime_error("Failed to create thread");
+            }
+            threads_.push_back(thread);
+        }
+    }
+
+    ~Impl()
+    {
+        stop();
+        destroy();
+    }
+
+    void parallelFor(size_t count, Task& task)
+    {
+        if (    threads_.empty() || (count <= 1)
+             || (pthread_getspecific(workerKey_) != NULL)) {
+            // Not worth it, or called from a task: run everything here
+            for (size_t i = 0; i < count; ++i) {
+                task.run(i);
+            }
+            return;
+        }
+
+        pthread_mutex_lock(&jobMutex_);
+
+        // Split the items evenly between all threads
+        for (size_t i = 0; i < slices_.size(); ++i) {
+            pthread_mutex_lock(&slices_[i].mutex);
+            slices_[i].begin = (count * i) / slices_.size();
+            slices_[i].end = (count * (i + 1)) / slices_.size();
+            pthread_mutex_unlock(&slices_[i].mutex);
+        }
+
+        pthread_mutex_lock(&mutex_);
+        task_ = &task;
+        pending_ = threads_.size();
+        ++generation_;
+        pthread_cond_broadcast(&wake_);
+        pthread_mutex_unlock(&mutex_);
+
+        // NB: Mark this thread as running tasks, so nested calls don't block
+        // on `jobMutex_`
+        pthread_setspecific(workerKey_, this);
+        work(0);
+        pthread_setspecific(workerKey_, NULL);
+
+        pthread_mutex_lock(&mutex_);
+        while (pending_ > 0) {
+            pthread_cond_wait(&done_, &mutex_);
+        }
+        task_ = NULL;
+        pthread_mutex_unlock(&mutex_);
+
+        pthread_mutex_unlock(&jobMutex_);
+    }
+
+    size_t getConcurrency() const
+    {
+        return slices_.size();
+    }
+
+private :
+    struct Worker
+    {
+        Impl*  impl;
+        size_t slice;
+    };
+
+    std::vector<Slice>     slices_;     /**< One per thread */
+    std::vector<pthread_t> threads_;    /**< Pool threads */
+    pthread_mutex_t        jobMutex_;   /**< One `parallelFor()` at a time */
+    pthread_mutex_t        mutex_;      /**< Protects the fields below */
+    pthread_cond_t         wake_;       /**< Signals a new job or stop */
+    pthread_cond_t         done_;       /**< Signals `pending_` reached 0 */
+    pthread_key_t          workerKey_;  /**< Set in threads running tasks */
+    Task*                  task_;       /**< Task being run */
+    size_t                 generation_; /**< Incremented for each job */
+    size_t                 pending_;    /**< Pool threads still working */
+    bool                   stopping_;   /**< Pool threads must exit */
+
+    static void* workerMain(void* arg)
+    {
+        Worker* worker = static_cast<Worker*>(arg);
+        worker->impl->workerLoop(worker->slice);
+        delete worker;
+        return NULL;
+    }
+
+    void workerLoop(size_t slice)
+    {
+        pthread_setspecific(workerKey_, this);
+        size_t seen = 0;
+        pthread_mutex_lock(&mutex_);
+        for (;;) {
+            while (!stopping_ && (generation_ == seen)) {
+                pthread_cond_wait(&wake_, &mutex_);
+            }
+            if (stopping_) {
+                break;
+            }
+            seen = generation_;
+            pthread_mutex_unlock(&mutex_);
+
+            work(slice);
+
+            pthread_mutex_lock(&mutex_);
+            if (--pending_ == 0) {
+                pthread_cond_signal(&done_);
+            }
+        }
+        pthread_mutex_unlock(&mutex_);
+    }
+
+    /** Run items until there are none left to take or steal */
+    void work(size_t slice)
+    {
+        size_t index;
+        while (take(slice, index) || steal(slice, index)) {
+            task_->run(index);
+        }
+    }
+
+    /** Take the next item of our own slice */
+    bool take(size_t slice, size_t& index)
+    {
+        Slice& own = slices_[slice];
+        bool found = false;
+        pthread_mutex_lock(&own.mutex);
+        if (own.begin < own.end) {
+            index = own.begin++;
+            found = true;
+        }
+        pthread_mutex_unlock(&own.mutex);
+        return found;
+    }
+
+    /** Steal the back half of the busiest slice
+     *
+     * The first stolen item is returned in `index`, the others become our
+     * own slice.
+     */
+    bool steal(size_t slice, size_t& index)
+    {
+        for (;;) {
+            size_t victim = slice;
+            size_t most = 0;
+            for (size_t i = 0; i < slices_.size(); ++i) {
+                pthread_mutex_lock(&slices_[i].mutex);
+                const size_t remaining = slices_[i].end - slices_[i].begin;
+                pthread_mutex_unlock(&slices_[i].mutex);
+                if ((i != slice) && (remaining > most)) {
+                    victim = i;
+                    most = remaining;
+                }
+            }
+            if (most == 0) {
+                return false; // nothing left anywhere
+            }
+
+            Slice& other = slices_[victim];
+            pthread_mutex_lock(&other.mutex);
+            if (other.begin >= other.end) {
+                pthread_mutex_unlock(&other.mutex);
+                continue; // somebody was faster, try again
+            }
+            const size_t end = other.end;
+            const size_t middle = other.begin + (end - other.begin) / 2;
+            other.end = middle;
+            pthread_mutex_unlock(&other.mutex);
+
+            Slice& own = slices_[slice];
+            pthread_mutex_lock(&own.mutex);
+            own.begin = middle + 1;
+            own.end = end;
+            pthread_mutex_unlock(&own.mutex);
+            index = middle;
+            return true;
+        }
+    }
+
+    void stop()
+    {
+        pthread_mutex_lock(&mutex_);
+        stopping_ = true;
+        pthread_cond_broadcast(&wake_);
+        pthread_mutex_unlock(&mutex_);
+        for (size_t i = 0; i < threads_.size(); ++i) {
+            pthread_join(threads_[i], NULL);
+        }
+        threads_.clear();
+    }
+
+    void destroy()
+    {
+        for (size_t i = 0; i < slices_.size(); ++i) {
+            pthread_mutex_destroy(&slices_[i].mutex);
+        }
+        pthread_key_delete(workerKey_);
+        pthread_cond_destroy(&done_);
+        pthread_cond_destroy(&wake_);
+        pthread_mutex_destroy(&mutex_);
+        pthread_mutex_destroy(&jobMutex_);
+    }
+};
+
+MerkleTreeThreadPool::MerkleTreeThreadPool(size_t concurrency)
+    : impl_(NULL)
+{
+    if (concurrency == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        concurrency = (cpus > 0) ? cpus : 1;
+    }
+    impl_ = new Impl(concurrency);
+}
+
+MerkleTreeThreadPool::~MerkleTreeThreadPool()
+{
+    delete impl_;
+}
+
+void MerkleTreeThreadPool::parallelFor(size_t count, Task& task)
+{
+    impl_->parallelFor(count, task);
+}
+
+size_t MerkleTreeThreadPool::getConcurrency() const
+{
+    return impl_->getConcurrency();
+}
+
+MerkleTreeThreadPool& MerkleTreeThreadPool::getDefault()
+{
+    pthread_once(&defaultPoolOnce, createDefaultPool);
+    return *defaultPool;
+}
@@ -0,0 +1,331 @@
+#include "merkle-tree/file-builder.hpp"
+#include <algorithm>
+#include <sstream>
+#include <cerrno>
+#include <cstring>
+#include "digest-sort.hpp"
+#include "layer-hash.hpp"
+#include "tree-file.hpp"
+
+extern "C" {
+#include <fcntl.h>
+#include <unistd.h>
+}
+
+namespace {
+
+/** The memory budget is never lower than this, in bytes */
+const size_t MIN_MEMORY_BUDGET_B = 64 << 10;
+
+/** Number of leaves read at a time by `addFile()` */
+const size_t LEAVES_PER_READ = 4096;
+
+/** Position of the leaves in the output file
+ *
+ * The number of layers is not known before all the leaves have been added,
+ * so room is left for as many layer offsets as there can be.
+ */
+uint64_t getLeavesPosition()
+{
+    return makeTreeFileHeader(false, TREE_FILE_MAX_LAYERS, 0, 0).nodesPos;
+}
+
+/** Open a file for writing, replacing it if it exists */
+int createFile(const std::string& path)
+{
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        std::ostringstream oss;
+        oss << "Failed to create " << path << ": " << strerror(errno);
+        throw std::runtime_error(oss.str());
+    }
+    return fd;
+}
+
+/** Orders the heads of runs so the lowest one comes first in a heap */
+struct HeadGreater
+{
+    bool operator()(const std::pair<MerkleTree::Digest, size_t>& a,
+            const std::pair<MerkleTree::Digest, size_t>& b) const
+    {
+        return a.first > b.first;
+    }
+};
+
+} // namespace
+
+MerkleTreeFileBuilder::MerkleTreeFileBuilder(const std::string& path,
+        bool preserveOrder, size_t memoryBudget)
+    : path_(path), fd_(-1), preserveOrder_(preserveOrder),
+      memoryBudget_(std::max(memoryBudget, MIN_MEMORY_BUDGET_B)),
+      leafCount_(0), written_(0), finished_(false), runsFd_(-1)
+{
+    // NB: In unordered mode, sorting a run takes twice its size
+    const size_t capacity = memoryBudget_ / sizeof(MerkleTree::Digest)
+        / (preserveOrder_ ? 1 : 2);
+    buffer_.reserve(capacity);
+    fd_ = createTreeFile(path_);
+}
+
+MerkleTreeFileBuilder::~MerkleTreeFileBuilder()
+{
+    if (fd_ >= 0) {
+        close(fd_);
+        unlink(getTreeFileTempPath(path_).c_str());
+    }
+    if (runsFd_ >= 0) {
+        close(runsFd_);
+        unlink(runsPath_.c_str());
+    }
+}
+
+void MerkleTreeFileBuilder::add(const MerkleTree::Buffer& element)
+{
+    if (element.empty()) {
+        return; // ignore empty elements
+    }
+    if (element.size() != MERKLE_TREE_ELEMENT_SIZE_B) {
+        std::ostringstream oss;
+        oss << "Element size is " << element.size() << ", it must be "
+            << MERKLE_TREE_ELEMENT_SIZE_B;
+        throw std::runtime_error(oss.str());
+    }
+    const MerkleTree::Digest leaf = MerkleTree::Digest::fromBuffer(element);
+    add(&leaf, 1);
+}
+
+void MerkleTreeFileBuilder::add(const MerkleTree::Digest* leaves, size_t count)
+{
+    if (finished_) {
+        throw std::runtime_error("Tree file already finished");
+    }
+    while (count > 0) {
+        const size_t room = buffer_.capacity() - buffer_.size();
+        const size_t n = std::min(count, room);
+        buffer_.insert(buffer_.end(), leaves, leaves + n);
+        leafCount_ += n;
+        leaves += n;
+        count -= n;
+        if (buffer_.size() == buffer_.capacity()) {
+            flush();
+        }
+    }
+}
+
+void MerkleTreeFileBuilder::addFile(int fd)
+{
+    MerkleTree::Digests chunk(LEAVES_PER_READ);
+    uint8_t* data = chunk[0].bytes;
+    const size_t size = chunk.size() * sizeof(MerkleTree::Digest);
+    size_t filled = 0;
+    for (;;) {
+        ssize_t ret = read(fd, data + filled, size - filled);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::ostringstream oss;
+            oss << "Failed to read leaves: " << strerror(errno);
+            throw std::runtime_error(oss.str());
+        }
+        filled += ret;
+        if ((filled == size) || (ret == 0)) {
+            add(&chunk[0], filled / sizeof(MerkleTree::Digest));
+            if (ret == 0) {
+                break;
+            }
+            filled = 0;
+        }
+    }
+    if (filled % sizeof(MerkleTree::Digest) != 0) {
+        throw std::runtime_error("Leaves file size is not a multiple of the "
+                "leaf size");
+    }
+}
+
+MerkleTree::Buffer MerkleTreeFileBuilder::finish()
+{
+    if (finished_) {
+        throw std::runtime_error("Tree file already finished");
+    }
+    flush();
+    const uint64_t count = preserveOrder_ ? written_ : mergeRuns();
+    if (count == 0) {
+        throw std::runtime_error("Empty elements list");
+    }
+    MerkleTree::Digests().swap(buffer_); // not needed anymore
+
+    std::vector<uint64_t> layerOffsets;
+    layerOffsets.push_back(0);
+    uint64_t size = count;
+    uint64_t total = 0;
+    for (;;) {
+        total += size;
+        layerOffsets.push_back(total);
+        if (size <= 1) {
+            break;
+        }
+        size = (size + 1) / 2;
+    }
+
+    // Build each layer from the one below it, in chunks of an even number
+    // of hashes, so a pair is never split between two chunks
+    const uint64_t leavesPosition = getLeavesPosition();
+    const size_t chunkSize = std::max<size_t>(2,
+            (memoryBudget_ * 2 / 3 / sizeof(MerkleTree::Digest)) & ~size_t(1));
+    MerkleTree::Digests in(std::min<uint64_t>(chunkSize, count));
+    MerkleTree::Digests out((in.size() + 1) / 2);
+    MerkleTree::Digest root;
+    readTreeFile(fd_, root.bytes, sizeof(root), leavesPosition);
+    for (size_t layer = 1; layer + 1 < layerOffsets.size(); ++layer) {
+        const uint64_t previousSize = layerOffsets[layer] - layerOffsets[layer - 1];
+        const uint64_t inPosition = leavesPosition
+            + layerOffsets[layer - 1] * sizeof(MerkleTree::Digest);
+        const uint64_t outPosition = leavesPosition
+            + layerOffsets[layer] * sizeof(MerkleTree::Digest);
+        for (uint64_t i = 0; i < previousSize; i += chunkSize) {
+            const size_t n = std::min<uint64_t>(chunkSize, previousSize - i);
+            readTreeFile(fd_, &in[0], n * sizeof(MerkleTree::Digest),
+                    inPosition + i * sizeof(MerkleTree::Digest));
+            const size_t pairs = n / 2;
+            hashPairs<MerkleTree>(&in[0], pairs, preserveOrder_, &out[0]);
+            if (n & 1) {
+                out[pairs] = in[n - 1]; // odd one out, carried up as is
+            }
+            writeTreeFile(fd_, &out[0],
+                    (pairs + (n & 1)) * sizeof(MerkleTree::Digest),
+                    outPosition + (i / 2) * sizeof(MerkleTree::Digest));
+        }
+        root = out[0];
+    }
+
+    // Complete the file; the header goes last, so an incomplete file can't
+    // be opened
+    TreeFileHeader header = makeTreeFileHeader(preserveOrder_,
+            TREE_FILE_MAX_LAYERS, total, 0);
+    header.layerCount = layerOffsets.size() - 1;
+    writeTreeFile(fd_, &layerOffsets[0],
+            layerOffsets.size() * sizeof(uint64_t), header.layerOffsetsPos);
+    if (ftruncate(fd_, getTreeFileSize(header)) < 0) {
+        std::ostringstream oss;
+        oss << "Failed to resize " << getTreeFileTempPath(path_) << ": "
+            << strerror(errno);
+        throw std::runtime_error(oss.str());
+    }
+    writeTreeFile(fd_, &header, sizeof(header), 0);
+    const int fd = fd_;
+    fd_ = -1;
+    commitTreeFile(fd, path_);
+    finished_ = true;
+    if (runsFd_ >= 0) {
+        close(runsFd_);
+        runsFd_ = -1;
+        unlink(runsPath_.c_str());
+    }
+    return root.toBuffer();
+}
+
+void MerkleTreeFileBuilder::flush()
+{
+    if (buffer_.empty()) {
+        return;
+    }
+    const size_t capacity = buffer_.capacity();
+    if (preserveOrder_) {
+        writeTreeFile(fd_, &buffer_[0],
+                buffer_.size() * sizeof(MerkleTree::Digest),
+                getLeavesPosition() + written_ * sizeof(MerkleTree::Digest));
+        written_ += buffer_.size();
+    } else {
+        sortUniqueDigests(buffer_, NULL);
+        if (runsFd_ < 0) {
+            runsPath_ = path_ + ".runs";
+            runsFd_ = createFile(runsPath_);
+        }
+        Run run;
+        run.position = runs_.empty() ? 0
+            : runs_.back().position
+              + runs_.back().count * sizeof(MerkleTree::Digest);
+        run.count = buffer_.size();
+        writeTreeFile(runsFd_, &buffer_[0],
+                buffer_.size() * sizeof(MerkleTree::Digest), run.position);
+        runs_.push_back(run);
+    }
+    buffer_.clear();
+    buffer_.reserve(capacity); // sorting may have swapped the buffer
+}
+
+uint64_t MerkleTreeFileBuilder::mergeRuns()
+{
+    if (runs_.empty()) {
+        return 0;
+    }
+    MerkleTree::Digests().swap(buffer_); // make room for the merge
+
+    // One read buffer per run, plus the output buffer
+    const size_t bufferSize = std::max<size_t>(1, memoryBudget_
+            / sizeof(MerkleTree::Digest) / (runs_.size() + 1));
+    std::vector<MerkleTree::Digests> inputs(runs_.size());
+    std::vector<size_t> positions(runs_.size(), 0); // next leaf in `inputs`
+    std::vector<uint64_t> consumed(runs_.size(), 0); // leaves read from runs
+    std::vector<std::pair<MerkleTree::Digest, size_t> > heads;
+    for (size_t r = 0; r < runs_.size(); ++r) {
+        consumed[r] = readRun(runsFd_, runs_[r], consumed[r], bufferSize,
+                inputs[r]);
+        heads.push_back(std::make_pair(inputs[r][0], r));
+    }
+    std::make_heap(heads.begin(), heads.end(), HeadGreater());
+
+    MerkleTree::Digests output;
+    output.reserve(bufferSize);
+    const uint64_t leavesPosition = getLeavesPosition();
+    uint64_t count = 0;
+    MerkleTree::Digest last;
+    while (!heads.empty()) {
+        std::pop_heap(heads.begin(), heads.end(), HeadGreater());
+        const MerkleTree::Digest leaf = heads.back().first;
+        const size_t r = heads.back().second;
+        heads.pop_back();
+
+        // NB: Duplicates come out one after the other
+        if ((count + output.size() == 0) || (leaf != last)) {
+            output.push_back(leaf);
+            last = leaf;
+            if (output.size() == bufferSize) {
+                writeTreeFile(fd_, &output[0],
+                        output.size() * sizeof(MerkleTree::Digest),
+                        leavesPosition + count * sizeof(MerkleTree::Digest));
+                count += output.size();
+                output.clear();
+            }
+        }
+
+        if (++positions[r] == inputs[r].size()) {
+            if (consumed[r] == runs_[r].count) {
+                continue; // this run is done
+            }
+            consumed[r] = readRun(runsFd_, runs_[r], consumed[r], bufferSize,
+                    inputs[r]);
+            positions[r] = 0;
+        }
+        heads.push_back(std::make_pair(inputs[r][positions[r]], r));
+        std::push_heap(heads.begin(), heads.end(), HeadGreater());
+    }
+    if (!output.empty()) {
+        writeTreeFile(fd_, &output[0],
+                output.size() * sizeof(MerkleTree::Digest),
+                leavesPosition + count * sizeof(MerkleTree::Digest));
+        count += output.size();
+    }
+    return count;
+}
+
+uint64_t MerkleTreeFileBuilder::readRun(int fd, const Run& run,
+        uint64_t consumed, size_t bufferSize, MerkleTree::Digests& input)
+{
+    const size_t n = std::min<uint64_t>(bufferSize, run.count - consumed);
+    input.resize(n);
+    readTreeFile(fd, &input[0], n * sizeof(MerkleTree::Digest),
+            run.position + consumed * sizeof(MerkleTree::Digest));
+    return consumed + n;
+}
@@ -0,0 +1,65 @@
+#ifndef MERKLE_TREE_HASH_POLICY_HPP_
+#define MERKLE_TREE_HASH_POLICY_HPP_
+
+#include "merkle-tree/merkle-tree.hpp"
+#include "blake2.h"
+#include "blake2b-multi.h"
+#include "stats-counters.hpp"
+
+/** BLAKE2b hash policy, \see BasicMerkleTree
+ *
+ * A hash policy provides, as static members:
+ *  - `State`, `init()`, `update()` and `final()`, to hash data incrementally
+ *  - `hashPairs()`, to hash many pairs of digests at once
+ *  - `BLOCK_SIZE_B`, the block size of the hash function; data read from
+ *    files is hashed in multiples of it
+ *  - `MAX_DIGEST_SIZE_B`, the largest digest size supported
+ *
+ * The digest size is always a compile-time constant of the calling tree, so
+ * all of this is inlined into each configuration. This is also where the
+ * hashing work is counted, \see MerkleTreeStats.
+ */
+struct MerkleTreeBlake2b
+{
+    typedef blake2b_state State;
+
+    static const size_t BLOCK_SIZE_B = BLAKE2B_BLOCKBYTES;
+
+    /** A pair of digests must fit in a single block */
+    static const size_t MAX_DIGEST_SIZE_B = BLAKE2B_BLOCKBYTES / 2;
+
+    static void init(State& state, size_t digestSize)
+    {
+        blake2b_init(&state, digestSize);
+    }
+
+    static void update(State& state, const void* data, size_t size)
+    {
+        blake2b_update(&state, data, size);
+    }
+
+    static void final(State& state, uint8_t* digest, size_t digestSize)
+    {
+        blake2b_final(&state, digest, digestSize);
+
+        // NB: The last block is compressed even if empty
+        MERKLE_TREE_STATS_ADD(bytesHashed, state.t[0]);
+        MERKLE_TREE_STATS_ADD(compressions, (state.t[0] > 0)
+                ? (state.t[0] + BLOCK_SIZE_B - 1) / BLOCK_SIZE_B : 1);
+    }
+
+    /** Hash `count` pairs of digests
+     *
+     * Pair `i` is the digest at `left[i]` followed by the digest at
+     * `right[i]`; its hash is written at `out + i * digestSize`.
+     */
+    static void hashPairs(uint8_t* out, const uint8_t* const* left,
+            const uint8_t* const* right, size_t digestSize, size_t count)
+    {
+        blake2b_pairs(out, digestSize, left, right, digestSize, count);
+        MERKLE_TREE_STATS_ADD(bytesHashed, 2 * digestSize * count);
+        MERKLE_TREE_STATS_ADD(compressions, count);
+    }
+};
+
+#endif // MERKLE_TREE_HASH_POLICY_HPP_
@@ -0,0 +1,41 @@
+#include "layer-hash.hpp"
+#include <algorithm>
+#include "hash-policy.hpp"
+
+namespace {
+
+/** Number of pairs hashed per call to the hash policy */
+const size_t PAIRS_PER_BATCH = 64;
+
+} // namespace
+
+template <class Tree>
+void hashPairs(const typename Tree::Digest* in, size_t pairs,
+        bool preserveOrder, typename Tree::Digest* out)
+{
+    typedef typename Tree::Digest Digest;
+    for (size_t i = 0; i < pairs; i += PAIRS_PER_BATCH) {
+        const size_t count = std::min(PAIRS_PER_BATCH, pairs - i);
+        const uint8_t* left[PAIRS_PER_BATCH];
+        const uint8_t* right[PAIRS_PER_BATCH];
+        for (size_t j = 0; j < count; ++j) {
+            const Digest& first = in[2*(i + j)];
+            const Digest& second = in[2*(i + j) + 1];
+            if (preserveOrder || (first > second)) {
+                left[j] = first.bytes;
+                right[j] = second.bytes;
+            } else {
+                left[j] = second.bytes;
+                right[j] = first.bytes;
+            }
+        }
+        // NB: Digests are exactly `Tree::DIGEST_SIZE_B` bytes apart
+        Tree::Hash::hashPairs(out[i].bytes, left, right, Tree::DIGEST_SIZE_B,
+                count);
+    }
+}
+
+template void hashPairs<MerkleTree>(const MerkleTree::Digest*, size_t, bool,
+        MerkleTree::Digest*);
+template void hashPairs<MerkleTree256>(const MerkleTree256::Digest*, size_t,
+        bool, MerkleTree256::Digest*);
@@ -0,0 +1,24 @@
+#ifndef MERKLE_TREE_LAYER_HASH_HPP_
+#define MERKLE_TREE_LAYER_HASH_HPP_
+
+#include "merkle-tree/merkle-tree.hpp"
+
+/** Hash consecutive pairs of digests, as when building the next layer
+ *
+ * `out[i]` is set to the combined hash of `in[2*i]` and `in[2*i + 1]`,
+ * \see BasicMerkleTree::combinedHash(). The pairs are hashed in batches with
+ * the hash policy of `Tree`.
+ *
+ * This is instantiated for each configuration of `BasicMerkleTree` built
+ * into the library.
+ *
+ * \param in            [in]  Digests to hash, two by two
+ * \param pairs         [in]  Number of pairs
+ * \param preserveOrder [in]  Whether to preserve the order of each pair
+ * \param out           [out] Hashes of the pairs; this may not overlap `in`
+ */
+template <class Tree>
+void hashPairs(const typename Tree::Digest* in, size_t pairs,
+        bool preserveOrder, typename Tree::Digest* out);
+
+#endif // MERKLE_TREE_LAYER_HASH_HPP_
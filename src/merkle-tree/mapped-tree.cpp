@@ -0,0 +1,200 @@
+#include "merkle-tree/mapped-tree.hpp"
+#include <sstream>
+#include <cerrno>
+#include <cstring>
+#include "tree-file.hpp"
+
+extern "C" {
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+}
+
+namespace {
+
+/** Throw a `std::runtime_error` about a file */
+void throwFileError(const char* what, const std::string& path)
+{
+    std::ostringstream oss;
+    oss << what << ": " << path;
+    throw std::runtime_error(oss.str());
+}
+
+/** Whether a section of `count` items of `itemSize` bytes at `position` is
+ * aligned and fits in a file of `fileSize` bytes */
+bool isInFile(uint64_t position, uint64_t count, uint64_t itemSize,
+        uint64_t fileSize)
+{
+    return (position % MERKLE_TREE_DIGEST_ALIGN_B == 0)
+        && (position <= fileSize)
+        && (count <= (fileSize - position) / itemSize);
+}
+
+} // namespace
+
+MappedMerkleTree::MappedMerkleTree(const std::string& path)
+    : map_(NULL), mapSize_(0), preserveOrder_(false), nodes_(NULL),
+      layerOffsets_(NULL), layerCount_(0), leafSlots_(NULL), slotCount_(0)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::ostringstream oss;
+        oss << "Failed to open " << path << ": " << strerror(errno);
+        throw std::runtime_error(oss.str());
+    }
+    struct stat st;
+    if ((fstat(fd, &st) < 0) || !S_ISREG(st.st_mode)) {
+        close(fd);
+        throwFileError("Not a regular file", path);
+    }
+    if (static_cast<uint64_t>(st.st_size) < sizeof(TreeFileHeader)) {
+        close(fd);
+        throwFileError("Not a Merkle Tree file", path);
+    }
+    mapSize_ = st.st_size;
+    map_ = mmap(NULL, mapSize_, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map_ == MAP_FAILED) {
+        map_ = NULL;
+        std::ostringstream oss;
+        oss << "Failed to map " << path << ": " << strerror(errno);
+        throw std::runtime_error(oss.str());
+    }
+
+    try {
+        // NB: Only the header and the layer offsets are checked, so opening
+        // doesn't depend on the size of the tree
+        const uint8_t* base = static_cast<const uint8_t*>(map_);
+        TreeFileHeader header;
+        std::memcpy(&header, base, sizeof(header));
+        if (std::memcmp(header.magic, TREE_FILE_MAGIC, sizeof(header.magic))) {
+            throwFileError("Not a Merkle Tree file", path);
+        }
+        if (header.byteOrder != TREE_FILE_BYTE_ORDER) {
+            throwFileError("Unsupported byte order", path);
+        }
+        if (    (header.version != TREE_FILE_VERSION)
+             || (header.digestSize != MERKLE_TREE_ELEMENT_SIZE_B)) {
+            throwFileError("Unsupported file version", path);
+        }
+        if (    (header.layerCount == 0)
+             || (header.layerCount > TREE_FILE_MAX_LAYERS)
+             || !isInFile(header.layerOffsetsPos, header.layerCount + 1,
+                 sizeof(uint64_t), mapSize_)) {
+            throwFileError("Corrupted Merkle Tree file", path);
+        }
+        preserveOrder_ = (header.flags & TREE_FILE_PRESERVE_ORDER);
+        layerCount_ = header.layerCount;
+        layerOffsets_ = reinterpret_cast<const uint64_t*>(
+                base + header.layerOffsetsPos);
+
+        // Each layer must be half the size of the one below, rounded up,
+        // up to a root of its own
+        bool valid = (layerOffsets_[0] == 0)
+            && (layerOffsets_[1] > 0) && (getLayerSize(layerCount_ - 1) == 1);
+        for (size_t layer = 1; valid && (layer < layerCount_); ++layer) {
+            valid = (layerOffsets_[layer + 1] > layerOffsets_[layer])
+                && (getLayerSize(layer) == (getLayerSize(layer - 1) + 1) / 2);
+        }
+        valid = valid
+            && isInFile(header.nodesPos, layerOffsets_[layerCount_],
+                    sizeof(MerkleTree::Digest), mapSize_)
+            && isInFile(header.slotsPos, header.slotCount, sizeof(uint64_t),
+                    mapSize_)
+            && ((header.slotCount & (header.slotCount - 1)) == 0)
+            && ((header.slotCount == 0)
+                || (preserveOrder_ && (header.slotCount > getLeafCount())));
+        if (!valid) {
+            throwFileError("Corrupted Merkle Tree file", path);
+        }
+        nodes_ = reinterpret_cast<const MerkleTree::Digest*>(
+                base + header.nodesPos);
+        slotCount_ = header.slotCount;
+        if (slotCount_ > 0) {
+            leafSlots_ = reinterpret_cast<const uint64_t*>(
+                    base + header.slotsPos);
+        }
+    } catch (...) {
+        munmap(map_, mapSize_);
+        throw;
+    }
+}
+
+MappedMerkleTree::~MappedMerkleTree()
+{
+    munmap(map_, mapSize_);
+}
+
+TreeView MappedMerkleTree::getView() const
+{
+    TreeView view;
+    view.nodes = nodes_;
+    view.layerOffsets = layerOffsets_;
+    view.layerCount = layerCount_;
+    view.preserveOrder = preserveOrder_;
+    view.leafSlots = leafSlots_;
+    view.slotCount = slotCount_;
+    return view;
+}
+
+MerkleTree::Elements MappedMerkleTree::getProof(
+        const MerkleTree::Buffer& element) const
+{
+    size_t index;
+    if (    (element.size() != MERKLE_TREE_ELEMENT_SIZE_B)
+         || !getView().findLeaf(MerkleTree::Digest::fromBuffer(element), index)) {
+        throw std::runtime_error("Element not found");
+    }
+    return getView().getProof(index);
+}
+
+std::string MappedMerkleTree::getProofHex(
+        const MerkleTree::Buffer& element) const
+{
+    return MerkleTree::elementsToHex(getProof(element));
+}
+
+MerkleTree::Elements MappedMerkleTree::getProofOrdered(
+        const MerkleTree::Buffer& element, size_t index) const
+{
+    if (index == 0) {
+        throw std::runtime_error("Index is zero");
+    }
+    index--;
+    if (    (index >= getLeafCount())
+         || (element.size() != MERKLE_TREE_ELEMENT_SIZE_B)
+         || (getLayer(0)[index] != MerkleTree::Digest::fromBuffer(element))) {
+        throw std::runtime_error("Index does not point to element");
+    }
+    return getView().getProof(index);
+}
+
+std::string MappedMerkleTree::getProofOrderedHex(
+        const MerkleTree::Buffer& element, size_t index) const
+{
+    return MerkleTree::elementsToHex(getProofOrdered(element, index));
+}
+
+size_t MappedMerkleTree::getProof(const MerkleTree::Digest& element,
+        MerkleTree::Digest* proof, size_t capacity) const
+{
+    size_t index;
+    if (!getView().findLeaf(element, index)) {
+        throw std::runtime_error("Element not found");
+    }
+    return getView().getProof(index, proof, capacity);
+}
+
+size_t MappedMerkleTree::getProofOrdered(const MerkleTree::Digest& element,
+        size_t index, MerkleTree::Digest* proof, size_t capacity) const
+{
+    if (index == 0) {
+        throw std::runtime_error("Index is zero");
+    }
+    index--;
+    if ((index >= getLeafCount()) || (getLayer(0)[index] != element)) {
+        throw std::runtime_error("Index does not point to element");
+    }
+    return getView().getProof(index, proof, capacity);
+}
@@ -2,7 +2,157 @@
 #include <sstream>
 #include <iomanip>
 #include <algorithm>
-#include "blake2.h"
+#include <utility>
+#include <cerrno>
+#include <cstring>
+#include "digest-sort.hpp"
+#include "hash-policy.hpp"
+#include "layer-hash.hpp"
+#include "proof-path.hpp"
+#include "stats-counters.hpp"
+#include "tree-file.hpp"
+#include "tree-view.hpp"
+
+extern "C" {
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+}
+
+namespace {
+
+/** Compile-time checks of a configuration of `BasicMerkleTree`
+ *
+ * Layers are hashed straight into `Digests`, which requires digests to be
+ * packed without padding; the leaf hash table mixes in the first 16 bytes of
+ * each digest; and the hash policy must support the digest size.
+ */
+template <class Tree>
+struct ConfigurationCheck
+{
+    typedef char DigestSize[
+        (    (sizeof(typename Tree::Digest) == Tree::DIGEST_SIZE_B)
+          && (Tree::DIGEST_SIZE_B >= 16)
+          && (Tree::DIGEST_SIZE_B <= Tree::Hash::MAX_DIGEST_SIZE_B))
+        ? 1 : -1];
+};
+
+/** Below this number of leaves, trees are built serially */
+const size_t MIN_PARALLEL_LEAVES = 1 << 15;
+
+/** Minimum number of leaves under a subtree built by a single work item,
+ * as a power of 2 */
+const size_t MIN_SUBTREE_HEIGHT = 12;
+
+/** Number of subtrees to aim for, per executor thread; more than one so
+ * threads can balance the load by stealing work */
+const size_t SUBTREES_PER_THREAD = 8;
+
+/** Minimum ratio of slots to leaves in the leaf hash table */
+const size_t LEAF_SLOTS_PER_LEAF = 2;
+
+/** Size of the buffer used to read files that can't be mapped in memory, in
+ * blocks of the hash function, so it can compress straight from it */
+const size_t READ_BUFFER_BLOCKS = 512;
+
+/** Number of pairs hashed at a time by `BasicMerkleTree::merkleRoot()` */
+const size_t ROOT_PAIRS_PER_BATCH = 64;
+
+/** Number of scattered pairs hashed at a time when updating leaves */
+const size_t NODE_PAIRS_PER_BATCH = 64;
+
+/** Below this number of nodes to rehash, a layer is updated serially */
+const size_t MIN_PARALLEL_NODES = 1 << 12;
+
+/** Minimum number of nodes rehashed by a single work item */
+const size_t MIN_NODES_PER_ITEM = 1 << 10;
+
+/** Throw a `std::runtime_error` describing `errno` */
+void throwErrno(const char* what)
+{
+    std::ostringstream oss;
+    oss << what << ": " << strerror(errno);
+    throw std::runtime_error(oss.str());
+}
+
+/** Start a new hash computation */
+template <class Tree>
+void hashInit(typename Tree::Hash::State& state)
+{
+    Tree::Hash::init(state, Tree::DIGEST_SIZE_B);
+}
+
+/** Finish a hash computation and return the digest */
+template <class Tree>
+typename Tree::Buffer hashFinal(typename Tree::Hash::State& state)
+{
+    uint8_t digest[Tree::DIGEST_SIZE_B];
+    Tree::Hash::final(state, digest, sizeof(digest));
+    return typename Tree::Buffer(digest, digest + sizeof(digest));
+}
+
+/** Hash a file by reading it in chunks
+ *
+ * If `positional` is `true`, the file is read with `pread()` starting at
+ * `offset`, for at most `size` bytes; otherwise it is read with `read()`
+ * until end of file. In both cases, this stops at end of file.
+ *
+ * \return The number of bytes hashed
+ */
+template <class Hash>
+size_t hashRead(typename Hash::State& state, int fd, bool positional,
+        off_t offset, size_t size)
+{
+    std::vector<uint8_t> buffer(READ_BUFFER_BLOCKS * Hash::BLOCK_SIZE_B);
+    size_t total = 0;
+    while (total < size) {
+        const size_t count = std::min(buffer.size(), size - total);
+        ssize_t ret;
+        if (positional) {
+            ret = pread(fd, &buffer[0], count, offset + total);
+        } else {
+            ret = read(fd, &buffer[0], count);
+        }
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throwErrno("Failed to read file");
+        }
+        if (ret == 0) {
+            break; // end of file
+        }
+        Hash::update(state, &buffer[0], ret);
+        total += ret;
+    }
+    return total;
+}
+
+/** Hash a region of a file by mapping it in memory
+ *
+ * The region must be within the file, otherwise accessing the mapping
+ * would raise SIGBUS.
+ *
+ * \return `true` if OK, `false` if the region can't be mapped
+ */
+template <class Hash>
+bool hashMapped(typename Hash::State& state, int fd, off_t offset,
+        size_t size)
+{
+    const off_t pageSize = sysconf(_SC_PAGESIZE);
+    const off_t start = offset - (offset % pageSize);
+    const size_t length = size + (offset - start);
+    void* addr = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, start);
+    if (addr == MAP_FAILED) {
+        return false;
+    }
+    madvise(addr, length, MADV_SEQUENTIAL);
+    Hash::update(state, static_cast<uint8_t*>(addr) + (offset - start), size);
+    munmap(addr, length);
+    return true;
+}
+
+} // namespace
 
 std::ostream& operator<<(std::ostream& os, const MerkleTree::Buffer& buffer)
 {
@@ -14,61 +164,300 @@ std::ostream& operator<<(std::ostream& os, const MerkleTree::Buffer& buffer)
     return os;
 }
 
-MerkleTree::MerkleTree(const Elements& elements, bool preserveOrder)
-    : preserveOrder_(preserveOrder)
+namespace {
+
+/** Resolve the executor to use */
+MerkleTreeExecutor& getExecutor(MerkleTreeExecutor* executor)
+{
+    return executor ? *executor : MerkleTreeThreadPool::getDefault();
+}
+
+/** Convert elements into digests, ignoring empty elements
+ *
+ * \throw `std::runtime_error` if `elements` is empty, or if it contains an
+ *        element which is not of the right size
+ */
+template <class Tree>
+typename Tree::Digests toDigests(const typename Tree::Elements& elements)
 {
     if (elements.empty()) {
         throw std::runtime_error("Empty elements list");
     }
 
-    for (   Elements::const_iterator it = elements.begin();
+    typename Tree::Digests leaves;
+    leaves.reserve(elements.size());
+    for (   typename Tree::Elements::const_iterator it = elements.begin();
             it != elements.end();
             ++it) {
         if (it->empty()) {
             continue; // ignore empty elements
         }
-        if (it->size() != MERKLE_TREE_ELEMENT_SIZE_B) {
+        if (it->size() != Tree::DIGEST_SIZE_B) {
             std::ostringstream oss;
             oss << "Element size is " << it->size() << ", it must be "
-                << MERKLE_TREE_ELEMENT_SIZE_B;
+                << Tree::DIGEST_SIZE_B;
             throw std::runtime_error(oss.str());
         }
-        if (!preserveOrder_) {
-            // Check that this element has not been pushed yet
-            if (std::find(elements_.begin(), elements_.end(), *it)
-                    != elements_.end()) {
-                continue; // ignore duplicates
+        leaves.push_back(Tree::Digest::fromBuffer(*it));
+    } // for each element
+    return leaves;
+}
+
+/** Walk up the proof of a leaf of a Merkle Tree with preserved order
+ *
+ * Unlike `checkProofOrdered()`, this knows the number of leaves, and so
+ * which layers the proof skips.
+ *
+ * \param proof     [in]  Proof of `leaf`
+ * \param leaf      [in]  Leaf
+ * \param position  [in]  Position of `leaf`, starting at 0
+ * \param leafCount [in]  Number of leaves of the Merkle Tree
+ * \param root      [out] Root computed from `leaf` and `proof`
+ *
+ * \return `false` if `proof` is not of the right length for this position
+ */
+template <class Tree>
+bool walkOrderedProof(const typename Tree::Elements& proof,
+        const typename Tree::Digest& leaf, size_t position, size_t leafCount,
+        typename Tree::Digest& root)
+{
+    root = leaf;
+    size_t next = 0;
+    for (size_t size = leafCount; size > 1; size = (size + 1) / 2) {
+        // The last hash of a layer with an odd number of hashes has no peer
+        if ((position ^ 1) < size) {
+            if (    (next == proof.size())
+                 || (proof[next].size() != Tree::DIGEST_SIZE_B)) {
+                return false;
             }
+            const typename Tree::Digest sibling =
+                Tree::Digest::fromBuffer(proof[next]);
+            root = (position & 1) ? Tree::combinedHash(sibling, root, true)
+                : Tree::combinedHash(root, sibling, true);
+            ++next;
         }
-        elements_.push_back(*it);
-    } // for each element
+        position /= 2;
+    }
+    return next == proof.size();
+}
 
-    if (!preserveOrder_) {
-        std::sort(elements_.begin(), elements_.end()); // sort elements
+/** Order leaf updates by index only, so a stable sort keeps the updates of
+ * an index in the order they were given */
+template <class Update>
+bool updateIndexLess(const Update& a, const Update& b)
+{
+    return a.first < b.first;
+}
+
+} // namespace
+
+template <class H, size_t N>
+const size_t BasicMerkleTree<H, N>::DIGEST_SIZE_B;
+
+template <class H, size_t N>
+const size_t BasicMerkleTree<H, N>::MAX_PROOF_LENGTH;
+
+/** Build the layers above blocks of `2^height` leaves, one block per item */
+template <class H, size_t N>
+class BasicMerkleTree<H, N>::SubtreesTask : public MerkleTreeExecutor::Task
+{
+public :
+    SubtreesTask(BasicMerkleTree& tree, size_t height)
+        : tree_(tree), height_(height)
+    {
+    }
+
+    virtual void run(size_t index)
+    {
+        for (size_t layer = 1; layer <= height_; ++layer) {
+            const size_t shift = height_ - layer;
+            const size_t first = index << shift;
+            const size_t last = std::min((index + 1) << shift,
+                    tree_.getLayerSize(layer));
+            if (first < last) {
+                tree_.getNextLayer(layer, first, last);
+            }
+        }
+    }
+
+private :
+    BasicMerkleTree& tree_;
+    size_t           height_;
+};
+
+/** Rehash a slice of the nodes of a layer per item */
+template <class H, size_t N>
+class BasicMerkleTree<H, N>::NodesTask : public MerkleTreeExecutor::Task
+{
+public :
+    NodesTask(BasicMerkleTree& tree, size_t layer,
+            const std::vector<size_t>& nodes, size_t items)
+        : tree_(tree), layer_(layer), nodes_(nodes), items_(items)
+    {
+    }
+
+    virtual void run(size_t index)
+    {
+        const size_t first = nodes_.size() * index / items_;
+        const size_t last = nodes_.size() * (index + 1) / items_;
+        tree_.rehashNodes(layer_, &nodes_[first], last - first);
+    }
+
+private :
+    BasicMerkleTree&           tree_;
+    size_t                     layer_;
+    const std::vector<size_t>& nodes_;
+    size_t                     items_;
+};
+
+template <class H, size_t N>
+BasicMerkleTree<H, N>::BasicMerkleTree(const Elements& elements,
+        bool preserveOrder)
+    : preserveOrder_(preserveOrder)
+{
+    Digests leaves = toDigests<BasicMerkleTree>(elements);
+    build(leaves, NULL);
+}
+
+template <class H, size_t N>
+BasicMerkleTree<H, N>::BasicMerkleTree(const Elements& elements,
+        bool preserveOrder, MerkleTreeExecutor& executor)
+    : preserveOrder_(preserveOrder)
+{
+    Digests leaves = toDigests<BasicMerkleTree>(elements);
+    build(leaves, &executor);
+}
+
+template <class H, size_t N>
+BasicMerkleTree<H, N>::BasicMerkleTree(const Digests& leaves,
+        bool preserveOrder)
+    : preserveOrder_(preserveOrder)
+{
+    Digests copy(leaves);
+    build(copy, NULL);
+}
+
+template <class H, size_t N>
+BasicMerkleTree<H, N>::BasicMerkleTree(const Digests& leaves,
+        bool preserveOrder, MerkleTreeExecutor& executor)
+    : preserveOrder_(preserveOrder)
+{
+    Digests copy(leaves);
+    build(copy, &executor);
+}
+
+template <class H, size_t N>
+BasicMerkleTree<H, N>::BasicMerkleTree(const BasicMerkleTree& other)
+    : preserveOrder_(other.preserveOrder_), nodes_(other.nodes_),
+      layerOffsets_(other.layerOffsets_), leafSlots_(other.leafSlots_)
+{
+    MERKLE_TREE_STATS_ADD(layerBytes, getMemoryUsage());
+}
+
+template <class H, size_t N>
+BasicMerkleTree<H, N>& BasicMerkleTree<H, N>::operator=(
+        const BasicMerkleTree& other)
+{
+    if (this != &other) {
+        BasicMerkleTree copy(other);
+        std::swap(preserveOrder_, copy.preserveOrder_);
+        nodes_.swap(copy.nodes_);
+        layerOffsets_.swap(copy.layerOffsets_);
+        leafSlots_.swap(copy.leafSlots_);
     }
+    return *this;
+}
+
+template <class H, size_t N>
+BasicMerkleTree<H, N>::~BasicMerkleTree()
+{
+    MERKLE_TREE_STATS_ADD(layerBytes, -static_cast<int64_t>(getMemoryUsage()));
+}
 
-    getLayers();
+template <class H, size_t N>
+typename BasicMerkleTree<H, N>::Buffer BasicMerkleTree<H, N>::hash(
+        const Buffer& data)
+{
+    return hash(data.empty() ? NULL : &data[0], data.size());
 }
 
-MerkleTree::~MerkleTree()
+template <class H, size_t N>
+typename BasicMerkleTree<H, N>::Buffer BasicMerkleTree<H, N>::hash(
+        const void* data, size_t size)
 {
+    typename H::State state;
+    hashInit<BasicMerkleTree>(state);
+    H::update(state, data, size);
+    return hashFinal<BasicMerkleTree>(state);
 }
 
-MerkleTree::Buffer MerkleTree::hash(const Buffer& data)
+template <class H, size_t N>
+typename BasicMerkleTree<H, N>::Buffer BasicMerkleTree<H, N>::hashIov(
+        const struct iovec* iov, size_t iovcnt)
 {
-    blake2b_state state;
-    blake2b_init(&state, MERKLE_TREE_ELEMENT_SIZE_B);
-    for (Buffer::const_iterator it = data.begin(); it != data.end(); ++it) {
-        blake2b_update(&state, &(*it), sizeof(*it));
+    typename H::State state;
+    hashInit<BasicMerkleTree>(state);
+    for (size_t i = 0; i < iovcnt; ++i) {
+        H::update(state, iov[i].iov_base, iov[i].iov_len);
     }
-    uint8_t digest[MERKLE_TREE_ELEMENT_SIZE_B];
-    blake2b_final(&state, digest, sizeof(digest));
-    return Buffer(digest, digest + sizeof(digest));
+    return hashFinal<BasicMerkleTree>(state);
 }
 
-MerkleTree::Buffer MerkleTree::combinedHash(const Buffer& first,
-        const Buffer& second, bool preserveOrder)
+template <class H, size_t N>
+typename BasicMerkleTree<H, N>::Buffer BasicMerkleTree<H, N>::hashFile(
+        int fd)
 {
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        throwErrno("Failed to stat file");
+    }
+    if (S_ISREG(st.st_mode) && (st.st_size > 0)) {
+        return hashFile(fd, 0, st.st_size);
+    }
+
+    // Not a regular file, or a file that does not report its size (like
+    // the ones in /proc): read it until the end
+    typename H::State state;
+    hashInit<BasicMerkleTree>(state);
+    hashRead<H>(state, fd, S_ISREG(st.st_mode), 0, static_cast<size_t>(-1));
+    return hashFinal<BasicMerkleTree>(state);
+}
+
+template <class H, size_t N>
+typename BasicMerkleTree<H, N>::Buffer BasicMerkleTree<H, N>::hashFile(
+        int fd, off_t offset, size_t size)
+{
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        throwErrno("Failed to stat file");
+    }
+    if (    S_ISREG(st.st_mode)
+         && ((offset > st.st_size) || (size > size_t(st.st_size - offset)))) {
+        throw std::runtime_error("File region extends past end of file");
+    }
+
+    typename H::State state;
+    hashInit<BasicMerkleTree>(state);
+    if (size > 0) {
+        if (    !S_ISREG(st.st_mode)
+             || !hashMapped<H>(state, fd, offset, size)) {
+            if (hashRead<H>(state, fd, true, offset, size) != size) {
+                throw std::runtime_error("File region extends past end of file");
+            }
+        }
+    }
+    return hashFinal<BasicMerkleTree>(state);
+}
+
+template <class H, size_t N>
+typename BasicMerkleTree<H, N>::Buffer BasicMerkleTree<H, N>::combinedHash(
+        const Buffer& first, const Buffer& second, bool preserveOrder)
+{
+    if ((first.size() == N) && (second.size() == N)) {
+        // Fast path: the two hashes are digests
+        return combinedHash(Digest::fromBuffer(first),
+                Digest::fromBuffer(second), preserveOrder).toBuffer();
+    }
     Buffer buffer;
     if (preserveOrder || (first > second)) {
         std::copy(first.begin(), first.end(), std::back_inserter(buffer));
@@ -80,57 +469,102 @@ MerkleTree::Buffer MerkleTree::combinedHash(const Buffer& first,
     return hash(buffer);
 }
 
-MerkleTree::Buffer MerkleTree::merkleRoot(const Elements& elements,
-        bool preserveOrder)
+template <class H, size_t N>
+typename BasicMerkleTree<H, N>::Digest BasicMerkleTree<H, N>::combinedHash(
+        const Digest& first, const Digest& second, bool preserveOrder)
 {
-    return MerkleTree(elements, preserveOrder).getRoot();
+    const uint8_t* left = first.bytes;
+    const uint8_t* right = second.bytes;
+    if (!preserveOrder && !(first > second)) {
+        std::swap(left, right);
+    }
+    Digest digest;
+    H::hashPairs(digest.bytes, &left, &right, N, 1);
+    return digest;
 }
 
-MerkleTree::Elements MerkleTree::getProof(const Buffer& element) const
+template <class H, size_t N>
+typename BasicMerkleTree<H, N>::Buffer BasicMerkleTree<H, N>::merkleRoot(
+        const Elements& elements, bool preserveOrder)
 {
-    bool found = false;
-    size_t index;
-    for (size_t i = 0; (i < elements_.size()) && !found; ++i) {
-        if (elements_[i] == element) {
-            found = true;
-            index = i;
+    Digests nodes = toDigests<BasicMerkleTree>(elements);
+    if (nodes.empty()) {
+        throw std::runtime_error("Empty elements list");
+    }
+    if (!preserveOrder) {
+        sortUniqueDigests(nodes, NULL);
+    }
+
+    // Replace each layer with the next one, in place; hashes are written
+    // behind the pairs still to be read, so nothing is overwritten before
+    // it is used
+    for (size_t size = nodes.size(); size > 1; size = (size + 1) / 2) {
+        const size_t pairs = size / 2;
+        Digest batch[ROOT_PAIRS_PER_BATCH];
+        for (size_t i = 0; i < pairs; i += ROOT_PAIRS_PER_BATCH) {
+            const size_t count = std::min(ROOT_PAIRS_PER_BATCH, pairs - i);
+            hashPairs<BasicMerkleTree>(&nodes[2*i], count, preserveOrder,
+                    batch);
+            std::copy(batch, batch + count, &nodes[i]);
+        }
+        if (size & 1) {
+            nodes[pairs] = nodes[size - 1]; // odd one out, carried up as is
         }
     }
-    if (!found) {
+    return nodes[0].toBuffer();
+}
+
+template <class H, size_t N>
+typename BasicMerkleTree<H, N>::Elements BasicMerkleTree<H, N>::getProof(
+        const Buffer& element) const
+{
+    if (element.size() != N) {
+        throw std::runtime_error("Element not found");
+    }
+    size_t index;
+    if (!findLeaf(Digest::fromBuffer(element), index)) {
         throw std::runtime_error("Element not found");
     }
     return getProof(index);
 }
 
-std::string MerkleTree::getProofHex(const Buffer& element) const
+template <class H, size_t N>
+std::string BasicMerkleTree<H, N>::getProofHex(const Buffer& element) const
 {
     return elementsToHex(getProof(element));
 }
 
-MerkleTree::Elements MerkleTree::getProofOrdered(const Buffer& element,
+template <class H, size_t N>
+typename BasicMerkleTree<H, N>::Elements
+BasicMerkleTree<H, N>::getProofOrdered(const Buffer& element,
         size_t index) const
 {
     if (index == 0) {
         throw std::runtime_error("Index is zero");
     }
     index--;
-    if ((index >= elements_.size()) || (elements_[index] != element)) {
+    if (    (index >= getLeafCount())
+         || (element.size() != N)
+         || (getLayer(0)[index] != Digest::fromBuffer(element))) {
         throw std::runtime_error("Index does not point to element");
     }
     return getProof(index);
 }
 
-std::string MerkleTree::getProofOrderedHex(const Buffer& element,
+template <class H, size_t N>
+std::string BasicMerkleTree<H, N>::getProofOrderedHex(const Buffer& element,
         size_t index) const
 {
     return elementsToHex(getProofOrdered(element, index));
 }
 
-bool MerkleTree::checkProof(const Elements& proof, const Buffer& root,
-        const Buffer& element)
+template <class H, size_t N>
+bool BasicMerkleTree<H, N>::checkProof(const Elements& proof,
+        const Buffer& root, const Buffer& element)
 {
+    MERKLE_TREE_STATS_ADD(proofsVerified, 1);
     Buffer tempHash = element;
-    for (   Elements::const_iterator it = proof.begin();
+    for (   typename Elements::const_iterator it = proof.begin();
             it != proof.end();
             ++it) {
         tempHash = combinedHash(tempHash, *it, false);
@@ -138,9 +572,240 @@ bool MerkleTree::checkProof(const Elements& proof, const Buffer& root,
     return tempHash == root;
 }
 
+template <class H, size_t N>
+typename BasicMerkleTree<H, N>::MultiProof
+BasicMerkleTree<H, N>::getMultiProof(const std::vector<size_t>& indices) const
+{
+    if (indices.empty()) {
+        throw std::runtime_error("Empty indices list");
+    }
+    MERKLE_TREE_STATS_ADD(proofsGenerated, 1);
+    MultiProof proof;
+    proof.indices = indices;
+    std::vector<size_t> positions;
+    positions.reserve(indices.size());
+    for (size_t i = 0; i < indices.size(); ++i) {
+        if (indices[i] == 0) {
+            throw std::runtime_error("Index is zero");
+        }
+        if (indices[i] > getLeafCount()) {
+            throw std::runtime_error("Index out of range");
+        }
+        positions.push_back(indices[i] - 1);
+    }
+    std::sort(positions.begin(), positions.end());
+    positions.erase(std::unique(positions.begin(), positions.end()),
+            positions.end());
+
+    // Walk up the layers, adding the siblings which are not already known;
+    // this must be kept in sync with `checkMultiProof()`
+    for (size_t layer = 0; layer + 1 < getLayerCount(); ++layer) {
+        const Digest* nodes = getLayer(layer);
+        const size_t size = getLayerSize(layer);
+        size_t parents = 0;
+        for (size_t i = 0; i < positions.size(); ++i) {
+            const size_t position = positions[i];
+            if ((position + 1 < size) || !(size & 1)) {
+                const size_t sibling = position ^ 1;
+                if ((i + 1 < positions.size()) && (positions[i + 1] == sibling)) {
+                    ++i; // both known
+                } else {
+                    proof.hashes.push_back(nodes[sibling]);
+                }
+            } // else: odd one out, carried up as is
+            positions[parents++] = position / 2;
+        }
+        positions.resize(parents);
+    }
+    return proof;
+}
+
+template <class H, size_t N>
+typename BasicMerkleTree<H, N>::MultiProof
+BasicMerkleTree<H, N>::getMultiProof(const Elements& elements) const
+{
+    if (elements.empty()) {
+        throw std::runtime_error("Empty elements list");
+    }
+    std::vector<size_t> indices;
+    indices.reserve(elements.size());
+    for (   typename Elements::const_iterator it = elements.begin();
+            it != elements.end();
+            ++it) {
+        size_t index;
+        if (    (it->size() != N)
+             || !findLeaf(Digest::fromBuffer(*it), index)) {
+            throw std::runtime_error("Element not found");
+        }
+        indices.push_back(index + 1);
+    }
+    return getMultiProof(indices);
+}
+
+template <class H, size_t N>
+bool BasicMerkleTree<H, N>::checkMultiProof(const MultiProof& proof,
+        const Buffer& root, size_t leafCount, const Elements& elements,
+        bool preserveOrder)
+{
+    MERKLE_TREE_STATS_ADD(proofsVerified, 1);
+    if (    (proof.indices.size() != elements.size()) || elements.empty()
+         || (leafCount == 0)) {
+        return false;
+    }
+
+    // Known nodes of the current layer, sorted by position
+    std::vector<std::pair<size_t, Digest> > known;
+    known.reserve(elements.size());
+    for (size_t i = 0; i < elements.size(); ++i) {
+        const size_t index = proof.indices[i];
+        if (    (index == 0) || (index > leafCount)
+             || (elements[i].size() != N)) {
+            return false;
+        }
+        known.push_back(std::make_pair(index - 1,
+                    Digest::fromBuffer(elements[i])));
+    }
+    std::sort(known.begin(), known.end());
+    size_t count = 0;
+    for (size_t i = 0; i < known.size(); ++i) {
+        if ((count > 0) && (known[count - 1].first == known[i].first)) {
+            if (known[count - 1].second != known[i].second) {
+                return false; // two different elements at the same index
+            }
+        } else {
+            known[count++] = known[i];
+        }
+    }
+    known.resize(count);
+
+    // Rebuild the layers above, hashing all the pairs of a layer at once;
+    // this must be kept in sync with `getMultiProof()`
+    size_t next = 0; // next hash to use in `proof.hashes`
+    std::vector<std::pair<size_t, Digest> > parents;
+    std::vector<const uint8_t*> left;
+    std::vector<const uint8_t*> right;
+    std::vector<size_t> hashed; // entries of `parents` to be hashed
+    Digests hashes;
+    for (size_t size = leafCount; size > 1; size = (size + 1) / 2) {
+        parents.clear();
+        left.clear();
+        right.clear();
+        hashed.clear();
+        for (size_t i = 0; i < known.size(); ++i) {
+            const size_t position = known[i].first;
+            const Digest* first = &known[i].second;
+            if ((position + 1 < size) || !(size & 1)) {
+                const Digest* second;
+                if (    (i + 1 < known.size())
+                     && (known[i + 1].first == (position ^ 1))) {
+                    second = &known[++i].second;
+                } else if (next < proof.hashes.size()) {
+                    second = &proof.hashes[next++];
+                } else {
+                    return false; // not enough hashes
+                }
+                if (position & 1) {
+                    std::swap(first, second);
+                }
+                if (!preserveOrder && !(*first > *second)) {
+                    std::swap(first, second);
+                }
+                left.push_back(first->bytes);
+                right.push_back(second->bytes);
+                hashed.push_back(parents.size());
+            } // else: odd one out, carried up as is
+            parents.push_back(std::make_pair(position / 2, *first));
+        }
+
+        hashes.resize(hashed.size());
+        if (!hashed.empty()) {
+            H::hashPairs(hashes[0].bytes, &left[0], &right[0], N,
+                    hashed.size());
+        }
+        for (size_t i = 0; i < hashed.size(); ++i) {
+            parents[hashed[i]].second = hashes[i];
+        }
+        known.swap(parents);
+    }
+    return (next == proof.hashes.size()) && (known.size() == 1)
+        && (known[0].second.toBuffer() == root);
+}
+
+template <class H, size_t N>
+typename BasicMerkleTree<H, N>::AbsenceProof
+BasicMerkleTree<H, N>::getAbsenceProof(const Buffer& element) const
+{
+    if (!preserveOrder_) {
+        throw std::runtime_error("Absence proofs need preserved order");
+    }
+    const Digest target = Digest::fromBuffer(element);
+    const Digest* leaves = getLayer(0);
+    const Digest* last = leaves + getLeafCount();
+    const Digest* found = std::lower_bound(leaves, last, target);
+    if ((found != last) && (*found == target)) {
+        throw std::runtime_error("Element is in the tree");
+    }
+    // NB: `found` is only right if the leaves are sorted, which would take
+    // a scan of all of them to check; its neighbours at least must be
+    if (    ((found != leaves) && !(found[-1] < target))
+         || ((found != last) && !(target < *found))) {
+        throw std::runtime_error("Leaves are not sorted");
+    }
+
+    AbsenceProof proof;
+    proof.lowerIndex = found - leaves;
+    if (found != leaves) {
+        proof.lower = found[-1].toBuffer();
+        proof.lowerProof = getProof(proof.lowerIndex - 1);
+    }
+    if (found != last) {
+        proof.upper = found->toBuffer();
+        proof.upperProof = getProof(proof.lowerIndex);
+    }
+    return proof;
+}
+
+template <class H, size_t N>
+bool BasicMerkleTree<H, N>::checkAbsenceProof(const AbsenceProof& proof,
+        const Buffer& root, size_t leafCount, const Buffer& element)
+{
+    MERKLE_TREE_STATS_ADD(proofsVerified, 1);
+    const bool hasLower = (proof.lowerIndex > 0);
+    const bool hasUpper = (proof.lowerIndex < leafCount);
+    if (    (element.size() != N) || (root.size() != N) || (leafCount == 0)
+         || (proof.lowerIndex > leafCount)
+         || (proof.lower.size() != (hasLower ? N : 0))
+         || (proof.upper.size() != (hasUpper ? N : 0))
+         || (hasLower && !(proof.lower < element))
+         || (hasUpper && !(element < proof.upper))) {
+        return false;
+    }
+
+    // Hashes are combined in the order of the leaves, so each leaf can only
+    // lead to the root from its own position
+    const Digest rootDigest = Digest::fromBuffer(root);
+    Digest computed;
+    if (    hasLower
+         && (    !walkOrderedProof<BasicMerkleTree>(proof.lowerProof,
+                     Digest::fromBuffer(proof.lower), proof.lowerIndex - 1,
+                     leafCount, computed)
+              || (computed != rootDigest))) {
+        return false;
+    }
+    if (    hasUpper
+         && (    !walkOrderedProof<BasicMerkleTree>(proof.upperProof,
+                     Digest::fromBuffer(proof.upper), proof.lowerIndex,
+                     leafCount, computed)
+              || (computed != rootDigest))) {
+        return false;
+    }
+    return true;
+}
+
 // Fabrice: This function seems buggy to me, rewrote it below
 #if 0
-bool MerkleTree::checkProofOrdered(const Elements& proof,
+template <class H, size_t N>
+bool BasicMerkleTree<H, N>::checkProofOrdered(const Elements& proof,
         const Buffer& root, const Buffer& element, size_t index)
 {
     Buffer tempHash = element;
@@ -165,111 +830,424 @@ bool MerkleTree::checkProofOrdered(const Elements& proof,
 }
 #endif
 
-bool MerkleTree::checkProofOrdered(const Elements& proof,
+template <class H, size_t N>
+bool BasicMerkleTree<H, N>::checkProofOrdered(const Elements& proof,
         const Buffer& root, const Buffer& element, size_t index)
 {
+    MERKLE_TREE_STATS_ADD(proofsVerified, 1);
     --index; // `index` argument starts at 1
     Buffer tempHash = element;
     for (size_t i = 0; i < proof.size(); ++i) {
-        size_t remaining = proof.size() - i;
-
-        // We don't assume that the tree is padded to a power of 2. If the
-        // index is even and the last one of the layer, then the proof starts
-        // with a hash at a higher layer, so we have to adjust the index to be
-        // the index at that layer.
-        while (((index & 1) == 0) && (index >= (1u << remaining))) {
-            index = index / 2;
+        if (orderedProofStep(index, proof.size() - i)) {
+            tempHash = combinedHash(proof[i], tempHash, true);
+        } else {
+            tempHash = combinedHash(tempHash, proof[i], true);
         }
+    }
+    return tempHash == root;
+}
 
-        if (index & 1) {
+template <class H, size_t N>
+size_t BasicMerkleTree<H, N>::getProof(const Digest& element, Digest* proof,
+        size_t capacity) const
+{
+    size_t index;
+    if (!findLeaf(element, index)) {
+        throw std::runtime_error("Element not found");
+    }
+    return getView().getProof(index, proof, capacity);
+}
+
+template <class H, size_t N>
+size_t BasicMerkleTree<H, N>::getProofOrdered(const Digest& element,
+        size_t index, Digest* proof, size_t capacity) const
+{
+    if (index == 0) {
+        throw std::runtime_error("Index is zero");
+    }
+    index--;
+    if ((index >= getLeafCount()) || (getLayer(0)[index] != element)) {
+        throw std::runtime_error("Index does not point to element");
+    }
+    return getView().getProof(index, proof, capacity);
+}
+
+template <class H, size_t N>
+bool BasicMerkleTree<H, N>::checkProof(const Digest* proof, size_t length,
+        const Digest& root, const Digest& element)
+{
+    MERKLE_TREE_STATS_ADD(proofsVerified, 1);
+    Digest tempHash = element;
+    for (size_t i = 0; i < length; ++i) {
+        tempHash = combinedHash(tempHash, proof[i], false);
+    }
+    return tempHash == root;
+}
+
+template <class H, size_t N>
+bool BasicMerkleTree<H, N>::checkProofOrdered(const Digest* proof,
+        size_t length, const Digest& root, const Digest& element,
+        size_t index)
+{
+    MERKLE_TREE_STATS_ADD(proofsVerified, 1);
+    --index; // `index` argument starts at 1
+    Digest tempHash = element;
+    for (size_t i = 0; i < length; ++i) {
+        if (orderedProofStep(index, length - i)) {
             tempHash = combinedHash(proof[i], tempHash, true);
         } else {
             tempHash = combinedHash(tempHash, proof[i], true);
         }
-        index = index / 2;
     }
     return tempHash == root;
 }
 
-void MerkleTree::getLayers()
+template <class H, size_t N>
+void BasicMerkleTree<H, N>::build(Digests& leaves, MerkleTreeExecutor* executor)
+{
+    if (leaves.empty()) {
+        throw std::runtime_error("Empty elements list");
+    }
+
+    nodes_.swap(leaves);
+    if (!preserveOrder_) {
+        // Sort elements and remove duplicates
+        sortUniqueDigests(nodes_, executor);
+    }
+
+    getLayers(executor);
+    indexLeaves();
+    MERKLE_TREE_STATS_ADD(layerBytes, getMemoryUsage());
+}
+
+template <class H, size_t N>
+void BasicMerkleTree<H, N>::getLayers(MerkleTreeExecutor* executor)
 {
-    layers_.clear();
+    // The first layer is the leaves themselves; each subsequent layer has
+    // half as many hashes as the one below it, rounded up, until the layer
+    // that has only one hash (this will be the root of the tree)
+    layerOffsets_.clear();
+    layerOffsets_.push_back(0);
+    size_t size = nodes_.size();
+    size_t total = 0;
+    for (;;) {
+        total += size;
+        layerOffsets_.push_back(total);
+        if (size <= 1) {
+            break;
+        }
+        size = (size + 1) / 2;
+    }
 
-    // The first layer is the elements themselves
-    layers_.push_back(elements_);
+    // Allocate all the layers at once, then compute them from the bottom up
+    nodes_.resize(total);
+    size_t layer = 1;
+    LayerTimer timer;
 
-    if (elements_.empty()) {
-        return; // nothing left to do
+    const size_t leaves = getLeafCount();
+    if (leaves >= MIN_PARALLEL_LEAVES) {
+        MerkleTreeExecutor& resolved = getExecutor(executor);
+        const size_t threads = resolved.getConcurrency();
+        size_t height = MIN_SUBTREE_HEIGHT;
+        while ((leaves >> height) > threads * SUBTREES_PER_THREAD) {
+            ++height;
+        }
+        if ((threads > 1) && (height + 1 < getLayerCount())) {
+            // Subtrees above blocks of `2^height` leaves are independent
+            SubtreesTask task(*this, height);
+            resolved.parallelFor(getLayerSize(height), task);
+            timer.lap(height);
+            layer = height + 1;
+        }
     }
 
-    // For subsequent layers, combine each pair of hashes in the previous
-    // layer to build the current layer. Repeat until the current layer has
-    // only one hash (this will be the root of the tree).
-    while (layers_.back().size() > 1) {
-        getNextLayer();
+    for ( ; layer < getLayerCount(); ++layer) {
+        getNextLayer(layer);
+        timer.lap(layer);
     }
 }
 
-void MerkleTree::getNextLayer()
+template <class H, size_t N>
+void BasicMerkleTree<H, N>::getNextLayer(size_t layer)
 {
-    const Elements& previous_layer = layers_.back();
+    getNextLayer(layer, 0, getLayerSize(layer));
+}
 
-    // Create a new empty layer
-    layers_.push_back(Elements());
-    Elements& current_layer = layers_.back();
+template <class H, size_t N>
+void BasicMerkleTree<H, N>::getNextLayer(size_t layer, size_t first,
+        size_t last)
+{
+    const Digest* previous_layer = &nodes_[layerOffsets_[layer - 1]];
+    const size_t previous_size = getLayerSize(layer - 1);
+    Digest* current_layer = &nodes_[layerOffsets_[layer]];
 
-    // For each pair of elements in the previous layer
+    // For each pair of elements in the previous layer, hash them in batches
+    // so the multi-buffer engine can process several pairs at once
     // NB: If there is an odd number of elements, we ignore the last one for now
-    for (size_t i = 0; i < (previous_layer.size() / 2); ++i) {
-        current_layer.push_back(combinedHash(previous_layer[2*i],
-                    previous_layer[2*i + 1], preserveOrder_));
+    const size_t pairs = std::min(previous_size / 2, last);
+    if (first < pairs) {
+        hashPairs<BasicMerkleTree>(previous_layer + 2*first, pairs - first,
+                preserveOrder_, current_layer + first);
     }
 
     // If there is an odd one out at the end, process it
     // NB: It's on its own, so we don't combine it with anything
-    if (previous_layer.size() & 1) {
-        current_layer.push_back(previous_layer.back());
+    if ((previous_size & 1) && (last > previous_size / 2)) {
+        current_layer[previous_size / 2] = previous_layer[previous_size - 1];
     }
 }
 
-MerkleTree::Elements MerkleTree::getProof(size_t index) const
+template <class H, size_t N>
+void BasicMerkleTree<H, N>::rehashNodes(size_t layer, const size_t* nodes,
+        size_t count)
 {
-    Elements proof;
-    for (   Layers::const_iterator it = layers_.begin();
-            it != layers_.end();
-            ++it) {
-        Buffer pair;
-        if (getPair(*it, index, pair)) {
-            proof.push_back(pair);
+    const Digest* previous_layer = &nodes_[layerOffsets_[layer - 1]];
+    const size_t previous_size = getLayerSize(layer - 1);
+    Digest* current_layer = &nodes_[layerOffsets_[layer]];
+
+    // The pairs are scattered, so they are gathered in batches for the
+    // multi-buffer engine, and their hashes scattered back
+    const uint8_t* left[NODE_PAIRS_PER_BATCH];
+    const uint8_t* right[NODE_PAIRS_PER_BATCH];
+    size_t targets[NODE_PAIRS_PER_BATCH];
+    Digest hashes[NODE_PAIRS_PER_BATCH];
+    size_t batch = 0;
+    for (size_t i = 0; i < count; ++i) {
+        const size_t node = nodes[i];
+        if (2*node + 1 < previous_size) {
+            left[batch] = previous_layer[2*node].bytes;
+            right[batch] = previous_layer[2*node + 1].bytes;
+            targets[batch++] = node;
+        } else {
+            // Odd one out, carried up as is
+            current_layer[node] = previous_layer[2*node];
         }
-        index = index / 2; // point to correct hash in next layer
-    } // for each layer
-    return proof;
+        if ((batch == NODE_PAIRS_PER_BATCH) || ((i + 1 == count) && batch)) {
+            H::hashPairs(hashes[0].bytes, left, right, N, batch);
+            for (size_t j = 0; j < batch; ++j) {
+                current_layer[targets[j]] = hashes[j];
+            }
+            batch = 0;
+        }
+    }
 }
 
-bool MerkleTree::getPair(const Elements& layer, size_t index, Buffer& pair)
+template <class H, size_t N>
+void BasicMerkleTree<H, N>::indexLeaves()
 {
-    size_t pairIndex;
-    if (index & 1) {
-        pairIndex = index - 1;
-    } else {
-        pairIndex = index + 1;
+    leafSlots_.clear();
+    if (!preserveOrder_) {
+        return; // leaves are sorted, no need for an index
     }
-    if (pairIndex >= layer.size()) {
-        return false;
+
+    const size_t count = getLeafCount();
+    size_t slots = 1;
+    while (slots < count * LEAF_SLOTS_PER_LEAF) {
+        slots <<= 1;
+    }
+    leafSlots_.resize(slots, 0);
+    for (size_t i = 0; i < count; ++i) {
+        indexLeaf(i);
     }
-    pair = layer[pairIndex];
-    return true;
 }
 
-std::string MerkleTree::elementsToHex(const Elements& elements)
+template <class H, size_t N>
+void BasicMerkleTree<H, N>::indexLeaf(size_t index)
+{
+    const size_t mask = leafSlots_.size() - 1;
+    size_t slot = slotOf(getLayer(0)[index], mask);
+    while (leafSlots_[slot] != 0) {
+        slot = (slot + 1) & mask;
+    }
+    leafSlots_[slot] = index + 1;
+}
+
+template <class H, size_t N>
+void BasicMerkleTree<H, N>::unindexLeaf(size_t index)
+{
+    const Digest* leaves = getLayer(0);
+    const size_t mask = leafSlots_.size() - 1;
+    size_t hole = slotOf(leaves[index], mask);
+    while (leafSlots_[hole] != index + 1) {
+        hole = (hole + 1) & mask;
+    }
+
+    // Shift back the following leaves of the cluster that would otherwise
+    // become unreachable from their home slot
+    for (size_t slot = (hole + 1) & mask; leafSlots_[slot] != 0;
+            slot = (slot + 1) & mask) {
+        const size_t home = slotOf(leaves[leafSlots_[slot] - 1], mask);
+        if (((slot - home) & mask) >= ((slot - hole) & mask)) {
+            leafSlots_[hole] = leafSlots_[slot];
+            hole = slot;
+        }
+    }
+    leafSlots_[hole] = 0;
+}
+
+template <class H, size_t N>
+BasicTreeView<BasicMerkleTree<H, N> > BasicMerkleTree<H, N>::getView() const
+{
+    BasicTreeView<BasicMerkleTree> view;
+    view.nodes = &nodes_[0];
+    view.layerOffsets = &layerOffsets_[0];
+    view.layerCount = getLayerCount();
+    view.preserveOrder = preserveOrder_;
+    view.leafSlots = leafSlots_.empty() ? NULL : &leafSlots_[0];
+    view.slotCount = leafSlots_.size();
+    return view;
+}
+
+template <class H, size_t N>
+bool BasicMerkleTree<H, N>::findLeaf(const Digest& leaf, size_t& index) const
+{
+    return getView().findLeaf(leaf, index);
+}
+
+template <class H, size_t N>
+size_t BasicMerkleTree<H, N>::getMemoryUsage() const
+{
+    return nodes_.capacity() * sizeof(Digest)
+        + layerOffsets_.capacity() * sizeof(uint64_t)
+        + leafSlots_.capacity() * sizeof(uint64_t);
+}
+
+template <class H, size_t N>
+void BasicMerkleTree<H, N>::updateLeaf(size_t index, const Buffer& element)
+{
+    updateLeaf(index, Digest::fromBuffer(element));
+}
+
+template <class H, size_t N>
+void BasicMerkleTree<H, N>::updateLeaf(size_t index, const Digest& element)
+{
+    if (!preserveOrder_) {
+        throw std::runtime_error("Can't update a tree without preserved order");
+    }
+    if (index == 0) {
+        throw std::runtime_error("Index is zero");
+    }
+    index--;
+    if (index >= getLeafCount()) {
+        throw std::runtime_error("Index out of range");
+    }
+
+    unindexLeaf(index);
+    nodes_[layerOffsets_[0] + index] = element;
+    indexLeaf(index);
+
+    // Rebuild the single hash above the leaf in each layer; this takes care
+    // of the odd node carried up unhashed, exactly as for a full build
+    for (size_t layer = 1; layer < getLayerCount(); ++layer) {
+        index /= 2;
+        getNextLayer(layer, index, index + 1);
+    }
+}
+
+template <class H, size_t N>
+void BasicMerkleTree<H, N>::updateLeaves(const LeafUpdates& updates)
+{
+    LeafUpdates copy(updates);
+    applyUpdates(copy, NULL);
+}
+
+template <class H, size_t N>
+void BasicMerkleTree<H, N>::updateLeaves(const LeafUpdates& updates,
+        MerkleTreeExecutor& executor)
+{
+    LeafUpdates copy(updates);
+    applyUpdates(copy, &executor);
+}
+
+template <class H, size_t N>
+void BasicMerkleTree<H, N>::applyUpdates(LeafUpdates& updates,
+        MerkleTreeExecutor* executor)
+{
+    if (!preserveOrder_) {
+        throw std::runtime_error("Can't update a tree without preserved order");
+    }
+    for (size_t i = 0; i < updates.size(); ++i) {
+        if (updates[i].first == 0) {
+            throw std::runtime_error("Index is zero");
+        }
+        if (updates[i].first > getLeafCount()) {
+            throw std::runtime_error("Index out of range");
+        }
+    }
+
+    // Keep only the last update of each leaf
+    std::stable_sort(updates.begin(), updates.end(),
+            updateIndexLess<typename LeafUpdates::value_type>);
+    std::vector<size_t> nodes;
+    nodes.reserve(updates.size());
+    for (size_t i = 0; i < updates.size(); ++i) {
+        if (    (i + 1 < updates.size())
+             && (updates[i + 1].first == updates[i].first)) {
+            continue;
+        }
+        const size_t index = updates[i].first - 1;
+        unindexLeaf(index);
+        nodes_[layerOffsets_[0] + index] = updates[i].second;
+        indexLeaf(index);
+        nodes.push_back(index);
+    }
+
+    // Walk up the layers: the nodes to rehash in a layer are the parents of
+    // those rehashed in the layer below, and they stay sorted
+    for (size_t layer = 1; (layer < getLayerCount()) && !nodes.empty();
+            ++layer) {
+        size_t parents = 0;
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            if ((parents == 0) || (nodes[parents - 1] != nodes[i] / 2)) {
+                nodes[parents++] = nodes[i] / 2;
+            }
+        }
+        nodes.resize(parents);
+
+        size_t items = 1;
+        if (nodes.size() >= MIN_PARALLEL_NODES) {
+            items = std::min(nodes.size() / MIN_NODES_PER_ITEM,
+                    getExecutor(executor).getConcurrency()
+                    * SUBTREES_PER_THREAD);
+        }
+        if (items > 1) {
+            NodesTask task(*this, layer, nodes, items);
+            getExecutor(executor).parallelFor(items, task);
+        } else {
+            rehashNodes(layer, &nodes[0], nodes.size());
+        }
+    }
+}
+
+template <class H, size_t N>
+typename BasicMerkleTree<H, N>::Elements BasicMerkleTree<H, N>::getProof(
+        size_t index) const
+{
+    return getView().getProof(index);
+}
+
+template <class H, size_t N>
+void BasicMerkleTree<H, N>::save(const std::string& path) const
+{
+    saveTreeFile(path, getView());
+}
+
+template <class H, size_t N>
+std::string BasicMerkleTree<H, N>::elementsToHex(
+        const Elements& elements)
 {
     std::ostringstream oss;
     oss << "0x";
-    for (   Elements::const_iterator it = elements.begin();
+    for (   typename Elements::const_iterator it = elements.begin();
             it != elements.end();
             ++it) {
         oss << *it;
     }
     return oss.str();
 }
+
+template class BasicMerkleTree<MerkleTreeBlake2b, MERKLE_TREE_ELEMENT_SIZE_B>;
+template struct ConfigurationCheck<MerkleTree>;
+
+template class BasicMerkleTree<MerkleTreeBlake2b, 32>;
+template struct ConfigurationCheck<MerkleTree256>;
@@ -0,0 +1,347 @@
+#include "merkle-tree/persistent-tree.hpp"
+#include <algorithm>
+#include <stdexcept>
+#include "layer-hash.hpp"
+#include "stats-counters.hpp"
+
+namespace {
+
+typedef MerkleTree::Digest Digest;
+typedef MerkleTree::Digests Digests;
+typedef MerkleTree::LeafUpdates::value_type Update;
+
+/** Get the size of a layer of a tree of `count` leaves
+ *
+ * \param count [in] Number of leaves; must be at least 1
+ * \param layer [in] Layer number; 0 is the leaves
+ */
+inline size_t layerSize(size_t count, size_t layer)
+{
+    return ((count - 1) >> layer) + 1;
+}
+
+/** Compare updates by leaf index only, so a stable sort keeps the updates of
+ * a leaf in the order they were given */
+bool updateIndexLess(const Update& a, const Update& b)
+{
+    return a.first < b.first;
+}
+
+/** Whether an update is before a given leaf index */
+bool updateBefore(const Update& update, size_t index)
+{
+    return update.first < index;
+}
+
+} // namespace
+
+const uint32_t PersistentMerkleTree::NONE;
+
+PersistentMerkleTree::PersistentMerkleTree(
+        const MerkleTree::Elements& elements)
+    : latest_(0), leafCount_(0), layerCount_(0)
+{
+    Digests leaves;
+    leaves.reserve(elements.size());
+    for (   MerkleTree::Elements::const_iterator it = elements.begin();
+            it != elements.end();
+            ++it) {
+        if (!it->empty()) { // ignore empty elements, like `MerkleTree`
+            leaves.push_back(Digest::fromBuffer(*it));
+        }
+    }
+    build(leaves);
+}
+
+PersistentMerkleTree::PersistentMerkleTree(const MerkleTree::Digests& leaves)
+    : latest_(0), leafCount_(0), layerCount_(0)
+{
+    build(leaves);
+}
+
+std::vector<PersistentMerkleTree::Version>
+PersistentMerkleTree::getVersions() const
+{
+    std::vector<Version> versions;
+    versions.reserve(roots_.size());
+    for (   std::map<Version, uint32_t>::const_iterator it = roots_.begin();
+            it != roots_.end();
+            ++it) {
+        versions.push_back(it->first);
+    }
+    return versions;
+}
+
+const MerkleTree::Digest& PersistentMerkleTree::getRootDigest(
+        Version version) const
+{
+    return nodes_[getRootNode(version)].hash;
+}
+
+const MerkleTree::Digest& PersistentMerkleTree::getLeaf(Version version,
+        size_t index) const
+{
+    const uint32_t root = getRootNode(version);
+    if (index == 0) {
+        throw std::runtime_error("Index is zero");
+    }
+    if (index > leafCount_) {
+        throw std::runtime_error("Index out of range");
+    }
+    size_t count;
+    return nodes_[findLeaf(root, index - 1, NULL, count)].hash;
+}
+
+PersistentMerkleTree::Version PersistentMerkleTree::updateLeaf(size_t index,
+        const MerkleTree::Digest& element)
+{
+    return updateLeaves(MerkleTree::LeafUpdates(1,
+                std::make_pair(index, element)));
+}
+
+PersistentMerkleTree::Version PersistentMerkleTree::updateLeaves(
+        const MerkleTree::LeafUpdates& updates)
+{
+    for (size_t i = 0; i < updates.size(); ++i) {
+        if (updates[i].first == 0) {
+            throw std::runtime_error("Index is zero");
+        }
+        if (updates[i].first > leafCount_) {
+            throw std::runtime_error("Index out of range");
+        }
+    }
+
+    // Keep only the last update of each leaf, with indices starting at 0
+    MerkleTree::LeafUpdates sorted(updates);
+    std::stable_sort(sorted.begin(), sorted.end(), updateIndexLess);
+    size_t count = 0;
+    for (size_t i = 0; i < sorted.size(); ++i) {
+        if ((i + 1 < sorted.size()) && (sorted[i + 1].first == sorted[i].first)) {
+            continue;
+        }
+        sorted[count] = sorted[i];
+        sorted[count].first--;
+        ++count;
+    }
+    sorted.resize(count);
+    checkCapacity(count * layerCount_);
+
+    // An empty update still creates a version, which shares the root
+    const uint32_t previous = roots_[latest_];
+    uint32_t root = previous;
+    if (!sorted.empty()) {
+        root = update(previous, layerCount_ - 1, 0, &sorted[0],
+                &sorted[0] + sorted.size());
+    }
+    nodes_[root].references++;
+    roots_[++latest_] = root;
+    return latest_;
+}
+
+void PersistentMerkleTree::releaseVersion(Version version)
+{
+    const uint32_t root = getRootNode(version);
+    if (version == latest_) {
+        throw std::runtime_error("Can't release the latest version");
+    }
+    roots_.erase(version);
+    release(root);
+}
+
+MerkleTree::Elements PersistentMerkleTree::getProofOrdered(Version version,
+        const MerkleTree::Buffer& element, size_t index) const
+{
+    if (    (element.size() != MerkleTree::DIGEST_SIZE_B)
+         || (getLeaf(version, index) != Digest::fromBuffer(element))) {
+        throw std::runtime_error("Index does not point to element");
+    }
+
+    Digest hashes[MerkleTree::MAX_PROOF_LENGTH];
+    const size_t length = getProof(version, index, hashes,
+            MerkleTree::MAX_PROOF_LENGTH);
+    MerkleTree::Elements proof;
+    for (size_t i = 0; i < length; ++i) {
+        proof.push_back(hashes[i].toBuffer());
+    }
+    return proof;
+}
+
+size_t PersistentMerkleTree::getProof(Version version, size_t index,
+        MerkleTree::Digest* proof, size_t capacity) const
+{
+    const uint32_t root = getRootNode(version);
+    if (index == 0) {
+        throw std::runtime_error("Index is zero");
+    }
+    if (index > leafCount_) {
+        throw std::runtime_error("Index out of range");
+    }
+    MERKLE_TREE_STATS_ADD(proofsGenerated, 1);
+
+    // The path is walked from the root down, and proofs go the other way
+    Digest siblings[MerkleTree::MAX_PROOF_LENGTH];
+    size_t length;
+    findLeaf(root, index - 1, siblings, length);
+    if (length > capacity) {
+        throw std::runtime_error("Proof buffer too small");
+    }
+    std::reverse_copy(siblings, siblings + length, proof);
+    return length;
+}
+
+size_t PersistentMerkleTree::getMemoryUsage() const
+{
+    return nodes_.capacity() * sizeof(Node)
+        + freeNodes_.capacity() * sizeof(uint32_t);
+}
+
+void PersistentMerkleTree::build(const MerkleTree::Digests& leaves)
+{
+    if (leaves.empty()) {
+        throw std::runtime_error("Empty elements list");
+    }
+    leafCount_ = leaves.size();
+    layerCount_ = 1;
+    for (size_t size = leafCount_; size > 1; size = (size + 1) / 2) {
+        ++layerCount_;
+    }
+    checkCapacity(2 * leafCount_);
+    nodes_.reserve(2 * leafCount_ - 1);
+
+    // Build the layers as in a `MerkleTree`, keeping the hashes of the layer
+    // below together to hash them in batches
+    std::vector<uint32_t> below;
+    below.reserve(leafCount_);
+    for (size_t i = 0; i < leafCount_; ++i) {
+        below.push_back(newNode(leaves[i], NONE, NONE));
+    }
+    Digests belowHashes(leaves);
+    Digests hashes((leafCount_ + 1) / 2);
+    std::vector<uint32_t> current;
+    current.reserve((leafCount_ + 1) / 2);
+    while (below.size() > 1) {
+        const size_t pairs = below.size() / 2;
+        hashPairs<MerkleTree>(&belowHashes[0], pairs, true, &hashes[0]);
+        current.clear();
+        for (size_t i = 0; i < pairs; ++i) {
+            current.push_back(newNode(hashes[i], below[2 * i],
+                        below[2 * i + 1]));
+            nodes_[below[2 * i]].references++;
+            nodes_[below[2 * i + 1]].references++;
+        }
+        if (below.size() & 1) {
+            // Odd one out, carried up as is
+            current.push_back(below.back());
+            hashes[pairs] = belowHashes.back();
+        }
+        below.swap(current);
+        belowHashes.assign(hashes.begin(), hashes.begin() + below.size());
+    }
+    nodes_[below[0]].references++;
+    roots_[0] = below[0];
+}
+
+uint32_t PersistentMerkleTree::getRootNode(Version version) const
+{
+    const std::map<Version, uint32_t>::const_iterator it =
+        roots_.find(version);
+    if (it == roots_.end()) {
+        throw std::runtime_error("Unknown version");
+    }
+    return it->second;
+}
+
+void PersistentMerkleTree::checkCapacity(size_t count) const
+{
+    if (count >= NONE - getNodeCount()) {
+        throw std::runtime_error("Too many nodes");
+    }
+}
+
+uint32_t PersistentMerkleTree::newNode(const MerkleTree::Digest& hash,
+        uint32_t left, uint32_t right)
+{
+    uint32_t node;
+    if (freeNodes_.empty()) {
+        nodes_.push_back(Node());
+        node = nodes_.size() - 1;
+    } else {
+        node = freeNodes_.back();
+        freeNodes_.pop_back();
+    }
+    Node& fresh = nodes_[node];
+    fresh.hash = hash;
+    fresh.children[0] = left;
+    fresh.children[1] = right;
+    fresh.references = 0;
+    return node;
+}
+
+uint32_t PersistentMerkleTree::findLeaf(uint32_t root, size_t index,
+        MerkleTree::Digest* siblings, size_t& count) const
+{
+    count = 0;
+    uint32_t node = root;
+    for (size_t layer = layerCount_ - 1; layer > 0; --layer) {
+        // A node with no peer in the layer below is that very node
+        const size_t position = index >> layer;
+        if (2 * position + 1 >= layerSize(leafCount_, layer - 1)) {
+            continue;
+        }
+        const size_t side = (index >> (layer - 1)) & 1;
+        if (siblings != NULL) {
+            siblings[count++] = nodes_[nodes_[node].children[1 - side]].hash;
+        }
+        node = nodes_[node].children[side];
+    }
+    return node;
+}
+
+void PersistentMerkleTree::release(uint32_t node)
+{
+    std::vector<uint32_t> stack(1, node);
+    while (!stack.empty()) {
+        const uint32_t current = stack.back();
+        stack.pop_back();
+        Node& released = nodes_[current];
+        if (--released.references > 0) {
+            continue;
+        }
+        if (released.children[0] != NONE) {
+            stack.push_back(released.children[0]);
+            stack.push_back(released.children[1]);
+        }
+        freeNodes_.push_back(current);
+    }
+}
+
+uint32_t PersistentMerkleTree::update(uint32_t node, size_t layer,
+        size_t position, const Update* begin, const Update* end)
+{
+    if (layer == 0) {
+        return newNode(begin->second, NONE, NONE);
+    }
+    if (2 * position + 1 >= layerSize(leafCount_, layer - 1)) {
+        return update(node, layer - 1, 2 * position, begin, end);
+    }
+
+    // Copy the children with updated leaves, and share the other one
+    uint32_t children[2] = { nodes_[node].children[0],
+                             nodes_[node].children[1] };
+    const Update* middle = std::lower_bound(begin, end,
+            (2 * position + 1) << (layer - 1), updateBefore);
+    if (begin != middle) {
+        children[0] = update(children[0], layer - 1, 2 * position, begin,
+                middle);
+    }
+    if (middle != end) {
+        children[1] = update(children[1], layer - 1, 2 * position + 1, middle,
+                end);
+    }
+    Digest pair[2] = { nodes_[children[0]].hash, nodes_[children[1]].hash };
+    Digest hash;
+    hashPairs<MerkleTree>(pair, 1, true, &hash);
+    nodes_[children[0]].references++;
+    nodes_[children[1]].references++;
+    return newNode(hash, children[0], children[1]);
+}
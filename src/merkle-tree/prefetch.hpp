@@ -0,0 +1,15 @@
+#ifndef MERKLE_TREE_PREFETCH_HPP_
+#define MERKLE_TREE_PREFETCH_HPP_
+
+/** Hint that `address` is about to be read
+ *
+ * Proofs read one hash per layer, at addresses known upfront: prefetching
+ * all of them before reading any lets their cache misses overlap.
+ */
+#if defined(__GNUC__)
+#define MERKLE_TREE_PREFETCH(address) __builtin_prefetch((address), 0, 3)
+#else
+#define MERKLE_TREE_PREFETCH(address) ((void)0)
+#endif
+
+#endif // MERKLE_TREE_PREFETCH_HPP_
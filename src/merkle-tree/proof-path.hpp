@@ -0,0 +1,36 @@
+#ifndef MERKLE_TREE_PROOF_PATH_HPP_
+#define MERKLE_TREE_PROOF_PATH_HPP_
+
+#include <cstddef>
+
+/** Walk one step up the path of a proof of a Merkle Tree with preserved order
+ *
+ * This is the rule used by `MerkleTree::checkProofOrdered()`; every verifier
+ * of such proofs must use it, so they all agree on which proofs are valid.
+ *
+ * \param index     [in,out] Index of the current hash in its layer, starting
+ *                           at 0; this is updated to the index of the next
+ *                           hash
+ * \param remaining [in]     Number of proof hashes left, including the one
+ *                           for this step
+ *
+ * \return `true` if the proof hash for this step goes on the left of the
+ *         current hash, `false` if it goes on the right
+ */
+inline bool orderedProofStep(size_t& index, size_t remaining)
+{
+    // We don't assume that the tree is padded to a power of 2. If the
+    // index is even and the last one of the layer, then the proof starts
+    // with a hash at a higher layer, so we have to adjust the index to be
+    // the index at that layer.
+    while (    ((index & 1) == 0) && (remaining < sizeof(size_t) * 8)
+            && (index >= (size_t(1) << remaining))) {
+        index = index / 2;
+    }
+
+    const bool left = (index & 1);
+    index = index / 2;
+    return left;
+}
+
+#endif // MERKLE_TREE_PROOF_PATH_HPP_
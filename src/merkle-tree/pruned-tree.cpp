@@ -0,0 +1,527 @@
+#include "merkle-tree/pruned-tree.hpp"
+#include <algorithm>
+#include "digest-sort.hpp"
+#include "layer-hash.hpp"
+#include "stats-counters.hpp"
+
+extern "C" {
+#include <pthread.h>
+}
+
+namespace {
+
+typedef MerkleTree::Digest Digest;
+typedef MerkleTree::Digests Digests;
+
+/** Below this number of leaves, the kept layers are built serially */
+const size_t MIN_PARALLEL_LEAVES = 1 << 15;
+
+/** Number of groups of blocks to aim for, per executor thread */
+const size_t GROUPS_PER_THREAD = 8;
+
+/** Get the size of a layer of a tree of `count` leaves
+ *
+ * \param count [in] Number of leaves; must be at least 1
+ * \param layer [in] Layer number; 0 is the leaves
+ */
+inline size_t layerSize(size_t count, size_t layer)
+{
+    return ((count - 1) >> layer) + 1;
+}
+
+/** Compute a node from the layer below it
+ *
+ * \param below         [in]  Layer below
+ * \param belowSize     [in]  Number of hashes in `below`
+ * \param index         [in]  Index of the node in its layer
+ * \param preserveOrder [in]  Whether to preserve the order of the pair
+ * \param layer         [out] Layer of the node
+ */
+inline void hashNode(const Digest* below, size_t belowSize, size_t index,
+        bool preserveOrder, Digest* layer)
+{
+    if (2 * index + 1 < belowSize) {
+        hashPairs<MerkleTree>(below + 2 * index, 1, preserveOrder,
+                layer + index);
+    } else {
+        layer[index] = below[2 * index]; // odd one out, carried up as is
+    }
+}
+
+/** Append the hash paired with a node to a proof, if it has one */
+inline void addSibling(const Digest* layer, size_t size, size_t position,
+        Digest* proof, size_t capacity, size_t& length)
+{
+    // The last hash of a layer with an odd number of hashes has no peer
+    const size_t pair = position ^ 1;
+    if (pair < size) {
+        if (length == capacity) {
+            throw std::runtime_error("Proof buffer too small");
+        }
+        proof[length++] = layer[pair];
+    }
+}
+
+/** Append to a proof the hashes paired with the path of a leaf, in layers 1
+ * to `height - 1` of the subtree above its block
+ *
+ * \param nodes    [in] Subtree, \see PrunedMerkleTree::buildSubtree()
+ * \param count    [in] Number of leaves of the block
+ * \param height   [in] Height of the subtree
+ * \param position [in] Position of the leaf in its block
+ */
+void addSubtreeSiblings(const Digest* nodes, size_t count, size_t height,
+        size_t position, Digest* proof, size_t capacity, size_t& length)
+{
+    for (size_t layer = 1; layer < height; ++layer) {
+        const size_t size = layerSize(count, layer);
+        addSibling(nodes, size, position >> layer, proof, capacity, length);
+        nodes += size;
+    }
+}
+
+/** Lock held for the lifetime of this object */
+class MutexLock
+{
+public :
+    explicit MutexLock(pthread_mutex_t& mutex)
+        : mutex_(mutex)
+    {
+        pthread_mutex_lock(&mutex_);
+    }
+
+    ~MutexLock()
+    {
+        pthread_mutex_unlock(&mutex_);
+    }
+
+private :
+    pthread_mutex_t& mutex_;
+};
+
+} // namespace
+
+const size_t PrunedMerkleTree::DEFAULT_CACHED_SUBTREES;
+
+/** Least recently used subtrees
+ *
+ * There are few entries, so they are searched linearly.
+ */
+class PrunedMerkleTree::Cache
+{
+public :
+    explicit Cache(size_t capacity)
+        : capacity_(capacity), clock_(0)
+    {
+        pthread_mutex_init(&mutex_, NULL);
+    }
+
+    ~Cache()
+    {
+        pthread_mutex_destroy(&mutex_);
+    }
+
+    /** Append to a proof the hashes of a cached subtree, \see
+     * addSubtreeSiblings()
+     *
+     * \return `true` if done, `false` if the subtree is not in the cache
+     */
+    bool addSiblings(size_t block, size_t count, size_t height,
+            size_t position, Digest* proof, size_t capacity, size_t& length)
+    {
+        MutexLock lock(mutex_);
+        Entry* entry = find(block);
+        if (entry == NULL) {
+            return false;
+        }
+        addSubtreeSiblings(&entry->nodes[0], count, height, position, proof,
+                capacity, length);
+        return true;
+    }
+
+    /** Get a subtree to modify it, or NULL if it is not in the cache; the
+     * caller must ensure nobody else uses the cache */
+    Digests* get(size_t block)
+    {
+        Entry* entry = find(block);
+        return entry ? &entry->nodes : NULL;
+    }
+
+    /** Add a subtree, unless it is already there
+     *
+     * \param block [in]     Block of the subtree
+     * \param nodes [in,out] Subtree; this is consumed
+     */
+    void insert(size_t block, Digests& nodes)
+    {
+        MutexLock lock(mutex_);
+        if (find(block) != NULL) {
+            return; // rebuilt concurrently by another thread
+        }
+        Entry* entry;
+        if (entries_.size() < capacity_) {
+            entries_.push_back(Entry());
+            entry = &entries_.back();
+        } else {
+            entry = &entries_[0];
+            for (size_t i = 1; i < entries_.size(); ++i) {
+                if (entries_[i].lastUse < entry->lastUse) {
+                    entry = &entries_[i];
+                }
+            }
+        }
+        entry->block = block;
+        entry->lastUse = ++clock_;
+        entry->nodes.swap(nodes);
+    }
+
+private :
+    struct Entry
+    {
+        size_t   block;    /**< Block of the subtree */
+        uint64_t lastUse;  /**< Value of `clock_` when last used */
+        Digests  nodes;    /**< Subtree */
+    };
+
+    size_t             capacity_; /**< Maximum number of entries */
+    uint64_t           clock_;    /**< Number of uses so far */
+    std::vector<Entry> entries_;
+    pthread_mutex_t    mutex_;    /**< Protects all the above */
+
+    /** Find the entry of a block and mark it as used */
+    Entry* find(size_t block)
+    {
+        for (size_t i = 0; i < entries_.size(); ++i) {
+            if (entries_[i].block == block) {
+                entries_[i].lastUse = ++clock_;
+                return &entries_[i];
+            }
+        }
+        return NULL;
+    }
+};
+
+/** Build the roots of the blocks, one group of consecutive blocks per item */
+class PrunedMerkleTree::BlockRootsTask : public MerkleTreeExecutor::Task
+{
+public :
+    BlockRootsTask(PrunedMerkleTree& tree, size_t groups)
+        : tree_(tree), groups_(groups),
+          blocks_(tree.getTopSize(tree.subtreeHeight_)),
+          scratchSize_(tree.getSubtreeSize(0)),
+          scratch_(groups * scratchSize_)
+    {
+    }
+
+    virtual void run(size_t index)
+    {
+        const size_t first = blocks_ * index / groups_;
+        const size_t last = blocks_ * (index + 1) / groups_;
+        Digest* nodes = &scratch_[index * scratchSize_];
+        Digest* roots = tree_.getTop(tree_.subtreeHeight_);
+        for (size_t block = first; block < last; ++block) {
+            tree_.buildSubtree(block, nodes);
+            roots[block] = nodes[tree_.getSubtreeSize(block) - 1];
+        }
+    }
+
+private :
+    PrunedMerkleTree& tree_;
+    size_t            groups_;
+    size_t            blocks_;
+    size_t            scratchSize_; /**< Size of the largest subtree */
+    Digests           scratch_;     /**< Subtree of each group */
+};
+
+PrunedMerkleTree::PrunedMerkleTree(const MerkleTree::Elements& elements,
+        bool preserveOrder, size_t keptLayers, size_t cachedSubtrees)
+    : preserveOrder_(preserveOrder), subtreeHeight_(0), cache_(NULL)
+{
+    leaves_.reserve(elements.size());
+    for (   MerkleTree::Elements::const_iterator it = elements.begin();
+            it != elements.end();
+            ++it) {
+        if (!it->empty()) { // ignore empty elements, like `MerkleTree`
+            leaves_.push_back(Digest::fromBuffer(*it));
+        }
+    }
+    build(keptLayers, cachedSubtrees);
+}
+
+PrunedMerkleTree::PrunedMerkleTree(const MerkleTree::Digests& leaves,
+        bool preserveOrder, size_t keptLayers, size_t cachedSubtrees)
+    : preserveOrder_(preserveOrder), leaves_(leaves), subtreeHeight_(0),
+      cache_(NULL)
+{
+    build(keptLayers, cachedSubtrees);
+}
+
+PrunedMerkleTree::~PrunedMerkleTree()
+{
+    MERKLE_TREE_STATS_ADD(layerBytes, -static_cast<int64_t>(getMemoryUsage()));
+    delete cache_;
+}
+
+size_t PrunedMerkleTree::getMemoryUsage() const
+{
+    return leaves_.capacity() * sizeof(Digest)
+        + top_.capacity() * sizeof(Digest)
+        + topOffsets_.capacity() * sizeof(uint64_t);
+}
+
+void PrunedMerkleTree::updateLeaf(size_t index, const MerkleTree::Digest& element)
+{
+    if (!preserveOrder_) {
+        throw std::runtime_error("Can't update a tree without preserved order");
+    }
+    if (index == 0) {
+        throw std::runtime_error("Index is zero");
+    }
+    index--;
+    if (index >= getLeafCount()) {
+        throw std::runtime_error("Index out of range");
+    }
+    leaves_[index] = element;
+
+    // Rehash the path of the leaf in its subtree, if it is cached, or
+    // rebuild the subtree otherwise
+    const size_t block = index >> subtreeHeight_;
+    Digest* roots = getTop(subtreeHeight_);
+    if (subtreeHeight_ == 0) {
+        roots[block] = element;
+    } else {
+        Digests* cached = cache_ ? cache_->get(block) : NULL;
+        if (cached != NULL) {
+            const size_t count = getBlockSize(block);
+            const size_t position = index - (block << subtreeHeight_);
+            const Digest* below = &leaves_[block << subtreeHeight_];
+            Digest* nodes = &(*cached)[0];
+            for (size_t layer = 1; layer <= subtreeHeight_; ++layer) {
+                hashNode(below, layerSize(count, layer - 1),
+                        position >> layer, preserveOrder_, nodes);
+                below = nodes;
+                nodes += layerSize(count, layer);
+            }
+            roots[block] = cached->back();
+        } else {
+            Digests nodes;
+            rebuildSubtree(block, nodes);
+            roots[block] = nodes.back();
+            if (cache_) {
+                cache_->insert(block, nodes);
+            }
+        }
+    }
+
+    // Then the path up to the root
+    size_t position = block;
+    for (size_t layer = subtreeHeight_ + 1; layer < getLayerCount(); ++layer) {
+        position /= 2;
+        hashNode(getTop(layer - 1), getTopSize(layer - 1), position,
+                preserveOrder_, getTop(layer));
+    }
+}
+
+MerkleTree::Elements PrunedMerkleTree::getProof(
+        const MerkleTree::Buffer& element) const
+{
+    MERKLE_TREE_STATS_ADD(leafLookups, 1);
+    if (element.size() != MerkleTree::DIGEST_SIZE_B) {
+        MERKLE_TREE_STATS_ADD(leafLookupMisses, 1);
+        throw std::runtime_error("Element not found");
+    }
+    const Digest leaf = Digest::fromBuffer(element);
+    Digests::const_iterator found;
+    if (preserveOrder_) {
+        found = std::find(leaves_.begin(), leaves_.end(), leaf);
+    } else {
+        found = std::lower_bound(leaves_.begin(), leaves_.end(), leaf);
+    }
+    if ((found == leaves_.end()) || (*found != leaf)) {
+        MERKLE_TREE_STATS_ADD(leafLookupMisses, 1);
+        throw std::runtime_error("Element not found");
+    }
+
+    Digest hashes[MerkleTree::MAX_PROOF_LENGTH];
+    const size_t length = getProof(found - leaves_.begin() + 1, hashes,
+            MerkleTree::MAX_PROOF_LENGTH);
+    MerkleTree::Elements proof;
+    for (size_t i = 0; i < length; ++i) {
+        proof.push_back(hashes[i].toBuffer());
+    }
+    return proof;
+}
+
+MerkleTree::Elements PrunedMerkleTree::getProofOrdered(
+        const MerkleTree::Buffer& element, size_t index) const
+{
+    if (index == 0) {
+        throw std::runtime_error("Index is zero");
+    }
+    if (    (index > getLeafCount())
+         || (element.size() != MerkleTree::DIGEST_SIZE_B)
+         || (leaves_[index - 1] != Digest::fromBuffer(element))) {
+        throw std::runtime_error("Index does not point to element");
+    }
+
+    Digest hashes[MerkleTree::MAX_PROOF_LENGTH];
+    const size_t length = getProof(index, hashes,
+            MerkleTree::MAX_PROOF_LENGTH);
+    MerkleTree::Elements proof;
+    for (size_t i = 0; i < length; ++i) {
+        proof.push_back(hashes[i].toBuffer());
+    }
+    return proof;
+}
+
+size_t PrunedMerkleTree::getProof(size_t index, MerkleTree::Digest* proof,
+        size_t capacity) const
+{
+    if (index == 0) {
+        throw std::runtime_error("Index is zero");
+    }
+    index--;
+    if (index >= getLeafCount()) {
+        throw std::runtime_error("Index out of range");
+    }
+    MERKLE_TREE_STATS_ADD(proofsGenerated, 1);
+
+    // The leaves are all there; the layers in between come from the
+    // subtree of the block of the leaf
+    size_t length = 0;
+    if (subtreeHeight_ > 0) {
+        addSibling(&leaves_[0], getLeafCount(), index, proof, capacity,
+                length);
+    }
+    if (subtreeHeight_ > 1) {
+        const size_t block = index >> subtreeHeight_;
+        const size_t count = getBlockSize(block);
+        const size_t position = index - (block << subtreeHeight_);
+        if (    (cache_ == NULL)
+             || !cache_->addSiblings(block, count, subtreeHeight_, position,
+                     proof, capacity, length)) {
+            Digests nodes;
+            rebuildSubtree(block, nodes);
+            addSubtreeSiblings(&nodes[0], count, subtreeHeight_, position,
+                    proof, capacity, length);
+            if (cache_) {
+                cache_->insert(block, nodes);
+            }
+        }
+    }
+
+    // Then the kept layers
+    index >>= subtreeHeight_;
+    for (size_t layer = subtreeHeight_; layer < getLayerCount(); ++layer) {
+        addSibling(getTop(layer), getTopSize(layer), index, proof, capacity,
+                length);
+        index /= 2;
+    }
+    return length;
+}
+
+void PrunedMerkleTree::build(size_t keptLayers, size_t cachedSubtrees)
+{
+    if (leaves_.empty()) {
+        throw std::runtime_error("Empty elements list");
+    }
+    if (keptLayers == 0) {
+        throw std::runtime_error("At least the root layer must be kept");
+    }
+    if (!preserveOrder_) {
+        // Sort elements and remove duplicates
+        sortUniqueDigests(leaves_, NULL);
+    }
+
+    size_t layerCount = 1;
+    for (size_t size = getLeafCount(); size > 1; size = (size + 1) / 2) {
+        ++layerCount;
+    }
+    if (layerCount > keptLayers + 1) {
+        subtreeHeight_ = layerCount - keptLayers;
+    } else {
+        subtreeHeight_ = std::min<size_t>(1, layerCount - 1); // keep them all
+    }
+    topOffsets_.clear();
+    topOffsets_.push_back(0);
+    for (size_t layer = subtreeHeight_; layer < layerCount; ++layer) {
+        topOffsets_.push_back(topOffsets_.back()
+                + layerSize(getLeafCount(), layer));
+    }
+    top_.resize(topOffsets_.back());
+
+    // The lowest kept layer holds the roots of the blocks, which are built
+    // independently; the layers above it are built as in a `MerkleTree`
+    if (subtreeHeight_ == 0) {
+        top_[0] = leaves_[0];
+    } else {
+        MerkleTreeExecutor& executor = MerkleTreeThreadPool::getDefault();
+        const size_t blocks = getTopSize(subtreeHeight_);
+        size_t groups = 1;
+        if (getLeafCount() >= MIN_PARALLEL_LEAVES) {
+            groups = std::min(blocks,
+                    executor.getConcurrency() * GROUPS_PER_THREAD);
+        }
+        BlockRootsTask task(*this, groups);
+        if (groups > 1) {
+            executor.parallelFor(groups, task);
+        } else {
+            task.run(0);
+        }
+    }
+    for (size_t layer = subtreeHeight_ + 1; layer < layerCount; ++layer) {
+        const Digest* below = getTop(layer - 1);
+        const size_t belowSize = getTopSize(layer - 1);
+        Digest* current = getTop(layer);
+        hashPairs<MerkleTree>(below, belowSize / 2, preserveOrder_, current);
+        if (belowSize & 1) {
+            current[belowSize / 2] = below[belowSize - 1];
+        }
+    }
+
+    if (cachedSubtrees > 0) {
+        cache_ = new Cache(cachedSubtrees);
+    }
+    MERKLE_TREE_STATS_ADD(layerBytes, getMemoryUsage());
+}
+
+size_t PrunedMerkleTree::getBlockSize(size_t block) const
+{
+    const size_t first = block << subtreeHeight_;
+    return std::min(getLeafCount() - first, size_t(1) << subtreeHeight_);
+}
+
+size_t PrunedMerkleTree::getSubtreeSize(size_t block) const
+{
+    const size_t count = getBlockSize(block);
+    size_t size = 0;
+    for (size_t layer = 1; layer <= subtreeHeight_; ++layer) {
+        size += layerSize(count, layer);
+    }
+    return size;
+}
+
+void PrunedMerkleTree::buildSubtree(size_t block, MerkleTree::Digest* nodes)
+    const
+{
+    // Same as `MerkleTree::getNextLayer()`, for each layer of the block
+    const Digest* below = &leaves_[block << subtreeHeight_];
+    size_t belowSize = getBlockSize(block);
+    for (size_t layer = 1; layer <= subtreeHeight_; ++layer) {
+        hashPairs<MerkleTree>(below, belowSize / 2, preserveOrder_, nodes);
+        if (belowSize & 1) {
+            nodes[belowSize / 2] = below[belowSize - 1];
+        }
+        below = nodes;
+        belowSize = (belowSize + 1) / 2;
+        nodes += belowSize;
+    }
+}
+
+void PrunedMerkleTree::rebuildSubtree(size_t block, MerkleTree::Digests& nodes)
+    const
+{
+    MERKLE_TREE_STATS_ADD(subtreesRebuilt, 1);
+    nodes.resize(getSubtreeSize(block));
+    buildSubtree(block, &nodes[0]);
+}
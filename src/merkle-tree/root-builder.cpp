@@ -0,0 +1,133 @@
+#include "merkle-tree/root-builder.hpp"
+#include <sstream>
+#include "layer-hash.hpp"
+
+namespace {
+
+/** Leaves added in batches are reduced by blocks of `2^BLOCK_HEIGHT` */
+const size_t BLOCK_HEIGHT = 8;
+
+/** Number of leaves in a block */
+const size_t BLOCK_LEAVES = size_t(1) << BLOCK_HEIGHT;
+
+/** Compute the root of a complete subtree of `BLOCK_LEAVES` leaves */
+MerkleTree::Digest reduceBlock(const MerkleTree::Digest* leaves,
+        bool preserveOrder)
+{
+    MerkleTree::Digest layers[2][BLOCK_LEAVES / 2];
+    hashPairs<MerkleTree>(leaves, BLOCK_LEAVES / 2, preserveOrder, layers[0]);
+    size_t current = 0;
+    for (size_t size = BLOCK_LEAVES / 2; size > 1; size /= 2) {
+        hashPairs<MerkleTree>(layers[current], size / 2, preserveOrder,
+                layers[1 - current]);
+        current = 1 - current;
+    }
+    return layers[current][0];
+}
+
+} // namespace
+
+MerkleRootBuilder::MerkleRootBuilder(bool preserveOrder)
+    : preserveOrder_(preserveOrder), leafCount_(0)
+{
+}
+
+void MerkleRootBuilder::add(const MerkleTree::Buffer& element)
+{
+    if (element.empty()) {
+        return; // ignore empty elements
+    }
+    if (element.size() != MERKLE_TREE_ELEMENT_SIZE_B) {
+        std::ostringstream oss;
+        oss << "Element size is " << element.size() << ", it must be "
+            << MERKLE_TREE_ELEMENT_SIZE_B;
+        throw std::runtime_error(oss.str());
+    }
+    add(MerkleTree::Digest::fromBuffer(element));
+}
+
+void MerkleRootBuilder::add(const MerkleTree::Digest& leaf)
+{
+    add(&leaf, 1);
+}
+
+void MerkleRootBuilder::add(const MerkleTree::Digest* leaves, size_t count)
+{
+    if (preserveOrder_) {
+        addRun(leaves, count);
+        return;
+    }
+
+    // Add runs of increasing leaves, skipping duplicates
+    size_t first = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if ((i == 0) && (leafCount_ == 0)) {
+            continue;
+        }
+        const MerkleTree::Digest& previous = (i > 0) ? leaves[i - 1] : last_;
+        if (leaves[i] > previous) {
+            continue;
+        }
+        addRun(leaves + first, i - first);
+        if (leaves[i] != previous) {
+            throw std::runtime_error("Leaves are not sorted");
+        }
+        first = i + 1;
+    }
+    addRun(leaves + first, count - first);
+}
+
+MerkleTree::Digest MerkleRootBuilder::getRootDigest() const
+{
+    if (peaks_.empty()) {
+        throw std::runtime_error("Empty elements list");
+    }
+
+    // Odd nodes are carried up unhashed, which amounts to combining the
+    // subtrees from right to left
+    MerkleTree::Digest root = peaks_.back();
+    for (size_t i = peaks_.size() - 1; i > 0; --i) {
+        root = MerkleTree::combinedHash(peaks_[i - 1], root, preserveOrder_);
+    }
+    return root;
+}
+
+void MerkleRootBuilder::reset()
+{
+    leafCount_ = 0;
+    peaks_.clear();
+}
+
+void MerkleRootBuilder::addRun(const MerkleTree::Digest* leaves, size_t count)
+{
+    if (count == 0) {
+        return;
+    }
+
+    // Add single leaves until the next one starts a block, then whole
+    // blocks, then the remaining leaves
+    size_t i = 0;
+    for ( ; (i < count) && ((leafCount_ & (BLOCK_LEAVES - 1)) != 0); ++i) {
+        addPeak(leaves[i], 0);
+    }
+    for ( ; i + BLOCK_LEAVES <= count; i += BLOCK_LEAVES) {
+        addPeak(reduceBlock(leaves + i, preserveOrder_), BLOCK_HEIGHT);
+    }
+    for ( ; i < count; ++i) {
+        addPeak(leaves[i], 0);
+    }
+    last_ = leaves[count - 1];
+}
+
+void MerkleRootBuilder::addPeak(const MerkleTree::Digest& peak, size_t height)
+{
+    // Like incrementing a binary counter: each carry merges two subtrees of
+    // the same size
+    MerkleTree::Digest node = peak;
+    for (uint64_t count = leafCount_ >> height; count & 1; count >>= 1) {
+        node = MerkleTree::combinedHash(peaks_.back(), node, preserveOrder_);
+        peaks_.pop_back();
+    }
+    peaks_.push_back(node);
+    leafCount_ += uint64_t(1) << height;
+}
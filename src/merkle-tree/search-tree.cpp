@@ -0,0 +1,357 @@
+#include "merkle-tree/search-tree.hpp"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+#include "digest-sort.hpp"
+#include "hash-policy.hpp"
+#include "stats-counters.hpp"
+
+namespace {
+
+typedef MerkleTree::Digest Digest;
+
+/** Hash of an empty subtree */
+const Digest EMPTY_HASH = Digest();
+
+/** Get the hash of a node from its key and the hashes of its subtrees */
+Digest hashNode(const Digest& left, const Digest& key, const Digest& right)
+{
+    uint8_t data[3 * sizeof(Digest)];
+    std::memcpy(data, left.bytes, sizeof(Digest));
+    std::memcpy(data + sizeof(Digest), key.bytes, sizeof(Digest));
+    std::memcpy(data + 2 * sizeof(Digest), right.bytes, sizeof(Digest));
+    MerkleTree::Hash::State state;
+    MerkleTree::Hash::init(state, sizeof(Digest));
+    MerkleTree::Hash::update(state, data, sizeof(data));
+    Digest digest;
+    MerkleTree::Hash::final(state, digest.bytes, sizeof(digest.bytes));
+    return digest;
+}
+
+/** Get the priority of a key: its 8-byte BLAKE2b hash, read in
+ * little-endian byte order so all hosts build the same tree */
+uint64_t priorityOf(const Digest& key)
+{
+    uint8_t hash[sizeof(uint64_t)];
+    MerkleTree::Hash::State state;
+    MerkleTree::Hash::init(state, sizeof(hash));
+    MerkleTree::Hash::update(state, key.bytes, sizeof(key.bytes));
+    MerkleTree::Hash::final(state, hash, sizeof(hash));
+    uint64_t priority = 0;
+    for (size_t i = 0; i < sizeof(hash); ++i) {
+        priority |= uint64_t(hash[i]) << (8 * i);
+    }
+    return priority;
+}
+
+/** Hash the nodes of a proof from the bottom up, starting from `hash`
+ *
+ * \return `false` if the proof goes through a node of `key`
+ */
+bool walkProof(const MerkleSearchTree::Proof& proof,
+        const MerkleSearchTree::Key& key, Digest& hash)
+{
+    for (size_t i = proof.steps.size(); i > 0; --i) {
+        const MerkleSearchTree::Proof::Step& step = proof.steps[i - 1];
+        if (key < step.key) {
+            hash = hashNode(hash, step.key, step.sibling);
+        } else if (step.key < key) {
+            hash = hashNode(step.sibling, step.key, hash);
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+const uint32_t MerkleSearchTree::NONE;
+
+MerkleSearchTree::MerkleSearchTree()
+    : root_(NONE), keyCount_(0)
+{
+}
+
+MerkleSearchTree::MerkleSearchTree(const Keys& keys)
+    : root_(NONE), keyCount_(0)
+{
+    Keys sorted(keys);
+    sortUniqueDigests(sorted, NULL);
+    nodes_.reserve(sorted.size());
+
+    // Build the tree from left to right, keeping the path from the root to
+    // the last node on a stack; a node pops the nodes it must be above, which
+    // then have all their descendants, and become its left subtree
+    std::vector<uint32_t> stack;
+    for (size_t i = 0; i < sorted.size(); ++i) {
+        const uint32_t node = newNode(sorted[i]);
+        uint32_t last = NONE;
+        while (!stack.empty() && isAbove(node, stack.back())) {
+            last = stack.back();
+            stack.pop_back();
+            rehash(last);
+        }
+        nodes_[node].children[0] = last;
+        if (!stack.empty()) {
+            nodes_[stack.back()].children[1] = node;
+        }
+        stack.push_back(node);
+    }
+    for (size_t i = stack.size(); i > 0; --i) {
+        rehash(stack[i - 1]);
+    }
+    root_ = stack.empty() ? NONE : stack[0];
+    keyCount_ = sorted.size();
+}
+
+const MerkleTree::Digest& MerkleSearchTree::getRootDigest() const
+{
+    return getHash(root_);
+}
+
+size_t MerkleSearchTree::getDepth() const
+{
+    size_t depth = 0;
+    std::vector<std::pair<uint32_t, size_t> > stack;
+    if (root_ != NONE) {
+        stack.push_back(std::make_pair(root_, 1));
+    }
+    while (!stack.empty()) {
+        const std::pair<uint32_t, size_t> top = stack.back();
+        stack.pop_back();
+        depth = std::max(depth, top.second);
+        for (size_t side = 0; side < 2; ++side) {
+            if (nodes_[top.first].children[side] != NONE) {
+                stack.push_back(std::make_pair(
+                            nodes_[top.first].children[side], top.second + 1));
+            }
+        }
+    }
+    return depth;
+}
+
+bool MerkleSearchTree::contains(const Key& key) const
+{
+    MERKLE_TREE_STATS_ADD(leafLookups, 1);
+    uint32_t node = root_;
+    while (node != NONE) {
+        const Node& current = nodes_[node];
+        if (key < current.key) {
+            node = current.children[0];
+        } else if (current.key < key) {
+            node = current.children[1];
+        } else {
+            return true;
+        }
+    }
+    MERKLE_TREE_STATS_ADD(leafLookupMisses, 1);
+    return false;
+}
+
+bool MerkleSearchTree::insert(const Key& key)
+{
+    if (contains(key)) {
+        return false;
+    }
+    const uint32_t fresh = newNode(key);
+
+    // Go down to the first node the new one must be above; it takes the
+    // place of that node, whose subtree is split between its two children
+    std::vector<uint32_t> path;
+    size_t side = 0;
+    uint32_t node = root_;
+    while ((node != NONE) && !isAbove(fresh, node)) {
+        path.push_back(node);
+        side = (key < nodes_[node].key) ? 0 : 1;
+        node = nodes_[node].children[side];
+    }
+    uint32_t lower;
+    uint32_t upper;
+    split(node, key, lower, upper);
+    nodes_[fresh].children[0] = lower;
+    nodes_[fresh].children[1] = upper;
+    rehash(fresh);
+    setChild(path.empty() ? NONE : path.back(), side, fresh);
+    rehashPath(path);
+    ++keyCount_;
+    return true;
+}
+
+bool MerkleSearchTree::erase(const Key& key)
+{
+    std::vector<uint32_t> path;
+    size_t side = 0;
+    uint32_t node = root_;
+    while ((node != NONE) && (nodes_[node].key != key)) {
+        path.push_back(node);
+        side = (key < nodes_[node].key) ? 0 : 1;
+        node = nodes_[node].children[side];
+    }
+    if (node == NONE) {
+        return false;
+    }
+
+    // The two subtrees of the node take its place
+    setChild(path.empty() ? NONE : path.back(), side,
+            join(nodes_[node].children[0], nodes_[node].children[1]));
+    freeNodes_.push_back(node);
+    rehashPath(path);
+    --keyCount_;
+    return true;
+}
+
+MerkleSearchTree::Keys MerkleSearchTree::getKeys() const
+{
+    Keys keys;
+    keys.reserve(keyCount_);
+    std::vector<uint32_t> stack;
+    uint32_t node = root_;
+    while ((node != NONE) || !stack.empty()) {
+        while (node != NONE) {
+            stack.push_back(node);
+            node = nodes_[node].children[0];
+        }
+        node = stack.back();
+        stack.pop_back();
+        keys.push_back(nodes_[node].key);
+        node = nodes_[node].children[1];
+    }
+    return keys;
+}
+
+MerkleSearchTree::Proof MerkleSearchTree::getProof(const Key& key) const
+{
+    MERKLE_TREE_STATS_ADD(proofsGenerated, 1);
+    Proof proof;
+    proof.children[0] = EMPTY_HASH;
+    proof.children[1] = EMPTY_HASH;
+    uint32_t node = root_;
+    while ((node != NONE) && (nodes_[node].key != key)) {
+        const Node& current = nodes_[node];
+        const size_t side = (key < current.key) ? 0 : 1;
+        Proof::Step step;
+        step.key = current.key;
+        step.sibling = getHash(current.children[1 - side]);
+        proof.steps.push_back(step);
+        node = current.children[side];
+    }
+    if (node != NONE) {
+        proof.children[0] = getHash(nodes_[node].children[0]);
+        proof.children[1] = getHash(nodes_[node].children[1]);
+    }
+    return proof;
+}
+
+bool MerkleSearchTree::checkProof(const Proof& proof,
+        const MerkleTree::Digest& root, const Key& key)
+{
+    MERKLE_TREE_STATS_ADD(proofsVerified, 1);
+    Digest hash = hashNode(proof.children[0], key, proof.children[1]);
+    return walkProof(proof, key, hash) && (hash == root);
+}
+
+bool MerkleSearchTree::checkExclusionProof(const Proof& proof,
+        const MerkleTree::Digest& root, const Key& key)
+{
+    MERKLE_TREE_STATS_ADD(proofsVerified, 1);
+    Digest hash = EMPTY_HASH;
+    return walkProof(proof, key, hash) && (hash == root);
+}
+
+uint32_t MerkleSearchTree::newNode(const Key& key)
+{
+    uint32_t node;
+    if (freeNodes_.empty()) {
+        if (nodes_.size() >= NONE) {
+            throw std::runtime_error("Too many keys");
+        }
+        nodes_.push_back(Node());
+        node = nodes_.size() - 1;
+    } else {
+        node = freeNodes_.back();
+        freeNodes_.pop_back();
+    }
+    Node& fresh = nodes_[node];
+    fresh.key = key;
+    fresh.hash = hashNode(EMPTY_HASH, key, EMPTY_HASH);
+    fresh.priority = priorityOf(key);
+    fresh.children[0] = NONE;
+    fresh.children[1] = NONE;
+    return node;
+}
+
+bool MerkleSearchTree::isAbove(uint32_t a, uint32_t b) const
+{
+    // NB: Priorities are 64-bit hashes, ties are very unlikely
+    return (nodes_[a].priority > nodes_[b].priority)
+        || (    (nodes_[a].priority == nodes_[b].priority)
+             && (nodes_[a].key < nodes_[b].key));
+}
+
+const MerkleTree::Digest& MerkleSearchTree::getHash(uint32_t node) const
+{
+    return (node == NONE) ? EMPTY_HASH : nodes_[node].hash;
+}
+
+void MerkleSearchTree::rehash(uint32_t node)
+{
+    Node& current = nodes_[node];
+    current.hash = hashNode(getHash(current.children[0]), current.key,
+            getHash(current.children[1]));
+}
+
+void MerkleSearchTree::setChild(uint32_t parent, size_t side, uint32_t child)
+{
+    if (parent == NONE) {
+        root_ = child;
+    } else {
+        nodes_[parent].children[side] = child;
+    }
+}
+
+void MerkleSearchTree::rehashPath(const std::vector<uint32_t>& path)
+{
+    for (size_t i = path.size(); i > 0; --i) {
+        rehash(path[i - 1]);
+    }
+}
+
+void MerkleSearchTree::split(uint32_t node, const Key& key, uint32_t& lower,
+        uint32_t& upper)
+{
+    if (node == NONE) {
+        lower = NONE;
+        upper = NONE;
+        return;
+    }
+    uint32_t child;
+    if (nodes_[node].key < key) {
+        split(nodes_[node].children[1], key, child, upper);
+        nodes_[node].children[1] = child;
+        lower = node;
+    } else {
+        split(nodes_[node].children[0], key, lower, child);
+        nodes_[node].children[0] = child;
+        upper = node;
+    }
+    rehash(node);
+}
+
+uint32_t MerkleSearchTree::join(uint32_t lower, uint32_t upper)
+{
+    if ((lower == NONE) || (upper == NONE)) {
+        return (lower == NONE) ? upper : lower;
+    }
+    if (isAbove(lower, upper)) {
+        const uint32_t child = join(nodes_[lower].children[1], upper);
+        nodes_[lower].children[1] = child;
+        rehash(lower);
+        return lower;
+    }
+    const uint32_t child = join(lower, nodes_[upper].children[0]);
+    nodes_[upper].children[0] = child;
+    rehash(upper);
+    return upper;
+}
@@ -0,0 +1,378 @@
+#include "merkle-tree/sparse-tree.hpp"
+#include <algorithm>
+#include "stats-counters.hpp"
+
+extern "C" {
+#include <pthread.h>
+}
+
+namespace {
+
+typedef MerkleTree::Digest Digest;
+
+pthread_once_t defaultHashesOnce = PTHREAD_ONCE_INIT;
+
+/** Hash of an empty subtree at each depth, the last one being an empty
+ * leaf */
+Digest defaultHashes[SparseMerkleTree::DEPTH + 1];
+
+void computeDefaultHashes()
+{
+    Digest* hashes = defaultHashes;
+    std::memset(hashes[SparseMerkleTree::DEPTH].bytes, 0, sizeof(Digest));
+    for (size_t depth = SparseMerkleTree::DEPTH; depth > 0; --depth) {
+        hashes[depth - 1] = MerkleTree::combinedHash(hashes[depth],
+                hashes[depth], true);
+    }
+}
+
+const Digest* getDefaultHashes()
+{
+    pthread_once(&defaultHashesOnce, computeDefaultHashes);
+    return defaultHashes;
+}
+
+/** Get bit `index` of a key, most significant bit first */
+inline size_t bitOf(const SparseMerkleTree::Key& key, size_t index)
+{
+    return (key.bytes[index / 8] >> (7 - (index % 8))) & 1;
+}
+
+/** Get the number of leading bits two keys have in common */
+size_t commonBits(const SparseMerkleTree::Key& a,
+        const SparseMerkleTree::Key& b)
+{
+    for (size_t i = 0; i < sizeof(a.bytes); ++i) {
+        const uint8_t diff = a.bytes[i] ^ b.bytes[i];
+        if (diff != 0) {
+            size_t bits = 8 * i;
+            for (uint8_t mask = 0x80; !(diff & mask); mask >>= 1) {
+                ++bits;
+            }
+            return bits;
+        }
+    }
+    return SparseMerkleTree::DEPTH;
+}
+
+/** Find the first of the given items whose key has bit `index` set; all
+ * the keys must have the same bits above it, so they are partitioned by it */
+template <class T>
+const T* splitAt(const T* first, const T* last, size_t index)
+{
+    while (first != last) {
+        const T* middle = first + (last - first) / 2;
+        if (bitOf(middle->key, index)) {
+            last = middle;
+        } else {
+            first = middle + 1;
+        }
+    }
+    return first;
+}
+
+/** Get the hash of a node from the hash of one of its children */
+inline Digest hashUp(const Digest& child, const Digest& sibling, size_t bit)
+{
+    return bit ? MerkleTree::combinedHash(sibling, child, true)
+        : MerkleTree::combinedHash(child, sibling, true);
+}
+
+} // namespace
+
+const size_t SparseMerkleTree::DEPTH;
+const size_t SparseMerkleTree::NONE;
+
+SparseMerkleTree::SparseMerkleTree()
+    : root_(NONE), leafCount_(0), rootHash_(getDefaultHashes()[0])
+{
+}
+
+const SparseMerkleTree::Value& SparseMerkleTree::getEmptyValue()
+{
+    return getDefaultHashes()[DEPTH];
+}
+
+const MerkleTree::Digest& SparseMerkleTree::getDefaultHash(size_t depth)
+{
+    if (depth > DEPTH) {
+        throw std::runtime_error("Depth out of range");
+    }
+    return getDefaultHashes()[depth];
+}
+
+bool SparseMerkleTree::find(const Key& key, Value& value) const
+{
+    MERKLE_TREE_STATS_ADD(leafLookups, 1);
+    size_t node = root_;
+    while ((node != NONE) && (nodes_[node].depth < DEPTH)) {
+        node = nodes_[node].children[bitOf(key, nodes_[node].depth)];
+    }
+    if ((node == NONE) || (nodes_[node].key != key)) {
+        MERKLE_TREE_STATS_ADD(leafLookupMisses, 1);
+        return false;
+    }
+    value = nodes_[node].hashes[0];
+    return true;
+}
+
+void SparseMerkleTree::insert(const Key& key, const Value& value)
+{
+    Entries entries;
+    entries.push_back(std::make_pair(key, value));
+    insert(entries);
+}
+
+void SparseMerkleTree::insert(const Entries& entries)
+{
+    std::vector<Change> changes(entries.size());
+    for (size_t i = 0; i < entries.size(); ++i) {
+        if (entries[i].second == getEmptyValue()) {
+            throw std::runtime_error("Value is the empty value");
+        }
+        changes[i].key = entries[i].first;
+        changes[i].value = entries[i].second;
+    }
+    apply(changes);
+}
+
+void SparseMerkleTree::erase(const Key& key)
+{
+    erase(Keys(1, key));
+}
+
+void SparseMerkleTree::erase(const Keys& keys)
+{
+    std::vector<Change> changes(keys.size());
+    for (size_t i = 0; i < keys.size(); ++i) {
+        changes[i].key = keys[i];
+        changes[i].value = getEmptyValue();
+    }
+    apply(changes);
+}
+
+SparseMerkleTree::Proof SparseMerkleTree::getProof(const Key& key) const
+{
+    MERKLE_TREE_STATS_ADD(proofsGenerated, 1);
+    Proof proof;
+    proof.bitmap[0] = 0;
+    proof.bitmap[1] = 0;
+
+    // Walk down the trie, from the root to the leaf of `key` or to the empty
+    // subtree it is in
+    size_t node = root_;
+    while (node != NONE) {
+        const Node& current = nodes_[node];
+        const size_t common = commonBits(key, current.key);
+        size_t depth;
+        if (common >= current.depth) {
+            if (current.depth == DEPTH) {
+                break; // found `key`
+            }
+            const size_t bit = bitOf(key, current.depth);
+            depth = current.depth + 1;
+            proof.siblings.push_back(current.hashes[1 - bit]);
+            node = current.children[bit];
+        } else {
+            // `key` leaves the path to `node` at depth `common`, the rest of
+            // its path is in empty subtrees
+            depth = common + 1;
+            proof.siblings.push_back(getHash(node, depth));
+            node = NONE;
+        }
+        proof.bitmap[(depth - 1) / 64] |= uint64_t(1) << ((depth - 1) % 64);
+    }
+    std::reverse(proof.siblings.begin(), proof.siblings.end());
+    return proof;
+}
+
+bool SparseMerkleTree::checkProof(const Proof& proof,
+        const MerkleTree::Digest& root, const Key& key, const Value& value)
+{
+    MERKLE_TREE_STATS_ADD(proofsVerified, 1);
+    const Digest* defaults = getDefaultHashes();
+    Digest hash = value;
+    bool empty = (value == defaults[DEPTH]); // `hash` is a default hash
+    size_t next = 0;
+    for (size_t depth = DEPTH; depth > 0; --depth) {
+        if (proof.bitmap[(depth - 1) / 64] & (uint64_t(1) << ((depth - 1) % 64))) {
+            if (next == proof.siblings.size()) {
+                return false;
+            }
+            hash = hashUp(hash, proof.siblings[next++], bitOf(key, depth - 1));
+            empty = false;
+        } else if (empty) {
+            hash = defaults[depth - 1]; // no need to hash empty subtrees
+        } else {
+            hash = hashUp(hash, defaults[depth], bitOf(key, depth - 1));
+        }
+    }
+    return (next == proof.siblings.size()) && (hash == root);
+}
+
+void SparseMerkleTree::apply(std::vector<Change>& changes)
+{
+    if (changes.empty()) {
+        return;
+    }
+
+    // Keep only the last change of each key
+    std::stable_sort(changes.begin(), changes.end());
+    size_t count = 0;
+    for (size_t i = 0; i < changes.size(); ++i) {
+        if ((i + 1 < changes.size()) && (changes[i + 1].key == changes[i].key)) {
+            continue;
+        }
+        changes[count++] = changes[i];
+    }
+
+    root_ = apply(root_, &changes[0], &changes[0] + count);
+    rootHash_ = (root_ == NONE) ? getDefaultHashes()[0] : getHash(root_, 0);
+}
+
+size_t SparseMerkleTree::apply(size_t node, const Change* first,
+        const Change* last)
+{
+    if (first == last) {
+        return node;
+    }
+    if ((node == NONE) || (nodes_[node].depth == DEPTH)) {
+        return merge(first, last, node);
+    }
+
+    // NB: `nodes_` may be reallocated below, don't keep references into it
+    const Key key = nodes_[node].key;
+    const size_t depth = nodes_[node].depth;
+    const size_t common = std::min(commonBits(key, first->key),
+            commonBits(key, (last - 1)->key));
+    if (common < depth) {
+        // Some changes are out of the subtree of `node`: they go under a new
+        // branch, at the depth where they part ways with it
+        const Change* middle = splitAt(first, last, common);
+        size_t children[2];
+        const size_t bit = bitOf(key, common);
+        if (bit) {
+            children[0] = merge(first, middle, NONE);
+            children[1] = apply(node, middle, last);
+        } else {
+            children[0] = apply(node, first, middle);
+            children[1] = merge(middle, last, NONE);
+        }
+        if ((children[0] == NONE) || (children[1] == NONE)) {
+            return (children[0] == NONE) ? children[1] : children[0];
+        }
+        return newBranch(common, children[0], children[1]);
+    }
+
+    const Change* middle = splitAt(first, last, depth);
+    const size_t left = apply(nodes_[node].children[0], first, middle);
+    const size_t right = apply(nodes_[node].children[1], middle, last);
+    if ((left == NONE) || (right == NONE)) {
+        freeNode(node);
+        return (left == NONE) ? right : left;
+    }
+
+    // Only rehash the sides that have changed
+    Node& branch = nodes_[node];
+    branch.key = nodes_[left].key;
+    branch.children[0] = left;
+    branch.children[1] = right;
+    if (first != middle) {
+        branch.hashes[0] = getHash(left, depth + 1);
+    }
+    if (middle != last) {
+        branch.hashes[1] = getHash(right, depth + 1);
+    }
+    return node;
+}
+
+size_t SparseMerkleTree::merge(const Change* first, const Change* last,
+        size_t leaf)
+{
+    std::vector<Change> leaves;
+    bool keepLeaf = (leaf != NONE);
+    for (const Change* it = first; it != last; ++it) {
+        if (keepLeaf && (it->key == nodes_[leaf].key)) {
+            keepLeaf = false; // replaced or removed
+        }
+        if (it->value != getEmptyValue()) {
+            leaves.push_back(*it);
+        }
+    }
+    if (leaf != NONE) {
+        if (keepLeaf) {
+            Change change;
+            change.key = nodes_[leaf].key;
+            change.value = nodes_[leaf].hashes[0];
+            leaves.insert(std::lower_bound(leaves.begin(), leaves.end(),
+                        change), change);
+        }
+        freeNode(leaf);
+        --leafCount_;
+    }
+    if (leaves.empty()) {
+        return NONE;
+    }
+    leafCount_ += leaves.size();
+    return build(&leaves[0], &leaves[0] + leaves.size());
+}
+
+size_t SparseMerkleTree::build(const Change* first, const Change* last)
+{
+    if (last - first == 1) {
+        const size_t leaf = newNode();
+        Node& node = nodes_[leaf];
+        node.key = first->key;
+        node.depth = DEPTH;
+        node.hashes[0] = first->value;
+        return leaf;
+    }
+    const size_t common = commonBits(first->key, (last - 1)->key);
+    const Change* middle = splitAt(first, last, common);
+    const size_t left = build(first, middle);
+    const size_t right = build(middle, last);
+    return newBranch(common, left, right);
+}
+
+size_t SparseMerkleTree::newNode()
+{
+    if (freeNodes_.empty()) {
+        nodes_.push_back(Node());
+        return nodes_.size() - 1;
+    }
+    const size_t node = freeNodes_.back();
+    freeNodes_.pop_back();
+    return node;
+}
+
+void SparseMerkleTree::freeNode(size_t node)
+{
+    freeNodes_.push_back(node);
+}
+
+size_t SparseMerkleTree::newBranch(size_t depth, size_t left, size_t right)
+{
+    const MerkleTree::Digest leftHash = getHash(left, depth + 1);
+    const MerkleTree::Digest rightHash = getHash(right, depth + 1);
+    const size_t node = newNode();
+    Node& branch = nodes_[node];
+    branch.key = nodes_[left].key;
+    branch.depth = depth;
+    branch.children[0] = left;
+    branch.children[1] = right;
+    branch.hashes[0] = leftHash;
+    branch.hashes[1] = rightHash;
+    return node;
+}
+
+MerkleTree::Digest SparseMerkleTree::getHash(size_t node, size_t depth) const
+{
+    const Digest* defaults = getDefaultHashes();
+    const Node& current = nodes_[node];
+    Digest hash = (current.depth == DEPTH) ? current.hashes[0]
+        : MerkleTree::combinedHash(current.hashes[0], current.hashes[1], true);
+    for (size_t d = current.depth; d > depth; --d) {
+        hash = hashUp(hash, defaults[d], bitOf(current.key, d - 1));
+    }
+    return hash;
+}
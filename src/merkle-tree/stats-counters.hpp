@@ -0,0 +1,80 @@
+#ifndef MERKLE_TREE_STATS_COUNTERS_HPP_
+#define MERKLE_TREE_STATS_COUNTERS_HPP_
+
+#include "merkle-tree/stats.hpp"
+
+extern "C" {
+#include <time.h>
+}
+
+#ifdef MERKLE_TREE_STATS
+
+/** Counters of the calling thread, or NULL if it has none yet */
+extern __thread MerkleTreeStats* merkleTreeThreadStats;
+
+/** Create and register the counters of the calling thread */
+MerkleTreeStats* registerThreadStats();
+
+/** Get the counters of the calling thread */
+inline MerkleTreeStats& threadStats()
+{
+    MerkleTreeStats* stats = merkleTreeThreadStats;
+    if (stats == NULL) {
+        stats = registerThreadStats();
+    }
+    return *stats;
+}
+
+/** Add `value` to the given counter of the calling thread */
+#define MERKLE_TREE_STATS_ADD(counter, value) \
+    (threadStats().counter += (value))
+
+#else
+
+#define MERKLE_TREE_STATS_ADD(counter, value) ((void)0)
+
+#endif
+
+/** Stopwatch timing the layers of a tree, \see
+ * MerkleTreeStats::layerNanoseconds
+ *
+ * This does nothing if statistics are compiled out.
+ */
+class LayerTimer
+{
+public :
+    /** Constructor; starts timing */
+    LayerTimer()
+    {
+#ifdef MERKLE_TREE_STATS
+        start_ = now();
+#endif
+    }
+
+    /** Account the time since the previous call (or the construction) to
+     * the given layer */
+    void lap(size_t layer)
+    {
+#ifdef MERKLE_TREE_STATS
+        const uint64_t end = now();
+        if (layer < MERKLE_TREE_STATS_LAYERS) {
+            MERKLE_TREE_STATS_ADD(layerNanoseconds[layer], end - start_);
+        }
+        start_ = end;
+#endif
+    }
+
+private :
+#ifdef MERKLE_TREE_STATS
+    uint64_t start_;
+
+    static uint64_t now()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+    }
+#endif
+};
+
+#endif // MERKLE_TREE_STATS_COUNTERS_HPP_
@@ -0,0 +1,176 @@
+#include "merkle-tree/stats.hpp"
+#include <algorithm>
+#include <new>
+#include "stats-counters.hpp"
+
+extern "C" {
+#include <pthread.h>
+}
+
+#ifdef MERKLE_TREE_STATS
+const bool MerkleTreeStats::ENABLED = true;
+#else
+const bool MerkleTreeStats::ENABLED = false;
+#endif
+
+MerkleTreeStats::MerkleTreeStats()
+    : compressions(0), bytesHashed(0), proofsGenerated(0), proofsVerified(0),
+      leafLookups(0), leafLookupMisses(0), subtreesRebuilt(0),
+      layerBytes(0)
+{
+    std::fill(layerNanoseconds, layerNanoseconds + MERKLE_TREE_STATS_LAYERS,
+            0);
+}
+
+MerkleTreeStats& MerkleTreeStats::operator+=(const MerkleTreeStats& other)
+{
+    compressions += other.compressions;
+    bytesHashed += other.bytesHashed;
+    for (size_t i = 0; i < MERKLE_TREE_STATS_LAYERS; ++i) {
+        layerNanoseconds[i] += other.layerNanoseconds[i];
+    }
+    proofsGenerated += other.proofsGenerated;
+    proofsVerified += other.proofsVerified;
+    leafLookups += other.leafLookups;
+    leafLookupMisses += other.leafLookupMisses;
+    subtreesRebuilt += other.subtreesRebuilt;
+    layerBytes += other.layerBytes;
+    return *this;
+}
+
+MerkleTreeStats& MerkleTreeStats::operator-=(const MerkleTreeStats& other)
+{
+    compressions -= other.compressions;
+    bytesHashed -= other.bytesHashed;
+    for (size_t i = 0; i < MERKLE_TREE_STATS_LAYERS; ++i) {
+        layerNanoseconds[i] -= other.layerNanoseconds[i];
+    }
+    proofsGenerated -= other.proofsGenerated;
+    proofsVerified -= other.proofsVerified;
+    leafLookups -= other.leafLookups;
+    leafLookupMisses -= other.leafLookupMisses;
+    subtreesRebuilt -= other.subtreesRebuilt;
+    layerBytes -= other.layerBytes;
+    return *this;
+}
+
+#ifdef MERKLE_TREE_STATS
+
+__thread MerkleTreeStats* merkleTreeThreadStats = NULL;
+
+namespace {
+
+/** Counters of a thread, linked to those of the other running threads */
+struct ThreadStats
+{
+    MerkleTreeStats stats;
+    ThreadStats* prev;
+    ThreadStats* next;
+};
+
+/** Storage for the counters of each thread
+ *
+ * NB: `__thread` variables can't have constructors, and allocating the
+ * counters on the heap would make the first counted event of a thread
+ * allocate memory, so they are constructed in place on registration.
+ */
+union ThreadStorage
+{
+    char bytes[sizeof(ThreadStats)];
+    uint64_t align;
+};
+__thread ThreadStorage threadStorage;
+
+pthread_once_t registryOnce = PTHREAD_ONCE_INIT;
+pthread_mutex_t registryMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/** Counters of the running threads that have any */
+ThreadStats* registry = NULL;
+
+/** Sum of the counters of the threads that have exited
+ *
+ * NB: Never destroyed, threads may exit after `main()` returns
+ */
+union RetiredStorage
+{
+    char bytes[sizeof(MerkleTreeStats)];
+    uint64_t align;
+};
+RetiredStorage retiredStorage;
+MerkleTreeStats* retired = NULL;
+
+/** Key whose destructor retires the counters of an exiting thread */
+pthread_key_t registryKey;
+
+void retireThreadStats(void* arg)
+{
+    ThreadStats* thread = static_cast<ThreadStats*>(arg);
+    pthread_mutex_lock(&registryMutex);
+    *retired += thread->stats;
+    if (thread->prev != NULL) {
+        thread->prev->next = thread->next;
+    } else {
+        registry = thread->next;
+    }
+    if (thread->next != NULL) {
+        thread->next->prev = thread->prev;
+    }
+    pthread_mutex_unlock(&registryMutex);
+    merkleTreeThreadStats = NULL;
+}
+
+void createRegistry()
+{
+    retired = new (retiredStorage.bytes) MerkleTreeStats;
+    pthread_key_create(&registryKey, retireThreadStats);
+}
+
+} // namespace
+
+MerkleTreeStats* registerThreadStats()
+{
+    pthread_once(&registryOnce, createRegistry);
+    ThreadStats* thread = new (threadStorage.bytes) ThreadStats;
+    thread->prev = NULL;
+    pthread_mutex_lock(&registryMutex);
+    thread->next = registry;
+    if (registry != NULL) {
+        registry->prev = thread;
+    }
+    registry = thread;
+    pthread_mutex_unlock(&registryMutex);
+    pthread_setspecific(registryKey, thread);
+    merkleTreeThreadStats = &thread->stats;
+    return &thread->stats;
+}
+
+MerkleTreeStats MerkleTreeStats::getThread()
+{
+    return threadStats();
+}
+
+MerkleTreeStats MerkleTreeStats::getTotal()
+{
+    pthread_once(&registryOnce, createRegistry);
+    pthread_mutex_lock(&registryMutex);
+    MerkleTreeStats total = *retired;
+    for (ThreadStats* thread = registry; thread != NULL; thread = thread->next) {
+        total += thread->stats;
+    }
+    pthread_mutex_unlock(&registryMutex);
+    return total;
+}
+
+#else
+
+MerkleTreeStats MerkleTreeStats::getThread()
+{
+    return MerkleTreeStats();
+}
+
+MerkleTreeStats MerkleTreeStats::getTotal()
+{
+    return MerkleTreeStats();
+}
+
+#endif
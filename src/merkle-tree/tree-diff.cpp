@@ -0,0 +1,247 @@
+#include "merkle-tree/tree-diff.hpp"
+
+namespace {
+
+/** Size of a serialized `NodeRange`, in bytes */
+const size_t NODE_RANGE_SIZE_B = 4 + 8 + 8;
+
+/** Append an integer in little-endian byte order */
+void putInteger(MerkleTree::Buffer& data, uint64_t value, size_t size)
+{
+    for (size_t i = 0; i < size; ++i) {
+        data.push_back(static_cast<uint8_t>(value >> (8 * i)));
+    }
+}
+
+/** Read an integer in little-endian byte order
+ *
+ * \param data     [in]     Buffer to read from
+ * \param position [in,out] Position of the integer; this is moved past it
+ * \param size     [in]     Size of the integer, in bytes
+ * \param what     [in]     Error message
+ *
+ * \throw `std::runtime_error` with `what` if `data` is too short
+ */
+uint64_t getInteger(const MerkleTree::Buffer& data, size_t& position,
+        size_t size, const char* what)
+{
+    if (data.size() - position < size) {
+        throw std::runtime_error(what);
+    }
+    uint64_t value = 0;
+    for (size_t i = 0; i < size; ++i) {
+        value |= uint64_t(data[position + i]) << (8 * i);
+    }
+    position += size;
+    return value;
+}
+
+/** Answer a request from the hashes of a tree */
+template <class Tree>
+MerkleTreeDiff::Response answerRequest(const Tree& tree,
+        const MerkleTreeDiff::Request& request)
+{
+    MerkleTreeDiff::Response response;
+    response.leafCount = tree.getLeafCount();
+    for (   std::vector<MerkleTreeDiff::NodeRange>::const_iterator it =
+                request.ranges.begin();
+            it != request.ranges.end();
+            ++it) {
+        if (    (it->layer >= tree.getLayerCount())
+             || (it->first > tree.getLayerSize(it->layer))
+             || (it->count > tree.getLayerSize(it->layer) - it->first)) {
+            throw std::runtime_error("Requested nodes not in the tree");
+        }
+        const MerkleTree::Digest* hashes = tree.getLayer(it->layer)
+            + it->first;
+        response.hashes.insert(response.hashes.end(), hashes,
+                hashes + it->count);
+    }
+    return response;
+}
+
+/** Add a node to a list of ranges of nodes of the same layer, in
+ * increasing order */
+void addNode(std::vector<MerkleTreeDiff::NodeRange>& ranges, uint32_t layer,
+        uint64_t node)
+{
+    if (    !ranges.empty()
+         && (ranges.back().first + ranges.back().count == node)) {
+        ++ranges.back().count;
+        return;
+    }
+    MerkleTreeDiff::NodeRange range;
+    range.layer = layer;
+    range.first = node;
+    range.count = 1;
+    ranges.push_back(range);
+}
+
+} // namespace
+
+MerkleTree::Buffer MerkleTreeDiff::Request::serialize() const
+{
+    MerkleTree::Buffer data;
+    data.reserve(4 + ranges.size() * NODE_RANGE_SIZE_B);
+    putInteger(data, ranges.size(), 4);
+    for (   std::vector<NodeRange>::const_iterator it = ranges.begin();
+            it != ranges.end();
+            ++it) {
+        putInteger(data, it->layer, 4);
+        putInteger(data, it->first, 8);
+        putInteger(data, it->count, 8);
+    }
+    return data;
+}
+
+MerkleTreeDiff::Request MerkleTreeDiff::Request::parse(
+        const MerkleTree::Buffer& data)
+{
+    const char* what = "Malformed diff request";
+    size_t position = 0;
+    const uint64_t count = getInteger(data, position, 4, what);
+    if (count != (data.size() - position) / NODE_RANGE_SIZE_B) {
+        throw std::runtime_error(what);
+    }
+    Request request;
+    request.ranges.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+        request.ranges[i].layer = getInteger(data, position, 4, what);
+        request.ranges[i].first = getInteger(data, position, 8, what);
+        request.ranges[i].count = getInteger(data, position, 8, what);
+    }
+    if (position != data.size()) {
+        throw std::runtime_error(what);
+    }
+    return request;
+}
+
+MerkleTree::Buffer MerkleTreeDiff::Response::serialize() const
+{
+    MerkleTree::Buffer data;
+    data.reserve(16 + hashes.size() * MERKLE_TREE_ELEMENT_SIZE_B);
+    putInteger(data, leafCount, 8);
+    putInteger(data, hashes.size(), 8);
+    for (   MerkleTree::Digests::const_iterator it = hashes.begin();
+            it != hashes.end();
+            ++it) {
+        data.insert(data.end(), it->bytes, it->bytes + sizeof(it->bytes));
+    }
+    return data;
+}
+
+MerkleTreeDiff::Response MerkleTreeDiff::Response::parse(
+        const MerkleTree::Buffer& data)
+{
+    const char* what = "Malformed diff response";
+    size_t position = 0;
+    Response response;
+    response.leafCount = getInteger(data, position, 8, what);
+    const uint64_t count = getInteger(data, position, 8, what);
+    if (    (count != (data.size() - position) / MERKLE_TREE_ELEMENT_SIZE_B)
+         || ((data.size() - position) % MERKLE_TREE_ELEMENT_SIZE_B != 0)) {
+        throw std::runtime_error(what);
+    }
+    response.hashes.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+        std::memcpy(response.hashes[i].bytes, &data[position],
+                MERKLE_TREE_ELEMENT_SIZE_B);
+        position += MERKLE_TREE_ELEMENT_SIZE_B;
+    }
+    return response;
+}
+
+template <class Tree>
+void MerkleTreeDiff::start(const Tree& local)
+{
+    for (size_t layer = 0; layer < local.getLayerCount(); ++layer) {
+        layers_.push_back(local.getLayer(layer));
+        layerSizes_.push_back(local.getLayerSize(layer));
+    }
+    addNode(request_.ranges, layers_.size() - 1, 0);
+    done_ = false;
+}
+
+MerkleTreeDiff::MerkleTreeDiff(const MerkleTree& local)
+{
+    start(local);
+}
+
+MerkleTreeDiff::MerkleTreeDiff(const MappedMerkleTree& local)
+{
+    start(local);
+}
+
+void MerkleTreeDiff::addResponse(const Response& response)
+{
+    if (done_) {
+        throw std::runtime_error("Diff is done");
+    }
+    if (response.leafCount != layerSizes_[0]) {
+        throw std::runtime_error("Trees have different shapes");
+    }
+    size_t expected = 0;
+    for (size_t i = 0; i < request_.ranges.size(); ++i) {
+        expected += request_.ranges[i].count;
+    }
+    if (response.hashes.size() != expected) {
+        throw std::runtime_error("Response does not match the request");
+    }
+
+    // All the nodes of a request are in the same layer; ask for the
+    // children of those that differ, or report them if they are leaves
+    const size_t layer = request_.ranges[0].layer;
+    std::vector<NodeRange> next;
+    size_t h = 0;
+    for (size_t r = 0; r < request_.ranges.size(); ++r) {
+        const NodeRange& range = request_.ranges[r];
+        for (uint64_t node = range.first; node < range.first + range.count;
+                ++node, ++h) {
+            if (response.hashes[h] == layers_[layer][node]) {
+                continue;
+            }
+            if (layer == 0) {
+                if (    !differences_.empty()
+                     && (   differences_.back().first
+                          + differences_.back().count == node + 1)) {
+                    ++differences_.back().count;
+                } else {
+                    LeafRange leaves;
+                    leaves.first = node + 1;
+                    leaves.count = 1;
+                    differences_.push_back(leaves);
+                }
+                continue;
+            }
+            // NB: The last node of a layer may have a single child
+            addNode(next, layer - 1, 2 * node);
+            if (2 * node + 1 < layerSizes_[layer - 1]) {
+                addNode(next, layer - 1, 2 * node + 1);
+            }
+        }
+    }
+    request_.ranges.swap(next);
+    done_ = request_.ranges.empty();
+}
+
+MerkleTreeDiff::Response MerkleTreeDiff::answer(const MerkleTree& tree,
+        const Request& request)
+{
+    return answerRequest(tree, request);
+}
+
+MerkleTreeDiff::Response MerkleTreeDiff::answer(const MappedMerkleTree& tree,
+        const Request& request)
+{
+    return answerRequest(tree, request);
+}
+
+MerkleTreeDiff::LeafRanges MerkleTreeDiff::compare(const MerkleTree& a,
+        const MerkleTree& b)
+{
+    MerkleTreeDiff diff(a);
+    while (!diff.isDone()) {
+        diff.addResponse(answer(b, diff.getRequest()));
+    }
+    return diff.getDifferences();
+}
@@ -0,0 +1,165 @@
+#include "tree-file.hpp"
+#include <sstream>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+extern "C" {
+#include <fcntl.h>
+#include <unistd.h>
+}
+
+namespace {
+
+uint64_t align(uint64_t position)
+{
+    return (position + TREE_FILE_ALIGN_B - 1) / TREE_FILE_ALIGN_B
+        * TREE_FILE_ALIGN_B;
+}
+
+/** Throw a `std::runtime_error` describing `errno` */
+void throwErrno(const char* what, const std::string& path)
+{
+    std::ostringstream oss;
+    oss << what << " " << path << ": " << strerror(errno);
+    throw std::runtime_error(oss.str());
+}
+
+} // namespace
+
+TreeFileHeader makeTreeFileHeader(bool preserveOrder, size_t layerCount,
+        uint64_t nodeCount, size_t slotCount, size_t digestSize)
+{
+    TreeFileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, TREE_FILE_MAGIC, sizeof(header.magic));
+    header.byteOrder = TREE_FILE_BYTE_ORDER;
+    header.version = TREE_FILE_VERSION;
+    header.digestSize = digestSize;
+    header.flags = preserveOrder ? TREE_FILE_PRESERVE_ORDER : 0;
+    header.layerCount = layerCount;
+    header.layerOffsetsPos = align(sizeof(header));
+    header.nodesPos = align(header.layerOffsetsPos
+            + (layerCount + 1) * sizeof(uint64_t));
+    header.slotCount = slotCount;
+    header.slotsPos = align(header.nodesPos
+            + nodeCount * digestSize);
+    return header;
+}
+
+uint64_t getTreeFileSize(const TreeFileHeader& header)
+{
+    return header.slotsPos + header.slotCount * sizeof(uint64_t);
+}
+
+void writeTreeFile(int fd, const void* data, size_t size, uint64_t position)
+{
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    while (size > 0) {
+        ssize_t ret = pwrite(fd, p, size, position);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::ostringstream oss;
+            oss << "Failed to write tree file: " << strerror(errno);
+            throw std::runtime_error(oss.str());
+        }
+        p += ret;
+        size -= ret;
+        position += ret;
+    }
+}
+
+std::string getTreeFileTempPath(const std::string& path)
+{
+    return path + ".tmp";
+}
+
+int createTreeFile(const std::string& path)
+{
+    const std::string temp = getTreeFileTempPath(path);
+    int fd = open(temp.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        throwErrno("Failed to create", temp);
+    }
+    return fd;
+}
+
+void commitTreeFile(int fd, const std::string& path)
+{
+    const std::string temp = getTreeFileTempPath(path);
+    if (fsync(fd) < 0) {
+        close(fd);
+        unlink(temp.c_str());
+        throwErrno("Failed to sync", temp);
+    }
+    if (close(fd) < 0) {
+        unlink(temp.c_str());
+        throwErrno("Failed to close", temp);
+    }
+    if (rename(temp.c_str(), path.c_str()) < 0) {
+        unlink(temp.c_str());
+        throwErrno("Failed to replace", path);
+    }
+}
+
+void readTreeFile(int fd, void* data, size_t size, uint64_t position)
+{
+    uint8_t* p = static_cast<uint8_t*>(data);
+    while (size > 0) {
+        ssize_t ret = pread(fd, p, size, position);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::ostringstream oss;
+            oss << "Failed to read tree file: " << strerror(errno);
+            throw std::runtime_error(oss.str());
+        }
+        if (ret == 0) {
+            throw std::runtime_error("Failed to read tree file: unexpected "
+                    "end of file");
+        }
+        p += ret;
+        size -= ret;
+        position += ret;
+    }
+}
+
+template <class Tree>
+void saveTreeFile(const std::string& path, const BasicTreeView<Tree>& view)
+{
+    const TreeFileHeader header = makeTreeFileHeader(view.preserveOrder,
+            view.layerCount, view.layerOffsets[view.layerCount],
+            view.slotCount, Tree::DIGEST_SIZE_B);
+
+    int fd = createTreeFile(path);
+    try {
+        // Write the sections first and the header last, so an incomplete
+        // file can't be opened
+        writeTreeFile(fd, view.layerOffsets,
+                (view.layerCount + 1) * sizeof(uint64_t),
+                header.layerOffsetsPos);
+        writeTreeFile(fd, view.nodes,
+                view.layerOffsets[view.layerCount] * Tree::DIGEST_SIZE_B,
+                header.nodesPos);
+        if (view.slotCount > 0) {
+            writeTreeFile(fd, view.leafSlots,
+                    view.slotCount * sizeof(uint64_t), header.slotsPos);
+        }
+        if (ftruncate(fd, getTreeFileSize(header)) < 0) {
+            throwErrno("Failed to resize", getTreeFileTempPath(path));
+        }
+        writeTreeFile(fd, &header, sizeof(header), 0);
+    } catch (...) {
+        close(fd);
+        unlink(getTreeFileTempPath(path).c_str());
+        throw;
+    }
+    commitTreeFile(fd, path);
+}
+
+template void saveTreeFile(const std::string&, const TreeView&);
+template void saveTreeFile(const std::string&,
+        const BasicTreeView<MerkleTree256>&);
@@ -0,0 +1,116 @@
+#ifndef MERKLE_TREE_TREE_FILE_HPP_
+#define MERKLE_TREE_TREE_FILE_HPP_
+
+#include "tree-view.hpp"
+#include <string>
+
+/** Magic bytes at the start of a Merkle Tree file */
+#define TREE_FILE_MAGIC "MRKLTREE"
+
+/** Current version of the file format */
+const uint32_t TREE_FILE_VERSION = 1;
+
+/** Written as is, to detect files from hosts with another byte order */
+const uint32_t TREE_FILE_BYTE_ORDER = 0x01020304;
+
+/** Flag set in files of trees with preserved order */
+const uint32_t TREE_FILE_PRESERVE_ORDER = 1;
+
+/** Maximum number of layers of a tree, with up to 2^64 leaves */
+const size_t TREE_FILE_MAX_LAYERS = 65;
+
+/** Alignment of each section of a file, in bytes */
+const uint64_t TREE_FILE_ALIGN_B = 64;
+
+/** Header of a Merkle Tree file
+ *
+ * The header is followed by these sections, each one starting on a multiple
+ * of `TREE_FILE_ALIGN_B` bytes:
+ *  - The layer offsets: `layerCount + 1` integers, \see TreeView
+ *  - All the hashes of all the layers, from the leaves up to the root
+ *  - The leaf hash table: `slotCount` integers, possibly none (trees with
+ *    preserved order only)
+ *
+ * All the integers are in the byte order of the host that wrote the file.
+ */
+struct TreeFileHeader
+{
+    char     magic[8];        /**< `TREE_FILE_MAGIC` */
+    uint32_t byteOrder;       /**< `TREE_FILE_BYTE_ORDER` */
+    uint32_t version;         /**< `TREE_FILE_VERSION` */
+    uint32_t digestSize;      /**< Size of a hash, in bytes */
+    uint32_t flags;           /**< `TREE_FILE_PRESERVE_ORDER` or 0 */
+    uint64_t layerCount;      /**< Number of layers */
+    uint64_t layerOffsetsPos; /**< Position of the layer offsets */
+    uint64_t nodesPos;        /**< Position of the hashes */
+    uint64_t slotCount;       /**< Number of slots in the leaf hash table */
+    uint64_t slotsPos;        /**< Position of the leaf hash table */
+};
+
+/** Build the header of a file, placing the sections one after the other
+ *
+ * \param preserveOrder [in] Whether the tree has preserved order
+ * \param layerCount    [in] Number of layers
+ * \param nodeCount     [in] Total number of hashes
+ * \param slotCount     [in] Number of slots in the leaf hash table, or 0
+ * \param digestSize    [in] Size of a hash, in bytes
+ */
+TreeFileHeader makeTreeFileHeader(bool preserveOrder, size_t layerCount,
+        uint64_t nodeCount, size_t slotCount,
+        size_t digestSize = MERKLE_TREE_ELEMENT_SIZE_B);
+
+/** Get the size of a file, in bytes */
+uint64_t getTreeFileSize(const TreeFileHeader& header);
+
+/** Write the whole of a buffer at the given position of a file
+ *
+ * \throw `std::runtime_error` if the data can't be written
+ */
+void writeTreeFile(int fd, const void* data, size_t size, uint64_t position);
+
+/** Read exactly `size` bytes at the given position of a file
+ *
+ * \throw `std::runtime_error` if the data can't be read
+ */
+void readTreeFile(int fd, void* data, size_t size, uint64_t position);
+
+/** Create the temporary file a tree file is written to
+ *
+ * Tree files are written next to their final path, and only renamed over it
+ * once complete, \see commitTreeFile(), so that processes which have mapped
+ * the previous file keep reading it intact.
+ *
+ * \param path [in] Final path of the file
+ *
+ * \return A descriptor of the temporary file, open for reading and writing
+ *
+ * \throw `std::runtime_error` if the file can't be created
+ */
+int createTreeFile(const std::string& path);
+
+/** Get the path of the temporary file a tree file is written to */
+std::string getTreeFileTempPath(const std::string& path);
+
+/** Sync a complete tree file to disk, close it and move it to its final
+ * path, replacing any file there
+ *
+ * `fd` is closed, and the temporary file removed, even on failure.
+ *
+ * \param fd   [in] Descriptor returned by `createTreeFile()`
+ * \param path [in] Final path of the file
+ *
+ * \throw `std::runtime_error` if the file can't be synced or renamed
+ */
+void commitTreeFile(int fd, const std::string& path);
+
+/** Save a tree to a file
+ *
+ * This is instantiated for each configuration of `BasicMerkleTree` built
+ * into the library.
+ *
+ * \throw `std::runtime_error` if the file can't be written
+ */
+template <class Tree>
+void saveTreeFile(const std::string& path, const BasicTreeView<Tree>& view);
+
+#endif // MERKLE_TREE_TREE_FILE_HPP_
@@ -0,0 +1,104 @@
+#include "tree-view.hpp"
+#include <algorithm>
+#include "prefetch.hpp"
+#include "stats-counters.hpp"
+
+template <class Tree>
+bool BasicTreeView<Tree>::findLeaf(const Digest& leaf, size_t& index) const
+{
+    MERKLE_TREE_STATS_ADD(leafLookups, 1);
+    if (!lookUpLeaf(leaf, index)) {
+        MERKLE_TREE_STATS_ADD(leafLookupMisses, 1);
+        return false;
+    }
+    return true;
+}
+
+template <class Tree>
+bool BasicTreeView<Tree>::lookUpLeaf(const Digest& leaf, size_t& index) const
+{
+    const Digest* leaves = getLayer(0);
+    if (!preserveOrder) {
+        const Digest* last = leaves + getLayerSize(0);
+        const Digest* found = std::lower_bound(leaves, last, leaf);
+        if ((found == last) || (*found != leaf)) {
+            return false;
+        }
+        index = found - leaves;
+        return true;
+    }
+
+    if (leafSlots == NULL) {
+        const size_t count = getLayerSize(0);
+        for (size_t i = 0; i < count; ++i) {
+            if (leaves[i] == leaf) {
+                index = i;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // NB: Duplicates are all in the same cluster, in no particular order;
+    // look at all of them to return the first one. A table always has an
+    // empty slot, but stop after visiting all the slots of a corrupted one.
+    bool found = false;
+    const size_t count = getLayerSize(0);
+    const size_t mask = slotCount - 1;
+    size_t slot = slotOf(leaf, mask);
+    for (size_t probe = 0; (probe < slotCount) && (leafSlots[slot] != 0);
+            ++probe, slot = (slot + 1) & mask) {
+        const size_t candidate = leafSlots[slot] - 1;
+        if (    (candidate < count) // don't trust files blindly
+             && (leaves[candidate] == leaf)
+             && (!found || (candidate < index))) {
+            index = candidate;
+            found = true;
+        }
+    }
+    return found;
+}
+
+template <class Tree>
+typename Tree::Elements BasicTreeView<Tree>::getProof(size_t index) const
+{
+    Digest hashes[Tree::MAX_PROOF_LENGTH];
+    const size_t length = getProof(index, hashes, Tree::MAX_PROOF_LENGTH);
+    typename Tree::Elements proof;
+    for (size_t i = 0; i < length; ++i) {
+        proof.push_back(hashes[i].toBuffer());
+    }
+    return proof;
+}
+
+template <class Tree>
+size_t BasicTreeView<Tree>::getProof(size_t index, Digest* proof,
+        size_t capacity) const
+{
+    MERKLE_TREE_STATS_ADD(proofsGenerated, 1);
+
+    // Find the hashes of all the layers first, and prefetch them: on large
+    // trees, each of them is likely a cache miss
+    const Digest* hashes[Tree::MAX_PROOF_LENGTH];
+    size_t length = 0;
+    for (size_t layer = 0; layer < layerCount; ++layer) {
+        // The last hash of a layer with an odd number of hashes has no peer
+        const size_t pair = (index & 1) ? (index - 1) : (index + 1);
+        if (pair < getLayerSize(layer)) {
+            if (length == capacity) {
+                throw std::runtime_error("Proof buffer too small");
+            }
+            hashes[length] = getLayer(layer) + pair;
+            MERKLE_TREE_PREFETCH(hashes[length]);
+            ++length;
+        }
+        index = index / 2; // point to correct hash in next layer
+    } // for each layer
+    for (size_t i = 0; i < length; ++i) {
+        proof[i] = *hashes[i];
+    }
+    return length;
+}
+
+template struct BasicTreeView<MerkleTree>;
+template struct BasicTreeView<MerkleTree256>;
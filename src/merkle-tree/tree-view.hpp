@@ -0,0 +1,97 @@
+#ifndef MERKLE_TREE_TREE_VIEW_HPP_
+#define MERKLE_TREE_TREE_VIEW_HPP_
+
+#include "merkle-tree/merkle-tree.hpp"
+
+/** Read-only view of the layers of a Merkle Tree
+ *
+ * This is the part of a Merkle Tree needed to serve proofs, wherever it is
+ * stored: in a `BasicMerkleTree`, or in a file mapped in memory. The layout
+ * is the one described in `BasicMerkleTree`: all the layers one after the
+ * other, from the leaves up to the root.
+ *
+ * This is instantiated for each configuration of `BasicMerkleTree` built
+ * into the library.
+ */
+template <class Tree>
+struct BasicTreeView
+{
+    typedef typename Tree::Digest Digest;
+
+    /** All the hashes, layer after layer */
+    const Digest* nodes;
+
+    /** Index in `nodes` of the first hash of each layer, plus the total
+     * number of hashes */
+    const uint64_t* layerOffsets;
+
+    /** Number of layers, including the leaves and the root */
+    size_t layerCount;
+
+    /** Whether the leaves are in their original order; if not, they are
+     * sorted */
+    bool preserveOrder;
+
+    /** Leaf hash table of a tree with preserved order, \see
+     * BasicMerkleTree::leafSlots_; may be NULL */
+    const uint64_t* leafSlots;
+
+    /** Number of entries in `leafSlots` */
+    size_t slotCount;
+
+    size_t getLayerSize(size_t layer) const
+    {
+        return layerOffsets[layer + 1] - layerOffsets[layer];
+    }
+
+    const Digest* getLayer(size_t layer) const
+    {
+        return nodes + layerOffsets[layer];
+    }
+
+    /** Find the index of the first leaf equal to `leaf`
+     *
+     * Sorted leaves are found by binary search, other leaves through
+     * `leafSlots` if there is one, and by a linear scan otherwise.
+     *
+     * \return `true` if found, `false` if not
+     */
+    bool findLeaf(const Digest& leaf, size_t& index) const;
+
+    /** Same as `findLeaf()`, without counting the lookup in the statistics */
+    bool lookUpLeaf(const Digest& leaf, size_t& index) const;
+
+    /** Get the proof of the leaf at the given index, starting at 0 */
+    typename Tree::Elements getProof(size_t index) const;
+
+    /** Get the proof of the leaf at the given index, starting at 0, in a
+     * buffer of `capacity` digests
+     *
+     * \return The number of hashes of the proof
+     *
+     * \throw `std::runtime_error` if `proof` is too small
+     */
+    size_t getProof(size_t index, Digest* proof, size_t capacity) const;
+};
+
+/** View of a `MerkleTree` */
+typedef BasicTreeView<MerkleTree> TreeView;
+
+/** Slot of a digest in a hash table of `mask + 1` slots
+ *
+ * The first 16 bytes of the digest are mixed in, so leaves sharing a prefix
+ * don't all end up in the same slots.
+ */
+template <class Digest>
+inline size_t slotOf(const Digest& digest, size_t mask)
+{
+    uint64_t a;
+    uint64_t b;
+    std::memcpy(&a, digest.bytes, sizeof(a));
+    std::memcpy(&b, digest.bytes + sizeof(a), sizeof(b));
+    uint64_t h = (a ^ (b * 0xff51afd7ed558ccdULL)) * 0x9e3779b97f4a7c15ULL;
+    h ^= h >> 32;
+    return static_cast<size_t>(h) & mask;
+}
+
+#endif // MERKLE_TREE_TREE_VIEW_HPP_
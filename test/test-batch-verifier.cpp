@@ -0,0 +1,87 @@
+#include <merkle-tree/batch-verifier.hpp>
+#include <gtest/gtest.h>
+
+namespace {
+
+MerkleTree::Elements makeElements(size_t count, size_t seed)
+{
+    MerkleTree::Elements elements;
+    for (size_t i = 0; i < count; ++i) {
+        const size_t data[2] = { seed, i };
+        elements.push_back(MerkleTree::hash(data, sizeof(data)));
+    }
+    return elements;
+}
+
+} // namespace
+
+TEST(MerkleBatchVerifier, MatchesSingleProofChecks)
+{
+    // Several trees, so proofs have various lengths and roots
+    const size_t counts[] = { 1, 2, 7, 100, 1000 };
+    for (int preserveOrder = 0; preserveOrder < 2; ++preserveOrder) {
+        MerkleBatchVerifier verifier(preserveOrder);
+        std::vector<bool> expected;
+        for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); ++c) {
+            MerkleTree::Elements elements = makeElements(counts[c], c);
+            MerkleTree tree(elements, preserveOrder);
+            MerkleTree::Buffer root = tree.getRoot();
+            for (size_t i = 0; i < elements.size(); ++i) {
+                MerkleTree::Elements proof = tree.getProof(elements[i]);
+                size_t index = i + 1;
+                if (i % 5 == 1) {
+                    // Proof for the wrong element
+                    index = (i + 1) % elements.size() + 1;
+                } else if ((i % 5 == 2) && !proof.empty()) {
+                    proof.back()[3] ^= 0x10;
+                }
+                const size_t position = verifier.add(proof, root,
+                        elements[i], index);
+                EXPECT_EQ(expected.size(), position);
+                if (preserveOrder) {
+                    expected.push_back(MerkleTree::checkProofOrdered(proof,
+                                root, elements[i], index));
+                } else {
+                    expected.push_back(MerkleTree::checkProof(proof, root,
+                                elements[i]));
+                }
+            }
+        }
+        EXPECT_EQ(expected.size(), verifier.size());
+        EXPECT_EQ(expected, verifier.verify());
+
+        verifier.clear();
+        EXPECT_EQ(0u, verifier.size());
+        EXPECT_TRUE(verifier.verify().empty());
+    }
+}
+
+TEST(MerkleBatchVerifier, SharedNodesAndBadSizes)
+{
+    MerkleTree::Elements elements = makeElements(64, 0);
+    MerkleTree tree(elements, true);
+    MerkleTree::Buffer root = tree.getRoot();
+    MerkleBatchVerifier verifier(true);
+
+    // The same proof many times, against the same root
+    MerkleTree::Elements proof = tree.getProofOrdered(elements[9], 10);
+    for (size_t i = 0; i < 100; ++i) {
+        verifier.add(proof, root, elements[9], 10);
+    }
+
+    MerkleTree::Elements short_hash = proof;
+    short_hash[2].pop_back();
+    EXPECT_EQ(100u, verifier.add(short_hash, root, elements[9], 10));
+    verifier.add(proof, MerkleTree::Buffer(3), elements[9], 10);
+    verifier.add(proof, root, MerkleTree::Buffer(), 10);
+    verifier.add(proof, root, elements[9], 0);
+
+    std::vector<bool> results = verifier.verify();
+    ASSERT_EQ(104u, results.size());
+    for (size_t i = 0; i < 100; ++i) {
+        EXPECT_TRUE(results[i]);
+    }
+    for (size_t i = 100; i < 104; ++i) {
+        EXPECT_FALSE(results[i]);
+    }
+}
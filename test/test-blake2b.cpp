@@ -0,0 +1,175 @@
+#include "blake2b-compress.h"
+#include "blake2b-multi.h"
+#include <gtest/gtest.h>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+/** Small deterministic pseudo-random generator (xorshift64) */
+class Random
+{
+public :
+    Random(uint64_t seed) : state_(seed) { }
+
+    uint64_t next()
+    {
+        state_ ^= state_ << 13;
+        state_ ^= state_ >> 7;
+        state_ ^= state_ << 17;
+        return state_;
+    }
+
+    void fill(void* data, size_t size)
+    {
+        uint8_t* p = static_cast<uint8_t*>(data);
+        for (size_t i = 0; i < size; ++i) {
+            p[i] = static_cast<uint8_t>(next());
+        }
+    }
+
+private :
+    uint64_t state_;
+};
+
+/** Restore the default implementation when going out of scope */
+class ImplGuard
+{
+public :
+    ~ImplGuard()
+    {
+        blake2b_select_impl(blake2b_best_impl());
+    }
+};
+
+std::vector<uint8_t> digest(size_t outlen, const std::vector<uint8_t>& data)
+{
+    std::vector<uint8_t> out(outlen);
+    blake2b(&out[0], outlen, data.empty() ? NULL : &data[0], data.size(),
+            NULL, 0);
+    return out;
+}
+
+} // namespace
+
+TEST(Blake2b, ReferenceIsAlwaysAvailable)
+{
+    EXPECT_TRUE(blake2b_compress_impl(BLAKE2B_IMPL_REF) != NULL);
+    EXPECT_TRUE(blake2b_compress_impl(blake2b_best_impl()) != NULL);
+    EXPECT_TRUE(blake2b_compress_impl(BLAKE2B_IMPL_COUNT) == NULL);
+}
+
+TEST(Blake2b, CompressMatchesReference)
+{
+    blake2b_compress_fn ref = blake2b_compress_impl(BLAKE2B_IMPL_REF);
+    for (int impl = BLAKE2B_IMPL_REF + 1; impl < BLAKE2B_IMPL_COUNT; ++impl) {
+        blake2b_compress_fn fn =
+            blake2b_compress_impl(static_cast<blake2b_impl>(impl));
+        if (fn == NULL) {
+            continue; // not supported on this host
+        }
+        Random random(0x9e3779b97f4a7c15ULL + impl);
+        for (int i = 0; i < 1000; ++i) {
+            blake2b_state expected;
+            std::memset(&expected, 0, sizeof(expected));
+            random.fill(expected.h, sizeof(expected.h));
+            random.fill(expected.t, sizeof(expected.t));
+            random.fill(expected.f, sizeof(expected.f));
+            blake2b_state actual = expected;
+
+            uint8_t block[BLAKE2B_BLOCKBYTES];
+            random.fill(block, sizeof(block));
+
+            ref(&expected, block);
+            fn(&actual, block);
+            ASSERT_EQ(0, std::memcmp(expected.h, actual.h, sizeof(actual.h)))
+                << blake2b_impl_name(static_cast<blake2b_impl>(impl));
+        }
+    }
+}
+
+TEST(Blake2b, HashMatchesReferenceForAllImplementations)
+{
+    ImplGuard guard;
+    Random random(42);
+    std::vector<std::vector<uint8_t> > inputs;
+    for (size_t size = 0; size < 3 * BLAKE2B_BLOCKBYTES; size += 7) {
+        std::vector<uint8_t> data(size);
+        if (size > 0) {
+            random.fill(&data[0], size);
+        }
+        inputs.push_back(data);
+    }
+
+    ASSERT_EQ(0, blake2b_select_impl(BLAKE2B_IMPL_REF));
+    std::vector<std::vector<uint8_t> > expected;
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        expected.push_back(digest(16, inputs[i]));
+    }
+
+    for (int impl = BLAKE2B_IMPL_REF + 1; impl < BLAKE2B_IMPL_COUNT; ++impl) {
+        if (blake2b_select_impl(static_cast<blake2b_impl>(impl)) != 0) {
+            continue; // not supported on this host
+        }
+        for (size_t i = 0; i < inputs.size(); ++i) {
+            EXPECT_EQ(expected[i], digest(16, inputs[i]))
+                << blake2b_impl_name(static_cast<blake2b_impl>(impl))
+                << ", size " << inputs[i].size();
+        }
+    }
+}
+
+TEST(Blake2b, PairsMatchSingleBufferHash)
+{
+    ImplGuard guard;
+    const size_t halflens[] = { 8, 16, 24, 32, 64 };
+    const size_t outlens[] = { 16, 20, 32, 64 };
+    for (int impl = BLAKE2B_IMPL_REF; impl < BLAKE2B_IMPL_COUNT; ++impl) {
+        if (blake2b_select_impl(static_cast<blake2b_impl>(impl)) != 0) {
+            continue; // not supported on this host
+        }
+        Random random(1234 + impl);
+        for (size_t h = 0; h < sizeof(halflens) / sizeof(halflens[0]); ++h) {
+            for (size_t o = 0; o < sizeof(outlens) / sizeof(outlens[0]); ++o) {
+                const size_t halflen = halflens[h];
+                const size_t outlen = outlens[o];
+                const size_t n = 19; // not a multiple of any lane count
+                std::vector<uint8_t> data(2 * n * halflen);
+                random.fill(&data[0], data.size());
+                std::vector<const uint8_t*> left;
+                std::vector<const uint8_t*> right;
+                for (size_t i = 0; i < n; ++i) {
+                    // Swap every other pair to make sure each half is
+                    // fetched from its own pointer
+                    const uint8_t* a = &data[2 * i * halflen];
+                    const uint8_t* b = a + halflen;
+                    left.push_back((i & 1) ? b : a);
+                    right.push_back((i & 1) ? a : b);
+                }
+
+                std::vector<uint8_t> out(n * outlen);
+                ASSERT_EQ(0, blake2b_pairs(&out[0], outlen, &left[0],
+                            &right[0], halflen, n));
+                for (size_t i = 0; i < n; ++i) {
+                    std::vector<uint8_t> message(left[i], left[i] + halflen);
+                    message.insert(message.end(), right[i], right[i] + halflen);
+                    std::vector<uint8_t> actual(out.begin() + i * outlen,
+                            out.begin() + (i + 1) * outlen);
+                    EXPECT_EQ(digest(outlen, message), actual)
+                        << blake2b_impl_name(static_cast<blake2b_impl>(impl))
+                        << ", halflen " << halflen << ", outlen " << outlen
+                        << ", message " << i;
+                }
+            }
+        }
+    }
+}
+
+TEST(Blake2b, PairsRejectInvalidSizes)
+{
+    uint8_t out[BLAKE2B_OUTBYTES + 1];
+    const uint8_t* in = out;
+    EXPECT_EQ(-1, blake2b_pairs(out, 0, &in, &in, 16, 1));
+    EXPECT_EQ(-1, blake2b_pairs(out, BLAKE2B_OUTBYTES + 1, &in, &in, 16, 1));
+    EXPECT_EQ(-1, blake2b_pairs(out, 16, &in, &in, BLAKE2B_BLOCKBYTES, 1));
+}
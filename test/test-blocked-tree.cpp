@@ -0,0 +1,86 @@
+#include <merkle-tree/blocked-tree.hpp>
+#include <merkle-tree/mapped-tree.hpp>
+#include "test-util.hpp"
+#include <gtest/gtest.h>
+#include <cstdio>
+
+extern "C" {
+#include <unistd.h>
+}
+
+namespace {
+
+/** Check that a blocked tree serves the same proofs as its source */
+void checkSameProofs(const BlockedMerkleTree& blocked, const MerkleTree& tree,
+        size_t step)
+{
+    ASSERT_EQ(tree.getLeafCount(), blocked.getLeafCount());
+    ASSERT_EQ(tree.getLayerCount(), blocked.getLayerCount());
+    EXPECT_TRUE(tree.getRootDigest() == blocked.getRootDigest());
+    for (size_t i = 0; i < tree.getLeafCount(); i += step) {
+        const MerkleTree::Digest& leaf = tree.getLayer(0)[i];
+        EXPECT_TRUE(leaf == blocked.getLeaf(i + 1)) << "leaf " << i;
+        MerkleTree::Digest expected[MerkleTree::MAX_PROOF_LENGTH];
+        MerkleTree::Digest actual[MerkleTree::MAX_PROOF_LENGTH];
+        const size_t length = tree.getProofOrdered(leaf, i + 1, expected,
+                MerkleTree::MAX_PROOF_LENGTH);
+        ASSERT_EQ(length, blocked.getProof(i + 1, actual,
+                    MerkleTree::MAX_PROOF_LENGTH)) << "leaf " << i;
+        for (size_t j = 0; j < length; ++j) {
+            EXPECT_TRUE(expected[j] == actual[j]) << "leaf " << i;
+        }
+    }
+}
+
+} // namespace
+
+TEST(BlockedMerkleTree, ServesSameProofsAsTree)
+{
+    // Up to 3 bands, the top one full or not
+    const size_t counts[] = { 1, 2, 3, 5, 100, 128, 129, 1000, 1 << 14,
+        (1 << 14) + 1, 100000 };
+    for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); ++c) {
+        for (int preserveOrder = 0; preserveOrder < 2; ++preserveOrder) {
+            MerkleTree tree(makeElements(counts[c]), preserveOrder);
+            BlockedMerkleTree blocked(tree);
+            checkSameProofs(blocked, tree, (counts[c] > 1000) ? 97 : 1);
+        }
+    }
+}
+
+TEST(BlockedMerkleTree, CopiesMappedTree)
+{
+    char path[] = "/tmp/merkle-tree-test-XXXXXX";
+    close(mkstemp(path));
+    MerkleTree tree(makeElements(5000), true);
+    tree.save(path);
+    {
+        MappedMerkleTree mapped(path);
+        BlockedMerkleTree blocked(mapped);
+        checkSameProofs(blocked, tree, 1);
+    }
+    unlink(path);
+}
+
+TEST(BlockedMerkleTree, UsesFullPages)
+{
+    // 2 full bands of 7 layers, then the root
+    MerkleTree tree(makeElements(1 << 14), true);
+    BlockedMerkleTree blocked(tree);
+    EXPECT_EQ(((1 << 14) / 128 + 1) * 4096u, blocked.getMemoryUsage());
+}
+
+TEST(BlockedMerkleTree, RejectsBadArguments)
+{
+    MerkleTree tree(makeElements(10), true);
+    BlockedMerkleTree blocked(tree);
+    EXPECT_THROW(blocked.getLeaf(0), std::runtime_error);
+    EXPECT_THROW(blocked.getLeaf(11), std::runtime_error);
+    MerkleTree::Digest proof[MerkleTree::MAX_PROOF_LENGTH];
+    EXPECT_THROW(blocked.getProof(0, proof, MerkleTree::MAX_PROOF_LENGTH),
+            std::runtime_error);
+    EXPECT_THROW(blocked.getProof(11, proof, MerkleTree::MAX_PROOF_LENGTH),
+            std::runtime_error);
+    EXPECT_THROW(blocked.getProof(1, proof, 1), std::runtime_error);
+    EXPECT_EQ(4u, blocked.getProof(1, proof, MerkleTree::MAX_PROOF_LENGTH));
+}
@@ -0,0 +1,96 @@
+#include "digest-sort.hpp"
+#include <gtest/gtest.h>
+#include <algorithm>
+
+namespace {
+
+/** Build `count` pseudo-random digests, with about one in `dups` being a
+ * copy of an earlier one */
+MerkleTree::Digests makeDigests(size_t count, size_t dups)
+{
+    MerkleTree::Digests digests(count);
+    uint64_t state = 0x2545f4914f6cdd1dULL + count;
+    for (size_t i = 0; i < count; ++i) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        if ((i > 0) && (state % dups == 0)) {
+            digests[i] = digests[state % i];
+            continue;
+        }
+        for (size_t j = 0; j < sizeof(digests[i].bytes); ++j) {
+            digests[i].bytes[j] = static_cast<uint8_t>(state >> (8 * (j % 8)))
+                ^ static_cast<uint8_t>(j);
+        }
+    }
+    return digests;
+}
+
+MerkleTree::Digests expected(MerkleTree::Digests digests)
+{
+    std::sort(digests.begin(), digests.end());
+    digests.erase(std::unique(digests.begin(), digests.end()), digests.end());
+    return digests;
+}
+
+} // namespace
+
+TEST(DigestSort, EmptyAndSingle)
+{
+    MerkleTreeThreadPool pool(4);
+    MerkleTree::Digests digests;
+    sortUniqueDigests(digests, &pool);
+    EXPECT_TRUE(digests.empty());
+
+    digests = makeDigests(1, 2);
+    MerkleTree::Digests copy = digests;
+    sortUniqueDigests(digests, &pool);
+    EXPECT_TRUE(copy == digests);
+}
+
+TEST(DigestSort, MatchesSortUnique)
+{
+    const size_t counts[] = { 2, 10, 4095, 4096, 50000 };
+    for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); ++i) {
+        MerkleTree::Digests digests = makeDigests(counts[i], 5);
+        MerkleTree::Digests reference = expected(digests);
+        MerkleTreeThreadPool pool(1);
+        sortUniqueDigests(digests, &pool);
+        EXPECT_TRUE(reference == digests) << counts[i];
+    }
+}
+
+TEST(DigestSort, SkewedLeadingBytes)
+{
+    // All digests fall in a handful of buckets
+    MerkleTree::Digests digests = makeDigests(20000, 7);
+    for (size_t i = 0; i < digests.size(); ++i) {
+        digests[i].bytes[0] = 0;
+        digests[i].bytes[1] = i % 3;
+    }
+    MerkleTree::Digests reference = expected(digests);
+    MerkleTreeThreadPool pool(2);
+    sortUniqueDigests(digests, &pool);
+    EXPECT_TRUE(reference == digests);
+}
+
+TEST(DigestSort, AlreadySortedInput)
+{
+    MerkleTree::Digests digests = expected(makeDigests(10000, 3));
+    std::vector<MerkleTree::Digest> doubled;
+    for (size_t i = 0; i < digests.size(); ++i) {
+        doubled.push_back(digests[i]);
+        doubled.push_back(digests[i]);
+    }
+    sortUniqueDigests(doubled, NULL);
+    EXPECT_TRUE(digests == doubled);
+}
+
+TEST(DigestSort, ParallelMatchesSortUnique)
+{
+    MerkleTree::Digests digests = makeDigests((1 << 20) + 123, 11);
+    MerkleTree::Digests reference = expected(digests);
+    MerkleTreeThreadPool pool(4);
+    sortUniqueDigests(digests, &pool);
+    EXPECT_TRUE(reference == digests);
+}
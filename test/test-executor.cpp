@@ -0,0 +1,181 @@
+#include <merkle-tree/merkle-tree.hpp>
+#include <merkle-tree/executor.hpp>
+#include "test-util.hpp"
+#include <gtest/gtest.h>
+#include <vector>
+
+namespace {
+
+/** Count how many times each item runs, with some items much slower than
+ * others so threads have to steal work */
+class CountingTask : public MerkleTreeExecutor::Task
+{
+public :
+    CountingTask(size_t count) : counts_(count, 0) { }
+
+    virtual void run(size_t index)
+    {
+        volatile size_t spin = 0;
+        for (size_t i = 0; i < ((index % 7 == 0) ? 100000 : 10); ++i) {
+            spin = spin + i;
+        }
+        ++counts_[index];
+    }
+
+    bool eachRanOnce() const
+    {
+        for (size_t i = 0; i < counts_.size(); ++i) {
+            if (counts_[i] != 1) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+private :
+    std::vector<int> counts_;
+};
+
+/** Run a nested `parallelFor()` on the same pool from each item */
+class NestedTask : public MerkleTreeExecutor::Task
+{
+public :
+    NestedTask(MerkleTreeExecutor& executor, size_t count)
+        : executor_(executor), tasks_(count, CountingTask(count))
+    {
+    }
+
+    virtual void run(size_t index)
+    {
+        executor_.parallelFor(tasks_.size(), tasks_[index]);
+    }
+
+    bool eachRanOnce() const
+    {
+        for (size_t i = 0; i < tasks_.size(); ++i) {
+            if (!tasks_[i].eachRanOnce()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+private :
+    MerkleTreeExecutor&       executor_;
+    std::vector<CountingTask> tasks_;
+};
+
+/** Serial executor that records how it is used */
+class RecordingExecutor : public MerkleTreeExecutor
+{
+public :
+    RecordingExecutor() : calls_(0), items_(0) { }
+
+    virtual void parallelFor(size_t count, Task& task)
+    {
+        ++calls_;
+        items_ += count;
+        for (size_t i = 0; i < count; ++i) {
+            task.run(i);
+        }
+    }
+
+    virtual size_t getConcurrency() const
+    {
+        return 16;
+    }
+
+    size_t calls() const { return calls_; }
+    size_t items() const { return items_; }
+
+private :
+    size_t calls_;
+    size_t items_;
+};
+
+} // namespace
+
+TEST(MerkleTreeThreadPool, RunsEachItemOnce)
+{
+    const size_t concurrencies[] = { 1, 2, 3, 8 };
+    const size_t counts[] = { 0, 1, 2, 7, 1000 };
+    for (size_t c = 0; c < sizeof(concurrencies) / sizeof(concurrencies[0]); ++c) {
+        MerkleTreeThreadPool pool(concurrencies[c]);
+        EXPECT_EQ(concurrencies[c], pool.getConcurrency());
+        for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); ++i) {
+            CountingTask task(counts[i]);
+            pool.parallelFor(counts[i], task);
+            EXPECT_TRUE(task.eachRanOnce())
+                << concurrencies[c] << " threads, " << counts[i] << " items";
+        }
+    }
+}
+
+TEST(MerkleTreeThreadPool, NestedCallsRunInline)
+{
+    MerkleTreeThreadPool pool(4);
+    NestedTask task(pool, 50);
+    pool.parallelFor(50, task);
+    EXPECT_TRUE(task.eachRanOnce());
+}
+
+TEST(MerkleTreeThreadPool, DefaultPoolHasOneThreadPerCpu)
+{
+    EXPECT_LE(1u, MerkleTreeThreadPool::getDefault().getConcurrency());
+    EXPECT_EQ(&MerkleTreeThreadPool::getDefault(),
+            &MerkleTreeThreadPool::getDefault());
+}
+
+TEST(MerkleTreeParallel, SameRootAsSerialBuild)
+{
+    const size_t counts[] = { 32767, 32768, 40000, 65536, 100003 };
+    MerkleTreeThreadPool serial(1);
+    MerkleTreeThreadPool parallel(4);
+    for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); ++i) {
+        MerkleTree::Digests leaves = makeLeaves(counts[i]);
+        for (int preserveOrder = 0; preserveOrder < 2; ++preserveOrder) {
+            MerkleTree expected(leaves, preserveOrder, serial);
+            MerkleTree actual(leaves, preserveOrder, parallel);
+            MerkleTree by_default(leaves, preserveOrder);
+            EXPECT_EQ(expected.getRootDigest(), actual.getRootDigest())
+                << counts[i];
+            EXPECT_EQ(expected.getRootDigest(), by_default.getRootDigest())
+                << counts[i];
+
+            // Check the whole tree, not just the root
+            ASSERT_EQ(expected.getLayerCount(), actual.getLayerCount());
+            for (size_t layer = 0; layer < expected.getLayerCount(); ++layer) {
+                ASSERT_EQ(expected.getLayerSize(layer),
+                        actual.getLayerSize(layer));
+                EXPECT_EQ(0, std::memcmp(expected.getLayer(layer),
+                            actual.getLayer(layer),
+                            expected.getLayerSize(layer)
+                            * sizeof(MerkleTree::Digest)));
+            }
+        }
+    }
+}
+
+TEST(MerkleTreeParallel, UsesGivenExecutorForLargeTreesOnly)
+{
+    RecordingExecutor small_executor;
+    MerkleTree small(makeLeaves(1000), true, small_executor);
+    EXPECT_EQ(0u, small_executor.calls());
+
+    RecordingExecutor large_executor;
+    MerkleTree::Digests leaves = makeLeaves(200000);
+    MerkleTree large(leaves, true, large_executor);
+    EXPECT_EQ(1u, large_executor.calls());
+    EXPECT_LT(1u, large_executor.items());
+
+    MerkleTree::Elements elements;
+    for (size_t i = 0; i < 10; ++i) {
+        elements.push_back(leaves[i * 1000].toBuffer());
+    }
+    for (size_t i = 0; i < elements.size(); ++i) {
+        MerkleTree::Elements proof = large.getProofOrdered(elements[i],
+                i * 1000 + 1);
+        EXPECT_TRUE(MerkleTree::checkProofOrdered(proof, large.getRoot(),
+                    elements[i], i * 1000 + 1));
+    }
+}
@@ -0,0 +1,149 @@
+#include <merkle-tree/file-builder.hpp>
+#include <merkle-tree/mapped-tree.hpp>
+#include <gtest/gtest.h>
+#include <cstdio>
+
+extern "C" {
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+}
+
+namespace {
+
+/** Temporary file path, removed when going out of scope */
+class TempPath
+{
+public :
+    TempPath()
+    {
+        char path[] = "/tmp/merkle-tree-test-XXXXXX";
+        close(mkstemp(path));
+        path_ = path;
+    }
+
+    ~TempPath()
+    {
+        unlink(path_.c_str());
+    }
+
+    const std::string& path() const { return path_; }
+
+private :
+    std::string path_;
+};
+
+MerkleTree::Digests makeLeaves(size_t count)
+{
+    MerkleTree::Digests leaves;
+    for (size_t i = 0; i < count; ++i) {
+        // Some duplicates, far apart
+        const size_t value = (i % 7 == 3) ? i / 2 : i;
+        leaves.push_back(MerkleTree::Digest::fromBuffer(
+                    MerkleTree::hash(&value, sizeof(value))));
+    }
+    return leaves;
+}
+
+bool exists(const std::string& path)
+{
+    struct stat st;
+    return stat(path.c_str(), &st) == 0;
+}
+
+} // namespace
+
+TEST(MerkleTreeFileBuilder, MatchesInMemoryTree)
+{
+    // The smallest memory budget, so there are many chunks and runs
+    const size_t counts[] = { 1, 2, 3, 4097, 20000 };
+    for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); ++c) {
+        MerkleTree::Digests leaves = makeLeaves(counts[c]);
+        for (int preserveOrder = 0; preserveOrder < 2; ++preserveOrder) {
+            MerkleTree tree(leaves, preserveOrder);
+            TempPath temp;
+            MerkleTreeFileBuilder builder(temp.path(), preserveOrder, 0);
+            for (size_t i = 0; i < leaves.size(); i += 1000) {
+                builder.add(&leaves[i], std::min<size_t>(1000,
+                            leaves.size() - i));
+            }
+            EXPECT_EQ(leaves.size(), builder.getLeafCount());
+            EXPECT_EQ(tree.getRoot(), builder.finish()) << counts[c];
+            EXPECT_FALSE(exists(temp.path() + ".runs"));
+            EXPECT_FALSE(exists(temp.path() + ".tmp"));
+
+            MappedMerkleTree mapped(temp.path());
+            EXPECT_EQ(bool(preserveOrder), mapped.isOrderPreserved());
+            EXPECT_EQ(tree.getRoot(), mapped.getRoot());
+            ASSERT_EQ(tree.getLayerCount(), mapped.getLayerCount());
+            for (size_t layer = 0; layer < tree.getLayerCount(); ++layer) {
+                ASSERT_EQ(tree.getLayerSize(layer), mapped.getLayerSize(layer));
+                EXPECT_EQ(0, std::memcmp(tree.getLayer(layer),
+                            mapped.getLayer(layer), tree.getLayerSize(layer)
+                            * sizeof(MerkleTree::Digest)));
+            }
+            for (size_t i = 0; i < leaves.size(); i += 97) {
+                const MerkleTree::Buffer element = leaves[i].toBuffer();
+                EXPECT_EQ(tree.getProof(element), mapped.getProof(element));
+                if (preserveOrder) {
+                    EXPECT_EQ(tree.getProofOrdered(element, i + 1),
+                            mapped.getProofOrdered(element, i + 1));
+                }
+            }
+        }
+    }
+}
+
+TEST(MerkleTreeFileBuilder, AddsLeavesFromFile)
+{
+    MerkleTree::Digests leaves = makeLeaves(10000);
+    TempPath input;
+    {
+        FILE* file = fopen(input.path().c_str(), "wb");
+        ASSERT_TRUE(file != NULL);
+        EXPECT_EQ(leaves.size(), fwrite(&leaves[0], sizeof(leaves[0]),
+                    leaves.size(), file));
+        fclose(file);
+    }
+
+    TempPath output;
+    MerkleTreeFileBuilder builder(output.path(), true, 0);
+    int fd = open(input.path().c_str(), O_RDONLY);
+    ASSERT_LE(0, fd);
+    builder.addFile(fd);
+    close(fd);
+    EXPECT_EQ(MerkleTree(leaves, true).getRoot(), builder.finish());
+    EXPECT_THROW(builder.finish(), std::runtime_error);
+
+    // Not a whole number of leaves
+    ASSERT_EQ(0, truncate(input.path().c_str(), 1000));
+    MerkleTreeFileBuilder truncated(output.path(), true, 0);
+    fd = open(input.path().c_str(), O_RDONLY);
+    ASSERT_LE(0, fd);
+    EXPECT_THROW(truncated.addFile(fd), std::runtime_error);
+    close(fd);
+}
+
+TEST(MerkleTreeFileBuilder, RemovesUnfinishedFile)
+{
+    // The file which was there before is left intact
+    TempPath temp;
+    MerkleTree previous(makeLeaves(10), true);
+    previous.save(temp.path());
+    {
+        MerkleTreeFileBuilder builder(temp.path(), false, 0);
+        MerkleTree::Digests leaves = makeLeaves(10000);
+        builder.add(&leaves[0], leaves.size());
+        EXPECT_TRUE(exists(temp.path() + ".tmp"));
+        EXPECT_TRUE(exists(temp.path() + ".runs"));
+    }
+    EXPECT_FALSE(exists(temp.path() + ".tmp"));
+    EXPECT_FALSE(exists(temp.path() + ".runs"));
+    EXPECT_EQ(previous.getRoot(), MappedMerkleTree(temp.path()).getRoot());
+
+    MerkleTreeFileBuilder empty(temp.path(), true);
+    EXPECT_THROW(empty.add(MerkleTree::Buffer(3)), std::runtime_error);
+    EXPECT_THROW(empty.finish(), std::runtime_error);
+    EXPECT_THROW(MerkleTreeFileBuilder("/nonexistent/tree", true),
+            std::runtime_error);
+}
@@ -0,0 +1,200 @@
+#include <merkle-tree/mapped-tree.hpp>
+#include "tree-file.hpp"
+#include "test-util.hpp"
+#include <gtest/gtest.h>
+#include <cstddef>
+#include <cstdio>
+
+extern "C" {
+#include <fcntl.h>
+#include <unistd.h>
+}
+
+namespace {
+
+/** Temporary file path, removed when going out of scope */
+class TempPath
+{
+public :
+    TempPath()
+    {
+        char path[] = "/tmp/merkle-tree-test-XXXXXX";
+        close(mkstemp(path));
+        path_ = path;
+    }
+
+    ~TempPath()
+    {
+        unlink(path_.c_str());
+    }
+
+    const std::string& path() const { return path_; }
+
+private :
+    std::string path_;
+};
+
+void overwrite(const std::string& path, const void* data, size_t size,
+        off_t offset)
+{
+    int fd = open(path.c_str(), O_WRONLY);
+    ASSERT_LE(0, fd);
+    EXPECT_EQ(ssize_t(size), pwrite(fd, data, size, offset));
+    close(fd);
+}
+
+} // namespace
+
+TEST(MappedMerkleTree, ServesSameProofsAsTree)
+{
+    const size_t counts[] = { 1, 2, 7, 100, 1025 };
+    for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); ++c) {
+        MerkleTree::Elements elements = makeElements(counts[c]);
+        elements.push_back(elements[0]); // duplicate
+        for (int preserveOrder = 0; preserveOrder < 2; ++preserveOrder) {
+            TempPath temp;
+            MerkleTree tree(elements, preserveOrder);
+            tree.save(temp.path());
+            MappedMerkleTree mapped(temp.path());
+
+            EXPECT_EQ(bool(preserveOrder), mapped.isOrderPreserved());
+            EXPECT_EQ(tree.getRoot(), mapped.getRoot());
+            ASSERT_EQ(tree.getLayerCount(), mapped.getLayerCount());
+            for (size_t layer = 0; layer < tree.getLayerCount(); ++layer) {
+                ASSERT_EQ(tree.getLayerSize(layer), mapped.getLayerSize(layer));
+                EXPECT_EQ(0, std::memcmp(tree.getLayer(layer),
+                            mapped.getLayer(layer), tree.getLayerSize(layer)
+                            * sizeof(MerkleTree::Digest)));
+            }
+            for (size_t i = 0; i < elements.size(); ++i) {
+                EXPECT_EQ(tree.getProof(elements[i]),
+                        mapped.getProof(elements[i]));
+                EXPECT_EQ(tree.getProofHex(elements[i]),
+                        mapped.getProofHex(elements[i]));
+                if (preserveOrder) {
+                    EXPECT_EQ(tree.getProofOrdered(elements[i], i + 1),
+                            mapped.getProofOrdered(elements[i], i + 1));
+                }
+            }
+            EXPECT_THROW(mapped.getProof(MerkleTree::hash(MerkleTree::Buffer(3))),
+                    std::runtime_error);
+            EXPECT_THROW(mapped.getProofOrdered(elements[0], 0),
+                    std::runtime_error);
+            EXPECT_THROW(mapped.getProofOrdered(elements[0],
+                        elements.size() + 1), std::runtime_error);
+        }
+    }
+}
+
+TEST(MappedMerkleTree, SaveReplacesFile)
+{
+    TempPath temp;
+    const MerkleTree::Elements elements = makeElements(1000);
+    MerkleTree large(elements, true);
+    large.save(temp.path());
+    MappedMerkleTree previous(temp.path());
+    MerkleTree small(makeElements(3), true);
+    small.save(temp.path());
+    MappedMerkleTree mapped(temp.path());
+    EXPECT_EQ(3u, mapped.getLeafCount());
+    EXPECT_EQ(small.getRoot(), mapped.getRoot());
+    EXPECT_NE(0, access((temp.path() + ".tmp").c_str(), F_OK));
+
+    // The file mapped before is left intact
+    EXPECT_EQ(1000u, previous.getLeafCount());
+    EXPECT_EQ(large.getRoot(), previous.getRoot());
+    EXPECT_EQ(large.getProofOrdered(elements[999], 1000),
+            previous.getProofOrdered(elements[999], 1000));
+}
+
+TEST(MappedMerkleTree, RejectsBadFiles)
+{
+    EXPECT_THROW(MappedMerkleTree("/nonexistent/tree"), std::runtime_error);
+    EXPECT_THROW(MappedMerkleTree("/tmp"), std::runtime_error);
+
+    TempPath empty;
+    EXPECT_THROW(MappedMerkleTree(empty.path()), std::runtime_error);
+
+    TempPath garbage;
+    const MerkleTree::Buffer junk(4096, 0x5a);
+    overwrite(garbage.path(), &junk[0], junk.size(), 0);
+    EXPECT_THROW(MappedMerkleTree(garbage.path()), std::runtime_error);
+
+    MerkleTree tree(makeElements(100), true);
+    TempPath version;
+    tree.save(version.path());
+    const uint32_t future = TREE_FILE_VERSION + 1;
+    overwrite(version.path(), &future, sizeof(future),
+            offsetof(TreeFileHeader, version));
+    EXPECT_THROW(MappedMerkleTree(version.path()), std::runtime_error);
+
+    TempPath wide;
+    MerkleTree256(MerkleTree256::Elements(1, MerkleTree256::hash(junk)))
+        .save(wide.path());
+    EXPECT_THROW(MappedMerkleTree(wide.path()), std::runtime_error);
+
+    TempPath truncated;
+    tree.save(truncated.path());
+    ASSERT_EQ(0, truncate(truncated.path().c_str(), 1000));
+    EXPECT_THROW(MappedMerkleTree(truncated.path()), std::runtime_error);
+
+    TempPath offsets;
+    tree.save(offsets.path());
+    const uint64_t bad = 3;
+    overwrite(offsets.path(), &bad, sizeof(bad),
+            makeTreeFileHeader(true, 0, 0, 0).layerOffsetsPos
+            + sizeof(uint64_t));
+    EXPECT_THROW(MappedMerkleTree(offsets.path()), std::runtime_error);
+
+    TempPath layers;
+    tree.save(layers.path());
+    const uint64_t huge = UINT64_MAX; // `layerCount + 1` would wrap
+    overwrite(layers.path(), &huge, sizeof(huge),
+            offsetof(TreeFileHeader, layerCount));
+    EXPECT_THROW(MappedMerkleTree(layers.path()), std::runtime_error);
+}
+
+TEST(MappedMerkleTree, SurvivesFullLeafTable)
+{
+    // A leaf table without any empty slot can't be checked when opening
+    const MerkleTree::Elements elements = makeElements(8);
+    MerkleTree tree(elements, true);
+    TempPath temp;
+    tree.save(temp.path());
+    TreeFileHeader header;
+    int fd = open(temp.path().c_str(), O_RDONLY);
+    ASSERT_LE(0, fd);
+    ASSERT_EQ(ssize_t(sizeof(header)), pread(fd, &header, sizeof(header), 0));
+    close(fd);
+    const std::vector<uint64_t> slots(header.slotCount, 1);
+    overwrite(temp.path(), &slots[0], slots.size() * sizeof(slots[0]),
+            header.slotsPos);
+
+    MappedMerkleTree mapped(temp.path());
+    EXPECT_EQ(tree.getProof(elements[0]), mapped.getProof(elements[0]));
+    EXPECT_THROW(mapped.getProof(elements[1]), std::runtime_error);
+}
+
+TEST(MappedMerkleTree, ServesFixedProofs)
+{
+    TempPath temp;
+    MerkleTree::Elements elements = makeElements(500);
+    MerkleTree tree(elements, true);
+    tree.save(temp.path());
+    MappedMerkleTree mapped(temp.path());
+    for (size_t i = 0; i < elements.size(); i += 11) {
+        const MerkleTree::Digest element =
+            MerkleTree::Digest::fromBuffer(elements[i]);
+        MerkleTree::Digest expected[MerkleTree::MAX_PROOF_LENGTH];
+        MerkleTree::Digest actual[MerkleTree::MAX_PROOF_LENGTH];
+        const size_t length = tree.getProofOrdered(element, i + 1, expected,
+                MerkleTree::MAX_PROOF_LENGTH);
+        ASSERT_EQ(length, mapped.getProofOrdered(element, i + 1, actual,
+                    MerkleTree::MAX_PROOF_LENGTH));
+        ASSERT_EQ(length, mapped.getProof(element, actual,
+                    MerkleTree::MAX_PROOF_LENGTH));
+        for (size_t j = 0; j < length; ++j) {
+            EXPECT_EQ(expected[j], actual[j]) << i;
+        }
+    }
+}
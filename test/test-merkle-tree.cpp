@@ -1,10 +1,182 @@
 #include <merkle-tree/merkle-tree.hpp>
+#include "blake2.h"
 #include <gtest/gtest.h>
 #include <gmock/gmock.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+extern "C" {
+#include <pthread.h>
+#include <unistd.h>
+}
 
 using ::testing::UnorderedElementsAre;
 using ::testing::ElementsAre;
 
+/** Number of heap allocations made so far by the whole test program */
+static size_t allocationCount = 0;
+
+#if __cplusplus >= 201103L
+#define THROW_BAD_ALLOC
+#define THROW_NOTHING noexcept
+#else
+#define THROW_BAD_ALLOC throw(std::bad_alloc)
+#define THROW_NOTHING throw()
+#endif
+
+// NB: Not inlined, so the compiler does not see `free()` called on memory
+// from `new`
+__attribute__((noinline)) void* operator new(size_t size) THROW_BAD_ALLOC
+{
+    __sync_fetch_and_add(&allocationCount, 1);
+    void* p = std::malloc(size ? size : 1);
+    if (p == NULL) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+__attribute__((noinline)) void operator delete(void* p) THROW_NOTHING
+{
+    std::free(p);
+}
+
+namespace {
+
+/** Compute a Merkle Tree root the slow way, one pair at a time */
+MerkleTree::Buffer naiveRoot(MerkleTree::Elements layer, bool preserveOrder)
+{
+    while (layer.size() > 1) {
+        MerkleTree::Elements next;
+        for (size_t i = 0; i + 1 < layer.size(); i += 2) {
+            next.push_back(MerkleTree::combinedHash(layer[i], layer[i + 1],
+                        preserveOrder));
+        }
+        if (layer.size() & 1) {
+            next.push_back(layer.back());
+        }
+        layer.swap(next);
+    }
+    return layer[0];
+}
+
+/** Build a list of `count` distinct elements */
+MerkleTree::Elements makeElements(size_t count)
+{
+    MerkleTree::Elements elements;
+    for (size_t i = 0; i < count; ++i) {
+        MerkleTree::Buffer data(4);
+        data[0] = i & 0xff;
+        data[1] = (i >> 8) & 0xff;
+        data[2] = (i >> 16) & 0xff;
+        data[3] = (i >> 24) & 0xff;
+        elements.push_back(MerkleTree::hash(data));
+    }
+    return elements;
+}
+
+/** Temporary file, removed when going out of scope */
+class TempFile
+{
+public :
+    TempFile(const MerkleTree::Buffer& content)
+    {
+        char path[] = "/tmp/merkle-tree-test-XXXXXX";
+        fd_ = mkstemp(path);
+        path_ = path;
+        if (!content.empty()) {
+            EXPECT_EQ(ssize_t(content.size()),
+                    write(fd_, &content[0], content.size()));
+        }
+    }
+
+    ~TempFile()
+    {
+        close(fd_);
+        unlink(path_.c_str());
+    }
+
+    int fd() const { return fd_; }
+
+private :
+    int         fd_;
+    std::string path_;
+};
+
+/** Build a buffer of `size` bytes with some non-trivial content */
+MerkleTree::Buffer makeData(size_t size)
+{
+    MerkleTree::Buffer data(size);
+    for (size_t i = 0; i < size; ++i) {
+        data[i] = (i * 7 + (i >> 8)) & 0xff;
+    }
+    return data;
+}
+
+} // namespace
+
+TEST(MerkleTreeHash, RawMemoryMatchesBuffer)
+{
+    const size_t sizes[] = { 0, 1, 127, 128, 129, 1000, 100000 };
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+        MerkleTree::Buffer data = makeData(sizes[i]);
+        MerkleTree::Buffer expected = MerkleTree::hash(data);
+        EXPECT_EQ(MERKLE_TREE_ELEMENT_SIZE_B, expected.size());
+        EXPECT_EQ(expected, MerkleTree::hash(data.empty() ? NULL : &data[0],
+                    data.size())) << sizes[i];
+    }
+    EXPECT_NE(MerkleTree::hash(makeData(128)), MerkleTree::hash(makeData(129)));
+}
+
+TEST(MerkleTreeHash, IovMatchesConcatenation)
+{
+    MerkleTree::Buffer data = makeData(1000);
+    const size_t cuts[] = { 0, 3, 128, 129, 500, 500, 1000 };
+    struct iovec iov[6];
+    for (size_t i = 0; i < 6; ++i) {
+        iov[i].iov_base = &data[cuts[i]];
+        iov[i].iov_len = cuts[i + 1] - cuts[i];
+    }
+    EXPECT_EQ(MerkleTree::hash(data), MerkleTree::hashIov(iov, 6));
+    EXPECT_EQ(MerkleTree::hash(MerkleTree::Buffer()),
+            MerkleTree::hashIov(NULL, 0));
+}
+
+TEST(MerkleTreeHash, FileMatchesBuffer)
+{
+    MerkleTree::Buffer data = makeData(300000);
+    TempFile file(data);
+    EXPECT_EQ(MerkleTree::hash(data), MerkleTree::hashFile(file.fd()));
+
+    // Region not aligned on a page boundary
+    MerkleTree::Buffer region(data.begin() + 5000, data.begin() + 205000);
+    EXPECT_EQ(MerkleTree::hash(region),
+            MerkleTree::hashFile(file.fd(), 5000, region.size()));
+    EXPECT_EQ(MerkleTree::hash(MerkleTree::Buffer()),
+            MerkleTree::hashFile(file.fd(), data.size(), 0));
+    EXPECT_THROW(MerkleTree::hashFile(file.fd(), 1, data.size()),
+            std::runtime_error);
+
+    TempFile empty((MerkleTree::Buffer()));
+    EXPECT_EQ(MerkleTree::hash(MerkleTree::Buffer()),
+            MerkleTree::hashFile(empty.fd()));
+
+    EXPECT_THROW(MerkleTree::hashFile(-1), std::runtime_error);
+}
+
+TEST(MerkleTreeHash, PipeIsReadUntilEnd)
+{
+    MerkleTree::Buffer data = makeData(10000);
+    int fds[2];
+    ASSERT_EQ(0, pipe(fds));
+    ASSERT_EQ(ssize_t(data.size()), write(fds[1], &data[0], data.size()));
+    close(fds[1]);
+    EXPECT_EQ(MerkleTree::hash(data), MerkleTree::hashFile(fds[0]));
+    close(fds[0]);
+}
+
 TEST(MerkleTreeUnordered, NoElementsShouldThrow)
 {
     MerkleTree::Elements empty_elements;
@@ -257,3 +429,643 @@ TEST(MerkleTreeOrdered, CheckProofWithTenElementsWithDuplicates)
         EXPECT_TRUE(MerkleTree::checkProofOrdered(proof, root, elements[i], i+1));
     }
 }
+
+TEST(MerkleTreeOrdered, RootMatchesPairwiseComputation)
+{
+    const size_t counts[] = { 1, 2, 3, 4, 5, 7, 8, 9, 63, 64, 65, 127, 129,
+        1000 };
+    for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); ++i) {
+        MerkleTree::Elements elements = makeElements(counts[i]);
+        EXPECT_EQ(naiveRoot(elements, true),
+                MerkleTree::merkleRoot(elements, true)) << counts[i];
+    }
+}
+
+TEST(MerkleTreeUnordered, RootMatchesPairwiseComputation)
+{
+    const size_t counts[] = { 1, 2, 3, 9, 65, 1000 };
+    for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); ++i) {
+        MerkleTree::Elements elements = makeElements(counts[i]);
+        MerkleTree::Elements sorted = elements;
+        std::sort(sorted.begin(), sorted.end());
+        EXPECT_EQ(naiveRoot(sorted, false),
+                MerkleTree::merkleRoot(elements, false)) << counts[i];
+    }
+}
+
+TEST(MerkleTreeDigest, ConvertsAndComparesLikeBuffer)
+{
+    MerkleTree::Elements elements = makeElements(20);
+    for (size_t i = 0; i < elements.size(); ++i) {
+        MerkleTree::Digest a = MerkleTree::Digest::fromBuffer(elements[i]);
+        EXPECT_EQ(elements[i], a.toBuffer());
+        for (size_t j = 0; j < elements.size(); ++j) {
+            MerkleTree::Digest b = MerkleTree::Digest::fromBuffer(elements[j]);
+            EXPECT_EQ(elements[i] == elements[j], a == b);
+            EXPECT_EQ(elements[i] < elements[j], a < b);
+            EXPECT_EQ(elements[i] > elements[j], a > b);
+        }
+    }
+    EXPECT_THROW(MerkleTree::Digest::fromBuffer(MerkleTree::Buffer(3)),
+            std::runtime_error);
+    EXPECT_EQ(size_t(MERKLE_TREE_ELEMENT_SIZE_B), sizeof(MerkleTree::Digest));
+}
+
+TEST(MerkleTreeDigest, DigestsConstructorMatchesElements)
+{
+    MerkleTree::Elements elements = makeElements(37);
+    elements.push_back(elements[3]); // duplicate
+    MerkleTree::Digests digests;
+    for (size_t i = 0; i < elements.size(); ++i) {
+        digests.push_back(MerkleTree::Digest::fromBuffer(elements[i]));
+    }
+    for (int preserveOrder = 0; preserveOrder < 2; ++preserveOrder) {
+        MerkleTree from_elements(elements, preserveOrder);
+        MerkleTree from_digests(digests, preserveOrder);
+        EXPECT_EQ(from_elements.getRoot(), from_digests.getRoot());
+        EXPECT_EQ(from_elements.getRoot(),
+                from_digests.getRootDigest().toBuffer());
+    }
+    EXPECT_THROW(MerkleTree m((MerkleTree::Digests())), std::runtime_error);
+}
+
+TEST(MerkleTreeDigest, LayersAreContiguous)
+{
+    MerkleTree::Elements elements = makeElements(11);
+    MerkleTree tree(elements, true);
+    ASSERT_EQ(5u, tree.getLayerCount()); // 11, 6, 3, 2, 1
+    EXPECT_EQ(11u, tree.getLeafCount());
+    EXPECT_EQ(6u, tree.getLayerSize(1));
+    EXPECT_EQ(3u, tree.getLayerSize(2));
+    EXPECT_EQ(2u, tree.getLayerSize(3));
+    EXPECT_EQ(1u, tree.getLayerSize(4));
+    for (size_t layer = 0; layer < tree.getLayerCount(); ++layer) {
+        const MerkleTree::Digest* digests = tree.getLayer(layer);
+        EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(digests)
+                % MERKLE_TREE_DIGEST_ALIGN_B);
+        for (size_t i = 0; i < tree.getLayerSize(layer); ++i) {
+            if (layer == 0) {
+                EXPECT_EQ(elements[i], digests[i].toBuffer());
+            } else if (2 * i + 1 < tree.getLayerSize(layer - 1)) {
+                EXPECT_EQ(MerkleTree::combinedHash(tree.getLayer(layer - 1)[2 * i],
+                            tree.getLayer(layer - 1)[2 * i + 1], true),
+                        digests[i]);
+            } else {
+                EXPECT_EQ(tree.getLayer(layer - 1)[2 * i], digests[i]);
+            }
+        }
+    }
+    EXPECT_EQ(tree.getLayer(4)[0], tree.getRootDigest());
+}
+
+TEST(MerkleTreeOrdered, GetProofFindsEveryElement)
+{
+    MerkleTree::Elements elements = makeElements(1000);
+    MerkleTree ordered_tree(elements, true);
+    for (size_t i = 0; i < elements.size(); ++i) {
+        EXPECT_EQ(ordered_tree.getProofOrdered(elements[i], i + 1),
+                ordered_tree.getProof(elements[i]));
+    }
+    EXPECT_THROW(ordered_tree.getProof(MerkleTree::hash(MerkleTree::Buffer(3))),
+            std::runtime_error);
+    EXPECT_THROW(ordered_tree.getProof(MerkleTree::Buffer(3)),
+            std::runtime_error);
+}
+
+TEST(MerkleTreeOrdered, GetProofUsesFirstDuplicate)
+{
+    MerkleTree::Elements elements = makeElements(5);
+    elements.push_back(elements[3]);
+    elements.push_back(elements[1]);
+    MerkleTree ordered_tree(elements, true);
+    EXPECT_EQ(ordered_tree.getProofOrdered(elements[3], 4),
+            ordered_tree.getProof(elements[3]));
+    EXPECT_EQ(ordered_tree.getProofOrdered(elements[1], 2),
+            ordered_tree.getProof(elements[1]));
+}
+
+TEST(MerkleTreeUnordered, GetProofFindsEveryElement)
+{
+    MerkleTree::Elements elements = makeElements(1000);
+    MerkleTree tree(elements);
+    MerkleTree::Buffer root = tree.getRoot();
+    for (size_t i = 0; i < elements.size(); ++i) {
+        EXPECT_TRUE(MerkleTree::checkProof(tree.getProof(elements[i]), root,
+                    elements[i]));
+    }
+    EXPECT_THROW(tree.getProof(MerkleTree::hash(MerkleTree::Buffer(3))),
+            std::runtime_error);
+}
+
+TEST(MerkleTreeOrdered, UpdateLeafMatchesRebuild)
+{
+    const size_t counts[] = { 1, 2, 3, 5, 11, 64, 65, 1000 };
+    for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); ++c) {
+        MerkleTree::Elements elements = makeElements(counts[c]);
+        MerkleTree::Elements replacements = makeElements(3 * counts[c] + 2);
+        MerkleTree tree(elements, true);
+        // Update the first, the last (possibly carried up) and some others
+        for (size_t i = 0; i < counts[c]; i += 1 + i / 3) {
+            const size_t indices[] = { i, counts[c] - 1 - i };
+            for (size_t k = 0; k < 2; ++k) {
+                elements[indices[k]] = replacements[counts[c] + 2 * i + k];
+                tree.updateLeaf(indices[k] + 1, elements[indices[k]]);
+            }
+            ASSERT_EQ(naiveRoot(elements, true), tree.getRoot())
+                << counts[c] << " leaves, update " << i;
+        }
+        MerkleTree rebuilt(elements, true);
+        for (size_t i = 0; i < elements.size(); ++i) {
+            EXPECT_EQ(rebuilt.getProofOrdered(elements[i], i + 1),
+                    tree.getProof(elements[i]));
+        }
+    }
+}
+
+TEST(MerkleTreeOrdered, UpdateLeafKeepsDuplicatesFindable)
+{
+    MerkleTree::Elements elements = makeElements(6);
+    elements[4] = elements[1];
+    MerkleTree tree(elements, true);
+
+    // Replacing the first duplicate makes the second one the first
+    tree.updateLeaf(2, elements[0]);
+    EXPECT_EQ(tree.getProofOrdered(elements[1], 5), tree.getProof(elements[1]));
+    EXPECT_EQ(tree.getProofOrdered(elements[0], 1), tree.getProof(elements[0]));
+
+    tree.updateLeaf(5, elements[2]);
+    EXPECT_THROW(tree.getProof(elements[1]), std::runtime_error);
+    EXPECT_EQ(tree.getProofOrdered(elements[2], 3), tree.getProof(elements[2]));
+}
+
+TEST(MerkleTreeOrdered, UpdateLeafRejectsBadArguments)
+{
+    MerkleTree::Elements elements = makeElements(4);
+    MerkleTree ordered_tree(elements, true);
+    EXPECT_THROW(ordered_tree.updateLeaf(0, elements[0]), std::runtime_error);
+    EXPECT_THROW(ordered_tree.updateLeaf(5, elements[0]), std::runtime_error);
+    EXPECT_THROW(ordered_tree.updateLeaf(1, MerkleTree::Buffer(3)),
+            std::runtime_error);
+    EXPECT_EQ(naiveRoot(elements, true), ordered_tree.getRoot());
+
+    MerkleTree unordered_tree(elements);
+    EXPECT_THROW(unordered_tree.updateLeaf(1, elements[0]), std::runtime_error);
+}
+
+TEST(MerkleTreeOrdered, UpdateLeavesMatchesRebuild)
+{
+    const size_t counts[] = { 1, 2, 3, 5, 11, 64, 65, 1000 };
+    for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); ++c) {
+        MerkleTree::Elements elements = makeElements(counts[c]);
+        MerkleTree::Elements replacements = makeElements(3 * counts[c] + 2);
+        MerkleTree tree(elements, true);
+
+        // Neighbours, the last leaf (possibly carried up), and an index
+        // given twice, in no particular order
+        MerkleTree::LeafUpdates updates;
+        for (size_t i = counts[c]; i > 0; i -= std::min(i, 1 + i / 4)) {
+            elements[i - 1] = replacements[counts[c] + i];
+            updates.push_back(std::make_pair(i,
+                        MerkleTree::Digest::fromBuffer(elements[i - 1])));
+        }
+        updates.push_back(std::make_pair(1,
+                    MerkleTree::Digest::fromBuffer(replacements[0])));
+        elements[0] = replacements[0];
+        tree.updateLeaves(updates);
+        EXPECT_EQ(naiveRoot(elements, true), tree.getRoot())
+            << counts[c] << " leaves";
+        for (size_t i = 0; i < elements.size(); ++i) {
+            EXPECT_EQ(tree.getProofOrdered(elements[i], i + 1),
+                    tree.getProof(elements[i]));
+        }
+    }
+}
+
+TEST(MerkleTreeOrdered, UpdateLeavesInParallel)
+{
+    // Enough updates for the lower layers to be split over the threads
+    MerkleTree::Digests leaves;
+    for (size_t i = 0; i < 100000; ++i) {
+        leaves.push_back(MerkleTree::Digest::fromBuffer(
+                    MerkleTree::hash(&i, sizeof(i))));
+    }
+    MerkleTree tree(leaves, true);
+    MerkleTree single(leaves, true);
+    MerkleTree::LeafUpdates updates;
+    for (size_t i = 0; i < 30000; ++i) {
+        const size_t index = (i * 7919) % leaves.size();
+        leaves[index] = MerkleTree::Digest::fromBuffer(
+                MerkleTree::hash(&i, 4));
+        updates.push_back(std::make_pair(index + 1, leaves[index]));
+        single.updateLeaf(index + 1, leaves[index]);
+    }
+    MerkleTreeThreadPool pool(4);
+    tree.updateLeaves(updates, pool);
+    EXPECT_TRUE(MerkleTree(leaves, true).getRootDigest()
+            == tree.getRootDigest());
+    EXPECT_TRUE(single.getRootDigest() == tree.getRootDigest());
+}
+
+TEST(MerkleTreeOrdered, UpdateLeavesRejectsBadArguments)
+{
+    MerkleTree::Elements elements = makeElements(4);
+    MerkleTree ordered_tree(elements, true);
+    MerkleTree::LeafUpdates updates;
+    updates.push_back(std::make_pair(1,
+                MerkleTree::Digest::fromBuffer(elements[3])));
+    updates.push_back(std::make_pair(5,
+                MerkleTree::Digest::fromBuffer(elements[0])));
+    EXPECT_THROW(ordered_tree.updateLeaves(updates), std::runtime_error);
+    updates[1].first = 0;
+    EXPECT_THROW(ordered_tree.updateLeaves(updates), std::runtime_error);
+    EXPECT_EQ(naiveRoot(elements, true), ordered_tree.getRoot());
+    ordered_tree.updateLeaves(MerkleTree::LeafUpdates());
+    EXPECT_EQ(naiveRoot(elements, true), ordered_tree.getRoot());
+
+    MerkleTree unordered_tree(elements);
+    EXPECT_THROW(unordered_tree.updateLeaves(MerkleTree::LeafUpdates()),
+            std::runtime_error);
+}
+
+TEST(MerkleTreeMultiProof, ChecksForAnySetOfIndices)
+{
+    const size_t counts[] = { 1, 2, 3, 5, 7, 11, 64, 100, 1000 };
+    for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); ++c) {
+        MerkleTree::Elements elements = makeElements(counts[c]);
+        for (int preserveOrder = 0; preserveOrder < 2; ++preserveOrder) {
+            MerkleTree tree(elements, preserveOrder);
+            const MerkleTree::Digest* leaves = tree.getLayer(0);
+            for (size_t step = 1; step <= counts[c]; step = 3 * step + 1) {
+                std::vector<size_t> indices;
+                MerkleTree::Elements proven;
+                // Give indices backwards, with a duplicate at the end
+                for (size_t i = counts[c]; i > 0; i -= std::min(step, i)) {
+                    indices.push_back(i);
+                    proven.push_back(leaves[i - 1].toBuffer());
+                }
+                indices.push_back(indices[0]);
+                proven.push_back(proven[0]);
+
+                MerkleTree::MultiProof proof = tree.getMultiProof(indices);
+                EXPECT_EQ(indices, proof.indices);
+                EXPECT_TRUE(MerkleTree::checkMultiProof(proof, tree.getRoot(),
+                            counts[c], proven, preserveOrder))
+                    << counts[c] << " leaves, step " << step;
+
+                // Less hashes than separate proofs, as soon as paths meet
+                size_t separate = 0;
+                for (size_t i = 0; i + 1 < proven.size(); ++i) {
+                    separate += tree.getProof(proven[i]).size();
+                }
+                EXPECT_LE(proof.hashes.size(), separate);
+            }
+        }
+    }
+}
+
+TEST(MerkleTreeMultiProof, FromElements)
+{
+    MerkleTree::Elements elements = makeElements(100);
+    MerkleTree tree(elements);
+    MerkleTree::Elements proven;
+    proven.push_back(elements[42]);
+    proven.push_back(elements[7]);
+    proven.push_back(elements[99]);
+    MerkleTree::MultiProof proof = tree.getMultiProof(proven);
+    EXPECT_TRUE(MerkleTree::checkMultiProof(proof, tree.getRoot(), 100,
+                proven, false));
+
+    proven.push_back(MerkleTree::hash(MerkleTree::Buffer(3)));
+    EXPECT_THROW(tree.getMultiProof(proven), std::runtime_error);
+    EXPECT_THROW(tree.getMultiProof(MerkleTree::Elements()),
+            std::runtime_error);
+}
+
+TEST(MerkleTreeMultiProof, RejectsTamperedProofs)
+{
+    MerkleTree::Elements elements = makeElements(37);
+    MerkleTree tree(elements, true);
+    std::vector<size_t> indices;
+    indices.push_back(3);
+    indices.push_back(20);
+    indices.push_back(37);
+    MerkleTree::Elements proven;
+    proven.push_back(elements[2]);
+    proven.push_back(elements[19]);
+    proven.push_back(elements[36]);
+    const MerkleTree::MultiProof proof = tree.getMultiProof(indices);
+    const MerkleTree::Buffer root = tree.getRoot();
+    ASSERT_TRUE(MerkleTree::checkMultiProof(proof, root, 37, proven, true));
+
+    MerkleTree::Elements wrong = proven;
+    wrong[1] = elements[18];
+    EXPECT_FALSE(MerkleTree::checkMultiProof(proof, root, 37, wrong, true));
+    wrong.pop_back();
+    EXPECT_FALSE(MerkleTree::checkMultiProof(proof, root, 37, wrong, true));
+
+    MerkleTree::MultiProof tampered = proof;
+    tampered.hashes[0].bytes[0] ^= 1;
+    EXPECT_FALSE(MerkleTree::checkMultiProof(tampered, root, 37, proven, true));
+    tampered = proof;
+    tampered.hashes.pop_back();
+    EXPECT_FALSE(MerkleTree::checkMultiProof(tampered, root, 37, proven, true));
+    tampered = proof;
+    tampered.hashes.push_back(proof.hashes[0]);
+    EXPECT_FALSE(MerkleTree::checkMultiProof(tampered, root, 37, proven, true));
+    EXPECT_FALSE(MerkleTree::checkMultiProof(proof, root, 38, proven, true));
+    tampered = proof;
+    tampered.indices[0] = 0;
+    EXPECT_FALSE(MerkleTree::checkMultiProof(tampered, root, 37, proven, true));
+
+    EXPECT_THROW(tree.getMultiProof(std::vector<size_t>()),
+            std::runtime_error);
+    indices.push_back(38);
+    EXPECT_THROW(tree.getMultiProof(indices), std::runtime_error);
+}
+
+TEST(MerkleTreeMultiProof, RejectsForgedLeafCount)
+{
+    // In a tree of 3 leaves, the last leaf is carried up as is, so the
+    // parent of leaves 3 and 4 of a tree of 4 leaves would pass for it
+    MerkleTree tree(makeElements(4), true);
+    const MerkleTree::Buffer root = tree.getRoot();
+    MerkleTree::MultiProof forged;
+    forged.indices.push_back(3);
+    forged.hashes.push_back(tree.getLayer(1)[0]);
+    const MerkleTree::Elements inner(1, tree.getLayer(1)[1].toBuffer());
+    ASSERT_TRUE(MerkleTree::checkMultiProof(forged, root, 3, inner, true));
+    EXPECT_FALSE(MerkleTree::checkMultiProof(forged, root, 4, inner, true));
+}
+
+namespace {
+
+/** Make elements in strictly increasing order, for absence proofs */
+MerkleTree::Elements makeSortedElements(size_t count)
+{
+    MerkleTree::Elements elements = makeElements(count);
+    std::sort(elements.begin(), elements.end());
+    return elements;
+}
+
+} // namespace
+
+TEST(MerkleTreeAbsenceProof, ProvesEveryGap)
+{
+    const size_t counts[] = { 1, 2, 3, 5, 8, 13, 100 };
+    for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); ++c) {
+        MerkleTree tree(makeSortedElements(counts[c]), true);
+        const MerkleTree::Buffer root = tree.getRoot();
+        const MerkleTree::Digest* leaves = tree.getLayer(0);
+
+        // An element in each gap between leaves, and one at each end
+        MerkleTree::Elements absent;
+        absent.push_back(MerkleTree::Buffer(MERKLE_TREE_ELEMENT_SIZE_B, 0));
+        absent.push_back(MerkleTree::Buffer(MERKLE_TREE_ELEMENT_SIZE_B, 0xff));
+        for (size_t i = 0; i + 1 < counts[c]; ++i) {
+            MerkleTree::Buffer element = leaves[i].toBuffer();
+            element.back() += 1;
+            if (element != leaves[i + 1].toBuffer()) {
+                absent.push_back(element);
+            }
+        }
+        for (size_t i = 0; i < absent.size(); ++i) {
+            const MerkleTree::AbsenceProof proof =
+                tree.getAbsenceProof(absent[i]);
+            EXPECT_TRUE(MerkleTree::checkAbsenceProof(proof, root, counts[c],
+                        absent[i])) << counts[c] << " leaves, element " << i;
+            if (proof.lowerIndex > 0) {
+                EXPECT_FALSE(MerkleTree::checkAbsenceProof(proof, root,
+                            counts[c], proof.lower));
+            }
+        }
+        EXPECT_THROW(tree.getAbsenceProof(leaves[counts[c] / 2].toBuffer()),
+                std::runtime_error);
+    }
+}
+
+TEST(MerkleTreeAbsenceProof, RejectsLeavesThatAreNotAdjacent)
+{
+    // Hide leaf 2 between leaves 1 and 4, whose proofs are valid on their
+    // own, claiming any position for them
+    const MerkleTree::Elements elements = makeSortedElements(8);
+    for (int preserveOrder = 0; preserveOrder < 2; ++preserveOrder) {
+        MerkleTree tree(elements, preserveOrder);
+        for (size_t lowerIndex = 1; lowerIndex < 8; ++lowerIndex) {
+            MerkleTree::AbsenceProof proof;
+            proof.lowerIndex = lowerIndex;
+            proof.lower = elements[1];
+            proof.lowerProof = tree.getProof(proof.lower);
+            proof.upper = elements[4];
+            proof.upperProof = tree.getProof(proof.upper);
+            EXPECT_FALSE(MerkleTree::checkAbsenceProof(proof, tree.getRoot(),
+                        8, elements[2])) << "index " << lowerIndex;
+        }
+    }
+
+    MerkleTree tree(makeSortedElements(20), true);
+    const MerkleTree::Buffer root = tree.getRoot();
+    MerkleTree::Buffer element = tree.getLayer(0)[9].toBuffer();
+    element.back() ^= 1;
+    const MerkleTree::AbsenceProof proof = tree.getAbsenceProof(element);
+    ASSERT_TRUE(MerkleTree::checkAbsenceProof(proof, root, 20, element));
+
+    MerkleTree::AbsenceProof tampered = proof;
+    tampered.lowerProof[0][0] ^= 1;
+    EXPECT_FALSE(MerkleTree::checkAbsenceProof(tampered, root, 20, element));
+    tampered = proof;
+    tampered.upperProof.pop_back();
+    EXPECT_FALSE(MerkleTree::checkAbsenceProof(tampered, root, 20, element));
+    tampered = proof;
+    tampered.lower.clear(); // lower leaf missing
+    EXPECT_FALSE(MerkleTree::checkAbsenceProof(tampered, root, 20, element));
+    tampered = proof;
+    std::swap(tampered.lower, tampered.upper);
+    std::swap(tampered.lowerProof, tampered.upperProof);
+    EXPECT_FALSE(MerkleTree::checkAbsenceProof(tampered, root, 20, element));
+    EXPECT_FALSE(MerkleTree::checkAbsenceProof(proof, root, 40, element));
+    EXPECT_FALSE(MerkleTree::checkAbsenceProof(proof, root, 20,
+                MerkleTree::Buffer(3)));
+
+    MerkleTree unordered(makeSortedElements(20));
+    EXPECT_THROW(unordered.getAbsenceProof(element), std::runtime_error);
+    EXPECT_THROW(tree.getAbsenceProof(MerkleTree::Buffer(3)),
+            std::runtime_error);
+}
+
+TEST(MerkleTree256, HashIsBlake2b256)
+{
+    const MerkleTree::Buffer data = makeData(1000);
+    uint8_t expected[32];
+    blake2b(expected, sizeof(expected), &data[0], data.size(), NULL, 0);
+    EXPECT_EQ(size_t(32), MerkleTree256::DIGEST_SIZE_B);
+    EXPECT_EQ(size_t(32), sizeof(MerkleTree256::Digest));
+    EXPECT_EQ(MerkleTree256::Buffer(expected, expected + sizeof(expected)),
+            MerkleTree256::hash(data));
+}
+
+TEST(MerkleTree256, WrongSizeElementShouldThrow)
+{
+    MerkleTree::Elements elements = makeElements(3);
+    EXPECT_THROW(MerkleTree256 tree(elements), std::runtime_error);
+}
+
+TEST(MerkleTree256, ProofsCheckInBothModes)
+{
+    MerkleTree256::Elements elements;
+    for (size_t i = 0; i < 27; ++i) {
+        elements.push_back(MerkleTree256::hash(&i, sizeof(i)));
+    }
+
+    for (int preserveOrder = 0; preserveOrder < 2; ++preserveOrder) {
+        MerkleTree256 tree(elements, preserveOrder);
+        EXPECT_EQ(MerkleTree256::merkleRoot(elements, preserveOrder),
+                tree.getRoot());
+
+        // Compute the root the slow way, one pair at a time
+        MerkleTree256::Elements layer;
+        for (size_t i = 0; i < tree.getLeafCount(); ++i) {
+            layer.push_back(tree.getLayer(0)[i].toBuffer());
+        }
+        while (layer.size() > 1) {
+            MerkleTree256::Elements next;
+            for (size_t i = 0; i + 1 < layer.size(); i += 2) {
+                next.push_back(MerkleTree256::combinedHash(layer[i],
+                            layer[i + 1], preserveOrder));
+            }
+            if (layer.size() & 1) {
+                next.push_back(layer.back());
+            }
+            layer.swap(next);
+        }
+        EXPECT_EQ(layer[0], tree.getRoot());
+
+        for (size_t i = 0; i < elements.size(); ++i) {
+            if (preserveOrder) {
+                EXPECT_TRUE(MerkleTree256::checkProofOrdered(
+                            tree.getProofOrdered(elements[i], i + 1),
+                            tree.getRoot(), elements[i], i + 1)) << i;
+            } else {
+                EXPECT_TRUE(MerkleTree256::checkProof(
+                            tree.getProof(elements[i]), tree.getRoot(),
+                            elements[i])) << i;
+            }
+        }
+
+        MerkleTree256::Elements proven;
+        proven.push_back(elements[4]);
+        proven.push_back(elements[26]);
+        EXPECT_TRUE(MerkleTree256::checkMultiProof(tree.getMultiProof(proven),
+                    tree.getRoot(), tree.getLeafCount(), proven,
+                    preserveOrder));
+    }
+}
+
+TEST(MerkleTreeFixedProof, MatchesProof)
+{
+    MerkleTree::Elements elements = makeElements(1000);
+    for (int preserveOrder = 0; preserveOrder < 2; ++preserveOrder) {
+        MerkleTree tree(elements, preserveOrder);
+        const MerkleTree::Digest root = tree.getRootDigest();
+        for (size_t i = 0; i < elements.size(); i += 7) {
+            const MerkleTree::Digest element =
+                MerkleTree::Digest::fromBuffer(elements[i]);
+            MerkleTree::Digest proof[MerkleTree::MAX_PROOF_LENGTH];
+            MerkleTree::Elements expected;
+            size_t length;
+            if (preserveOrder) {
+                expected = tree.getProofOrdered(elements[i], i + 1);
+                length = tree.getProofOrdered(element, i + 1, proof,
+                        MerkleTree::MAX_PROOF_LENGTH);
+                EXPECT_EQ(MerkleTree::checkProofOrdered(expected,
+                            tree.getRoot(), elements[i], i + 1),
+                        MerkleTree::checkProofOrdered(proof, length, root,
+                            element, i + 1)) << i;
+            } else {
+                expected = tree.getProof(elements[i]);
+                length = tree.getProof(element, proof,
+                        MerkleTree::MAX_PROOF_LENGTH);
+                EXPECT_TRUE(MerkleTree::checkProof(proof, length, root,
+                            element)) << i;
+                EXPECT_FALSE(MerkleTree::checkProof(proof, length, element,
+                            element)) << i;
+            }
+            ASSERT_EQ(expected.size(), length) << i;
+            for (size_t j = 0; j < length; ++j) {
+                EXPECT_EQ(expected[j], proof[j].toBuffer()) << i;
+            }
+        }
+    }
+}
+
+TEST(MerkleTreeFixedProof, MakesNoAllocation)
+{
+    MerkleTree::Elements elements = makeElements(1000);
+    MerkleTree ordered(elements, true);
+    MerkleTree unordered(elements, false);
+    const MerkleTree::Digest element =
+        MerkleTree::Digest::fromBuffer(elements[123]);
+    MerkleTree::Digest proof[MerkleTree::MAX_PROOF_LENGTH];
+
+    const size_t before = allocationCount;
+    size_t length = unordered.getProof(element, proof,
+            MerkleTree::MAX_PROOF_LENGTH);
+    const bool valid = MerkleTree::checkProof(proof, length,
+            unordered.getRootDigest(), element);
+    length = ordered.getProofOrdered(element, 124, proof,
+            MerkleTree::MAX_PROOF_LENGTH);
+    const bool validOrdered = MerkleTree::checkProofOrdered(proof, length,
+            ordered.getRootDigest(), element, 124);
+    length = ordered.getProof(element, proof, MerkleTree::MAX_PROOF_LENGTH);
+    EXPECT_EQ(before, allocationCount);
+
+    EXPECT_TRUE(valid);
+    EXPECT_TRUE(validOrdered);
+    EXPECT_EQ(10u, length);
+}
+
+namespace {
+
+/** Check a proof on a thread that hasn't done anything else yet */
+void* checkProofOnNewThread(void* arg)
+{
+    const MerkleTree* tree = static_cast<const MerkleTree*>(arg);
+    const MerkleTree::Digest& element = tree->getLayer(0)[5];
+    MerkleTree::Digest proof[MerkleTree::MAX_PROOF_LENGTH];
+
+    const size_t before = allocationCount;
+    const size_t length = tree->getProof(element, proof,
+            MerkleTree::MAX_PROOF_LENGTH);
+    const bool valid = MerkleTree::checkProof(proof, length,
+            tree->getRootDigest(), element);
+    return reinterpret_cast<void*>((allocationCount == before) && valid);
+}
+
+} // namespace
+
+TEST(MerkleTreeFixedProof, MakesNoAllocationOnNewThread)
+{
+    // The first statistics counted on a thread register its counters
+    MerkleTree tree(makeElements(100), false);
+    pthread_t thread;
+    ASSERT_EQ(0, pthread_create(&thread, NULL, checkProofOnNewThread, &tree));
+    void* result;
+    ASSERT_EQ(0, pthread_join(thread, &result));
+    EXPECT_TRUE(result != NULL);
+}
+
+TEST(MerkleTreeFixedProof, RejectsBadArguments)
+{
+    MerkleTree::Elements elements = makeElements(100);
+    MerkleTree tree(elements, true);
+    const MerkleTree::Digest element =
+        MerkleTree::Digest::fromBuffer(elements[5]);
+    MerkleTree::Digest proof[MerkleTree::MAX_PROOF_LENGTH];
+    EXPECT_EQ(7u, tree.getProof(element, proof, 7));
+    EXPECT_THROW(tree.getProof(element, proof, 6), std::runtime_error);
+    EXPECT_THROW(tree.getProofOrdered(element, 5, proof,
+                MerkleTree::MAX_PROOF_LENGTH), std::runtime_error);
+    EXPECT_THROW(tree.getProofOrdered(element, 0, proof,
+                MerkleTree::MAX_PROOF_LENGTH), std::runtime_error);
+    EXPECT_THROW(tree.getProof(tree.getRootDigest(), proof,
+                MerkleTree::MAX_PROOF_LENGTH), std::runtime_error);
+}
@@ -0,0 +1,136 @@
+#include <merkle-tree/persistent-tree.hpp>
+#include <gtest/gtest.h>
+
+namespace {
+
+MerkleTree::Digests makeLeaves(size_t count, size_t seed)
+{
+    MerkleTree::Digests leaves;
+    for (size_t i = 0; i < count; ++i) {
+        const size_t data[2] = { i, seed };
+        leaves.push_back(MerkleTree::Digest::fromBuffer(
+                    MerkleTree::hash(data, sizeof(data))));
+    }
+    return leaves;
+}
+
+/** Check that a version serves the same proofs as a full tree */
+void checkSameProofs(const PersistentMerkleTree& tree,
+        PersistentMerkleTree::Version version, const MerkleTree& full)
+{
+    ASSERT_EQ(full.getLeafCount(), tree.getLeafCount());
+    ASSERT_EQ(full.getLayerCount(), tree.getLayerCount());
+    EXPECT_TRUE(full.getRootDigest() == tree.getRootDigest(version));
+    for (size_t i = 0; i < full.getLeafCount(); ++i) {
+        const MerkleTree::Buffer leaf = full.getLayer(0)[i].toBuffer();
+        EXPECT_EQ(full.getProofOrdered(leaf, i + 1),
+                tree.getProofOrdered(version, leaf, i + 1))
+            << "version " << version << ", leaf " << i;
+    }
+}
+
+} // namespace
+
+TEST(PersistentMerkleTree, KeepsAllVersions)
+{
+    const size_t counts[] = { 1, 2, 3, 5, 13, 100, 1025 };
+    for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); ++c) {
+        const size_t count = counts[c];
+        std::vector<MerkleTree::Digests> history(1, makeLeaves(count, 0));
+        PersistentMerkleTree tree(history[0]);
+
+        // Single updates, then batches with repeated leaves
+        for (size_t seed = 1; seed <= 6; ++seed) {
+            MerkleTree::Digests leaves = history.back();
+            const MerkleTree::Digests values = makeLeaves(seed, seed);
+            MerkleTree::LeafUpdates updates;
+            for (size_t i = 0; i < values.size(); ++i) {
+                const size_t index = (i * 7 + seed) % count;
+                updates.push_back(std::make_pair(index + 1, values[i]));
+                leaves[index] = values[i];
+            }
+            const PersistentMerkleTree::Version version = (seed == 1)
+                ? tree.updateLeaf(updates[0].first, updates[0].second)
+                : tree.updateLeaves(updates);
+            EXPECT_EQ(seed, version);
+            history.push_back(leaves);
+        }
+
+        const std::vector<PersistentMerkleTree::Version> versions =
+            tree.getVersions();
+        ASSERT_EQ(history.size(), versions.size());
+        for (size_t v = 0; v < versions.size(); ++v) {
+            EXPECT_EQ(v, versions[v]);
+            checkSameProofs(tree, v, MerkleTree(history[v], true));
+        }
+    }
+}
+
+TEST(PersistentMerkleTree, SharesUnchangedNodes)
+{
+    const MerkleTree::Digests leaves = makeLeaves(1 << 12, 0);
+    PersistentMerkleTree tree(leaves);
+    EXPECT_EQ(13u, tree.getLayerCount());
+    EXPECT_EQ(2 * leaves.size() - 1, tree.getNodeCount());
+
+    // Each update only adds the path of its leaf
+    const MerkleTree::Digests values = makeLeaves(3, 1);
+    for (size_t i = 0; i < values.size(); ++i) {
+        tree.updateLeaf(i * 1000 + 1, values[i]);
+        EXPECT_EQ(2 * leaves.size() - 1 + 13 * (i + 1), tree.getNodeCount());
+    }
+    EXPECT_TRUE(leaves[0] == tree.getLeaf(0, 1));
+    EXPECT_TRUE(values[0] == tree.getLeaf(3, 1));
+
+    // Paths which are shared with retained versions stay: version 2 shares
+    // the path of leaf 1 below layer 10 with version 1
+    tree.releaseVersion(1);
+    EXPECT_EQ(2 * leaves.size() - 1 + 13 * 3 - 3, tree.getNodeCount());
+    EXPECT_FALSE(tree.hasVersion(1));
+    tree.releaseVersion(0);
+    tree.releaseVersion(2);
+    EXPECT_EQ(2 * leaves.size() - 1, tree.getNodeCount());
+
+    MerkleTree::Digests latest(leaves);
+    for (size_t i = 0; i < values.size(); ++i) {
+        latest[i * 1000] = values[i];
+    }
+    checkSameProofs(tree, 3, MerkleTree(latest, true));
+
+    // Freed nodes are reused
+    const size_t memory = tree.getMemoryUsage();
+    for (size_t i = 0; i < 100; ++i) {
+        tree.updateLeaf(i + 1, values[i % values.size()]);
+        tree.releaseVersion(tree.getLatestVersion() - 1);
+    }
+    EXPECT_EQ(memory, tree.getMemoryUsage());
+}
+
+TEST(PersistentMerkleTree, RejectsBadArguments)
+{
+    EXPECT_THROW(PersistentMerkleTree(MerkleTree::Digests()),
+            std::runtime_error);
+
+    const MerkleTree::Digests leaves = makeLeaves(10, 0);
+    PersistentMerkleTree tree(leaves);
+    EXPECT_THROW(tree.updateLeaf(0, leaves[0]), std::runtime_error);
+    EXPECT_THROW(tree.updateLeaf(11, leaves[0]), std::runtime_error);
+    MerkleTree::LeafUpdates updates;
+    updates.push_back(std::make_pair(1, leaves[1]));
+    updates.push_back(std::make_pair(11, leaves[1]));
+    EXPECT_THROW(tree.updateLeaves(updates), std::runtime_error);
+    EXPECT_EQ(0u, tree.getLatestVersion());
+
+    EXPECT_THROW(tree.getRootDigest(1), std::runtime_error);
+    EXPECT_THROW(tree.getLeaf(0, 11), std::runtime_error);
+    EXPECT_THROW(tree.releaseVersion(0), std::runtime_error);
+    EXPECT_THROW(tree.getProofOrdered(0, leaves[1].toBuffer(), 1),
+            std::runtime_error);
+    MerkleTree::Digest proof[MerkleTree::MAX_PROOF_LENGTH];
+    EXPECT_THROW(tree.getProof(0, 1, proof, 1), std::runtime_error);
+    EXPECT_EQ(4u, tree.getProof(0, 1, proof, MerkleTree::MAX_PROOF_LENGTH));
+
+    EXPECT_EQ(1u, tree.updateLeaves(MerkleTree::LeafUpdates()));
+    EXPECT_TRUE(tree.getRootDigest(0) == tree.getRootDigest(1));
+    EXPECT_THROW(tree.releaseVersion(2), std::runtime_error);
+}
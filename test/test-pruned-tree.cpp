@@ -0,0 +1,126 @@
+#include <merkle-tree/pruned-tree.hpp>
+#include <merkle-tree/stats.hpp>
+#include "test-util.hpp"
+#include <gtest/gtest.h>
+
+namespace {
+
+/** Check that a pruned tree serves the same proofs as a full one */
+void checkSameProofs(const PrunedMerkleTree& pruned, const MerkleTree& full,
+        size_t step)
+{
+    ASSERT_EQ(full.getLeafCount(), pruned.getLeafCount());
+    ASSERT_EQ(full.getLayerCount(), pruned.getLayerCount());
+    EXPECT_TRUE(full.getRootDigest() == pruned.getRootDigest());
+    for (size_t i = 0; i < full.getLeafCount(); i += step) {
+        const MerkleTree::Buffer leaf = full.getLayer(0)[i].toBuffer();
+        EXPECT_EQ(full.getProofOrdered(leaf, i + 1),
+                pruned.getProofOrdered(leaf, i + 1)) << "leaf " << i;
+    }
+}
+
+} // namespace
+
+TEST(PrunedMerkleTree, SameRootAndProofs)
+{
+    const size_t counts[] = { 1, 2, 3, 5, 8, 13, 100, 1000, 1025 };
+    for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); ++c) {
+        const MerkleTree::Elements elements = makeElements(counts[c]);
+        for (int order = 0; order < 2; ++order) {
+            MerkleTree full(elements, order);
+            for (size_t kept = 1; kept <= full.getLayerCount(); ++kept) {
+                PrunedMerkleTree pruned(elements, order, kept);
+                EXPECT_EQ(std::max<size_t>(1, full.getLayerCount() - kept),
+                        std::max<size_t>(1, pruned.getSubtreeHeight()))
+                    << counts[c] << " leaves, " << kept << " kept";
+                checkSameProofs(pruned, full, 1);
+                if (!order) {
+                    const MerkleTree::Buffer leaf =
+                        full.getLayer(0)[counts[c] / 2].toBuffer();
+                    EXPECT_EQ(full.getProof(leaf), pruned.getProof(leaf));
+                }
+            }
+        }
+    }
+}
+
+TEST(PrunedMerkleTree, KeepsOnlyTopLayers)
+{
+    const MerkleTree::Elements elements = makeElements(1 << 16);
+    MerkleTree full(elements, true);
+    PrunedMerkleTree pruned(elements, true, 5);
+    EXPECT_EQ(12u, pruned.getSubtreeHeight());
+    checkSameProofs(pruned, full, 997);
+
+    // The leaves, plus 16 + 8 + 4 + 2 + 1 hashes
+    const size_t leavesBytes = elements.size() * sizeof(MerkleTree::Digest);
+    EXPECT_LT(pruned.getMemoryUsage(), leavesBytes + 1024);
+    EXPECT_GT(full.getMemoryUsage(), 2 * leavesBytes);
+}
+
+TEST(PrunedMerkleTree, CachesSubtrees)
+{
+    const MerkleTree::Elements elements = makeElements(1000);
+    MerkleTree full(elements, true);
+    PrunedMerkleTree cached(elements, true, 2, 2);
+    PrunedMerkleTree uncached(elements, true, 2, 0);
+    ASSERT_EQ(9u, cached.getSubtreeHeight()); // 2 blocks
+
+    MerkleTreeStats before = MerkleTreeStats::getThread();
+    checkSameProofs(cached, full, 1);
+    checkSameProofs(uncached, full, 1);
+    MerkleTreeStats delta = MerkleTreeStats::getThread();
+    delta -= before;
+    if (MerkleTreeStats::ENABLED) {
+        EXPECT_EQ(2 + 1000u, delta.subtreesRebuilt);
+    }
+
+    // Updates rehash cached subtrees in place
+    PrunedMerkleTree pruned(elements, true, 3);
+    for (size_t i = 1; i <= 1000; i += 111) {
+        const MerkleTree::Digest leaf = MerkleTree::Digest::fromBuffer(
+                MerkleTree::hash(&i, 3));
+        full.updateLeaf(i, leaf);
+        pruned.updateLeaf(i, leaf);
+        EXPECT_TRUE(full.getRootDigest() == pruned.getRootDigest());
+        cached.updateLeaf(i, leaf);
+        uncached.updateLeaf(i, leaf);
+    }
+    checkSameProofs(pruned, full, 1);
+    checkSameProofs(cached, full, 1);
+    checkSameProofs(uncached, full, 1);
+}
+
+TEST(PrunedMerkleTree, BuildsLargeTreesInParallel)
+{
+    const MerkleTree::Digests leaves = makeLeaves((1 << 15) + 3);
+    MerkleTree full(leaves, true);
+    PrunedMerkleTree pruned(leaves, true, 8);
+    checkSameProofs(pruned, full, 4099);
+}
+
+TEST(PrunedMerkleTree, RejectsBadArguments)
+{
+    const MerkleTree::Elements elements = makeElements(10);
+    EXPECT_THROW(PrunedMerkleTree(MerkleTree::Elements(), true, 3),
+            std::runtime_error);
+    EXPECT_THROW(PrunedMerkleTree(elements, true, 0), std::runtime_error);
+
+    PrunedMerkleTree unordered(elements, false, 2);
+    EXPECT_THROW(unordered.updateLeaf(1, MerkleTree::Digest()),
+            std::runtime_error);
+    EXPECT_THROW(unordered.getProof(MerkleTree::hash("x", 1)),
+            std::runtime_error);
+
+    PrunedMerkleTree ordered(elements, true, 2);
+    EXPECT_THROW(ordered.updateLeaf(0, MerkleTree::Digest()),
+            std::runtime_error);
+    EXPECT_THROW(ordered.updateLeaf(11, MerkleTree::Digest()),
+            std::runtime_error);
+    EXPECT_THROW(ordered.getProofOrdered(elements[1], 1), std::runtime_error);
+    EXPECT_THROW(ordered.getProofOrdered(elements[1], 11),
+            std::runtime_error);
+    MerkleTree::Digest proof[MerkleTree::MAX_PROOF_LENGTH];
+    EXPECT_THROW(ordered.getProof(1, proof, 1), std::runtime_error);
+    EXPECT_EQ(4u, ordered.getProof(1, proof, MerkleTree::MAX_PROOF_LENGTH));
+}
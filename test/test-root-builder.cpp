@@ -0,0 +1,81 @@
+#include <merkle-tree/root-builder.hpp>
+#include "test-util.hpp"
+#include <gtest/gtest.h>
+#include <algorithm>
+
+TEST(MerkleRootBuilder, MatchesTreeOneLeafAtATime)
+{
+    MerkleTree::Digests leaves = makeLeaves(1100);
+    MerkleRootBuilder builder(true);
+    for (size_t i = 0; i < leaves.size(); ++i) {
+        builder.add(leaves[i]);
+        MerkleTree::Digests prefix(leaves.begin(), leaves.begin() + i + 1);
+        ASSERT_EQ(MerkleTree(prefix, true).getRootDigest(),
+                builder.getRootDigest()) << i + 1;
+    }
+    EXPECT_EQ(leaves.size(), builder.getLeafCount());
+}
+
+TEST(MerkleRootBuilder, MatchesTreeInBatches)
+{
+    // Batches of various sizes, so whole blocks start at various offsets
+    const size_t counts[] = { 1, 255, 256, 257, 511, 512, 1000, 4099, 70000 };
+    const size_t batches[] = { 1, 3, 100, 256, 1000, 100000 };
+    for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); ++c) {
+        MerkleTree::Digests leaves = makeLeaves(counts[c]);
+        const MerkleTree::Digest expected =
+            MerkleTree(leaves, true).getRootDigest();
+        for (size_t b = 0; b < sizeof(batches) / sizeof(batches[0]); ++b) {
+            MerkleRootBuilder builder(true);
+            for (size_t i = 0; i < leaves.size(); i += batches[b]) {
+                builder.add(&leaves[i],
+                        std::min(batches[b], leaves.size() - i));
+            }
+            EXPECT_EQ(expected, builder.getRootDigest())
+                << counts[c] << " leaves, batches of " << batches[b];
+        }
+    }
+}
+
+TEST(MerkleRootBuilder, UnorderedRequiresSortedLeaves)
+{
+    MerkleTree::Digests leaves = makeLeaves(3000);
+    const MerkleTree::Digest expected = MerkleTree(leaves).getRootDigest();
+    std::sort(leaves.begin(), leaves.end());
+
+    // Duplicates are ignored, in a batch and across batches
+    MerkleTree::Digests doubled;
+    for (size_t i = 0; i < leaves.size(); ++i) {
+        doubled.push_back(leaves[i]);
+        doubled.push_back(leaves[i]);
+    }
+    MerkleRootBuilder builder(false);
+    builder.add(&doubled[0], 1001);
+    builder.add(&doubled[1001], doubled.size() - 1001);
+    EXPECT_EQ(leaves.size(), builder.getLeafCount());
+    EXPECT_EQ(expected, builder.getRootDigest());
+
+    MerkleRootBuilder unsorted(false);
+    unsorted.add(&leaves[10], 10);
+    EXPECT_THROW(unsorted.add(leaves[5]), std::runtime_error);
+    EXPECT_EQ(10u, unsorted.getLeafCount());
+    std::swap(leaves[30], leaves[31]);
+    EXPECT_THROW(unsorted.add(&leaves[20], 20), std::runtime_error);
+    EXPECT_EQ(21u, unsorted.getLeafCount());
+}
+
+TEST(MerkleRootBuilder, EmptyAndReset)
+{
+    MerkleRootBuilder builder(true);
+    EXPECT_THROW(builder.getRootDigest(), std::runtime_error);
+    builder.add(MerkleTree::Buffer());
+    EXPECT_EQ(0u, builder.getLeafCount());
+    EXPECT_THROW(builder.add(MerkleTree::Buffer(3)), std::runtime_error);
+
+    MerkleTree::Digests leaves = makeLeaves(5);
+    builder.add(&leaves[0], leaves.size());
+    builder.reset();
+    EXPECT_EQ(0u, builder.getLeafCount());
+    builder.add(leaves[0].toBuffer());
+    EXPECT_EQ(leaves[0].toBuffer(), builder.getRoot());
+}
@@ -0,0 +1,151 @@
+#include <merkle-tree/search-tree.hpp>
+#include "test-util.hpp"
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <set>
+
+TEST(MerkleSearchTree, RootOnlyDependsOnKeys)
+{
+    const MerkleSearchTree::Keys keys = makeLeaves(1000);
+    MerkleSearchTree built(keys);
+    EXPECT_EQ(1000u, built.getKeyCount());
+
+    MerkleSearchTree forward;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        EXPECT_TRUE(forward.insert(keys[i]));
+    }
+    EXPECT_FALSE(forward.insert(keys[7]));
+    MerkleSearchTree backward;
+    for (size_t i = keys.size(); i > 0; --i) {
+        EXPECT_TRUE(backward.insert(keys[i - 1]));
+    }
+    EXPECT_TRUE(built.getRootDigest() == forward.getRootDigest());
+    EXPECT_TRUE(built.getRootDigest() == backward.getRootDigest());
+    EXPECT_EQ(built.getDepth(), forward.getDepth());
+
+    // Removing keys gives the tree built without them
+    MerkleSearchTree::Keys kept;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        if (i % 3) {
+            kept.push_back(keys[i]);
+        } else {
+            EXPECT_TRUE(forward.erase(keys[i]));
+        }
+    }
+    EXPECT_FALSE(forward.erase(keys[0]));
+    EXPECT_EQ(kept.size(), forward.getKeyCount());
+    EXPECT_TRUE(MerkleSearchTree(kept).getRootDigest()
+            == forward.getRootDigest());
+
+    // And adding them back gives the initial tree
+    for (size_t i = 0; i < keys.size(); i += 3) {
+        EXPECT_TRUE(forward.insert(keys[i]));
+    }
+    EXPECT_TRUE(built.getRootDigest() == forward.getRootDigest());
+}
+
+TEST(MerkleSearchTree, KeepsKeysSorted)
+{
+    MerkleSearchTree::Keys keys = makeLeaves(500);
+    keys.push_back(keys[10]);
+    MerkleSearchTree tree(keys);
+    EXPECT_EQ(500u, tree.getKeyCount());
+
+    std::set<MerkleTree::Digest> expected(keys.begin(), keys.end());
+    MerkleSearchTree::Keys actual = tree.getKeys();
+    ASSERT_EQ(expected.size(), actual.size());
+    EXPECT_TRUE(std::equal(actual.begin(), actual.end(), expected.begin()));
+    for (size_t i = 0; i < keys.size(); ++i) {
+        EXPECT_TRUE(tree.contains(keys[i]));
+    }
+    EXPECT_FALSE(tree.contains(MerkleTree::Digest()));
+
+    // The expected depth is about 2 ln n, i.e. 12 here
+    EXPECT_LT(tree.getDepth(), 30u);
+}
+
+TEST(MerkleSearchTree, ChecksProofs)
+{
+    const MerkleSearchTree::Keys keys = makeLeaves(300);
+    MerkleSearchTree tree;
+    for (size_t i = 0; i < keys.size(); i += 2) {
+        tree.insert(keys[i]);
+    }
+    const MerkleTree::Digest& root = tree.getRootDigest();
+    for (size_t i = 0; i < keys.size(); ++i) {
+        const MerkleSearchTree::Proof proof = tree.getProof(keys[i]);
+        const bool present = !(i % 2);
+        EXPECT_EQ(present, MerkleSearchTree::checkProof(proof, root, keys[i]))
+            << "key " << i;
+        EXPECT_EQ(!present,
+                MerkleSearchTree::checkExclusionProof(proof, root, keys[i]))
+            << "key " << i;
+
+        // Proofs don't hold for other keys, or other roots
+        const MerkleSearchTree::Key& other = keys[(i + 2) % keys.size()];
+        EXPECT_FALSE(MerkleSearchTree::checkProof(proof, root, other));
+        EXPECT_FALSE(MerkleSearchTree::checkProof(proof, MerkleTree::Digest(),
+                    keys[i]));
+    }
+}
+
+TEST(MerkleSearchTree, RejectsTamperedProofs)
+{
+    const MerkleSearchTree::Keys keys = makeLeaves(100);
+    MerkleSearchTree tree(MerkleSearchTree::Keys(keys.begin() + 1,
+                keys.end()));
+    const MerkleTree::Digest& root = tree.getRootDigest();
+
+    // Present key
+    MerkleSearchTree::Proof proof = tree.getProof(keys[50]);
+    ASSERT_FALSE(proof.steps.empty());
+    ASSERT_TRUE(MerkleSearchTree::checkProof(proof, root, keys[50]));
+    MerkleSearchTree::Proof tampered = proof;
+    tampered.steps.back().sibling.bytes[0] ^= 1;
+    EXPECT_FALSE(MerkleSearchTree::checkProof(tampered, root, keys[50]));
+    tampered = proof;
+    tampered.children[1].bytes[3] ^= 1;
+    EXPECT_FALSE(MerkleSearchTree::checkProof(tampered, root, keys[50]));
+    tampered = proof;
+    tampered.steps.pop_back();
+    EXPECT_FALSE(MerkleSearchTree::checkProof(tampered, root, keys[50]));
+
+    // Absent key: a membership proof can't be passed off as an exclusion one
+    EXPECT_FALSE(MerkleSearchTree::checkExclusionProof(proof, root,
+                keys[50]));
+    proof = tree.getProof(keys[0]);
+    ASSERT_TRUE(MerkleSearchTree::checkExclusionProof(proof, root, keys[0]));
+    tampered = proof;
+    tampered.steps[0].key = keys[0];
+    EXPECT_FALSE(MerkleSearchTree::checkExclusionProof(tampered, root,
+                keys[0]));
+    tampered = proof;
+    tampered.steps.pop_back();
+    EXPECT_FALSE(MerkleSearchTree::checkExclusionProof(tampered, root,
+                keys[0]));
+}
+
+TEST(MerkleSearchTree, HandlesEmptySet)
+{
+    MerkleSearchTree tree;
+    EXPECT_TRUE(MerkleTree::Digest() == tree.getRootDigest());
+    EXPECT_TRUE(MerkleTree::Digest() == MerkleSearchTree(
+                MerkleSearchTree::Keys()).getRootDigest());
+    EXPECT_EQ(0u, tree.getDepth());
+    EXPECT_TRUE(tree.getKeys().empty());
+
+    const MerkleSearchTree::Key key = makeLeaves(1)[0];
+    EXPECT_FALSE(tree.erase(key));
+    MerkleSearchTree::Proof proof = tree.getProof(key);
+    EXPECT_TRUE(proof.steps.empty());
+    EXPECT_TRUE(MerkleSearchTree::checkExclusionProof(proof,
+                tree.getRootDigest(), key));
+
+    EXPECT_TRUE(tree.insert(key));
+    EXPECT_EQ(1u, tree.getDepth());
+    proof = tree.getProof(key);
+    EXPECT_TRUE(MerkleSearchTree::checkProof(proof, tree.getRootDigest(),
+                key));
+    EXPECT_TRUE(tree.erase(key));
+    EXPECT_TRUE(MerkleTree::Digest() == tree.getRootDigest());
+}
@@ -0,0 +1,237 @@
+#include <merkle-tree/sparse-tree.hpp>
+#include <gtest/gtest.h>
+#include <map>
+
+namespace {
+
+typedef SparseMerkleTree::Key Key;
+typedef SparseMerkleTree::Value Value;
+typedef std::map<Key, Value> Contents;
+
+Key makeKey(size_t seed)
+{
+    return MerkleTree::Digest::fromBuffer(MerkleTree::hash(&seed,
+                sizeof(seed)));
+}
+
+Value makeValue(size_t seed)
+{
+    return makeKey(seed + 1000000);
+}
+
+/** Root hash computed the slow way, by hashing the whole path of each
+ * subtree down to depth `depth` */
+MerkleTree::Digest referenceRoot(Contents::const_iterator first,
+        Contents::const_iterator last, size_t depth)
+{
+    if (first == last) {
+        return SparseMerkleTree::getDefaultHash(depth);
+    }
+    if (depth == SparseMerkleTree::DEPTH) {
+        return first->second;
+    }
+    Contents::const_iterator middle = first;
+    while (    (middle != last)
+            && !((middle->first.bytes[depth / 8] >> (7 - depth % 8)) & 1)) {
+        ++middle;
+    }
+    return MerkleTree::combinedHash(referenceRoot(first, middle, depth + 1),
+            referenceRoot(middle, last, depth + 1), true);
+}
+
+MerkleTree::Digest referenceRoot(const Contents& contents)
+{
+    return referenceRoot(contents.begin(), contents.end(), 0);
+}
+
+/** Check the proofs of all the keys present and of a few absent ones */
+void checkProofs(const SparseMerkleTree& tree, const Contents& contents,
+        size_t absent)
+{
+    const MerkleTree::Digest& root = tree.getRootDigest();
+    for (Contents::const_iterator it = contents.begin(); it != contents.end();
+            ++it) {
+        SparseMerkleTree::Proof proof = tree.getProof(it->first);
+        EXPECT_TRUE(SparseMerkleTree::checkProof(proof, root, it->first,
+                    it->second));
+        EXPECT_FALSE(SparseMerkleTree::checkExclusionProof(proof, root,
+                    it->first));
+        EXPECT_FALSE(SparseMerkleTree::checkProof(proof, root, it->first,
+                    makeValue(12345)));
+    }
+    for (size_t i = 0; i < absent; ++i) {
+        const Key key = makeKey(1000 + i);
+        if (contents.count(key) == 0) {
+            SparseMerkleTree::Proof proof = tree.getProof(key);
+            EXPECT_TRUE(SparseMerkleTree::checkExclusionProof(proof, root,
+                        key));
+            EXPECT_FALSE(SparseMerkleTree::checkProof(proof, root, key,
+                        makeValue(i)));
+        }
+    }
+}
+
+} // namespace
+
+TEST(SparseMerkleTree, EmptyTree)
+{
+    SparseMerkleTree tree;
+    EXPECT_EQ(0u, tree.getLeafCount());
+    EXPECT_TRUE(SparseMerkleTree::getDefaultHash(0) == tree.getRootDigest());
+    EXPECT_TRUE(SparseMerkleTree::getEmptyValue()
+            == SparseMerkleTree::getDefaultHash(SparseMerkleTree::DEPTH));
+    const MerkleTree::Digest& leaf =
+        SparseMerkleTree::getDefaultHash(SparseMerkleTree::DEPTH);
+    EXPECT_TRUE(MerkleTree::combinedHash(leaf, leaf, true)
+            == SparseMerkleTree::getDefaultHash(SparseMerkleTree::DEPTH - 1));
+    EXPECT_THROW(SparseMerkleTree::getDefaultHash(SparseMerkleTree::DEPTH + 1),
+            std::runtime_error);
+
+    // The proof of an absent key in an empty tree is all default hashes
+    SparseMerkleTree::Proof proof = tree.getProof(makeKey(1));
+    EXPECT_TRUE(proof.siblings.empty());
+    EXPECT_TRUE(SparseMerkleTree::checkExclusionProof(proof,
+                tree.getRootDigest(), makeKey(1)));
+
+    Value value;
+    EXPECT_FALSE(tree.find(makeKey(1), value));
+}
+
+TEST(SparseMerkleTree, MatchesReference)
+{
+    SparseMerkleTree tree;
+    Contents contents;
+    for (size_t i = 0; i < 50; ++i) {
+        tree.insert(makeKey(i), makeValue(i));
+        contents[makeKey(i)] = makeValue(i);
+        EXPECT_EQ(contents.size(), tree.getLeafCount());
+        EXPECT_TRUE(referenceRoot(contents) == tree.getRootDigest());
+    }
+    checkProofs(tree, contents, 20);
+
+    // Replace and remove some keys
+    for (size_t i = 0; i < 50; i += 3) {
+        tree.insert(makeKey(i), makeValue(i + 100));
+        contents[makeKey(i)] = makeValue(i + 100);
+        tree.erase(makeKey(i + 1));
+        contents.erase(makeKey(i + 1));
+        tree.erase(makeKey(i + 500)); // absent
+        EXPECT_EQ(contents.size(), tree.getLeafCount());
+        EXPECT_TRUE(referenceRoot(contents) == tree.getRootDigest());
+    }
+    checkProofs(tree, contents, 20);
+
+    for (Contents::const_iterator it = contents.begin(); it != contents.end();
+            ++it) {
+        Value value;
+        ASSERT_TRUE(tree.find(it->first, value));
+        EXPECT_TRUE(it->second == value);
+    }
+
+    // Back to empty
+    for (size_t i = 0; i < 50; ++i) {
+        tree.erase(makeKey(i));
+    }
+    EXPECT_EQ(0u, tree.getLeafCount());
+    EXPECT_TRUE(SparseMerkleTree::getDefaultHash(0) == tree.getRootDigest());
+}
+
+TEST(SparseMerkleTree, BatchesMatchSingleUpdates)
+{
+    SparseMerkleTree batched;
+    SparseMerkleTree single;
+    SparseMerkleTree::Entries entries;
+    for (size_t i = 0; i < 1000; ++i) {
+        entries.push_back(std::make_pair(makeKey(i), makeValue(i)));
+        single.insert(makeKey(i), makeValue(i));
+    }
+    // The last value given for a key wins
+    entries.push_back(std::make_pair(makeKey(7), makeValue(7777)));
+    single.insert(makeKey(7), makeValue(7777));
+    batched.insert(entries);
+    EXPECT_EQ(1000u, batched.getLeafCount());
+    EXPECT_TRUE(single.getRootDigest() == batched.getRootDigest());
+
+    SparseMerkleTree::Keys keys;
+    for (size_t i = 0; i < 1000; i += 2) {
+        keys.push_back(makeKey(i));
+        single.erase(makeKey(i));
+    }
+    keys.push_back(makeKey(5000)); // absent
+    batched.erase(keys);
+    EXPECT_EQ(500u, batched.getLeafCount());
+    EXPECT_TRUE(single.getRootDigest() == batched.getRootDigest());
+
+    Contents contents;
+    for (size_t i = 1; i < 1000; i += 2) {
+        contents[makeKey(i)] = makeValue(i);
+    }
+    contents[makeKey(7)] = makeValue(7777);
+    EXPECT_TRUE(referenceRoot(contents) == batched.getRootDigest());
+}
+
+TEST(SparseMerkleTree, NeighbourKeys)
+{
+    // Keys that only differ in their last bits have the longest proofs
+    SparseMerkleTree tree;
+    Contents contents;
+    Key key = makeKey(0);
+    for (uint8_t last = 0; last < 4; ++last) {
+        key.bytes[MERKLE_TREE_ELEMENT_SIZE_B - 1] = last;
+        tree.insert(key, makeValue(last));
+        contents[key] = makeValue(last);
+    }
+    std::memset(key.bytes, 0, sizeof(key.bytes));
+    tree.insert(key, makeValue(10));
+    contents[key] = makeValue(10);
+    std::memset(key.bytes, 0xff, sizeof(key.bytes));
+    tree.insert(key, makeValue(11));
+    contents[key] = makeValue(11);
+    EXPECT_TRUE(referenceRoot(contents) == tree.getRootDigest());
+    checkProofs(tree, contents, 5);
+
+    key.bytes[MERKLE_TREE_ELEMENT_SIZE_B - 1] = 0xfe; // absent neighbour
+    SparseMerkleTree::Proof proof = tree.getProof(key);
+    EXPECT_TRUE(SparseMerkleTree::checkExclusionProof(proof,
+                tree.getRootDigest(), key));
+}
+
+TEST(SparseMerkleTree, RejectsBadProofs)
+{
+    SparseMerkleTree tree;
+    for (size_t i = 0; i < 10; ++i) {
+        tree.insert(makeKey(i), makeValue(i));
+    }
+    const MerkleTree::Digest& root = tree.getRootDigest();
+    const SparseMerkleTree::Proof proof = tree.getProof(makeKey(3));
+    ASSERT_TRUE(SparseMerkleTree::checkProof(proof, root, makeKey(3),
+                makeValue(3)));
+
+    // Proof for another key
+    EXPECT_FALSE(SparseMerkleTree::checkProof(proof, root, makeKey(4),
+                makeValue(3)));
+
+    SparseMerkleTree::Proof bad = proof;
+    bad.siblings[0].bytes[0] ^= 1;
+    EXPECT_FALSE(SparseMerkleTree::checkProof(bad, root, makeKey(3),
+                makeValue(3)));
+
+    bad = proof;
+    bad.siblings.push_back(makeValue(0));
+    EXPECT_FALSE(SparseMerkleTree::checkProof(bad, root, makeKey(3),
+                makeValue(3)));
+
+    bad = proof;
+    bad.siblings.pop_back();
+    EXPECT_FALSE(SparseMerkleTree::checkProof(bad, root, makeKey(3),
+                makeValue(3)));
+
+    bad = proof;
+    bad.bitmap[1] ^= uint64_t(1) << 63;
+    EXPECT_FALSE(SparseMerkleTree::checkProof(bad, root, makeKey(3),
+                makeValue(3)));
+
+    EXPECT_THROW(tree.insert(makeKey(20), SparseMerkleTree::getEmptyValue()),
+            std::runtime_error);
+    EXPECT_EQ(10u, tree.getLeafCount());
+}
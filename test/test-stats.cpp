@@ -0,0 +1,144 @@
+#include <merkle-tree/stats.hpp>
+#include <merkle-tree/merkle-tree.hpp>
+#include "test-util.hpp"
+#include <gtest/gtest.h>
+
+extern "C" {
+#include <pthread.h>
+}
+
+namespace {
+
+/** Expected change of a counter, if statistics are collected */
+uint64_t expected(uint64_t delta)
+{
+    return MerkleTreeStats::ENABLED ? delta : 0;
+}
+
+/** Counters of the calling thread since `before` */
+MerkleTreeStats since(const MerkleTreeStats& before)
+{
+    MerkleTreeStats delta = MerkleTreeStats::getThread();
+    delta -= before;
+    return delta;
+}
+
+void* hashInThread(void*)
+{
+    const uint8_t data[300] = { 0 };
+    MerkleTree::hash(data, sizeof(data));
+    return NULL;
+}
+
+} // namespace
+
+TEST(MerkleTreeStats, CountsHashing)
+{
+    const uint8_t data[300] = { 0 };
+    MerkleTreeStats before = MerkleTreeStats::getThread();
+    MerkleTree::hash(data, sizeof(data));
+    MerkleTreeStats delta = since(before);
+    EXPECT_EQ(expected(300), delta.bytesHashed);
+    EXPECT_EQ(expected(3), delta.compressions);
+
+    // The last block is compressed even if empty
+    before = MerkleTreeStats::getThread();
+    MerkleTree::hash(data, 0);
+    delta = since(before);
+    EXPECT_EQ(0u, delta.bytesHashed);
+    EXPECT_EQ(expected(1), delta.compressions);
+
+    before = MerkleTreeStats::getThread();
+    MerkleTree::combinedHash(MerkleTree::Digest::fromBuffer(
+                MerkleTree::hash(data, 1)),
+            MerkleTree::Digest::fromBuffer(MerkleTree::hash(data, 2)), true);
+    delta = since(before);
+    EXPECT_EQ(expected(1 + 2 + 2 * MERKLE_TREE_ELEMENT_SIZE_B),
+            delta.bytesHashed);
+    EXPECT_EQ(expected(3), delta.compressions);
+}
+
+TEST(MerkleTreeStats, CountsProofsAndLookups)
+{
+    MerkleTree::Elements elements = makeElements(100);
+    MerkleTree tree(elements);
+    MerkleTree::Buffer root = tree.getRoot();
+
+    MerkleTreeStats before = MerkleTreeStats::getThread();
+    MerkleTree::Elements proof = tree.getProof(elements[10]);
+    EXPECT_TRUE(MerkleTree::checkProof(proof, root, elements[10]));
+    EXPECT_FALSE(MerkleTree::checkProof(proof, root, elements[11]));
+    EXPECT_THROW(tree.getProof(MerkleTree::hash("x", 1)), std::runtime_error);
+    MerkleTree::MultiProof multiProof = tree.getMultiProof(
+            MerkleTree::Elements(elements.begin(), elements.begin() + 3));
+    EXPECT_TRUE(MerkleTree::checkMultiProof(multiProof, root, 100,
+                MerkleTree::Elements(elements.begin(), elements.begin() + 3),
+                false));
+    MerkleTreeStats delta = since(before);
+    EXPECT_EQ(expected(2), delta.proofsGenerated);
+    EXPECT_EQ(expected(3), delta.proofsVerified);
+    EXPECT_EQ(expected(5), delta.leafLookups);
+    EXPECT_EQ(expected(1), delta.leafLookupMisses);
+}
+
+TEST(MerkleTreeStats, TracksLayerMemory)
+{
+    const MerkleTreeStats before = MerkleTreeStats::getTotal();
+    {
+        MerkleTree tree(makeElements(1000), true);
+        EXPECT_LT(1000 * sizeof(MerkleTree::Digest), tree.getMemoryUsage());
+        MerkleTree copy(tree);
+        MerkleTreeStats delta = MerkleTreeStats::getTotal();
+        delta -= before;
+        EXPECT_EQ(static_cast<int64_t>(expected(tree.getMemoryUsage()
+                        + copy.getMemoryUsage())),
+                delta.layerBytes);
+        copy = MerkleTree(makeElements(10), false);
+        delta = MerkleTreeStats::getTotal();
+        delta -= before;
+        EXPECT_EQ(static_cast<int64_t>(expected(tree.getMemoryUsage()
+                        + copy.getMemoryUsage())),
+                delta.layerBytes);
+    }
+    MerkleTreeStats delta = MerkleTreeStats::getTotal();
+    delta -= before;
+    EXPECT_EQ(0, delta.layerBytes);
+}
+
+TEST(MerkleTreeStats, TimesLayers)
+{
+    MerkleTree::Elements elements = makeElements(1000);
+    MerkleTreeStats before = MerkleTreeStats::getThread();
+    MerkleTree tree(elements, true);
+    MerkleTreeStats delta = since(before);
+    EXPECT_EQ(0u, delta.layerNanoseconds[0]);
+    uint64_t total = 0;
+    for (size_t layer = 1; layer < MERKLE_TREE_STATS_LAYERS; ++layer) {
+        total += delta.layerNanoseconds[layer];
+        if (layer >= tree.getLayerCount()) {
+            EXPECT_EQ(0u, delta.layerNanoseconds[layer]);
+        }
+    }
+    if (MerkleTreeStats::ENABLED) {
+        EXPECT_LT(0u, total);
+    }
+}
+
+TEST(MerkleTreeStats, SumsAllThreads)
+{
+    const MerkleTreeStats before = MerkleTreeStats::getTotal();
+    const MerkleTreeStats thread = MerkleTreeStats::getThread();
+    pthread_t threads[2];
+    for (size_t i = 0; i < 2; ++i) {
+        ASSERT_EQ(0, pthread_create(&threads[i], NULL, hashInThread, NULL));
+    }
+    for (size_t i = 0; i < 2; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+
+    // The threads have exited, their counters must still be there
+    MerkleTreeStats delta = MerkleTreeStats::getTotal();
+    delta -= before;
+    EXPECT_EQ(expected(600), delta.bytesHashed);
+    EXPECT_EQ(0u, since(thread).bytesHashed);
+}
@@ -0,0 +1,150 @@
+#include <merkle-tree/tree-diff.hpp>
+#include "test-util.hpp"
+#include <gtest/gtest.h>
+#include <cstdio>
+
+extern "C" {
+#include <unistd.h>
+}
+
+namespace {
+
+/** Leaves that differ, found the slow way */
+std::vector<size_t> naiveDiff(const MerkleTree& a, const MerkleTree& b)
+{
+    std::vector<size_t> indices;
+    for (size_t i = 0; i < a.getLeafCount(); ++i) {
+        if (a.getLayer(0)[i] != b.getLayer(0)[i]) {
+            indices.push_back(i + 1);
+        }
+    }
+    return indices;
+}
+
+std::vector<size_t> toIndices(const MerkleTreeDiff::LeafRanges& ranges)
+{
+    std::vector<size_t> indices;
+    for (size_t r = 0; r < ranges.size(); ++r) {
+        // Ranges are maximal
+        if (r > 0) {
+            EXPECT_LT(ranges[r - 1].first + ranges[r - 1].count,
+                    ranges[r].first);
+        }
+        for (size_t i = 0; i < ranges[r].count; ++i) {
+            indices.push_back(ranges[r].first + i);
+        }
+    }
+    return indices;
+}
+
+} // namespace
+
+TEST(MerkleTreeDiff, FindsDifferingLeaves)
+{
+    const size_t counts[] = { 1, 2, 3, 7, 100, 1000 };
+    for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); ++c) {
+        MerkleTree::Elements elements = makeElements(counts[c]);
+        MerkleTree a(elements, true);
+        MerkleTree b(elements, true);
+        EXPECT_TRUE(MerkleTreeDiff::compare(a, b).empty());
+
+        // A few isolated leaves, a run of leaves, and the last leaf
+        for (size_t i = 0; i < counts[c]; i += 37) {
+            b.updateLeaf(i + 1, MerkleTree::hash(&i, 1));
+        }
+        for (size_t i = counts[c] / 2; i < std::min(counts[c] / 2 + 5,
+                    counts[c]); ++i) {
+            b.updateLeaf(i + 1, MerkleTree::hash(&i, 2));
+        }
+        b.updateLeaf(counts[c], MerkleTree::hash(&c, 3));
+        EXPECT_EQ(naiveDiff(a, b), toIndices(MerkleTreeDiff::compare(a, b)))
+            << counts[c] << " leaves";
+        EXPECT_EQ(naiveDiff(a, b), toIndices(MerkleTreeDiff::compare(b, a)));
+    }
+}
+
+TEST(MerkleTreeDiff, OnlyWalksDifferingSubtrees)
+{
+    MerkleTree::Elements elements = makeElements(1 << 16);
+    MerkleTree a(elements, true);
+    MerkleTree b(elements, true);
+    b.updateLeaf(12345, MerkleTree::hash("x", 1));
+
+    // Two hashes per layer below the root, over the wire
+    MerkleTreeDiff diff(a);
+    size_t rounds = 0;
+    size_t hashes = 0;
+    while (!diff.isDone()) {
+        const MerkleTree::Buffer request = diff.getRequest().serialize();
+        MerkleTreeDiff::Response response = MerkleTreeDiff::answer(b,
+                MerkleTreeDiff::Request::parse(request));
+        hashes += response.hashes.size();
+        diff.addResponse(MerkleTreeDiff::Response::parse(
+                    response.serialize()));
+        ++rounds;
+    }
+    EXPECT_EQ(a.getLayerCount(), rounds);
+    EXPECT_EQ(1 + 2 * (a.getLayerCount() - 1), hashes);
+    ASSERT_EQ(1u, diff.getDifferences().size());
+    EXPECT_EQ(12345u, diff.getDifferences()[0].first);
+    EXPECT_EQ(1u, diff.getDifferences()[0].count);
+    EXPECT_THROW(diff.addResponse(MerkleTreeDiff::Response()),
+            std::runtime_error);
+}
+
+TEST(MerkleTreeDiff, WorksWithMappedTrees)
+{
+    char path[] = "/tmp/merkle-tree-test-XXXXXX";
+    close(mkstemp(path));
+    MerkleTree::Elements elements = makeElements(300);
+    MerkleTree a(elements, true);
+    a.save(path);
+    {
+        MappedMerkleTree mapped(path);
+        elements[200] = MerkleTree::hash("y", 1);
+        MerkleTree b(elements, true);
+
+        MerkleTreeDiff diff(b);
+        while (!diff.isDone()) {
+            diff.addResponse(MerkleTreeDiff::answer(mapped, diff.getRequest()));
+        }
+        ASSERT_EQ(1u, diff.getDifferences().size());
+        EXPECT_EQ(201u, diff.getDifferences()[0].first);
+    }
+    unlink(path);
+}
+
+TEST(MerkleTreeDiff, RejectsBadMessages)
+{
+    MerkleTree a(makeElements(10), true);
+    MerkleTree b(makeElements(11), true);
+    EXPECT_THROW(MerkleTreeDiff::compare(a, b), std::runtime_error);
+
+    MerkleTreeDiff diff(a);
+    MerkleTreeDiff::Response response = MerkleTreeDiff::answer(a,
+            diff.getRequest());
+    response.hashes.push_back(response.hashes[0]);
+    EXPECT_THROW(diff.addResponse(response), std::runtime_error);
+
+    MerkleTreeDiff::Request request;
+    MerkleTreeDiff::NodeRange range;
+    range.layer = 0;
+    range.first = 8;
+    range.count = 3;
+    request.ranges.push_back(range);
+    EXPECT_THROW(MerkleTreeDiff::answer(a, request), std::runtime_error);
+    range.layer = a.getLayerCount();
+    range.first = 0;
+    range.count = 1;
+    request.ranges[0] = range;
+    EXPECT_THROW(MerkleTreeDiff::answer(a, request), std::runtime_error);
+
+    MerkleTree::Buffer data = diff.getRequest().serialize();
+    data.pop_back();
+    EXPECT_THROW(MerkleTreeDiff::Request::parse(data), std::runtime_error);
+    data = MerkleTreeDiff::answer(a, diff.getRequest()).serialize();
+    data.push_back(0);
+    EXPECT_THROW(MerkleTreeDiff::Response::parse(data), std::runtime_error);
+    EXPECT_THROW(MerkleTreeDiff::Response::parse(MerkleTree::Buffer(3)),
+            std::runtime_error);
+}
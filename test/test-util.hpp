@@ -0,0 +1,27 @@
+#ifndef MERKLE_TREE_TEST_UTIL_HPP_
+#define MERKLE_TREE_TEST_UTIL_HPP_
+
+#include <merkle-tree/merkle-tree.hpp>
+
+/** Make `count` distinct leaves, the same ones on every call */
+inline MerkleTree::Digests makeLeaves(size_t count)
+{
+    MerkleTree::Digests leaves;
+    for (size_t i = 0; i < count; ++i) {
+        leaves.push_back(MerkleTree::Digest::fromBuffer(
+                    MerkleTree::hash(&i, sizeof(i))));
+    }
+    return leaves;
+}
+
+/** Make the same values as `makeLeaves()`, as elements */
+inline MerkleTree::Elements makeElements(size_t count)
+{
+    MerkleTree::Elements elements;
+    for (size_t i = 0; i < count; ++i) {
+        elements.push_back(MerkleTree::hash(&i, sizeof(i)));
+    }
+    return elements;
+}
+
+#endif // MERKLE_TREE_TEST_UTIL_HPP_